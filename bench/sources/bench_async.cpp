@@ -0,0 +1,185 @@
+/**
+ * @file bench_async.cpp
+ * @brief Measures one application thread driving many cameras on the mock USB
+ * backend.
+ *
+ * The synchronous receive() issued camera by camera is compared with
+ * receive_async(), which keeps a transaction in flight on every camera while
+ * the application thread only waits for the completions. At last a camera is
+ * deleted with transactions queued, all of which must be resolved.
+ */
+
+#include <getopt.h>
+#include <ports_usb_mock.h>
+#include <pthread.h>
+#include <socc_ptp.h>
+#include <socc_time.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+
+#include <chrono>
+#include <future>
+#include <vector>
+
+using namespace com::sony::imaging::remote;
+using com::sony::imaging::ports::ports_usb_mock;
+
+typedef struct completion_t {
+  pthread_mutex_t mutex;
+  pthread_cond_t cond;
+  int remaining;
+  int errors;
+  socc_ptp *ptp;
+} completion_t;
+
+static void completed(const AsyncResult &result, void *vp) {
+  completion_t *completion = (completion_t *)vp;
+  void *data = result.data;
+  completion->ptp->dispose_data(&data);
+  pthread_mutex_lock(&completion->mutex);
+  if (result.ret != SOCC_OK) {
+    completion->errors++;
+  }
+  if (--completion->remaining == 0) {
+    pthread_cond_signal(&completion->cond);
+  }
+  pthread_mutex_unlock(&completion->mutex);
+}
+
+static double bench_sync(std::vector<socc_ptp *> &cameras, int rounds) {
+  Container response;
+  uint64_t begin = socc_monotonic_us();
+  for (int r = 0; r < rounds; r++) {
+    for (size_t i = 0; i < cameras.size(); i++) {
+      void *data = NULL;
+      uint32_t size = 0;
+      if (cameras[i]->receive(0x9202, NULL, 0, response, &data, size) !=
+          SOCC_OK) {
+        fprintf(stderr, "receive failed\n");
+      }
+      cameras[i]->dispose_data(&data);
+    }
+  }
+  return rounds * cameras.size() * 1000000.0 / (socc_monotonic_us() - begin);
+}
+
+static double bench_async(std::vector<socc_ptp *> &cameras, int rounds) {
+  std::vector<completion_t> completions(cameras.size());
+  uint64_t begin = socc_monotonic_us();
+
+  for (size_t i = 0; i < cameras.size(); i++) {
+    completion_t *completion = &completions[i];
+    pthread_mutex_init(&completion->mutex, NULL);
+    pthread_cond_init(&completion->cond, NULL);
+    completion->remaining = rounds;
+    completion->errors = 0;
+    completion->ptp = cameras[i];
+  }
+  for (int r = 0; r < rounds; r++) {
+    for (size_t i = 0; i < cameras.size(); i++) {
+      cameras[i]->receive_async(0x9202, NULL, 0, completed, &completions[i]);
+    }
+  }
+  for (size_t i = 0; i < cameras.size(); i++) {
+    completion_t *completion = &completions[i];
+    pthread_mutex_lock(&completion->mutex);
+    while (completion->remaining > 0) {
+      pthread_cond_wait(&completion->cond, &completion->mutex);
+    }
+    pthread_mutex_unlock(&completion->mutex);
+    if (completion->errors > 0) {
+      fprintf(stderr, "camera %zu: %d errors\n", i, completion->errors);
+    }
+  }
+  return rounds * cameras.size() * 1000000.0 / (socc_monotonic_us() - begin);
+}
+
+// deletes a camera with transactions queued. Returns the futures left
+// unresolved, which must be none.
+static int bench_cancel(uint32_t latency_us, int queued) {
+  ports_usb_mock *usb = new ports_usb_mock();
+  usb->set_timing(latency_us, 0);
+  socc_ptp *ptp = new socc_ptp(usb);
+  ptp->connect();
+
+  std::vector<std::future<AsyncResult>> futures;
+  for (int i = 0; i < queued; i++) {
+    futures.push_back(ptp->receive_async(0x9202, NULL, 0));
+  }
+  struct timespec ts = {0, (long)latency_us * 1000};
+  nanosleep(&ts, NULL);
+  delete ptp;
+
+  int completed = 0, canceled = 0, unresolved = 0;
+  for (size_t i = 0; i < futures.size(); i++) {
+    if (futures[i].wait_for(std::chrono::seconds(0)) !=
+        std::future_status::ready) {
+      unresolved++;
+      continue;
+    }
+    AsyncResult result = futures[i].get();
+    if (result.ret == SOCC_ERROR_CANCELED) {
+      canceled++;
+    } else {
+      // the buffer is of the deleted camera, malloc()ed by the backend
+      free(result.data);
+      completed++;
+    }
+  }
+  printf("deleted with %d queued : %d completed, %d canceled, %d unresolved\n",
+         queued, completed, canceled, unresolved);
+  return unresolved;
+}
+
+static void usage() {
+  fprintf(stderr,
+          "usage: bench_async [--cameras=N] [--rounds=N] [--latency=us]\n");
+}
+
+int main(int argc, char **argv) {
+  int ncameras = 8;
+  int rounds = 200;
+  uint32_t latency_us = 300;
+
+  static struct option loptions[] = {{"cameras", required_argument, 0, 'c'},
+                                     {"rounds", required_argument, 0, 'n'},
+                                     {"latency", required_argument, 0, 'l'},
+                                     {0, 0, 0, 0}};
+  int opt;
+  while ((opt = getopt_long(argc, argv, "c:n:l:", loptions, NULL)) != -1) {
+    switch (opt) {
+      case 'c':
+        ncameras = strtol(optarg, NULL, 0);
+        break;
+      case 'n':
+        rounds = strtol(optarg, NULL, 0);
+        break;
+      case 'l':
+        latency_us = strtoul(optarg, NULL, 0);
+        break;
+      default:
+        usage();
+        return -1;
+    }
+  }
+
+  printf("%d cameras, latency %u us, %d transactions per camera\n", ncameras,
+         latency_us, rounds);
+
+  std::vector<socc_ptp *> cameras;
+  for (int i = 0; i < ncameras; i++) {
+    ports_usb_mock *usb = new ports_usb_mock();
+    usb->set_timing(latency_us, 0);
+    cameras.push_back(new socc_ptp(usb));
+    cameras.back()->connect();
+  }
+
+  printf("receive, one by one : %10.1f tx/s\n", bench_sync(cameras, rounds));
+  printf("receive_async       : %10.1f tx/s\n", bench_async(cameras, rounds));
+
+  for (int i = 0; i < ncameras; i++) {
+    delete cameras[i];
+  }
+  return bench_cancel(latency_us, rounds) == 0 ? 0 : 1;
+}
@@ -0,0 +1,189 @@
+/**
+ * @file bench_capture.cpp
+ * @brief Measures burst shooting on the mock USB backend.
+ *
+ * The sequence of shoot_an_image_and_get_it.sh (shutter, polling 0xD215,
+ * GetObjectInfo and GetObject for each shot) is compared with socc_capture,
+ * which keeps triggering while the captures are downloaded in background.
+ */
+
+#include <getopt.h>
+#include <parser.h>
+#include <ports_usb_mock.h>
+#include <socc_capture.h>
+#include <socc_ptp.h>
+#include <socc_time.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+using namespace com::sony::imaging::remote;
+using com::sony::imaging::ports::ports_usb_mock;
+
+#define SHOT_HANDLE 0xFFFFC001
+
+static socc_ptp *open_mock(uint32_t object_size, uint32_t latency_us,
+                           uint32_t bytes_per_sec) {
+  ports_usb_mock *usb = new ports_usb_mock();
+  usb->set_timing(latency_us, bytes_per_sec);
+  usb->set_object(object_size);
+  socc_ptp *ptp = new socc_ptp(usb);
+  ptp->connect();
+  return ptp;
+}
+
+static int control(socc_ptp *ptp, uint16_t code, uint16_t value) {
+  uint32_t params[1] = {code};
+  Container response;
+  return ptp->send(0x9207, params, 1, response, &value, sizeof(value));
+}
+
+static bool shooting_file_ready(socc_ptp *ptp) {
+  Container response;
+  void *data = NULL;
+  uint32_t size = 0;
+  bool ready = false;
+
+  if (ptp->receive(0x9209, NULL, 0, response, &data, size) == SOCC_OK) {
+    SDIDevicePropInfoDatasetArray info(data);
+    SDIDevicePropInfoDataset *file_info = info.get(0xD215);
+    if (file_info != NULL) {
+      ready = (static_cast<DataTypeInteger<uint16_t> *>(file_info)
+                   ->CurrentValue &
+               0x8000) != 0;
+    }
+  }
+  ptp->dispose_data(&data);
+  return ready;
+}
+
+static double bench_serial(socc_ptp *ptp, const char *path_format,
+                           int shots) {
+  uint32_t params[1] = {SHOT_HANDLE};
+  char path[256];
+  uint64_t begin = socc_monotonic_us();
+
+  for (int i = 0; i < shots; i++) {
+    control(ptp, 0xD2C1, 0x0002);
+    control(ptp, 0xD2C2, 0x0002);
+    control(ptp, 0xD2C2, 0x0001);
+    control(ptp, 0xD2C1, 0x0001);
+    while (!shooting_file_ready(ptp)) {
+    }
+
+    Container response;
+    void *data = NULL;
+    uint32_t size = 0;
+    ptp->receive(0x1008, params, 1, response, &data, size);
+    ptp->dispose_data(&data);
+    if (ptp->receive(0x1009, params, 1, response, &data, size) != SOCC_OK) {
+      fprintf(stderr, "receive failed\n");
+      return 0;
+    }
+    snprintf(path, sizeof(path), path_format, i + 1);
+    FILE *fp = fopen(path, "wb");
+    fwrite(data, 1, size, fp);
+    fclose(fp);
+    ptp->dispose_data(&data);
+  }
+  return shots * 1000000.0 / (socc_monotonic_us() - begin);
+}
+
+static double bench_capture(socc_ptp *ptp, const char *path_format, int shots,
+                            int depth, CaptureStats &stats) {
+  socc_capture capture(ptp, NULL, depth);
+
+  capture.start(path_format);
+  uint64_t begin = socc_monotonic_us();
+  for (int i = 0; i < shots; i++) {
+    if (capture.trigger() != SOCC_OK) {
+      fprintf(stderr, "trigger failed\n");
+      break;
+    }
+  }
+  uint64_t triggered = socc_monotonic_us();
+  if (capture.wait_idle(10000) != SOCC_OK) {
+    fprintf(stderr, "timeout\n");
+  }
+  double sps = shots * 1000000.0 / (socc_monotonic_us() - begin);
+  capture.get_stats(stats);
+  printf("  triggers done in %llu us\n",
+         (unsigned long long)(triggered - begin));
+  capture.stop();
+  return sps;
+}
+
+static void usage() {
+  fprintf(stderr,
+          "usage: bench_capture [--shots=N] [--size=bytes] [--depth=N] "
+          "[--latency=us] [--rate=bytes/s]\n");
+}
+
+int main(int argc, char **argv) {
+  int shots = 20;
+  int depth = 8;
+  uint32_t object_size = 8 * 1024 * 1024;
+  uint32_t latency_us = 300;
+  uint32_t rate = 40 * 1000 * 1000;  // high speed USB in practice
+  const char *path_format = "bench_capture%04u.jpg";
+
+  static struct option loptions[] = {{"shots", required_argument, 0, 'n'},
+                                     {"size", required_argument, 0, 's'},
+                                     {"depth", required_argument, 0, 'd'},
+                                     {"latency", required_argument, 0, 'l'},
+                                     {"rate", required_argument, 0, 'r'},
+                                     {0, 0, 0, 0}};
+  int opt;
+  while ((opt = getopt_long(argc, argv, "n:s:d:l:r:", loptions, NULL)) != -1) {
+    switch (opt) {
+      case 'n':
+        shots = strtol(optarg, NULL, 0);
+        break;
+      case 's':
+        object_size = strtoul(optarg, NULL, 0);
+        break;
+      case 'd':
+        depth = strtol(optarg, NULL, 0);
+        break;
+      case 'l':
+        latency_us = strtoul(optarg, NULL, 0);
+        break;
+      case 'r':
+        rate = strtoul(optarg, NULL, 0);
+        break;
+      default:
+        usage();
+        return -1;
+    }
+  }
+
+  printf("image %u bytes, latency %u us, rate %u bytes/s, %d shots\n",
+         object_size, latency_us, rate, shots);
+
+  socc_ptp *ptp = open_mock(object_size, latency_us, rate);
+  double sps = bench_serial(ptp, path_format, shots);
+  printf("shoot, poll, get       : %8.2f shots/s\n", sps);
+  delete ptp;
+
+  CaptureStats stats;
+  ptp = open_mock(object_size, latency_us, rate);
+  sps = bench_capture(ptp, path_format, shots, depth, stats);
+  printf("socc_capture           : %8.2f shots/s\n", sps);
+  printf("  triggered %llu, announced %llu, downloaded %llu, errors %llu\n",
+         (unsigned long long)stats.triggered,
+         (unsigned long long)stats.announced,
+         (unsigned long long)stats.downloaded,
+         (unsigned long long)stats.errors);
+  printf("  max depth %u, trigger avg %u us, download avg %u us\n",
+         stats.max_depth, stats.trigger_us_avg, stats.download_us_avg);
+  delete ptp;
+
+  char path[256];
+  for (int i = 0; i < shots; i++) {
+    snprintf(path, sizeof(path), path_format, i + 1);
+    unlink(path);
+  }
+  return 0;
+}
@@ -0,0 +1,149 @@
+/**
+ * @file bench_coro.cpp
+ * @brief Runs the workflow of shoot_an_image_and_get_it.sh on many mock
+ * cameras, as coroutines interleaved on one thread.
+ */
+
+#include <getopt.h>
+#include <ports_usb_mock.h>
+#include <socc_coro.h>
+#include <socc_ptp.h>
+#include <socc_time.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+
+#include <vector>
+
+using namespace com::sony::imaging::remote;
+using com::sony::imaging::ports::ports_usb_mock;
+
+#define SHOT_HANDLE 0xFFFFC001
+
+static socc_task<int> shoot(socc_camera &cam, int index, int shots,
+                            int &downloaded) {
+  int ret;
+  if ((ret = co_await cam.open_session()) != SOCC_OK ||
+      (ret = co_await cam.auth()) != SOCC_OK) {
+    fprintf(stderr, "camera %d: cannot connect (%d)\n", index, ret);
+    co_return ret;
+  }
+
+  // Position Key Setting to the PC remote, then Still Capture Mode
+  co_await cam.set(0xD25A, 0x01, 1);
+  ret = co_await cam.until(
+      0x5013, [](const PropertyValue &v) { return v.is_enable == 1; });
+  if (ret != SOCC_OK) {
+    fprintf(stderr, "camera %d: 0x5013 is not enabled (%d)\n", index, ret);
+    co_return ret;
+  }
+  co_await cam.set(0x5013, 0x00000001, 4);
+  co_await cam.until(0x5013,
+                     [](const PropertyValue &v) { return v.current == 1; });
+  ret = co_await cam.until(
+      0xD221, [](const PropertyValue &v) { return v.current == 0x01; });
+  if (ret != SOCC_OK) {
+    fprintf(stderr, "camera %d: no LiveView (%d)\n", index, ret);
+    co_return ret;
+  }
+
+  for (int i = 0; i < shots; i++) {
+    co_await cam.control(0xD2C1, 0x0002);
+    co_await cam.control(0xD2C2, 0x0002);
+    co_await cam.control(0xD2C2, 0x0001);
+    co_await cam.control(0xD2C1, 0x0001);
+
+    AsyncResult event = co_await cam.next_event(0xC201);  // ObjectAdded
+    if (event.ret != SOCC_OK) {
+      fprintf(stderr, "camera %d: no capture (%d)\n", index, event.ret);
+      co_return event.ret;
+    }
+    AsyncResult image = co_await cam.receive(0x1009, {SHOT_HANDLE});
+    if (image.ret == SOCC_OK && image.size > 0) {
+      downloaded++;
+    }
+    cam.ptp()->dispose_data(&image.data);
+  }
+  co_return SOCC_OK;
+}
+
+static void usage() {
+  fprintf(stderr,
+          "usage: bench_coro [--cameras=N] [--shots=N] [--size=bytes] "
+          "[--latency=us] [--rate=bytes/s]\n");
+}
+
+int main(int argc, char **argv) {
+  int ncameras = 8;
+  int shots = 10;
+  uint32_t object_size = 4 * 1024 * 1024;
+  uint32_t latency_us = 300;
+  uint32_t rate = 40 * 1000 * 1000;  // high speed USB in practice
+
+  static struct option loptions[] = {{"cameras", required_argument, 0, 'c'},
+                                     {"shots", required_argument, 0, 'n'},
+                                     {"size", required_argument, 0, 's'},
+                                     {"latency", required_argument, 0, 'l'},
+                                     {"rate", required_argument, 0, 'r'},
+                                     {0, 0, 0, 0}};
+  int opt;
+  while ((opt = getopt_long(argc, argv, "c:n:s:l:r:", loptions, NULL)) !=
+         -1) {
+    switch (opt) {
+      case 'c':
+        ncameras = strtol(optarg, NULL, 0);
+        break;
+      case 'n':
+        shots = strtol(optarg, NULL, 0);
+        break;
+      case 's':
+        object_size = strtoul(optarg, NULL, 0);
+        break;
+      case 'l':
+        latency_us = strtoul(optarg, NULL, 0);
+        break;
+      case 'r':
+        rate = strtoul(optarg, NULL, 0);
+        break;
+      default:
+        usage();
+        return -1;
+    }
+  }
+
+  printf("%d cameras, %d shots of %u bytes, latency %u us, rate %u bytes/s\n",
+         ncameras, shots, object_size, latency_us, rate);
+
+  socc_executor executor;
+  std::vector<socc_ptp *> ptps;
+  std::vector<socc_camera *> cameras;
+  std::vector<int> downloaded(ncameras, 0);
+  for (int i = 0; i < ncameras; i++) {
+    ports_usb_mock *usb = new ports_usb_mock();
+    usb->set_timing(latency_us, rate);
+    usb->set_object(object_size);
+    ptps.push_back(new socc_ptp(usb));
+    ptps.back()->connect();
+    cameras.push_back(new socc_camera(ptps.back(), executor));
+  }
+
+  uint64_t begin = socc_monotonic_us();
+  for (int i = 0; i < ncameras; i++) {
+    executor.spawn(shoot(*cameras[i], i, shots, downloaded[i]));
+  }
+  executor.run();
+  uint64_t elapsed = socc_monotonic_us() - begin;
+
+  int total = 0;
+  for (int i = 0; i < ncameras; i++) {
+    total += downloaded[i];
+  }
+  printf("downloaded %d of %d in %.1f ms on one thread: %.1f shots/s\n", total,
+         ncameras * shots, elapsed / 1000.0, total * 1000000.0 / elapsed);
+
+  for (int i = 0; i < ncameras; i++) {
+    delete cameras[i];
+    delete ptps[i];
+  }
+  return total == ncameras * shots ? 0 : 1;
+}
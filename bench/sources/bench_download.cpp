@@ -0,0 +1,195 @@
+/**
+ * @file bench_download.cpp
+ * @brief Measures the object download on the mock USB backend.
+ *
+ * The monolithic GetObject receive()/write() path used by "control get" is
+ * compared with socc_download, which pipelines GetPartialObject with the
+ * writes. A halt of the bulk in endpoint can be injected to exercise the
+ * resume from the last good offset.
+ */
+
+#include <fcntl.h>
+#include <getopt.h>
+#include <ports_usb_mock.h>
+#include <socc_download.h>
+#include <socc_ptp.h>
+#include <socc_time.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+using namespace com::sony::imaging::remote;
+using com::sony::imaging::ports::ports_usb_mock;
+
+#define SHOT_HANDLE 0xFFFFC001
+
+static socc_ptp *open_mock(ports_usb_mock **usb, uint32_t object_size,
+                           uint32_t latency_us, uint32_t bytes_per_sec) {
+  *usb = new ports_usb_mock();
+  (*usb)->set_timing(latency_us, bytes_per_sec);
+  (*usb)->set_object(object_size);
+  socc_ptp *ptp = new socc_ptp(*usb);
+  ptp->connect();
+  return ptp;
+}
+
+static bool verify(const char *path, uint32_t size) {
+  FILE *fp = fopen(path, "rb");
+  if (fp == NULL) {
+    return false;
+  }
+  bool ok = true;
+  uint32_t i = 0;
+  int c;
+  while ((c = fgetc(fp)) != EOF) {
+    if (i >= size || c != (unsigned char)((i * 2654435761u) >> 24)) {
+      ok = false;
+      break;
+    }
+    i++;
+  }
+  fclose(fp);
+  return ok && i == size;
+}
+
+static double bench_receive(socc_ptp *ptp, const char *path, int count,
+                            uint32_t size) {
+  uint32_t params[1] = {SHOT_HANDLE};
+  Container response;
+  uint64_t begin = socc_monotonic_us();
+
+  for (int i = 0; i < count; i++) {
+    void *data = NULL;
+    uint32_t received = 0;
+    if (ptp->receive(0x1009, params, 1, response, &data, received) !=
+        SOCC_OK) {
+      fprintf(stderr, "receive failed\n");
+      return 0;
+    }
+    FILE *fp = fopen(path, "wb");
+    fwrite(data, 1, received, fp);
+    fclose(fp);
+    ptp->dispose_data(&data);
+  }
+  double mbps = (double)size * count / (socc_monotonic_us() - begin);
+  if (!verify(path, size)) {
+    fprintf(stderr, "broken download\n");
+  }
+  return mbps;
+}
+
+static double bench_download(socc_ptp *ptp, const char *path, int count,
+                             uint32_t size, uint32_t chunk_size,
+                             DownloadStats &stats) {
+  socc_download download(ptp, NULL, chunk_size);
+  uint64_t begin = socc_monotonic_us();
+
+  for (int i = 0; i < count; i++) {
+    int ret = download.download(SHOT_HANDLE, path);
+    if (ret != SOCC_OK) {
+      fprintf(stderr, "download failed (%d)\n", ret);
+      return 0;
+    }
+  }
+  double mbps = (double)size * count / (socc_monotonic_us() - begin);
+  download.get_stats(stats);
+  if (!verify(path, size)) {
+    fprintf(stderr, "broken download\n");
+  }
+  return mbps;
+}
+
+static void print_stats(const DownloadStats &stats) {
+  printf("  chunks %u, retries %u, usb %llu us, write %llu us, total %llu us\n",
+         stats.chunks, stats.retries, (unsigned long long)stats.usb_us,
+         (unsigned long long)stats.write_us,
+         (unsigned long long)stats.elapsed_us);
+}
+
+static void usage() {
+  fprintf(stderr,
+          "usage: bench_download [--count=N] [--size=bytes] [--chunk=bytes] "
+          "[--latency=us] [--rate=bytes/s] [--halt=bytes] [--out=path]\n");
+}
+
+int main(int argc, char **argv) {
+  int count = 5;
+  uint32_t object_size = 24 * 1024 * 1024;
+  uint32_t chunk_size = 1024 * 1024;
+  uint32_t latency_us = 300;
+  uint32_t rate = 40 * 1000 * 1000;  // high speed USB in practice
+  uint64_t halt = 0;
+  const char *path = "bench_download.jpg";
+
+  static struct option loptions[] = {{"count", required_argument, 0, 'n'},
+                                     {"size", required_argument, 0, 's'},
+                                     {"chunk", required_argument, 0, 'c'},
+                                     {"latency", required_argument, 0, 'l'},
+                                     {"rate", required_argument, 0, 'r'},
+                                     {"halt", required_argument, 0, 'h'},
+                                     {"out", required_argument, 0, 'o'},
+                                     {0, 0, 0, 0}};
+  int opt;
+  while ((opt = getopt_long(argc, argv, "n:s:c:l:r:h:o:", loptions, NULL)) !=
+         -1) {
+    switch (opt) {
+      case 'n':
+        count = strtol(optarg, NULL, 0);
+        break;
+      case 's':
+        object_size = strtoul(optarg, NULL, 0);
+        break;
+      case 'c':
+        chunk_size = strtoul(optarg, NULL, 0);
+        break;
+      case 'l':
+        latency_us = strtoul(optarg, NULL, 0);
+        break;
+      case 'r':
+        rate = strtoul(optarg, NULL, 0);
+        break;
+      case 'h':
+        halt = strtoull(optarg, NULL, 0);
+        break;
+      case 'o':
+        path = optarg;
+        break;
+      default:
+        usage();
+        return -1;
+    }
+  }
+
+  printf(
+      "object %u bytes, chunk %u bytes, latency %u us, rate %u bytes/s, "
+      "%d downloads\n",
+      object_size, chunk_size, latency_us, rate, count);
+
+  ports_usb_mock *usb;
+  socc_ptp *ptp = open_mock(&usb, object_size, latency_us, rate);
+  double mbps = bench_receive(ptp, path, count, object_size);
+  printf("GetObject + write      : %8.1f MB/s\n", mbps);
+  delete ptp;
+
+  DownloadStats stats;
+  ptp = open_mock(&usb, object_size, latency_us, rate);
+  mbps = bench_download(ptp, path, count, object_size, chunk_size, stats);
+  printf("socc_download          : %8.1f MB/s\n", mbps);
+  print_stats(stats);
+  delete ptp;
+
+  if (halt > 0) {
+    ptp = open_mock(&usb, object_size, latency_us, rate);
+    usb->inject_halt(halt);
+    mbps = bench_download(ptp, path, 1, object_size, chunk_size, stats);
+    printf("socc_download, halted after %llu bytes: %8.1f MB/s\n",
+           (unsigned long long)halt, mbps);
+    print_stats(stats);
+    delete ptp;
+  }
+
+  unlink(path);
+  return 0;
+}
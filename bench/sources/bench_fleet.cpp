@@ -0,0 +1,133 @@
+/**
+ * @file bench_fleet.cpp
+ * @brief Measures the control of multiple cameras on the mock USB backend.
+ *
+ * Opening, authenticating, setting a property and triggering the cameras one
+ * after another, as control_multiple_fx30.sh does with a process per camera,
+ * is compared with socc_fleet running them in parallel.
+ */
+
+#include <getopt.h>
+#include <ports_usb_mock.h>
+#include <socc_fleet.h>
+#include <socc_ptp.h>
+#include <socc_time.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include <vector>
+
+using namespace com::sony::imaging::remote;
+using com::sony::imaging::ports::ports_usb_mock;
+
+static ports_usb_mock *new_mock(uint32_t latency_us, uint32_t bytes_per_sec) {
+  ports_usb_mock *usb = new ports_usb_mock();
+  usb->set_timing(latency_us, bytes_per_sec);
+  return usb;
+}
+
+static int run_sequence(socc_fleet &fleet, std::vector<FleetResult> &results,
+                        const char *&failed) {
+  uint16_t save_media = 0x0001;
+  if (fleet.open(results) != SOCC_OK) {
+    failed = "open";
+    return -1;
+  }
+  if (fleet.auth(results) != SOCC_OK) {
+    failed = "auth";
+    return -1;
+  }
+  if (fleet.set_property(0xD222, &save_media, sizeof(save_media), results) !=
+      SOCC_OK) {
+    failed = "set_property";
+    return -1;
+  }
+  if (fleet.trigger(results) != SOCC_OK) {
+    failed = "trigger";
+    return -1;
+  }
+  return 0;
+}
+
+static double bench_sequential(int cameras, uint32_t latency_us,
+                               uint32_t rate) {
+  uint64_t begin = socc_monotonic_us();
+  for (int i = 0; i < cameras; i++) {
+    // a fleet of one camera at a time, like a process per camera
+    socc_fleet fleet;
+    std::vector<FleetResult> results;
+    const char *failed = NULL;
+    fleet.add(new_mock(latency_us, rate));
+    if (run_sequence(fleet, results, failed) != 0) {
+      fprintf(stderr, "%s failed\n", failed);
+    }
+  }
+  return (socc_monotonic_us() - begin) / 1000.0;
+}
+
+static double bench_fleet(int cameras, uint32_t latency_us, uint32_t rate,
+                          std::vector<FleetResult> &results) {
+  socc_fleet fleet;
+  const char *failed = NULL;
+  for (int i = 0; i < cameras; i++) {
+    fleet.add(new_mock(latency_us, rate));
+  }
+  uint64_t begin = socc_monotonic_us();
+  if (run_sequence(fleet, results, failed) != 0) {
+    fprintf(stderr, "%s failed\n", failed);
+  }
+  return (socc_monotonic_us() - begin) / 1000.0;
+}
+
+static void usage() {
+  fprintf(stderr,
+          "usage: bench_fleet [--cameras=N] [--latency=us] [--rate=bytes/s]\n");
+}
+
+int main(int argc, char **argv) {
+  int cameras = 8;
+  uint32_t latency_us = 2000;
+  uint32_t rate = 40 * 1000 * 1000;  // high speed USB in practice
+
+  static struct option loptions[] = {{"cameras", required_argument, 0, 'n'},
+                                     {"latency", required_argument, 0, 'l'},
+                                     {"rate", required_argument, 0, 'r'},
+                                     {0, 0, 0, 0}};
+  int opt;
+  while ((opt = getopt_long(argc, argv, "n:l:r:", loptions, NULL)) != -1) {
+    switch (opt) {
+      case 'n':
+        cameras = strtol(optarg, NULL, 0);
+        break;
+      case 'l':
+        latency_us = strtoul(optarg, NULL, 0);
+        break;
+      case 'r':
+        rate = strtoul(optarg, NULL, 0);
+        break;
+      default:
+        usage();
+        return -1;
+    }
+  }
+
+  printf("%d cameras, latency %u us, rate %u bytes/s\n", cameras, latency_us,
+         rate);
+  printf("open, auth, set property and trigger\n");
+
+  double ms = bench_sequential(cameras, latency_us, rate);
+  printf("one camera at a time   : %8.1f ms\n", ms);
+
+  std::vector<FleetResult> results;
+  ms = bench_fleet(cameras, latency_us, rate, results);
+  printf("socc_fleet             : %8.1f ms\n", ms);
+  printf("  trigger latency per camera:");
+  for (size_t i = 0; i < results.size(); i++) {
+    printf(" %u", results[i].latency_us);
+  }
+  printf(" us\n");
+
+  return 0;
+}
@@ -0,0 +1,199 @@
+/**
+ * @file bench_liveview.cpp
+ * @brief Measures the sustainable LiveView frame rate on the mock USB backend.
+ *
+ * The per-frame receive()/dispose_data() path used by "control getliveview"
+ * is compared with socc_liveview receiving into its preallocated frames,
+ * first with a consumer which only takes the frames, then with one which
+ * spends --work micro seconds on each, as a viewer fed with them does. The
+ * engine receives the next frame meanwhile, while the receive() path does
+ * one after the other. The paths are run in turns and the best of each is
+ * reported, as the first run is slowed by the allocator warming up.
+ */
+
+#include <getopt.h>
+#include <parser.h>
+#include <ports_usb_mock.h>
+#include <socc_liveview.h>
+#include <socc_ptp.h>
+#include <socc_time.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+using namespace com::sony::imaging::remote;
+using com::sony::imaging::ports::ports_usb_mock;
+
+static socc_ptp *open_mock(uint32_t image_size, uint32_t repeat,
+                           uint32_t latency_us, uint32_t bytes_per_sec) {
+  ports_usb_mock *usb = new ports_usb_mock();
+  usb->set_timing(latency_us, bytes_per_sec);
+  usb->set_liveview(image_size, repeat);
+  socc_ptp *ptp = new socc_ptp(usb);
+  ptp->connect();
+  return ptp;
+}
+
+// the consumer handling a frame, like writing it to a viewer
+static void work(uint32_t work_us) {
+  if (work_us > 0) {
+    struct timespec ts = {(time_t)(work_us / 1000000),
+                          (long)(work_us % 1000000) * 1000};
+    nanosleep(&ts, NULL);
+  }
+}
+
+static double bench_receive(socc_ptp *ptp, int frames, uint32_t work_us) {
+  uint32_t params[1] = {0xFFFFC002};
+  Container response;
+  uint64_t begin = socc_monotonic_us();
+
+  for (int i = 0; i < frames; i++) {
+    void *data = NULL;
+    uint32_t size = 0;
+    if (ptp->receive(0x1009, params, 1, response, &data, size) != SOCC_OK) {
+      fprintf(stderr, "receive failed\n");
+      return 0;
+    }
+    LiveViewImage image(data);
+    if (image.size() == 0 || image.get()[0] != 0xFF) {
+      fprintf(stderr, "broken LiveView image\n");
+    }
+    work(work_us);
+    ptp->dispose_data(&data);
+  }
+  return frames * 1000000.0 / (socc_monotonic_us() - begin);
+}
+
+static double bench_engine(socc_ptp *ptp, int frames, int nframes,
+                           uint32_t work_us, LiveViewStats &stats) {
+  socc_liveview engine(ptp, NULL, nframes);
+  LiveViewFrame *frame;
+  uint64_t sequence = 0;
+
+  engine.set_interval(0);
+  engine.start();
+  uint64_t begin = socc_monotonic_us();
+  for (int i = 0; i < frames; i++) {
+    if (engine.acquire(&frame, sequence, 1000) != SOCC_OK) {
+      fprintf(stderr, "acquire failed\n");
+      break;
+    }
+    if (frame->jpeg_size == 0 || frame->jpeg[0] != 0xFF) {
+      fprintf(stderr, "broken LiveView image\n");
+    }
+    sequence = frame->sequence;
+    work(work_us);
+    engine.release(frame);
+  }
+  double fps = frames * 1000000.0 / (socc_monotonic_us() - begin);
+  engine.get_stats(stats);
+  engine.stop();
+  return fps;
+}
+
+static void usage() {
+  fprintf(stderr,
+          "usage: bench_liveview [--frames=N] [--size=bytes] "
+          "[--latency=us] [--rate=bytes/s] [--slots=N] [--repeat=N] "
+          "[--work=us] [--rounds=N]\n");
+}
+
+int main(int argc, char **argv) {
+  int frames = 300;
+  int slots = 3;
+  uint32_t repeat = 1;
+  uint32_t image_size = 200 * 1024;
+  uint32_t latency_us = 300;
+  uint32_t rate = 40 * 1000 * 1000;  // high speed USB in practice
+  uint32_t work_us = 2000;
+  int rounds = 2;
+
+  static struct option loptions[] = {{"frames", required_argument, 0, 'n'},
+                                     {"size", required_argument, 0, 's'},
+                                     {"latency", required_argument, 0, 'l'},
+                                     {"rate", required_argument, 0, 'r'},
+                                     {"slots", required_argument, 0, 'k'},
+                                     {"repeat", required_argument, 0, 'p'},
+                                     {"work", required_argument, 0, 'w'},
+                                     {"rounds", required_argument, 0, 'o'},
+                                     {0, 0, 0, 0}};
+  int opt;
+  while ((opt = getopt_long(argc, argv, "n:s:l:r:k:p:w:o:", loptions,
+                            NULL)) != -1) {
+    switch (opt) {
+      case 'n':
+        frames = strtol(optarg, NULL, 0);
+        break;
+      case 's':
+        image_size = strtoul(optarg, NULL, 0);
+        break;
+      case 'l':
+        latency_us = strtoul(optarg, NULL, 0);
+        break;
+      case 'r':
+        rate = strtoul(optarg, NULL, 0);
+        break;
+      case 'k':
+        slots = strtol(optarg, NULL, 0);
+        break;
+      case 'p':
+        repeat = strtoul(optarg, NULL, 0);
+        break;
+      case 'w':
+        work_us = strtoul(optarg, NULL, 0);
+        break;
+      case 'o':
+        rounds = strtol(optarg, NULL, 0);
+        break;
+      default:
+        usage();
+        return -1;
+    }
+  }
+
+  printf(
+      "image %u bytes (refreshed every %u requests), latency %u us, "
+      "rate %u bytes/s, %d frames\n",
+      image_size, repeat, latency_us, rate, frames);
+
+  uint32_t works[] = {0, work_us};
+  for (int w = 0; w < (work_us > 0 ? 2 : 1); w++) {
+    double receive_fps = 0;
+    double engine_fps = 0;
+    LiveViewStats stats;
+    memset(&stats, 0, sizeof(stats));
+    for (int r = 0; r < rounds; r++) {
+      socc_ptp *ptp = open_mock(image_size, repeat, latency_us, rate);
+      double fps = bench_receive(ptp, frames, works[w]);
+      receive_fps = fps > receive_fps ? fps : receive_fps;
+      delete ptp;
+
+      LiveViewStats round_stats;
+      ptp = open_mock(image_size, repeat, latency_us, rate);
+      fps = bench_engine(ptp, frames, slots, works[w], round_stats);
+      if (fps > engine_fps) {
+        engine_fps = fps;
+        stats = round_stats;
+      }
+      delete ptp;
+    }
+
+    printf("consumer work %u us per frame\n", works[w]);
+    printf("  receive + dispose_data : %8.1f fps\n", receive_fps);
+    printf("  socc_liveview          : %8.1f fps\n", engine_fps);
+    printf("    frames %llu, dropped %llu, not ready %llu, errors %llu\n",
+           (unsigned long long)stats.frames, (unsigned long long)stats.dropped,
+           (unsigned long long)stats.not_ready,
+           (unsigned long long)stats.errors);
+    printf("    duplicates suppressed %llu (%.1f%%)\n",
+           (unsigned long long)stats.duplicates,
+           stats.duplicates * 100.0 / (stats.frames + stats.duplicates));
+    printf("    transfer last %u us, avg %u us, max %u us, age %llu us\n",
+           stats.transfer_us_last, stats.transfer_us_avg,
+           stats.transfer_us_max, (unsigned long long)stats.age_us);
+  }
+
+  return 0;
+}
@@ -0,0 +1,106 @@
+/**
+ * @file bench_stats.cpp
+ * @brief Measures the cost of the transaction statistics on the mock USB
+ * backend.
+ *
+ * The same transactions are run with the statistics disabled and enabled,
+ * without any simulated latency so that the cost is not hidden by the
+ * transfer. The rounds alternate to cancel the drift of the clock frequency.
+ */
+
+#include <getopt.h>
+#include <ports_usb_mock.h>
+#include <socc_ptp.h>
+#include <socc_stats.h>
+#include <socc_time.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include <string>
+
+using namespace com::sony::imaging::remote;
+using com::sony::imaging::ports::ports_usb_mock;
+
+static uint64_t run(socc_ptp *ptp, int transactions) {
+  uint32_t params[1] = {0xD222};
+  uint16_t value = 0x0001;
+  Container response;
+  void *data = NULL;
+  uint32_t size = 0;
+
+  uint64_t begin = socc_monotonic_ns();
+  for (int i = 0; i < transactions; i += 2) {
+    ptp->send(0x9205, params, 1, response, &value, sizeof(value));
+    ptp->receive(0x9202, params, 1, response, &data, size);
+    ptp->dispose_data(&data);
+  }
+  return socc_monotonic_ns() - begin;
+}
+
+static void usage() {
+  fprintf(stderr,
+          "usage: bench_stats [--transactions=N] [--rounds=N] [--json]\n");
+}
+
+int main(int argc, char **argv) {
+  int transactions = 200000;
+  int rounds = 5;
+  bool json = false;
+
+  static struct option loptions[] = {
+      {"transactions", required_argument, 0, 'n'},
+      {"rounds", required_argument, 0, 'r'},
+      {"json", no_argument, 0, 'j'},
+      {0, 0, 0, 0}};
+  int opt;
+  while ((opt = getopt_long(argc, argv, "n:r:j", loptions, NULL)) != -1) {
+    switch (opt) {
+      case 'n':
+        transactions = strtol(optarg, NULL, 0);
+        break;
+      case 'r':
+        rounds = strtol(optarg, NULL, 0);
+        break;
+      case 'j':
+        json = true;
+        break;
+      default:
+        usage();
+        return -1;
+    }
+  }
+
+  socc_ptp ptp(new ports_usb_mock());
+  if (ptp.connect() != SOCC_OK) {
+    fprintf(stderr, "connect failed\n");
+    return 1;
+  }
+
+  uint64_t off_ns = 0, on_ns = 0;
+  for (int i = 0; i < rounds; i++) {
+    ptp.stats()->set_enabled(false);
+    off_ns += run(&ptp, transactions);
+    ptp.stats()->set_enabled(true);
+    on_ns += run(&ptp, transactions);
+  }
+
+  double off = (double)off_ns / rounds / transactions;
+  double on = (double)on_ns / rounds / transactions;
+  printf("%d transactions x %d rounds\n", transactions, rounds);
+  printf("statistics disabled    : %8.1f ns/transaction\n", off);
+  printf("statistics enabled     : %8.1f ns/transaction\n", on);
+  printf("overhead               : %8.1f ns/transaction (%.1f%%)\n", on - off,
+         (on - off) * 100 / off);
+  // a transaction on the real bus takes a few microframes at least
+  printf("against a 125 us microframe: %.2f%%\n", (on - off) * 100 / 125000);
+
+  if (json) {
+    std::string out;
+    ptp.stats()->to_json(out);
+    printf("%s\n", out.c_str());
+  }
+  ptp.disconnect();
+  return 0;
+}
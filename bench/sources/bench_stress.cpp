@@ -0,0 +1,226 @@
+/**
+ * @file bench_stress.cpp
+ * @brief Shares one socc_ptp on the mock USB backend among many threads, and
+ * checks that no transaction is corrupted by another.
+ *
+ * Each thread mixes receive(), receive_into(), send(), receive_async() and a
+ * prepared transaction, while an event thread reads the interrupt endpoint.
+ * Every response must be OK with a TransactionID of its own, and every data
+ * phase must be the one of its request.
+ */
+
+#include <getopt.h>
+#include <ports_usb_mock.h>
+#include <pthread.h>
+#include <socc_ptp.h>
+#include <socc_time.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include <algorithm>
+#include <atomic>
+#include <vector>
+
+using namespace com::sony::imaging::remote;
+using com::sony::imaging::ports::ports_usb_mock;
+
+#define OBJECT_HANDLE 0xFFFFC001
+
+typedef struct worker_t {
+  socc_ptp *ptp;
+  int transactions;
+  const void *device_info;
+  uint32_t device_info_size;
+  uint32_t object_size;
+  std::vector<uint32_t> transaction_ids;
+  int errors;
+  pthread_t thread;
+} worker_t;
+
+static std::atomic<int> events(0);
+
+static void event_received(const AsyncResult &result, void *vp) {
+  if (result.ret == SOCC_OK) {
+    events++;
+  }
+}
+
+static bool check(worker_t *worker, int ret, const Container &response,
+                  const char *what) {
+  if (ret != SOCC_OK || response.code != 0x2001) {
+    fprintf(stderr, "%s: ret %d, response 0x%04X\n", what, ret, response.code);
+    worker->errors++;
+    return false;
+  }
+  worker->transaction_ids.push_back(response.transaction_id);
+  return true;
+}
+
+static void *work(void *vp) {
+  worker_t *worker = (worker_t *)vp;
+  socc_ptp *ptp = worker->ptp;
+  std::vector<uint8_t> buffer(worker->object_size);
+  Container response;
+  uint32_t handle = OBJECT_HANDLE;
+
+  for (int i = 0; i < worker->transactions; i++) {
+    switch (i % 5) {
+      case 0: {
+        void *data = NULL;
+        uint32_t size = 0;
+        int ret = ptp->receive(0x9202, NULL, 0, response, &data, size);
+        if (check(worker, ret, response, "receive") &&
+            (size != worker->device_info_size ||
+             memcmp(data, worker->device_info, size) != 0)) {
+          fprintf(stderr, "receive: data of another transaction\n");
+          worker->errors++;
+        }
+        ptp->dispose_data(&data);
+        break;
+      }
+      case 1: {
+        uint32_t size = 0;
+        int ret = ptp->receive_into(0x1009, &handle, 1, response, &buffer[0],
+                                    buffer.size(), size);
+        if (check(worker, ret, response, "receive_into") &&
+            size != worker->object_size) {
+          fprintf(stderr, "receive_into: %u bytes instead of %u\n", size,
+                  worker->object_size);
+          worker->errors++;
+        }
+        break;
+      }
+      case 2: {
+        uint32_t param = 0xD25A;
+        uint8_t value = 0x01;
+        int ret = ptp->send(0x9205, &param, 1, response, &value, 1);
+        check(worker, ret, response, "send");
+        break;
+      }
+      case 3: {
+        std::future<AsyncResult> future = ptp->receive_async(0x9202, NULL, 0);
+        AsyncResult result = future.get();
+        if (check(worker, result.ret, result.response, "receive_async") &&
+            result.size != worker->device_info_size) {
+          fprintf(stderr, "receive_async: data of another transaction\n");
+          worker->errors++;
+        }
+        ptp->dispose_data(&result.data);
+        break;
+      }
+      case 4: {
+        uint32_t param = 0xD2C2;
+        uint16_t value = 0x0002;
+        PreparedTransaction prepared;
+        ptp->prepare_send(0x9207, &param, 1, &value, 2, prepared);
+        int ret = ptp->issue_prepared(prepared);
+        if (ret == SOCC_OK) {
+          ret = ptp->complete_prepared(response);
+        }
+        check(worker, ret, response, "prepared");
+        break;
+      }
+    }
+  }
+  return NULL;
+}
+
+static void usage() {
+  fprintf(stderr,
+          "usage: bench_stress [--threads=N] [--transactions=N] "
+          "[--size=bytes] [--latency=us]\n");
+}
+
+int main(int argc, char **argv) {
+  int nthreads = 32;
+  int transactions = 1000;
+  uint32_t object_size = 64 * 1024;
+  uint32_t latency_us = 0;
+
+  static struct option loptions[] = {
+      {"threads", required_argument, 0, 't'},
+      {"transactions", required_argument, 0, 'n'},
+      {"size", required_argument, 0, 's'},
+      {"latency", required_argument, 0, 'l'},
+      {0, 0, 0, 0}};
+  int opt;
+  while ((opt = getopt_long(argc, argv, "t:n:s:l:", loptions, NULL)) != -1) {
+    switch (opt) {
+      case 't':
+        nthreads = strtol(optarg, NULL, 0);
+        break;
+      case 'n':
+        transactions = strtol(optarg, NULL, 0);
+        break;
+      case 's':
+        object_size = strtoul(optarg, NULL, 0);
+        break;
+      case 'l':
+        latency_us = strtoul(optarg, NULL, 0);
+        break;
+      default:
+        usage();
+        return -1;
+    }
+  }
+
+  printf("%d threads, %d transactions each, object of %u bytes, latency %u us\n",
+         nthreads, transactions, object_size, latency_us);
+
+  ports_usb_mock *usb = new ports_usb_mock();
+  usb->set_timing(latency_us, 0);
+  usb->set_object(object_size);
+  socc_ptp *ptp = new socc_ptp(usb);
+  ptp->connect();
+
+  Container response;
+  uint32_t session = 1;
+  ptp->send(0x1002, &session, 1, response, NULL, 0);
+
+  void *device_info = NULL;
+  uint32_t device_info_size = 0;
+  ptp->receive(0x9202, NULL, 0, response, &device_info, device_info_size);
+  ptp->set_event_callback(event_received, NULL);
+
+  std::vector<worker_t> workers(nthreads);
+  uint64_t begin = socc_monotonic_us();
+  for (int i = 0; i < nthreads; i++) {
+    worker_t *worker = &workers[i];
+    worker->ptp = ptp;
+    worker->transactions = transactions;
+    worker->device_info = device_info;
+    worker->device_info_size = device_info_size;
+    worker->object_size = object_size;
+    worker->errors = 0;
+    pthread_create(&worker->thread, NULL, work, worker);
+  }
+  std::vector<uint32_t> ids;
+  int errors = 0;
+  for (int i = 0; i < nthreads; i++) {
+    pthread_join(workers[i].thread, NULL);
+    ids.insert(ids.end(), workers[i].transaction_ids.begin(),
+               workers[i].transaction_ids.end());
+    errors += workers[i].errors;
+  }
+  uint64_t elapsed = socc_monotonic_us() - begin;
+
+  // OpenSession and GetExtDeviceInfo above took 0 and 1
+  std::sort(ids.begin(), ids.end());
+  for (size_t i = 0; i < ids.size(); i++) {
+    if (ids[i] != i + 2) {
+      fprintf(stderr, "TransactionID %u is duplicated or skipped\n", ids[i]);
+      errors++;
+      break;
+    }
+  }
+
+  printf("%zu transactions in %.1f ms: %.1f tx/s, %d events, %d errors\n",
+         ids.size(), elapsed / 1000.0, ids.size() * 1000000.0 / elapsed,
+         events.load(), errors);
+
+  ptp->dispose_data(&device_info);
+  delete ptp;
+  return errors == 0 ? 0 : 1;
+}
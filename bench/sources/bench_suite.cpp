@@ -0,0 +1,834 @@
+/**
+ * @file bench_suite.cpp
+ * @brief Runs the benchmarks of the hot paths and writes the results as JSON.
+ *
+ * The transactions run on the mock USB backend without latency and with an
+ * unlimited rate by default, so that the software path is measured. The
+ * daemon round trip forks a server on the mock, like "control" does on a
+ * camera. The reconnection is the time for a server with reconnect to serve a
+ * command again, after the cable of its mock is pulled and plugged back. The
+ * authentication is run on a mock which is still starting up, and measured
+ * until its properties can be read. The batch runs the transactions of the
+ * round trip as the steps of a single request, and a round trip is measured
+ * again while another client's batch sleeps. The log benchmarks write lines
+ * to a file opened with O_SYNC, by the old fprintf and fflush per line and by
+ * the LogWriter, and measure the transactions of a Command logging to it.
+ * The offline batch parses a directory of copies of the mock 0x9209 dump.
+ * The snapshot diff compares two datasets of 400 properties with a few
+ * changes, against the text of both parsed by getall.
+ * Each result is a line of "results" in the JSON, and a previous run given
+ * with --baseline fails the suite on a regression beyond --tolerance.
+ */
+
+#include <errno.h>
+#include <fcntl.h>
+#include <getopt.h>
+#include <parser.h>
+#include <ports_usb_mock.h>
+#include <pthread.h>
+#include <signal.h>
+#include <socc_auth.h>
+#include <socc_liveview.h>
+#include <socc_ptp.h>
+#include <socc_snapshot.h>
+#include <socc_time.h>
+#include <stdarg.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/time.h>
+#include <sys/utsname.h>
+#include <sys/wait.h>
+#include <time.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <string>
+#include <vector>
+
+#include "log_writer.h"
+#include "offline.h"
+#include "serverclient.h"
+#include "socket.hpp"
+#include "websocket_server.h"
+
+using namespace com::sony::imaging::remote;
+using com::sony::imaging::ports::ports_usb_mock;
+
+#define SHOT_HANDLE 0xFFFFC001
+
+// a camera just powered on is not ready at once
+#define BRINGUP_VERSION_DELAY_US 20000
+#define BRINGUP_PROPERTIES_DELAY_US 10000
+
+typedef struct result_t {
+  std::string name;
+  double value;
+  const char *unit;
+  bool higher_is_better;
+} result_t;
+
+static std::vector<result_t> results;
+static uint32_t latency_us = 0;
+static uint32_t rate = 0;
+static int scale = 10;
+
+static void report(const std::string &name, double value, const char *unit,
+                   bool higher_is_better) {
+  result_t result = {name, value, unit, higher_is_better};
+  results.push_back(result);
+  printf("%-36s %14.2f %s\n", name.c_str(), value, unit);
+}
+
+static socc_ptp *open_mock(ports_usb_mock **usb) {
+  *usb = new ports_usb_mock();
+  (*usb)->set_timing(latency_us, rate);
+  socc_ptp *ptp = new socc_ptp(*usb);
+  ptp->connect();
+  return ptp;
+}
+
+static void bench_transactions() {
+  int count = 2000 * scale;
+  ports_usb_mock *usb;
+  socc_ptp *ptp = open_mock(&usb);
+  Container response;
+
+  uint64_t begin = socc_monotonic_us();
+  for (int i = 0; i < count; i++) {
+    void *data = NULL;
+    uint32_t size = 0;
+    if (ptp->receive(0x9202, NULL, 0, response, &data, size) != SOCC_OK) {
+      fprintf(stderr, "receive failed\n");
+      break;
+    }
+    ptp->dispose_data(&data);
+  }
+  report("ptp.receive_small", count * 1000000.0 / (socc_monotonic_us() - begin),
+         "tx/s", true);
+
+  uint32_t params[1] = {0x5013};
+  uint16_t value = 0x0001;
+  begin = socc_monotonic_us();
+  for (int i = 0; i < count; i++) {
+    if (ptp->send(0x9205, params, 1, response, &value, sizeof(value)) !=
+        SOCC_OK) {
+      fprintf(stderr, "send failed\n");
+      break;
+    }
+  }
+  report("ptp.send_small", count * 1000000.0 / (socc_monotonic_us() - begin),
+         "tx/s", true);
+  delete ptp;
+}
+
+static void bench_getobject() {
+  static const uint32_t sizes[] = {64 * 1024, 1024 * 1024, 8 * 1024 * 1024,
+                                   32 * 1024 * 1024};
+  uint64_t total = (uint64_t)scale * 16 * 1024 * 1024;
+
+  for (size_t s = 0; s < sizeof(sizes) / sizeof(sizes[0]); s++) {
+    ports_usb_mock *usb;
+    socc_ptp *ptp = open_mock(&usb);
+    usb->set_object(sizes[s]);
+    uint32_t params[1] = {SHOT_HANDLE};
+    Container response;
+    int count = std::max<uint64_t>(total / sizes[s], 2);
+
+    uint64_t begin = socc_monotonic_us();
+    for (int i = 0; i < count; i++) {
+      void *data = NULL;
+      uint32_t size = 0;
+      if (ptp->receive(0x1009, params, 1, response, &data, size) != SOCC_OK ||
+          size != sizes[s]) {
+        fprintf(stderr, "GetObject failed\n");
+        break;
+      }
+      ptp->dispose_data(&data);
+    }
+    char name[64];
+    snprintf(name, sizeof(name), "ptp.getobject.%u", sizes[s]);
+    report(name, (double)sizes[s] * count / (socc_monotonic_us() - begin), "MB/s",
+           true);
+    delete ptp;
+  }
+}
+
+static void bench_liveview() {
+  int frames = 100 * scale;
+  ports_usb_mock *usb;
+  socc_ptp *ptp = open_mock(&usb);
+  usb->set_liveview(200 * 1024, 1);
+
+  socc_liveview engine(ptp, NULL, 3);
+  LiveViewFrame *frame;
+  uint64_t sequence = 0;
+  engine.set_interval(0);
+  engine.start();
+  uint64_t begin = socc_monotonic_us();
+  for (int i = 0; i < frames; i++) {
+    if (engine.acquire(&frame, sequence, 1000) != SOCC_OK) {
+      fprintf(stderr, "acquire failed\n");
+      break;
+    }
+    sequence = frame->sequence;
+    engine.release(frame);
+  }
+  report("liveview.fps", frames * 1000000.0 / (socc_monotonic_us() - begin), "fps",
+         true);
+  engine.stop();
+  delete ptp;
+}
+
+static bool read_file(const char *path, std::vector<char> &buf) {
+  FILE *fp = fopen(path, "rb");
+  if (fp == NULL) {
+    fprintf(stderr, "cannot open %s: %s\n", path, strerror(errno));
+    return false;
+  }
+  char chunk[4096];
+  size_t n;
+  while ((n = fread(chunk, 1, sizeof(chunk), fp)) > 0) {
+    buf.insert(buf.end(), chunk, chunk + n);
+  }
+  fclose(fp);
+  return !buf.empty();
+}
+
+static void bench_dataset(const char *name, void *data) {
+  int count = 100 * scale;
+  SDIDevicePropInfoDatasetArray *info;
+
+  uint64_t begin = socc_monotonic_us();
+  for (int i = 0; i < count; i++) {
+    info = new SDIDevicePropInfoDatasetArray(data);
+    delete info;
+  }
+  report(std::string("parser.") + name + ".parse",
+         (double)(socc_monotonic_us() - begin) / count, "us", false);
+
+  std::string str;
+  info = new SDIDevicePropInfoDatasetArray(data);
+  begin = socc_monotonic_us();
+  for (int i = 0; i < count; i++) {
+    str.clear();
+    info->toString(str);
+  }
+  report(std::string("parser.") + name + ".tostring",
+         (double)(socc_monotonic_us() - begin) / count, "us", false);
+  delete info;
+}
+
+// "control getall --if=dir --format=json" on copies of a dump
+static void bench_offline(const void *data, uint32_t size) {
+  char dir[] = "/tmp/bench_offline.XXXXXX";
+  if (mkdtemp(dir) == NULL) {
+    return;
+  }
+  int count = 50 * scale;
+  std::vector<std::string> paths;
+  for (int i = 0; i < count; i++) {
+    char path[64];
+    snprintf(path, sizeof(path), "%s/%04d.dat", dir, i);
+    FILE *fp = fopen(path, "wb");
+    if (fp == NULL) {
+      break;
+    }
+    fwrite(data, 1, size, fp);
+    fclose(fp);
+    paths.push_back(path);
+  }
+
+  uint64_t begin = socc_monotonic_us();
+  offline_batch(dir, "/dev/null", 0, OFFLINE_FORMAT_JSON, 0);
+  report("offline.batch", paths.size() * 1000000.0 / (socc_monotonic_us() - begin),
+         "dumps/s", true);
+
+  for (size_t i = 0; i < paths.size(); i++) {
+    unlink(paths[i].c_str());
+  }
+  rmdir(dir);
+}
+
+static void append_bytes(std::vector<char> &buf, const void *p, size_t n) {
+  buf.insert(buf.end(), (const char *)p, (const char *)p + n);
+}
+
+// a dataset of UINT16 properties with 16 enumerated values and a string
+static void build_dataset(std::vector<char> &buf, uint16_t changed,
+                          const char *name) {
+  uint64_t num = 401;
+  append_bytes(buf, &num, sizeof(num));
+  for (uint16_t i = 0; i < 400; i++) {
+    uint16_t head[2] = {(uint16_t)(0xD000 + i), 0x0004};
+    uint8_t flags[2] = {1, 1};
+    uint16_t current = i == changed || i == changed + 7 ? i + 1 : i;
+    uint8_t form = 0x02;
+    uint16_t n = 16;
+    append_bytes(buf, head, sizeof(head));
+    append_bytes(buf, flags, sizeof(flags));
+    append_bytes(buf, &i, sizeof(i));
+    append_bytes(buf, &current, sizeof(current));
+    append_bytes(buf, &form, sizeof(form));
+    for (int list = 0; list < 2; list++) {
+      append_bytes(buf, &n, sizeof(n));
+      for (uint16_t v = 0; v < n; v++) {
+        append_bytes(buf, &v, sizeof(v));
+      }
+    }
+  }
+  uint16_t head[2] = {0xFFF0, 0xFFFF};
+  uint8_t flags[2] = {1, 1};
+  append_bytes(buf, head, sizeof(head));
+  append_bytes(buf, flags, sizeof(flags));
+  for (int value = 0; value < 2; value++) {
+    uint8_t len = strlen(name) + 1;
+    append_bytes(buf, &len, sizeof(len));
+    for (uint8_t c = 0; c < len; c++) {
+      uint16_t u = (uint8_t)name[c];
+      append_bytes(buf, &u, sizeof(u));
+    }
+  }
+  uint8_t form = 0;
+  append_bytes(buf, &form, sizeof(form));
+}
+
+static void bench_snapshot() {
+  int count = 1000 * scale;
+  std::vector<char> a, b, c;
+  build_dataset(a, 0, "ILME-FX30");
+  build_dataset(b, 200, "ILME-FX30");
+  build_dataset(c, 200, "ILCE-7SM3 ");  // the string is longer
+
+  socc_snapshot before, after, unaligned;
+  uint64_t begin = socc_monotonic_us();
+  for (int i = 0; i < count; i++) {
+    before.parse(&a[0], a.size());
+  }
+  report("snapshot.parse", (double)(socc_monotonic_us() - begin) / count, "us",
+         false);
+  after.parse(&b[0], b.size());
+  unaligned.parse(&c[0], c.size());
+
+  std::vector<SnapshotChange> changes;
+  begin = socc_monotonic_us();
+  for (int i = 0; i < count; i++) {
+    socc_snapshot::diff(before, after, changes);
+  }
+  report("snapshot.diff", (double)(socc_monotonic_us() - begin) / count, "us",
+         false);
+  begin = socc_monotonic_us();
+  for (int i = 0; i < count; i++) {
+    socc_snapshot::diff(before, unaligned, changes);
+  }
+  report("snapshot.diff.unaligned", (double)(socc_monotonic_us() - begin) / count,
+         "us", false);
+
+  // two getall outputs, compared line by line
+  int text_count = 10 * scale;
+  begin = socc_monotonic_us();
+  size_t differ = 0;
+  for (int i = 0; i < text_count; i++) {
+    std::string text[2];
+    SDIDevicePropInfoDatasetArray first(&a[0], a.size());
+    SDIDevicePropInfoDatasetArray second(&b[0], b.size());
+    first.toString(text[0]);
+    second.toString(text[1]);
+    size_t p = 0, q = 0;
+    while (p < text[0].size() && q < text[1].size()) {
+      size_t e = text[0].find('\n', p), f = text[1].find('\n', q);
+      differ += text[0].compare(p, e - p, text[1], q, f - q) != 0;
+      p = e + 1;
+      q = f + 1;
+    }
+  }
+  report("snapshot.diff.text", (double)(socc_monotonic_us() - begin) / text_count,
+         "us", false);
+}
+
+static void bench_parser(const std::vector<const char *> &datasets) {
+  ports_usb_mock *usb;
+  socc_ptp *ptp = open_mock(&usb);
+  Container response;
+  void *data = NULL;
+  uint32_t size = 0;
+  if (ptp->receive(0x9209, NULL, 0, response, &data, size) == SOCC_OK) {
+    bench_dataset("9209_mock", data);
+    bench_offline(data, size);
+    ptp->dispose_data(&data);
+  }
+
+  // socc_stats of the transactions above, as served by "control stats"
+  int count = 100 * scale;
+  std::string json;
+  uint64_t begin = socc_monotonic_us();
+  for (int i = 0; i < count; i++) {
+    json.clear();
+    ptp->stats()->to_json(json);
+  }
+  report("stats.to_json", (double)(socc_monotonic_us() - begin) / count, "us",
+         false);
+  delete ptp;
+
+  for (size_t i = 0; i < datasets.size(); i++) {
+    std::vector<char> buf;
+    if (read_file(datasets[i], buf)) {
+      const char *base = strrchr(datasets[i], '/');
+      bench_dataset(base != NULL ? base + 1 : datasets[i], &buf[0]);
+    }
+  }
+}
+
+static void bench_websocket() {
+  static const size_t sizes[] = {125, 4096, 65536, 1024 * 1024};
+  uint64_t total = (uint64_t)scale * 32 * 1024 * 1024;
+
+  for (size_t s = 0; s < sizeof(sizes) / sizeof(sizes[0]); s++) {
+    std::string message(sizes[s], 'x');
+    int count = std::max<uint64_t>(total / sizes[s], 16);
+    char name[64];
+
+    uint64_t begin = socc_monotonic_us();
+    size_t bytes = 0;
+    for (int i = 0; i < count; i++) {
+      bytes += WebSocketServer::encodeWebSocketFrame(message).size();
+    }
+    snprintf(name, sizeof(name), "websocket.encode.%zu", sizes[s]);
+    report(name, (double)bytes / (socc_monotonic_us() - begin), "MB/s", true);
+
+    // a masked frame as sent by a browser
+    std::vector<uint8_t> frame = WebSocketServer::encodeWebSocketFrame(message);
+    size_t header = frame.size() - message.size();
+    static const uint8_t mask[4] = {0x12, 0x34, 0x56, 0x78};
+    frame[1] |= 0x80;
+    frame.insert(frame.begin() + header, mask, mask + 4);
+    for (size_t i = 0; i < message.size(); i++) {
+      frame[header + 4 + i] ^= mask[i % 4];
+    }
+    begin = socc_monotonic_us();
+    bytes = 0;
+    for (int i = 0; i < count; i++) {
+      bytes += WebSocketServer::decodeWebSocketFrame(frame).size();
+    }
+    snprintf(name, sizeof(name), "websocket.decode.%zu", sizes[s]);
+    report(name, (double)bytes / (socc_monotonic_us() - begin), "MB/s", true);
+  }
+}
+
+static void bench_daemon() {
+  int count = 50 * scale;
+  char socket_name[32];
+  snprintf(socket_name, sizeof(socket_name), "c2sbench%d", getpid());
+
+  SocketServer *serverport = new SocketServer(socket_name);
+  pid_t pid = fork();
+  if (pid == 0) {
+    ports_usb_mock *usb = new ports_usb_mock();
+    usb->set_timing(latency_us, rate);
+    socc_ptp *ptp = new socc_ptp(usb);
+    server(ptp, serverport);
+    exit(0);
+  }
+  delete serverport;
+
+  char devnull[] = "/dev/null";
+  PTPTransaction transaction;
+  memset(&transaction, 0, sizeof(transaction));
+  transaction.code = 0x9202;
+  std::vector<uint64_t> latencies;
+
+  for (int i = 0; i < count; i++) {
+    uint64_t begin = socc_monotonic_us();
+    SocketClient *client_port = new SocketClient(socket_name);
+    if (!client_port->connect()) {
+      fprintf(stderr, "cannot connect server: %s\n", strerror(errno));
+      delete client_port;
+      break;
+    }
+    client(client_port, devnull, devnull, RECV, &transaction, 0, 0);
+    delete client_port;
+    latencies.push_back(socc_monotonic_us() - begin);
+  }
+
+  // the same transactions as the steps of a single batch
+  std::string script = "[{\"op\": \"loop\", \"count\": ";
+  script += std::to_string(count);
+  script += ", \"steps\": [{\"op\": \"recv\", \"code\": \"0x9202\"}]}]";
+  uint64_t batch_us = 0;
+  SocketClient *client_port = new SocketClient(socket_name);
+  if (client_port->connect()) {
+    uint64_t begin = socc_monotonic_us();
+    client(client_port, devnull, devnull, BATCH, &transaction, 0, 0,
+           script.c_str());
+    batch_us = socc_monotonic_us() - begin;
+  }
+  delete client_port;
+
+  // the batch sleeps on its own thread, not in the loop of the daemon
+  uint64_t during_batch_us = 0;
+  pid_t batch_pid = fork();
+  if (batch_pid == 0) {
+    client_port = new SocketClient(socket_name);
+    if (client_port->connect()) {
+      client(client_port, devnull, devnull, BATCH, &transaction, 0, 0,
+             "[{\"op\": \"sleep\", \"ms\": 1000}]");
+    }
+    exit(0);
+  }
+  struct timespec ts = {0, 200 * 1000000};
+  nanosleep(&ts, NULL);
+  client_port = new SocketClient(socket_name);
+  if (client_port->connect()) {
+    uint64_t begin = socc_monotonic_us();
+    client(client_port, devnull, devnull, RECV, &transaction, 0, 0);
+    during_batch_us = socc_monotonic_us() - begin;
+  }
+  delete client_port;
+  waitpid(batch_pid, NULL, 0);
+  kill(pid, SIGTERM);
+  waitpid(pid, NULL, 0);
+
+  if (!latencies.empty()) {
+    std::sort(latencies.begin(), latencies.end());
+    report("daemon.roundtrip.p50", latencies[latencies.size() / 2], "us",
+           false);
+    report("daemon.roundtrip.p99", latencies[latencies.size() * 99 / 100],
+           "us", false);
+  }
+  if (0 < batch_us) {
+    report("daemon.batch.step", (double)batch_us / count, "us", false);
+  }
+  if (0 < during_batch_us) {
+    report("daemon.roundtrip.batch", during_batch_us, "us", false);
+  }
+}
+
+// the log line of Command before the LogWriter
+static void log_sync(FILE *logout, const char *format, ...) {
+  struct timeval now;
+  gettimeofday(&now, NULL);
+  struct tm *time_st = localtime(&now.tv_sec);
+  fprintf(logout, "%02d:%02d:%02d.%06ld ", time_st->tm_hour, time_st->tm_min,
+          time_st->tm_sec, (long)now.tv_usec);
+  va_list ap;
+  va_start(ap, format);
+  vfprintf(logout, format, ap);
+  va_end(ap);
+  fflush(logout);
+}
+
+static void log_async(int fd, const char *format, ...) {
+  va_list ap;
+  va_start(ap, format);
+  LogWriter::instance()->vlog(fd, format, ap);
+  va_end(ap);
+}
+
+static void bench_log() {
+  int count = 100 * scale;
+  char path[64];
+  snprintf(path, sizeof(path), "/tmp/bench_log%d", getpid());
+  int fd = open(path, O_RDWR | O_CREAT | O_TRUNC | O_APPEND | O_SYNC, 0644);
+  if (fd < 0) {
+    fprintf(stderr, "cannot open %s: %s\n", path, strerror(errno));
+    return;
+  }
+  unlink(path);
+
+  FILE *logout = fdopen(dup(fd), "a");
+  uint64_t begin = socc_monotonic_us();
+  for (int i = 0; i < count; i++) {
+    log_sync(logout, "recv > code=0x%04X, n=%d, p1=0x%08X\n", 0x9202, 1, i);
+  }
+  report("log.line.sync", (double)(socc_monotonic_us() - begin) / count, "us",
+         false);
+  fclose(logout);
+
+  begin = socc_monotonic_us();
+  for (int i = 0; i < count; i++) {
+    log_async(fd, "recv > code=0x%04X, n=%d, p1=0x%08X\n", 0x9202, 1, i);
+  }
+  report("log.line.async", (double)(socc_monotonic_us() - begin) / count, "us",
+         false);
+  LogWriter::instance()->flush();
+
+  // the transactions of a Command logging two lines each, without the flush
+  // of its destructor
+  ports_usb_mock *usb;
+  socc_ptp *ptp = open_mock(&usb);
+  Command *command = new Command(fd, open("/dev/null", O_RDWR));
+  PTPTransaction transaction;
+  memset(&transaction, 0, sizeof(transaction));
+  transaction.code = 0x9202;
+  std::vector<uint64_t> latencies;
+  for (int i = 0; i < count; i++) {
+    begin = socc_monotonic_us();
+    command->recv(ptp, &transaction);
+    latencies.push_back(socc_monotonic_us() - begin);
+  }
+  delete command;
+  delete ptp;
+  std::sort(latencies.begin(), latencies.end());
+  report("log.transaction.p50", latencies[latencies.size() / 2], "us", false);
+}
+
+typedef struct reconnect_server_t {
+  socc_ptp *ptp;
+  SocketServer *serverport;
+} reconnect_server_t;
+
+static void *serve_reconnect(void *vp) {
+  reconnect_server_t *s = (reconnect_server_t *)vp;
+  server(s->ptp, s->serverport, true);
+  return NULL;
+}
+
+static bool request(const char *socket_name, int command,
+                    PTPTransaction *transaction) {
+  char devnull[] = "/dev/null";
+  SocketClient *client_port = new SocketClient((char *)socket_name);
+  if (!client_port->connect()) {
+    fprintf(stderr, "cannot connect server: %s\n", strerror(errno));
+    delete client_port;
+    return false;
+  }
+  client(client_port, devnull, devnull, command, transaction, 0, 0);
+  delete client_port;
+  return true;
+}
+
+static void bench_reconnect() {
+  int count = 2 * scale;
+  char socket_name[32];
+  snprintf(socket_name, sizeof(socket_name), "c2srecon%d", getpid());
+
+  // the server runs in this process to reach the cable of its mock
+  ports_usb_mock *usb = new ports_usb_mock();
+  usb->set_timing(latency_us, rate);
+  reconnect_server_t s = {new socc_ptp(usb), new SocketServer(socket_name)};
+  pthread_t thread;
+  pthread_create(&thread, NULL, serve_reconnect, &s);
+
+  PTPTransaction transaction;
+  memset(&transaction, 0, sizeof(transaction));
+  request(socket_name, OPEN, &transaction);
+  request(socket_name, AUTH, &transaction);
+  transaction.code = 0x9205;
+  transaction.params[0] = 0xD25A;  // Position Key Setting to the PC remote
+  transaction.nparam = 1;
+  transaction.data.send = 0x01;
+  transaction.size = 1;
+  request(socket_name, SEND, &transaction);
+
+  std::vector<uint64_t> latencies;
+  memset(&transaction, 0, sizeof(transaction));
+  transaction.code = 0x9202;
+  for (int i = 0; i < count; i++) {
+    usb->unplug();
+    uint64_t begin = socc_monotonic_us();
+    usb->replug();
+    if (!request(socket_name, RECV, &transaction)) {
+      break;
+    }
+    latencies.push_back(socc_monotonic_us() - begin);
+    if (usb->property(0xD25A) != 0x01) {
+      fprintf(stderr, "daemon.reconnect: the property is not restored\n");
+      break;
+    }
+  }
+
+  memset(&transaction, 0, sizeof(transaction));
+  request(socket_name, CLOSE, &transaction);
+  pthread_join(thread, NULL);
+  delete s.serverport;
+  delete s.ptp;
+
+  if (!latencies.empty()) {
+    std::sort(latencies.begin(), latencies.end());
+    report("daemon.reconnect.p50", latencies[latencies.size() / 2], "us",
+           false);
+  }
+}
+
+static void bench_auth() {
+  int count = 2 * scale;
+  std::vector<uint64_t> latencies;
+  uint32_t transactions = 0;
+  for (int i = 0; i < count; i++) {
+    ports_usb_mock *usb;
+    socc_ptp *ptp = open_mock(&usb);
+    usb->set_bringup(BRINGUP_VERSION_DELAY_US, BRINGUP_PROPERTIES_DELAY_US);
+    Container response;
+    uint32_t session = 1;
+    ptp->send(0x1002, &session, 1, response, NULL, 0);
+
+    socc_auth auth(ptp);
+    if (auth.run() != SOCC_OK) {
+      fprintf(stderr, "auth failed\n");
+      delete ptp;
+      break;
+    }
+    const AuthTiming &timing = auth.timing();
+    latencies.push_back(timing.total_us);
+    for (int s = 0; s < SOCC_AUTH_STEPS; s++) {
+      transactions += timing.polls[s];
+    }
+    delete ptp;
+  }
+
+  if (!latencies.empty()) {
+    std::sort(latencies.begin(), latencies.end());
+    report("auth.ready.p50", latencies[latencies.size() / 2], "us", false);
+    report("auth.transactions", (double)transactions / latencies.size(), "tx",
+           false);
+  }
+}
+
+static int write_json(const char *path, const char *label) {
+  FILE *fp = strcmp(path, "-") == 0 ? stdout : fopen(path, "w");
+  if (fp == NULL) {
+    fprintf(stderr, "cannot open %s: %s\n", path, strerror(errno));
+    return -1;
+  }
+  struct utsname host;
+  uname(&host);
+
+  fprintf(fp, "{\n");
+  fprintf(fp, "  \"suite\": \"libcameracontrolptp\",\n");
+  fprintf(fp, "  \"label\": \"%s\",\n", label);
+  fprintf(fp, "  \"time\": %ld,\n", (long)time(NULL));
+  fprintf(fp, "  \"host\": \"%s %s %s\",\n", host.nodename, host.sysname,
+          host.machine);
+  fprintf(fp, "  \"latency_us\": %u,\n", latency_us);
+  fprintf(fp, "  \"rate\": %u,\n", rate);
+  fprintf(fp, "  \"results\": [\n");
+  // one line per result, which --baseline reads back
+  for (size_t i = 0; i < results.size(); i++) {
+    fprintf(fp,
+            "    {\"name\": \"%s\", \"value\": %.3f, \"unit\": \"%s\", "
+            "\"better\": \"%s\"}%s\n",
+            results[i].name.c_str(), results[i].value, results[i].unit,
+            results[i].higher_is_better ? "higher" : "lower",
+            i + 1 < results.size() ? "," : "");
+  }
+  fprintf(fp, "  ]\n}\n");
+  if (fp != stdout) {
+    fclose(fp);
+  }
+  return 0;
+}
+
+static int compare(const char *path, double tolerance) {
+  FILE *fp = fopen(path, "r");
+  if (fp == NULL) {
+    fprintf(stderr, "cannot open %s: %s\n", path, strerror(errno));
+    return -1;
+  }
+  int regressions = 0;
+  char line[512];
+  while (fgets(line, sizeof(line), fp) != NULL) {
+    char name[128];
+    double base;
+    if (sscanf(line, " {\"name\": \"%127[^\"]\", \"value\": %lf", name,
+               &base) != 2) {
+      continue;
+    }
+    for (size_t i = 0; i < results.size(); i++) {
+      if (results[i].name != name || base <= 0) {
+        continue;
+      }
+      double change = (results[i].value - base) * 100 / base;
+      bool worse = results[i].higher_is_better ? change < -tolerance
+                                               : change > tolerance;
+      if (worse) {
+        fprintf(stderr, "regression %s: %.2f -> %.2f %s (%+.1f%%)\n", name,
+                base, results[i].value, results[i].unit, change);
+        regressions++;
+      }
+    }
+  }
+  fclose(fp);
+  return regressions;
+}
+
+static void usage() {
+  fprintf(stderr,
+          "usage: bench_suite [--json=path] [--label=text] [--baseline=path] "
+          "[--tolerance=percent] [--dataset=path]... [--latency=us] "
+          "[--rate=bytes/s] [--quick]\n");
+}
+
+int main(int argc, char **argv) {
+  const char *json = NULL;
+  const char *label = "";
+  const char *baseline = NULL;
+  double tolerance = 10;
+  std::vector<const char *> datasets;
+
+  static struct option loptions[] = {{"json", required_argument, 0, 'j'},
+                                     {"label", required_argument, 0, 'b'},
+                                     {"baseline", required_argument, 0, 'c'},
+                                     {"tolerance", required_argument, 0, 't'},
+                                     {"dataset", required_argument, 0, 'd'},
+                                     {"latency", required_argument, 0, 'l'},
+                                     {"rate", required_argument, 0, 'r'},
+                                     {"quick", no_argument, 0, 'q'},
+                                     {0, 0, 0, 0}};
+  int opt;
+  while ((opt = getopt_long(argc, argv, "j:b:c:t:d:l:r:q", loptions, NULL)) !=
+         -1) {
+    switch (opt) {
+      case 'j':
+        json = optarg;
+        break;
+      case 'b':
+        label = optarg;
+        break;
+      case 'c':
+        baseline = optarg;
+        break;
+      case 't':
+        tolerance = strtod(optarg, NULL);
+        break;
+      case 'd':
+        datasets.push_back(optarg);
+        break;
+      case 'l':
+        latency_us = strtoul(optarg, NULL, 0);
+        break;
+      case 'r':
+        rate = strtoul(optarg, NULL, 0);
+        break;
+      case 'q':
+        scale = 1;
+        break;
+      default:
+        usage();
+        return -1;
+    }
+  }
+
+  printf("latency %u us, rate %u bytes/s%s\n", latency_us, rate,
+         scale == 1 ? ", quick" : "");
+  bench_transactions();
+  bench_getobject();
+  bench_liveview();
+  bench_parser(datasets);
+  bench_websocket();
+  bench_daemon();
+  bench_log();
+  bench_snapshot();
+  bench_reconnect();
+  bench_auth();
+
+  if (json != NULL && write_json(json, label) != 0) {
+    return -1;
+  }
+  if (baseline != NULL) {
+    int regressions = compare(baseline, tolerance);
+    if (regressions != 0) {
+      return 1;
+    }
+  }
+  return 0;
+}
@@ -0,0 +1,181 @@
+/**
+ * @file bench_sync_trigger.cpp
+ * @brief Measures the skew of the cameras triggered together on the mock USB
+ * backend.
+ *
+ * The full press of the shutter button is sent right after the half press by
+ * each camera on its own, as socc_fleet::trigger() does, and by
+ * socc_fleet::trigger_sync(), where the cameras are released together. Both
+ * send the full press with prepare_send()/issue_prepared() and take its time
+ * when the request and the data have been written, so that only the barrier
+ * differs. Exits with 1 if the median skew of trigger_sync() is over the one
+ * of the cameras on their own, or its p99 skew is over the budget if given.
+ */
+
+#include <getopt.h>
+#include <ports_usb_mock.h>
+#include <socc_fleet.h>
+#include <socc_ptp.h>
+#include <socc_time.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include <algorithm>
+#include <vector>
+
+using namespace com::sony::imaging::remote;
+using com::sony::imaging::ports::ports_usb_mock;
+
+static int control(socc_ptp *ptp, uint16_t code, uint16_t value) {
+  uint32_t params[1] = {code};
+  Container response;
+  return ptp->send(0x9207, params, 1, response, &value, sizeof(value));
+}
+
+// the sequence of socc_fleet::trigger() with the time of the full press, taken
+// at the same point as trigger_sync() does
+static int unsync_trigger_camera(socc_ptp *ptp, int index, void *vp) {
+  std::vector<uint64_t> *issued = (std::vector<uint64_t> *)vp;
+  uint32_t params[1] = {0xD2C2};
+  uint16_t value = 0x0002;
+  PreparedTransaction prepared;
+  Container response;
+  control(ptp, 0xD2C1, 0x0002);
+  int ret = ptp->prepare_send(0x9207, params, 1, &value, sizeof(value),
+                              prepared);
+  if (ret == SOCC_OK) {
+    ret = ptp->issue_prepared(prepared);
+    (*issued)[index] = socc_monotonic_us();
+    if (ret == SOCC_OK) {
+      ret = ptp->complete_prepared(response);
+    }
+  }
+  control(ptp, 0xD2C2, 0x0001);
+  control(ptp, 0xD2C1, 0x0001);
+  return ret;
+}
+
+static uint32_t percentile(std::vector<uint32_t> &values, int p) {
+  if (values.empty()) {
+    return 0;
+  }
+  std::sort(values.begin(), values.end());
+  return values[(values.size() * p + 99) / 100 - 1];
+}
+
+static void report(const char *name, std::vector<uint32_t> &spreads) {
+  std::sort(spreads.begin(), spreads.end());
+  printf("%-22s : min %6u us, median %6u us, p99 %6u us, max %6u us\n", name,
+         spreads.empty() ? 0 : spreads.front(), percentile(spreads, 50),
+         percentile(spreads, 99), spreads.empty() ? 0 : spreads.back());
+}
+
+static bool open_fleet(socc_fleet &fleet, int cameras, uint32_t latency_us,
+                       uint32_t rate) {
+  std::vector<FleetResult> results;
+  for (int i = 0; i < cameras; i++) {
+    ports_usb_mock *usb = new ports_usb_mock();
+    usb->set_timing(latency_us, rate);
+    fleet.add(usb);
+  }
+  return fleet.open(results) == SOCC_OK && fleet.auth(results) == SOCC_OK;
+}
+
+static void usage() {
+  fprintf(stderr,
+          "usage: bench_sync_trigger [--cameras=N] [--triggers=N] "
+          "[--latency=us] [--rate=bytes/s] [--budget=us]\n");
+}
+
+int main(int argc, char **argv) {
+  int cameras = 16;
+  int triggers = 300;
+  uint32_t latency_us = 200;
+  uint32_t rate = 40 * 1000 * 1000;  // high speed USB in practice
+  uint32_t budget_us = 0;
+
+  static struct option loptions[] = {{"cameras", required_argument, 0, 'n'},
+                                     {"triggers", required_argument, 0, 't'},
+                                     {"latency", required_argument, 0, 'l'},
+                                     {"rate", required_argument, 0, 'r'},
+                                     {"budget", required_argument, 0, 'b'},
+                                     {0, 0, 0, 0}};
+  int opt;
+  while ((opt = getopt_long(argc, argv, "n:t:l:r:b:", loptions, NULL)) !=
+         -1) {
+    switch (opt) {
+      case 'n':
+        cameras = strtol(optarg, NULL, 0);
+        break;
+      case 't':
+        triggers = strtol(optarg, NULL, 0);
+        break;
+      case 'l':
+        latency_us = strtoul(optarg, NULL, 0);
+        break;
+      case 'r':
+        rate = strtoul(optarg, NULL, 0);
+        break;
+      case 'b':
+        budget_us = strtoul(optarg, NULL, 0);
+        break;
+      default:
+        usage();
+        return -1;
+    }
+  }
+
+  printf("%d cameras, %d triggers, latency %u us, rate %u bytes/s\n", cameras,
+         triggers, latency_us, rate);
+
+  socc_fleet fleet;
+  if (!open_fleet(fleet, cameras, latency_us, rate)) {
+    fprintf(stderr, "open failed\n");
+    return 1;
+  }
+
+  std::vector<uint32_t> spreads;
+  std::vector<FleetResult> results;
+  std::vector<uint64_t> issued(cameras);
+  for (int i = 0; i < triggers; i++) {
+    if (fleet.run(unsync_trigger_camera, &issued, results) != SOCC_OK) {
+      fprintf(stderr, "trigger failed\n");
+      return 1;
+    }
+    spreads.push_back(*std::max_element(issued.begin(), issued.end()) -
+                      *std::min_element(issued.begin(), issued.end()));
+  }
+  report("one after another", spreads);
+  uint32_t unsync_median = percentile(spreads, 50);
+
+  spreads.clear();
+  for (int i = 0; i < triggers; i++) {
+    FleetSkew skew;
+    if (fleet.trigger_sync(results, skew) != SOCC_OK ||
+        skew.cameras != (uint32_t)cameras) {
+      fprintf(stderr, "trigger_sync failed\n");
+      return 1;
+    }
+    spreads.push_back(skew.max_us);
+  }
+  uint32_t median = percentile(spreads, 50);
+  uint32_t p99 = percentile(spreads, 99);
+  report("trigger_sync", spreads);
+
+  fleet.close(results);
+
+  if (median > unsync_median) {
+    printf("FAIL: median skew %u us is over %u us without the barrier\n",
+           median, unsync_median);
+    return 1;
+  }
+  if (budget_us > 0 && p99 > budget_us) {
+    printf("FAIL: p99 skew %u us is over the budget %u us\n", p99, budget_us);
+    return 1;
+  }
+  printf("OK: median skew %u us, %u us without the barrier\n", median,
+         unsync_median);
+  return 0;
+}
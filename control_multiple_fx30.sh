@@ -55,6 +55,10 @@ if [ $# -eq 0 ]; then
     echo "Control all cameras simultaneously:"
     echo "  $0 openall       # Open all FX30 cameras"
     echo "  $0 authall       # Authenticate all FX30 cameras"
+    echo
+    echo "Control all cameras in parallel from one process:"
+    echo "  $0 fleet open,auth,trigger,download,close"
+    echo "  $0 fleet open,auth,sync,close   # Fire the shutters together"
     exit 1
 fi
 
@@ -134,6 +138,15 @@ case $1 in
         done
         ;;
     
+    "fleet")
+        if [ -z "$2" ]; then
+            echo "Error: Operations required. Usage: $0 fleet <op[,op...]>"
+            exit 1
+        fi
+        echo "Running $2 on all FX30 cameras in parallel..."
+        ./out/bin/control fleet $2 --fx30
+        ;;
+    
     *)
         echo "Unknown command: $1"
         echo "Run '$0' without arguments to see usage examples."
@@ -0,0 +1,468 @@
+#include "batch.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "serverclient.h"
+#include "socc_types.h"
+
+using namespace com::sony::imaging::remote;
+
+#define JSON_MAX_DEPTH 16
+
+// a value of the JSON of a script
+typedef struct json_t {
+  enum { NUL, BOOLEAN, NUMBER, STRING, ARRAY, OBJECT } type;
+  bool boolean;
+  double number;
+  std::string string;
+  std::vector<json_t> items;
+  std::vector<std::pair<std::string, json_t> > members;
+} json_t;
+
+static const struct {
+  const char *name;
+  int command;
+} ops[] = {
+    {"send", SEND},           {"recv", RECV},         {"wait", WAIT},
+    {"open", OPEN},           {"close", CLOSE},       {"auth", AUTH},
+    {"get", GET},             {"getall", GETALL},     {"getobject", GETOBJECT},
+    {"await", BATCH_AWAIT},   {"sleep", BATCH_SLEEP}, {"loop", BATCH_LOOP},
+};
+
+static void skip_space(const char **p) {
+  while (' ' == **p || '\t' == **p || '\n' == **p || '\r' == **p) {
+    (*p)++;
+  }
+}
+
+static bool fail(std::string &error, const char *p, const char *what) {
+  char buf[80];
+  snprintf(buf, sizeof(buf), "%s at \"%.16s\"", what, p);
+  error = buf;
+  return false;
+}
+
+static bool parse_value(const char **p, json_t &v, std::string &error,
+                        int depth);
+
+static bool parse_string(const char **p, std::string &s, std::string &error) {
+  if ('"' != **p) {
+    return fail(error, *p, "a string is expected");
+  }
+  (*p)++;
+  s.clear();
+  while ('"' != **p) {
+    char c = **p;
+    if ('\0' == c) {
+      return fail(error, *p, "the string is not terminated");
+    }
+    (*p)++;
+    if ('\\' == c) {
+      c = **p;
+      (*p)++;
+      switch (c) {
+        case 'n':
+          c = '\n';
+          break;
+        case 't':
+          c = '\t';
+          break;
+        case 'r':
+          c = '\r';
+          break;
+        case 'b':
+          c = '\b';
+          break;
+        case 'f':
+          c = '\f';
+          break;
+        case 'u': {
+          // only ASCII is meaningful to the camera
+          char hex[5] = {0};
+          for (int i = 0; i < 4 && '\0' != **p; i++) {
+            hex[i] = *(*p)++;
+          }
+          unsigned long code = strtoul(hex, NULL, 16);
+          c = code < 0x80 ? (char)code : '?';
+          break;
+        }
+        case '"':
+        case '\\':
+        case '/':
+          break;
+        default:
+          return fail(error, *p - 2, "unknown escape");
+      }
+    }
+    s.push_back(c);
+  }
+  (*p)++;
+  return true;
+}
+
+static bool parse_value(const char **p, json_t &v, std::string &error,
+                        int depth) {
+  if (JSON_MAX_DEPTH < depth) {
+    return fail(error, *p, "too deep");
+  }
+  skip_space(p);
+  v.type = json_t::NUL;
+  if ('{' == **p) {
+    v.type = json_t::OBJECT;
+    (*p)++;
+    skip_space(p);
+    if ('}' == **p) {
+      (*p)++;
+      return true;
+    }
+    while (1) {
+      std::pair<std::string, json_t> member;
+      skip_space(p);
+      if (!parse_string(p, member.first, error)) {
+        return false;
+      }
+      skip_space(p);
+      if (':' != **p) {
+        return fail(error, *p, "':' is expected");
+      }
+      (*p)++;
+      if (!parse_value(p, member.second, error, depth + 1)) {
+        return false;
+      }
+      v.members.push_back(member);
+      skip_space(p);
+      if ('}' == **p) {
+        (*p)++;
+        return true;
+      }
+      if (',' != **p) {
+        return fail(error, *p, "',' or '}' is expected");
+      }
+      (*p)++;
+    }
+  } else if ('[' == **p) {
+    v.type = json_t::ARRAY;
+    (*p)++;
+    skip_space(p);
+    if (']' == **p) {
+      (*p)++;
+      return true;
+    }
+    while (1) {
+      json_t item;
+      if (!parse_value(p, item, error, depth + 1)) {
+        return false;
+      }
+      v.items.push_back(item);
+      skip_space(p);
+      if (']' == **p) {
+        (*p)++;
+        return true;
+      }
+      if (',' != **p) {
+        return fail(error, *p, "',' or ']' is expected");
+      }
+      (*p)++;
+    }
+  } else if ('"' == **p) {
+    v.type = json_t::STRING;
+    return parse_string(p, v.string, error);
+  } else if (0 == strncmp(*p, "true", 4) || 0 == strncmp(*p, "false", 5)) {
+    v.type = json_t::BOOLEAN;
+    v.boolean = 't' == **p;
+    *p += v.boolean ? 4 : 5;
+    return true;
+  } else if (0 == strncmp(*p, "null", 4)) {
+    *p += 4;
+    return true;
+  } else {
+    char *end;
+    v.type = json_t::NUMBER;
+    v.number = strtod(*p, &end);
+    if (end == *p) {
+      return fail(error, *p, "a value is expected");
+    }
+    *p = end;
+    return true;
+  }
+}
+
+static const json_t *member(const json_t &object, const char *name) {
+  for (size_t i = 0; i < object.members.size(); i++) {
+    if (object.members[i].first == name) {
+      return &object.members[i].second;
+    }
+  }
+  return NULL;
+}
+
+// a number, or a string like "0xD25A"
+static bool to_number(const json_t *v, uint64_t &value) {
+  if (NULL == v) {
+    return false;
+  }
+  if (json_t::NUMBER == v->type) {
+    value = (uint64_t)(int64_t)v->number;
+    return true;
+  }
+  if (json_t::STRING == v->type && !v->string.empty()) {
+    char *end;
+    value = strtoull(v->string.c_str(), &end, 0);
+    return '\0' == *end;
+  }
+  return false;
+}
+
+static bool get_number(const json_t &object, const char *name, uint64_t &value,
+                       uint64_t default_value, bool required,
+                       std::string &error) {
+  const json_t *v = member(object, name);
+  if (NULL == v) {
+    value = default_value;
+    if (required) {
+      error = std::string("\"") + name + "\" is required";
+    }
+    return !required;
+  }
+  if (!to_number(v, value)) {
+    error = std::string("\"") + name + "\" is not a number";
+    return false;
+  }
+  return true;
+}
+
+static bool get_path(const json_t &object, const char *name, const char *dir,
+                     char *path, std::string &error) {
+  const json_t *v = member(object, name);
+  path[0] = '\0';
+  if (NULL == v) {
+    return true;
+  }
+  if (json_t::STRING != v->type) {
+    error = std::string("\"") + name + "\" is not a string";
+    return false;
+  }
+  int len;
+  if ('/' == v->string[0] || "-" == v->string || NULL == dir || '\0' == *dir) {
+    len = snprintf(path, FILENAME_MAX_LEN, "%s", v->string.c_str());
+  } else {
+    len = snprintf(path, FILENAME_MAX_LEN, "%s/%s", dir, v->string.c_str());
+  }
+  if (FILENAME_MAX_LEN <= len) {
+    error = "the path(" + v->string + ") is too long";
+    return false;
+  }
+  return true;
+}
+
+static bool to_steps(const json_t &array, const char *dir,
+                     std::vector<BatchStep> &steps, std::string &error,
+                     int depth);
+
+static bool to_step(const json_t &object, const char *dir, BatchStep &step,
+                    std::string &error, int depth) {
+  const json_t *op = member(object, "op");
+  if (json_t::OBJECT != object.type || NULL == op ||
+      json_t::STRING != op->type) {
+    error = "a step needs \"op\"";
+    return false;
+  }
+  step.command = 0;
+  for (size_t i = 0; i < sizeof(ops) / sizeof(ops[0]); i++) {
+    if (op->string == ops[i].name) {
+      step.command = ops[i].command;
+    }
+  }
+  memset(&step.transaction, 0, sizeof(step.transaction));
+  step.device_property_code = 0;
+  step.handle = 0;
+  step.field = BATCH_FIELD_CURRENT;
+  step.value = 0;
+  step.mask = ~(uint64_t)0;
+  step.interval_ms = 0;
+  step.timeout_ms = 0;
+  step.sleep_ms = 0;
+  step.count = 0;
+  if (!get_path(object, "of", dir, step.of, error)) {
+    return false;
+  }
+
+  uint64_t n;
+  switch (step.command) {
+    case SEND:
+    case RECV: {
+      PTPTransaction &t = step.transaction;
+      if (!get_number(object, "code", n, 0, true, error)) {
+        return false;
+      }
+      t.code = n;
+      const json_t *params = member(object, "params");
+      if (NULL != params) {
+        if (json_t::ARRAY != params->type || 5 < params->items.size()) {
+          error = "\"params\" must be an array of 5 numbers at most";
+          return false;
+        }
+        for (size_t i = 0; i < params->items.size(); i++) {
+          if (!to_number(&params->items[i], n)) {
+            error = "\"params\" must be an array of 5 numbers at most";
+            return false;
+          }
+          t.params[i] = n;
+        }
+        t.nparam = params->items.size();
+      }
+      if (RECV == step.command) {
+        break;
+      }
+      const json_t *data = member(object, "data");
+      if (NULL != member(object, "file")) {
+        if (!get_path(object, "file", dir, t.data.file, error)) {
+          return false;
+        }
+        t.size = PTPTransaction::DATA_IS_FILE;
+      } else if (NULL != data && json_t::STRING == data->type &&
+                 !to_number(data, n)) {
+        snprintf(t.data.string, sizeof(t.data.string), "%s",
+                 data->string.c_str());
+        t.size = PTPTransaction::DATA_IS_STRING;
+      } else if (NULL != data) {
+        uint64_t size;
+        if (!to_number(data, n)) {
+          error = "\"data\" is not a number";
+          return false;
+        }
+        if (!get_number(object, "size", size, 0, true, error)) {
+          return false;
+        }
+        if (sizeof(t.data.send) < size) {
+          error = "\"size\" of a number is 4 at most";
+          return false;
+        }
+        t.data.send = n;
+        t.size = size;
+      }
+      break;
+    }
+    case GET:
+    case BATCH_AWAIT: {
+      if (!get_number(object, "property", n, 0, true, error)) {
+        return false;
+      }
+      step.device_property_code = n;
+      if (GET == step.command) {
+        break;
+      }
+      const json_t *field = member(object, "field");
+      if (NULL != field) {
+        if (json_t::STRING == field->type && "enable" == field->string) {
+          step.field = BATCH_FIELD_ENABLE;
+        } else if (json_t::STRING != field->type ||
+                   "current" != field->string) {
+          error = "\"field\" is \"current\" or \"enable\"";
+          return false;
+        }
+      }
+      if (!get_number(object, "value", step.value, 0, true, error) ||
+          !get_number(object, "mask", step.mask, ~(uint64_t)0, false,
+                      error) ||
+          !get_number(object, "interval_ms", n, 100, false, error)) {
+        return false;
+      }
+      step.interval_ms = n;
+      if (!get_number(object, "timeout_ms", n, 10000, false, error)) {
+        return false;
+      }
+      step.timeout_ms = n;
+      break;
+    }
+    case GETOBJECT:
+      if (!get_number(object, "handle", n, 0, true, error)) {
+        return false;
+      }
+      step.handle = n;
+      break;
+    case BATCH_SLEEP:
+      if (!get_number(object, "ms", n, 0, true, error)) {
+        return false;
+      }
+      step.sleep_ms = n;
+      break;
+    case BATCH_LOOP: {
+      const json_t *steps = member(object, "steps");
+      if (!get_number(object, "count", n, 0, true, error)) {
+        return false;
+      }
+      step.count = n;
+      if (NULL == steps || json_t::ARRAY != steps->type) {
+        error = "\"loop\" needs \"steps\"";
+        return false;
+      }
+      return to_steps(*steps, dir, step.steps, error, depth + 1);
+    }
+    case WAIT:
+    case OPEN:
+    case CLOSE:
+    case AUTH:
+    case GETALL:
+      break;
+    default:
+      error = "unknown op \"" + op->string + "\"";
+      return false;
+  }
+  return true;
+}
+
+static bool to_steps(const json_t &array, const char *dir,
+                     std::vector<BatchStep> &steps, std::string &error,
+                     int depth) {
+  if (JSON_MAX_DEPTH < depth) {
+    error = "the loops are too deep";
+    return false;
+  }
+  steps.resize(array.items.size());
+  for (size_t i = 0; i < array.items.size(); i++) {
+    if (!to_step(array.items[i], dir, steps[i], error, depth)) {
+      char index[32];
+      snprintf(index, sizeof(index), "step %zu: ", i + 1);
+      error = index + error;
+      return false;
+    }
+  }
+  return true;
+}
+
+int com::sony::imaging::remote::batch_parse(const char *script,
+                                            const char *dir,
+                                            std::vector<BatchStep> &steps,
+                                            std::string &error) {
+  json_t root;
+  const char *p = script;
+  if (!parse_value(&p, root, error, 0)) {
+    return SOCC_ERROR_INVALID_PARAMETER;
+  }
+  skip_space(&p);
+  if ('\0' != *p) {
+    fail(error, p, "the end is expected");
+    return SOCC_ERROR_INVALID_PARAMETER;
+  }
+  if (json_t::ARRAY != root.type) {
+    error = "the script must be an array of steps";
+    return SOCC_ERROR_INVALID_PARAMETER;
+  }
+  steps.clear();
+  if (!to_steps(root, dir, steps, error, 0)) {
+    return SOCC_ERROR_INVALID_PARAMETER;
+  }
+  return SOCC_OK;
+}
+
+const char *com::sony::imaging::remote::batch_op_name(int command) {
+  for (size_t i = 0; i < sizeof(ops) / sizeof(ops[0]); i++) {
+    if (command == ops[i].command) {
+      return ops[i].name;
+    }
+  }
+  return "unknown";
+}
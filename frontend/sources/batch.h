@@ -0,0 +1,91 @@
+/**
+ * @file batch.h
+ * @brief Header file of the batch script.
+ */
+
+#ifndef __BATCH_H__
+#define __BATCH_H__
+
+#include <stdint.h>
+
+#include <string>
+#include <vector>
+
+#include "command.h"
+
+// the steps of a batch which are not commands of serverclient.h
+#define BATCH_AWAIT 101
+#define BATCH_SLEEP 102
+#define BATCH_LOOP 103
+
+// the fields of a property compared by BATCH_AWAIT
+#define BATCH_FIELD_CURRENT 0
+#define BATCH_FIELD_ENABLE 1
+
+#define BATCH_SCRIPT_MAX_LEN (64 * 1024)
+
+namespace com {
+namespace sony {
+namespace imaging {
+namespace remote {
+
+/**
+ * @brief a step of a batch script
+ */
+typedef struct BatchStep {
+  int command;  //!< SEND, RECV, WAIT, OPEN, CLOSE, AUTH, GET, GETALL,
+                //!< GETOBJECT, BATCH_AWAIT, BATCH_SLEEP or BATCH_LOOP
+  PTPTransaction transaction;     //!< send and recv
+  uint16_t device_property_code;  //!< get and await
+  uint32_t handle;                //!< getobject
+  char of[FILENAME_MAX_LEN];      //!< the output, empty for the one of batch
+  int field;                      //!< await: BATCH_FIELD_CURRENT or ENABLE
+  uint64_t value;                 //!< await: the value of the masked field
+  uint64_t mask;                  //!< await
+  uint32_t interval_ms;           //!< await: between the polls
+  uint32_t timeout_ms;            //!< await
+  uint32_t sleep_ms;              //!< sleep
+  uint32_t count;                 //!< loop: the repetitions of steps
+  std::vector<BatchStep> steps;   //!< loop
+} BatchStep;
+
+/**
+ * @brief parses a batch script
+ *
+ * The script is a JSON array of steps, each an object whose "op" is one of
+ * - send: "code", "params" [p1, ...], and "data" with "size" in byte. A
+ *   string "data" is sent as a string, and "file" sends a file.
+ * - recv: "code", "params", "of"
+ * - get: "property", "of"
+ * - getall: "of"
+ * - await: polls "property" every "interval_ms" (100) until its "field",
+ *   "current" (default) or "enable", masked with "mask" equals "value", or
+ *   fails after "timeout_ms" (10000)
+ * - wait: waits for an event
+ * - getobject: "handle", "of"
+ * - sleep: "ms"
+ * - loop: runs "steps" "count" times
+ * - open, close, auth
+ *
+ * The numbers may be written as strings like "0xD25A". The relative paths of
+ * "of" and "file" are resolved from dir.
+ * @param [in]script the script
+ * @param [in]dir the directory of the relative paths
+ * @param [out]steps the steps
+ * @param [out]error the reason of a failure
+ * @return 0 on success, SOCC_ERROR_INVALID_PARAMETER on failure
+ */
+int batch_parse(const char *script, const char *dir,
+                std::vector<BatchStep> &steps, std::string &error);
+
+/**
+ * @brief the name of the op of a step
+ */
+const char *batch_op_name(int command);
+
+}  // namespace remote
+}  // namespace imaging
+}  // namespace sony
+}  // namespace com
+
+#endif  // __BATCH_H__
@@ -5,8 +5,17 @@
 #include <string.h>
 #include <sys/time.h>
 
+#include "batch.h"
+#include "journal.h"
+#include "log_writer.h"
 #include "parser.h"
+#include "serverclient.h"
+#include "socc_auth.h"
+#include "socc_capture.h"
 #include "socc_ptp.h"
+#include "socc_snapshot.h"
+#include "socc_stats.h"
+#include "socc_trace.h"
 #include "socc_types.h"
 
 // for stat
@@ -27,19 +36,42 @@
 
 using namespace com::sony::imaging::remote;
 
-static struct timeval _time;
-static struct tm *time_st;
-
 inline void Command::log(const char *format, ...) {
-  gettimeofday(&_time, NULL);
-  time_st = localtime(&_time.tv_sec);
-  fprintf(logout, "%02d:%02d:%02d.%06ld ", time_st->tm_hour, time_st->tm_min,
-          time_st->tm_sec, _time.tv_usec);
   va_list ap;
   va_start(ap, format);
-  vfprintf(logout, format, ap);
+  LogWriter::instance()->vlog(fileno(logout), format, ap);
   va_end(ap);
-  fflush(logout);
+}
+
+static long elapsed_us(const struct timeval &begin) {
+  struct timeval end;
+  gettimeofday(&end, NULL);
+  return (end.tv_sec - begin.tv_sec) * 1000000L + (end.tv_usec - begin.tv_usec);
+}
+
+// a transaction begun at begin, to the journal of SOCC_JOURNAL if any
+static void journal(Journal *j, uint8_t direction, const PTPTransaction *t,
+                    int ret, const Container &res, const void *data,
+                    uint32_t size, const struct timeval &begin) {
+  if (NULL == j) {
+    return;
+  }
+  JournalRecord record;
+  memset(&record, 0, sizeof(record));
+  record.time_us = (uint64_t)begin.tv_sec * 1000000 + begin.tv_usec;
+  record.latency_us = elapsed_us(begin);
+  record.ret = ret;
+  record.code = t->code;
+  record.response_code = res.code;
+  record.direction = direction;
+  record.nparam = t->nparam;
+  memcpy(record.params, t->params, sizeof(record.params));
+  record.size = size;
+  if (NULL != data) {
+    memcpy(record.data, data,
+           size < JOURNAL_DATA_LEN ? size : JOURNAL_DATA_LEN);
+  }
+  j->append(record);
 }
 
 static void write(void *data, size_t size, FILE *target) {
@@ -54,6 +86,7 @@ static void write(void *data, size_t size, FILE *target) {
 }
 
 Command::Command(char *log, char *out) {
+  memset(&auth_timing_, 0, sizeof(auth_timing_));
   logout = stdout;
   setLogfile(log);
   outfile = stdout;
@@ -61,6 +94,7 @@ Command::Command(char *log, char *out) {
 }
 
 Command::Command(int logfd, int outfd) {
+  memset(&auth_timing_, 0, sizeof(auth_timing_));
   logout = fdopen(logfd, "r+");
   outfile = fdopen(outfd, "r+");
 }
@@ -69,12 +103,15 @@ Command::~Command() {
   if (stdout != outfile) {
     fclose(outfile);
   }
+  // the lines must be written before the descriptor is closed and reused
+  LogWriter::instance()->flush_all();
   if (stdout != logout) {
     fclose(logout);
   }
 }
 
 void Command::setLogfile(char *filename) {
+  LogWriter::instance()->flush_all();
   if (stdout != logout) {
     fclose(logout);
   }
@@ -98,6 +135,8 @@ int Command::_send(com::sony::imaging::remote::socc_ptp *ptp,
                    PTPTransaction *t) {
   com::sony::imaging::remote::Container res;
   int ret;
+  Journal *j = Journal::instance();
+  struct timeval begin;
   if (com::sony::imaging::remote::PTPTransaction::DATA_IS_STRING == t->size) {
     // string
     uint8_t string_length = strnlen(t->data.string, PTP_MAXSTRLEN) + 1;
@@ -117,7 +156,9 @@ int Command::_send(com::sony::imaging::remote::socc_ptp *ptp,
         "p5=0x%08X, data=\"%s\", size=%d\n",
         t->code, t->nparam, t->params[0], t->params[1], t->params[2],
         t->params[3], t->params[4], t->data.string, send_size);
+    gettimeofday(&begin, NULL);
     ret = ptp->send(t->code, t->params, t->nparam, res, send_data, send_size);
+    journal(j, JOURNAL_SEND, t, ret, res, send_data, send_size, begin);
     log("send < ret=%d, session=%d, transaction=%d, code=0x%04X, n=%d, "
         "p1=0x%08X, p2=0x%08X, p3=0x%08X, p4=0x%08X, p5=0x%08X\n",
         ret, res.session_id, res.transaction_id, res.code, res.nparam,
@@ -165,8 +206,10 @@ int Command::_send(com::sony::imaging::remote::socc_ptp *ptp,
             "p4=0x%08X, p5=0x%08X, file=\"%s\", size=%ld\n",
             t->code, t->nparam, t->params[0], t->params[1], t->params[2],
             t->params[3], t->params[4], t->data.file, file_stat.st_size);
+        gettimeofday(&begin, NULL);
         ret = ptp->send(t->code, t->params, t->nparam, res, buf,
                         file_stat.st_size);
+        journal(j, JOURNAL_SEND, t, ret, res, buf, file_stat.st_size, begin);
         log("send < ret=%d, session=%d, transaction=%d, code=0x%04X, n=%d, "
             "p1=0x%08X, p2=0x%08X, p3=0x%08X, p4=0x%08X, p5=0x%08X\n",
             ret, res.session_id, res.transaction_id, res.code, res.nparam,
@@ -199,7 +242,9 @@ int Command::_send(com::sony::imaging::remote::socc_ptp *ptp,
         t->code, t->nparam, t->params[0], t->params[1], t->params[2],
         t->params[3], t->params[4], t->size * 2, t->data.send, t->size);
 
+    gettimeofday(&begin, NULL);
     ret = ptp->send(t->code, t->params, t->nparam, res, &t->data.send, t->size);
+    journal(j, JOURNAL_SEND, t, ret, res, &t->data.send, t->size, begin);
     log("send < ret=%d, session=%d, transaction=%d, code=0x%04X, n=%d, "
         "p1=0x%08X, p2=0x%08X, p3=0x%08X, p4=0x%08X, p5=0x%08X\n",
         ret, res.session_id, res.transaction_id, res.code, res.nparam,
@@ -220,8 +265,12 @@ int Command::_recv(com::sony::imaging::remote::socc_ptp *ptp,
       "p5=0x%08X\n",
       t->code, t->nparam, t->params[0], t->params[1], t->params[2],
       t->params[3], t->params[4]);
+  Journal *j = Journal::instance();
+  struct timeval begin;
+  gettimeofday(&begin, NULL);
   ret =
       ptp->receive(t->code, t->params, t->nparam, res, &t->data.recv, t->size);
+  journal(j, JOURNAL_RECV, t, ret, res, t->data.recv, t->size, begin);
 
   char buf[16];
 
@@ -270,10 +319,15 @@ int Command::recv(com::sony::imaging::remote::socc_ptp *ptp,
 }
 
 int Command::wait(com::sony::imaging::remote::socc_ptp *ptp) {
-  int ret;
   com::sony::imaging::remote::Container res;
-  log("wait >\n");
-  ret = ptp->wait_event(res);
+  wait_begin();
+  return wait_end(ptp->wait_event(res), res);
+}
+
+void Command::wait_begin() { log("wait >\n"); }
+
+int Command::wait_end(int ret,
+                      const com::sony::imaging::remote::Container &res) {
   log("wait < ret=%d, session=%d, transaction=%d, code=0x%04X, n=%d, "
       "p1=0x%08X, p2=0x%08X, p3=0x%08X, p4=0x%08X, p5=0x%08X\n",
       ret, res.session_id, res.transaction_id, res.code, res.nparam, res.param1,
@@ -323,67 +377,37 @@ int Command::close(com::sony::imaging::remote::socc_ptp *ptp) {
 }
 
 int Command::auth(com::sony::imaging::remote::socc_ptp *ptp) {
-  int ret;
-  uint16_t version = 0;
-
-  PTPTransaction transaction = {
-      0x9201,  // .code
-      {        // .params
-       1, 0x00000000, 0x00000000, 0, 0},
-      3,    // .nparam
-      {0},  // .data
-      0,    // .size
-  };
-  ret = _recv(ptp, &transaction);
-  ptp->dispose_data(&transaction.data.recv);
-  if (SOCC_OK != ret) goto bail;
-
-  transaction = PTPTransaction{
-      0x9201,  // .code
-      {        // .params
-       2, 0x00000000, 0x00000000, 0, 0},
-      3,    // .nparam
-      {0},  // .data
-      0,    // .size
-  };
-  ret = _recv(ptp, &transaction);
-  ptp->dispose_data(&transaction.data.recv);
-  if (SOCC_OK != ret) goto bail;
-
-  do {
-    transaction = PTPTransaction{
-        0x9202,                // .code
-        {                      // .params
-         0x012C, 0, 0, 0, 0},  // 0x00C8/0x012C
-        1,                     // .nparam
-        {0},                   // .data
-        0,                     // .size
-    };
-    ret = _recv(ptp, &transaction);
-    if (0 != transaction.size) {
-      version = *(uint16_t *)transaction.data.recv;
-    }
-    ptp->dispose_data(&transaction.data.recv);
-    if (SOCC_OK != ret) goto bail;
-
-  } while (0x012C != version);  // 0x00C8/0x012C
+  const char *cache = getenv(SOCC_AUTH_CACHE_ENV);
+  if (NULL != cache) {
+    socc_auth::load_cache(cache);
+  }
 
-  transaction = PTPTransaction{
-      0x9201,  // .code
-      {        // .params
-       3, 0x00000000, 0x00000000, 0, 0},
-      3,    // .nparam
-      {0},  // .data
-      0,    // .size
-  };
-  ret = _recv(ptp, &transaction);
-  ptp->dispose_data(&transaction.data.recv);
-  if (SOCC_OK != ret) goto bail;
+  socc_auth auth(ptp);
+  int ret = auth.run();
+  const AuthTiming &timing = auth.timing();
+  for (int i = SOCC_AUTH_CONNECT_1; i < (int)auth.current(); i++) {
+    log("auth: %-10s %8llu us, %u transactions\n",
+        socc_auth::step_name((socc_auth_step_t)i),
+        (unsigned long long)timing.step_us[i], timing.polls[i]);
+  }
+  if (SOCC_OK != ret) {
+    log("auth: failed at %s (%d)\n", socc_auth::step_name(auth.current()),
+        ret);
+    return ret;
+  }
+  log("auth: ready in %llu us, version 0x%04X%s\n",
+      (unsigned long long)timing.total_us, timing.version,
+      timing.cached ? " (cached)" : "");
+  auth_timing_ = timing;
 
-bail:
+  if (NULL != cache) {
+    socc_auth::save_cache(cache);
+  }
   return ret;
 }
 
+const AuthTiming &Command::auth_timing() { return auth_timing_; }
+
 int Command::getall(com::sony::imaging::remote::socc_ptp *ptp) {
   int ret;
   std::string str;
@@ -456,6 +480,330 @@ bail:
   return ret;
 }
 
+int Command::burst(com::sony::imaging::remote::socc_ptp *ptp, uint32_t count,
+                   const char *path_format) {
+  int ret = SOCC_OK;
+  CaptureStats stats;
+  socc_capture capture(ptp);
+
+  ret = capture.start(path_format);
+  if (SOCC_OK != ret) {
+    log("cannot start the capture: %d\n", ret);
+    return ret;
+  }
+  for (uint32_t i = 0; i < count; i++) {
+    ret = capture.trigger();
+    if (SOCC_OK != ret) {
+      log("trigger %u failed: %d\n", i + 1, ret);
+      break;
+    }
+    capture.get_stats(stats);
+    log("trigger %u, depth %u\n", i + 1, stats.depth);
+  }
+  if (SOCC_OK != capture.wait_idle(10000)) {
+    log("timeout waiting for the captures\n");
+  }
+  capture.get_stats(stats);
+  capture.stop();
+
+  fprintf(outfile,
+          "triggered: %llu\n"
+          "downloaded: %llu\n"
+          "errors: %llu\n"
+          "bytes: %llu\n"
+          "shots/sec: %.2f\n"
+          "max depth: %u\n"
+          "trigger avg: %u us\n"
+          "download avg: %u us\n",
+          (unsigned long long)stats.triggered,
+          (unsigned long long)stats.downloaded,
+          (unsigned long long)stats.errors, (unsigned long long)stats.bytes,
+          stats.shots_per_sec, stats.max_depth, stats.trigger_us_avg,
+          stats.download_us_avg);
+  return ret;
+}
+
+int Command::fleet(com::sony::imaging::remote::socc_fleet *fleet,
+                   const char *ops, PTPTransaction *t) {
+  int ret = SOCC_OK;
+  char buf[FILENAME_MAX_LEN];
+  char *saveptr = NULL;
+  std::vector<FleetResult> results;
+  FleetSkew skew;
+
+  strncpy(buf, ops, sizeof(buf) - 1);
+  buf[sizeof(buf) - 1] = '\0';
+  for (char *op = strtok_r(buf, ",", &saveptr); NULL != op;
+       op = strtok_r(NULL, ",", &saveptr)) {
+    struct timeval begin, end;
+    gettimeofday(&begin, NULL);
+    if (0 == strcmp("open", op)) {
+      ret = fleet->open(results);
+    } else if (0 == strcmp("close", op)) {
+      ret = fleet->close(results);
+    } else if (0 == strcmp("auth", op)) {
+      ret = fleet->auth(results);
+    } else if (0 == strcmp("set", op)) {
+      ret = fleet->set_property(t->params[0], &t->data.send, t->size,
+                                results);
+    } else if (0 == strcmp("trigger", op)) {
+      ret = fleet->trigger(results);
+    } else if (0 == strcmp("sync", op)) {
+      ret = fleet->trigger_sync(results, skew);
+    } else if (0 == strcmp("download", op)) {
+      ret = fleet->download(0xFFFFC001, "cam%02d.jpg", results);
+    } else {
+      log("unknown operation: %s\n", op);
+      return SOCC_ERROR_INVALID_PARAMETER;
+    }
+    gettimeofday(&end, NULL);
+
+    fprintf(outfile, "%s: ret=%d, %ld us\n", op, ret,
+            (end.tv_sec - begin.tv_sec) * 1000000L +
+                (end.tv_usec - begin.tv_usec));
+    for (size_t i = 0; i < results.size(); i++) {
+      fprintf(outfile, "  camera %zu: ret=%d, latency=%u us\n", i,
+              results[i].ret, results[i].latency_us);
+    }
+    if (0 == strcmp("sync", op)) {
+      fprintf(outfile, "  skew: min=%u us, max=%u us, p99=%u us\n",
+              skew.min_us, skew.max_us, skew.p99_us);
+    }
+    fflush(outfile);
+    if (SOCC_OK != ret) {
+      break;
+    }
+  }
+  return ret;
+}
+
+int Command::await(com::sony::imaging::remote::socc_ptp *ptp,
+                   uint16_t device_property_code, int field, uint64_t value,
+                   uint64_t mask, uint32_t interval_ms, uint32_t timeout_ms) {
+  struct timeval begin;
+  gettimeofday(&begin, NULL);
+  log("await > code=0x%04X, %s & 0x%llX == 0x%llX\n", device_property_code,
+      BATCH_FIELD_ENABLE == field ? "IsEnable" : "CurrentValue",
+      (unsigned long long)mask, (unsigned long long)value);
+  while (1) {
+    PTPTransaction transaction = {
+        0x9209,           // .code
+        {0, 0, 0, 0, 0},  // .params
+        0,                // .nparam
+        {0},              // .data
+        0,                // .size
+    };
+    bool found = false;
+    uint64_t current = 0;
+    int ret = _recv(ptp, &transaction);
+    if (SOCC_OK == ret) {
+      SDIDevicePropInfoDatasetArray info(transaction.data.recv,
+                                         transaction.size);
+      SDIDevicePropInfoDataset *data = info.get(device_property_code);
+      if (NULL != data) {
+        found = true;
+        current = BATCH_FIELD_ENABLE == field
+                      ? data->IsEnable
+                      : (uint64_t)data->currentInteger();
+      }
+    }
+    ptp->dispose_data(&transaction.data.recv);
+    if (SOCC_OK != ret) {
+      return ret;
+    }
+    if (found && (current & mask) == value) {
+      log("await < ret=0, value=0x%llX\n", (unsigned long long)current);
+      return SOCC_OK;
+    }
+    if (elapsed_us(begin) / 1000 >= timeout_ms) {
+      log("await < ret=%d, value=0x%llX\n", SOCC_ERROR_USB_TIMEOUT,
+          (unsigned long long)current);
+      return SOCC_ERROR_USB_TIMEOUT;
+    }
+    usleep(interval_ms * 1000);
+  }
+}
+
+int Command::_step(com::sony::imaging::remote::socc_ptp *ptp,
+                   const BatchStep &step, const BatchHooks *hooks) {
+  PTPTransaction transaction = step.transaction;
+  switch (step.command) {
+    case SEND:
+      return send(ptp, &transaction);
+    case RECV:
+      return recv(ptp, &transaction);
+    case WAIT:
+      if (NULL != hooks && NULL != hooks->wait_event) {
+        com::sony::imaging::remote::Container res;
+        memset(&res, 0, sizeof(res));
+        wait_begin();
+        return wait_end(hooks->wait_event(res, hooks->vp), res);
+      }
+      return wait(ptp);
+    case OPEN:
+      return open(ptp);
+    case CLOSE:
+      return close(ptp);
+    case AUTH:
+      return auth(ptp);
+    case GET:
+      return get(ptp, step.device_property_code);
+    case GETALL:
+      return getall(ptp);
+    case GETOBJECT:
+      return getobject(ptp, step.handle);
+    case BATCH_AWAIT:
+      return await(ptp, step.device_property_code, step.field, step.value,
+                   step.mask, step.interval_ms, step.timeout_ms);
+    case BATCH_SLEEP:
+      usleep(step.sleep_ms * 1000);
+      return SOCC_OK;
+  }
+  return SOCC_ERROR_INVALID_PARAMETER;
+}
+
+int Command::_batch(com::sony::imaging::remote::socc_ptp *ptp,
+                    const std::vector<BatchStep> &steps,
+                    const BatchHooks *hooks, uint32_t *executed) {
+  int ret = SOCC_OK;
+  for (size_t i = 0; i < steps.size(); i++) {
+    const BatchStep &step = steps[i];
+    if (BATCH_LOOP == step.command) {
+      for (uint32_t n = 0; n < step.count; n++) {
+        if (SOCC_OK != (ret = _batch(ptp, step.steps, hooks, executed))) {
+          return ret;
+        }
+      }
+      continue;
+    }
+
+    // "of" replaces the output of the batch during the step
+    FILE *saved = outfile;
+    if (0 != step.of[0] && 0 != strcmp("-", step.of)) {
+      outfile = fopen(step.of, "w");
+      if (NULL == outfile) {
+        log("cannot open %s: %s\n", step.of, strerror(errno));
+        outfile = saved;
+        return SOCC_ERROR_FILE_IO;
+      }
+    }
+    uint64_t trace_begin = socc_trace_now();
+    struct timeval begin;
+    gettimeofday(&begin, NULL);
+    ret = _step(ptp, step, hooks);
+    long us = elapsed_us(begin);
+    if (saved != outfile) {
+      fclose(outfile);
+      outfile = saved;
+    }
+    (*executed)++;
+    socc_trace_span("batch step", "daemon", trace_begin, "command",
+                    step.command);
+    log("step %u %s: ret=%d, %ld us\n", *executed,
+        batch_op_name(step.command), ret, us);
+    if (NULL != hooks && NULL != hooks->step_done) {
+      hooks->step_done(step, ret, hooks->vp);
+    }
+    if (SOCC_OK != ret) {
+      return ret;
+    }
+  }
+  return ret;
+}
+
+int Command::batch(com::sony::imaging::remote::socc_ptp *ptp,
+                   const char *script, const char *dir,
+                   const BatchHooks *hooks) {
+  std::vector<BatchStep> steps;
+  std::string error;
+  int ret = batch_parse(script, dir, steps, error);
+  if (SOCC_OK != ret) {
+    log("batch < ret=%d, %s\n", ret, error.c_str());
+    return ret;
+  }
+
+  uint32_t executed = 0;
+  struct timeval begin;
+  gettimeofday(&begin, NULL);
+  log("batch >\n");
+  ret = _batch(ptp, steps, hooks, &executed);
+  log("batch < ret=%d, steps=%u, total=%ld us\n", ret, executed,
+      elapsed_us(begin));
+  fflush(outfile);
+  return ret;
+}
+
+int Command::stats(com::sony::imaging::remote::socc_ptp *ptp) {
+  std::string json;
+  ptp->stats()->to_json(json);
+  fprintf(outfile, "%s\n", json.c_str());
+  fflush(outfile);
+  return SOCC_OK;
+}
+
+int Command::snapshot(com::sony::imaging::remote::socc_ptp *ptp,
+                      com::sony::imaging::remote::socc_snapshot *snap) {
+  int ret;
+  PTPTransaction transaction = {
+      0x9209,           // .code
+      {0, 0, 0, 0, 0},  // .params
+      0,                // .nparam
+      {0},              // .data
+      0,                // .size
+  };
+  ret = _recv(ptp, &transaction);
+  if (SOCC_OK != ret) goto bail;
+  ret = snap->parse(transaction.data.recv, transaction.size);
+  if (SOCC_OK != ret) {
+    log("the dataset is truncated after %u properties\n", snap->num());
+    goto bail;
+  }
+  fprintf(outfile, "snapshot: %u properties\n", snap->num());
+  fflush(outfile);
+
+bail:
+  ptp->dispose_data(&transaction.data.recv);
+  return ret;
+}
+
+int Command::diff(com::sony::imaging::remote::socc_ptp *ptp,
+                  const com::sony::imaging::remote::socc_snapshot *before,
+                  com::sony::imaging::remote::socc_snapshot *after) {
+  int ret;
+  PTPTransaction transaction = {
+      0x9209,           // .code
+      {0, 0, 0, 0, 0},  // .params
+      0,                // .nparam
+      {0},              // .data
+      0,                // .size
+  };
+  std::vector<SnapshotChange> changes;
+  std::string str;
+  ret = _recv(ptp, &transaction);
+  if (SOCC_OK != ret) goto bail;
+  ret = after->parse(transaction.data.recv, transaction.size);
+  if (SOCC_OK != ret) {
+    log("the dataset is truncated after %u properties\n", after->num());
+    goto bail;
+  }
+  if (NULL == before) {
+    log("no snapshot to compare with\n");
+    fprintf(outfile, "snapshot: %u properties\n", after->num());
+    fflush(outfile);
+    goto bail;
+  }
+  socc_snapshot::diff(*before, *after, changes);
+  socc_snapshot::changes_to_string(*before, *after, changes, str);
+  log("%zu properties changed in %llu ms\n", changes.size(),
+      (unsigned long long)(after->time_us() - before->time_us()) / 1000);
+  fprintf(outfile, "%s", str.c_str());
+  fflush(outfile);
+
+bail:
+  ptp->dispose_data(&transaction.data.recv);
+  return ret;
+}
+
 int Command::getliveview(com::sony::imaging::remote::socc_ptp *ptp) {
   int ret;
   LiveViewImage *live;
@@ -470,6 +818,17 @@ int Command::getliveview(com::sony::imaging::remote::socc_ptp *ptp) {
   if (SOCC_OK != ret) goto bail;
   live = new LiveViewImage(transaction.data.recv);
   write(live->get(), live->size(), outfile);
+  if (NULL != live->focalFrameInfo() &&
+      live->focalFrameInfo() - (uint8_t *)transaction.data.recv +
+              live->focalFrameInfoSize() <=
+          transaction.size) {
+    FocalFrameInfo info(live->focalFrameInfo(), live->focalFrameInfoSize());
+    if (info.valid()) {
+      std::string str;
+      info.toString(str);
+      log("%s", str.c_str());
+    }
+  }
   delete live;
 
 bail:
@@ -8,7 +8,12 @@
 
 #include <stdint.h>
 
+#include <vector>
+
+#include "socc_auth.h"
+#include "socc_fleet.h"
 #include "socc_ptp.h"
+#include "socc_snapshot.h"
 #include "socc_types.h"  // need to be removed
 
 #define FILENAME_MAX_LEN 256
@@ -18,6 +23,8 @@ namespace sony {
 namespace imaging {
 namespace remote {
 
+struct BatchStep;
+
 typedef struct _PTPTransaction {
   static const uint32_t DATA_IS_STRING = 0xFFFFFFFF;
   static const uint32_t DATA_IS_FILE = 0xFFFFFFFE;
@@ -33,10 +40,22 @@ typedef struct _PTPTransaction {
   uint32_t size;
 } PTPTransaction;
 
+/**
+ * @brief What a caller of Command::batch() does between the steps.
+ */
+typedef struct BatchHooks {
+  //! called after each step, NULL for none
+  void (*step_done)(const BatchStep &step, int ret, void *vp);
+  //! waits for an event instead of socc_ptp::wait_event(), NULL for it
+  int (*wait_event)(Container &event, void *vp);
+  void *vp;  //!< user data of the hooks
+} BatchHooks;
+
 class Command {
  private:
   FILE *logout;
   FILE *outfile;
+  AuthTiming auth_timing_;
 
   inline void log(const char *format, ...);
   void setOutfile(char *filename);
@@ -44,6 +63,11 @@ class Command {
 
   int _send(com::sony::imaging::remote::socc_ptp *ptp, PTPTransaction *t);
   int _recv(com::sony::imaging::remote::socc_ptp *ptp, PTPTransaction *t);
+  int _batch(com::sony::imaging::remote::socc_ptp *ptp,
+             const std::vector<BatchStep> &steps, const BatchHooks *hooks,
+             uint32_t *executed);
+  int _step(com::sony::imaging::remote::socc_ptp *ptp, const BatchStep &step,
+            const BatchHooks *hooks);
 
  public:
   Command(char *log, char *out);
@@ -53,6 +77,18 @@ class Command {
   int send(com::sony::imaging::remote::socc_ptp *ptp, PTPTransaction *t);
   int recv(com::sony::imaging::remote::socc_ptp *ptp, PTPTransaction *t);
   int wait(com::sony::imaging::remote::socc_ptp *ptp);
+
+  /**
+   * @brief logs the beginning of wait(), for an event waited for by the
+   * caller
+   */
+  void wait_begin();
+
+  /**
+   * @brief logs the event waited for since wait_begin(), like wait()
+   * @return ret
+   */
+  int wait_end(int ret, const com::sony::imaging::remote::Container &res);
   int reset(com::sony::imaging::remote::socc_ptp *ptp);
   int clear_halt(com::sony::imaging::remote::socc_ptp *ptp);
   int open(com::sony::imaging::remote::socc_ptp *ptp);
@@ -63,6 +99,52 @@ class Command {
           uint16_t device_property_code);
   int getobject(com::sony::imaging::remote::socc_ptp *ptp, uint32_t handle);
   int getliveview(com::sony::imaging::remote::socc_ptp *ptp);
+  int burst(com::sony::imaging::remote::socc_ptp *ptp, uint32_t count,
+            const char *path_format);
+  int fleet(com::sony::imaging::remote::socc_fleet *fleet, const char *ops,
+            PTPTransaction *t);
+  int stats(com::sony::imaging::remote::socc_ptp *ptp);
+
+  /**
+   * @brief takes a snapshot of the device properties, and writes the number
+   * of them
+   */
+  int snapshot(com::sony::imaging::remote::socc_ptp *ptp,
+               com::sony::imaging::remote::socc_snapshot *snap);
+
+  /**
+   * @brief takes a snapshot of the device properties, and writes the ones
+   * changed since \em before
+   * @param before the earlier snapshot, NULL for none
+   * @param after the snapshot taken
+   */
+  int diff(com::sony::imaging::remote::socc_ptp *ptp,
+           const com::sony::imaging::remote::socc_snapshot *before,
+           com::sony::imaging::remote::socc_snapshot *after);
+
+  /**
+   * @brief polls a device property until its masked field has a value
+   * @param field BATCH_FIELD_CURRENT or BATCH_FIELD_ENABLE
+   * @return 0 on success, SOCC_ERROR_USB_TIMEOUT after timeout_ms
+   */
+  int await(com::sony::imaging::remote::socc_ptp *ptp,
+            uint16_t device_property_code, int field, uint64_t value,
+            uint64_t mask, uint32_t interval_ms, uint32_t timeout_ms);
+
+  /**
+   * @brief runs the steps of a batch script back to back, and logs the time
+   * of each step and the total. It stops at the first failed step.
+   * @param script the script, see batch_parse()
+   * @param dir the directory of the relative paths in the script
+   * @param hooks NULL for none
+   */
+  int batch(com::sony::imaging::remote::socc_ptp *ptp, const char *script,
+            const char *dir, const BatchHooks *hooks = NULL);
+
+  /**
+   * @brief the timing of the last auth(), zero if none has completed
+   */
+  const AuthTiming &auth_timing();
 };
 
 }  // namespace remote
@@ -0,0 +1,235 @@
+#include "event_loop.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#if defined(__linux__)
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <sys/timerfd.h>
+#elif defined(__APPLE__)
+#include <sys/event.h>
+#endif
+
+#include "socc_time.h"
+
+using namespace com::sony::imaging::remote;
+
+#define EVENT_LOOP_MAX_EVENTS 32
+
+// the counter of the eventfd and the timerfd, or the bytes of the pipe
+static void drain(int fd) {
+  char buf[64];
+  while (0 < read(fd, buf, sizeof(buf))) {
+  }
+}
+
+EventLoop::EventLoop()
+    : loop_fd(-1),
+      timer_fd(-1),
+      notify_fd(-1),
+      notify_write_fd(-1),
+      timer_tag(NULL),
+      notify_tag(NULL),
+      timer_interval_ms(0),
+      timer_next_ms(0) {
+#if defined(__linux__)
+  loop_fd = epoll_create1(EPOLL_CLOEXEC);
+#elif defined(__APPLE__)
+  loop_fd = kqueue();
+#endif
+}
+
+EventLoop::~EventLoop() {
+  if (-1 != timer_fd) {
+    close(timer_fd);
+  }
+  if (-1 != notify_write_fd && notify_fd != notify_write_fd) {
+    close(notify_write_fd);
+  }
+  if (-1 != notify_fd) {
+    close(notify_fd);
+  }
+  if (-1 != loop_fd) {
+    close(loop_fd);
+  }
+}
+
+bool EventLoop::add(int fd, void *tag) {
+#if defined(__linux__)
+  struct epoll_event ev;
+  memset(&ev, 0, sizeof(ev));
+  ev.events = EPOLLIN;  // EPOLLHUP is always reported
+  ev.data.ptr = tag;
+  return 0 == epoll_ctl(loop_fd, EPOLL_CTL_ADD, fd, &ev);
+#elif defined(__APPLE__)
+  struct kevent ev;
+  EV_SET(&ev, fd, EVFILT_READ, EV_ADD, 0, 0, tag);
+  return 0 == kevent(loop_fd, &ev, 1, NULL, 0, NULL);
+#else
+  struct pollfd p;
+  p.fd = fd;
+  p.events = POLLIN;
+  p.revents = 0;
+  fds.push_back(p);
+  fd_tags.push_back(tag);
+  return true;
+#endif
+}
+
+void EventLoop::remove(int fd) {
+#if defined(__linux__)
+  epoll_ctl(loop_fd, EPOLL_CTL_DEL, fd, NULL);
+#elif defined(__APPLE__)
+  struct kevent ev;
+  EV_SET(&ev, fd, EVFILT_READ, EV_DELETE, 0, 0, NULL);
+  kevent(loop_fd, &ev, 1, NULL, 0, NULL);
+#else
+  for (size_t i = 0; i < fds.size(); i++) {
+    if (fd == fds[i].fd) {
+      fds.erase(fds.begin() + i);
+      fd_tags.erase(fd_tags.begin() + i);
+      break;
+    }
+  }
+#endif
+}
+
+bool EventLoop::set_timer(uint32_t interval_ms, void *tag) {
+  timer_tag = tag;
+#if defined(__linux__)
+  timer_fd = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC);
+  if (-1 == timer_fd) {
+    return false;
+  }
+  struct itimerspec spec;
+  spec.it_interval.tv_sec = interval_ms / 1000;
+  spec.it_interval.tv_nsec = (interval_ms % 1000) * 1000000;
+  spec.it_value = spec.it_interval;
+  if (0 != timerfd_settime(timer_fd, 0, &spec, NULL)) {
+    return false;
+  }
+  return add(timer_fd, tag);
+#elif defined(__APPLE__)
+  struct kevent ev;
+  EV_SET(&ev, 0, EVFILT_TIMER, EV_ADD, 0, interval_ms, tag);
+  return 0 == kevent(loop_fd, &ev, 1, NULL, 0, NULL);
+#else
+  timer_interval_ms = interval_ms;
+  timer_next_ms = socc_monotonic_us() / 1000 + interval_ms;
+  return true;
+#endif
+}
+
+bool EventLoop::set_notifier(void *tag) {
+  notify_tag = tag;
+#if defined(__linux__)
+  notify_fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+  notify_write_fd = notify_fd;
+  return -1 != notify_fd && add(notify_fd, tag);
+#elif defined(__APPLE__)
+  struct kevent ev;
+  EV_SET(&ev, 0, EVFILT_USER, EV_ADD | EV_CLEAR, 0, 0, tag);
+  return 0 == kevent(loop_fd, &ev, 1, NULL, 0, NULL);
+#else
+  int pipefd[2];
+  if (0 != pipe(pipefd)) {
+    return false;
+  }
+  fcntl(pipefd[0], F_SETFL, O_NONBLOCK);
+  fcntl(pipefd[1], F_SETFL, O_NONBLOCK);
+  notify_fd = pipefd[0];
+  notify_write_fd = pipefd[1];
+  return add(notify_fd, tag);
+#endif
+}
+
+void EventLoop::notify() {
+#if defined(__linux__)
+  uint64_t one = 1;
+  write(notify_write_fd, &one, sizeof(one));
+#elif defined(__APPLE__)
+  struct kevent ev;
+  EV_SET(&ev, 0, EVFILT_USER, 0, NOTE_TRIGGER, 0, NULL);
+  kevent(loop_fd, &ev, 1, NULL, 0, NULL);
+#else
+  // a full pipe has a notification pending already
+  char c = 0;
+  write(notify_write_fd, &c, sizeof(c));
+#endif
+}
+
+int EventLoop::wait(void **tags, int max, int timeout_ms) {
+  if (EVENT_LOOP_MAX_EVENTS < max) {
+    max = EVENT_LOOP_MAX_EVENTS;
+  }
+#if defined(__linux__)
+  struct epoll_event events[EVENT_LOOP_MAX_EVENTS];
+  int n = epoll_wait(loop_fd, events, max, timeout_ms);
+  if (n < 0) {
+    return EINTR == errno ? 0 : -1;
+  }
+  for (int i = 0; i < n; i++) {
+    tags[i] = events[i].data.ptr;
+    if (-1 != timer_fd && timer_tag == tags[i]) {
+      drain(timer_fd);
+    } else if (-1 != notify_fd && notify_tag == tags[i]) {
+      drain(notify_fd);
+    }
+  }
+  return n;
+#elif defined(__APPLE__)
+  struct kevent events[EVENT_LOOP_MAX_EVENTS];
+  struct timespec ts;
+  struct timespec *timeout = NULL;
+  if (0 <= timeout_ms) {
+    ts.tv_sec = timeout_ms / 1000;
+    ts.tv_nsec = (timeout_ms % 1000) * 1000000;
+    timeout = &ts;
+  }
+  int n = kevent(loop_fd, NULL, 0, events, max, timeout);
+  if (n < 0) {
+    return EINTR == errno ? 0 : -1;
+  }
+  for (int i = 0; i < n; i++) {
+    tags[i] = events[i].udata;
+  }
+  return n;
+#else
+  if (0 < timer_interval_ms) {
+    uint64_t now = socc_monotonic_us() / 1000;
+    int remaining = timer_next_ms > now ? (int)(timer_next_ms - now) : 0;
+    if (timeout_ms < 0 || remaining < timeout_ms) {
+      timeout_ms = remaining;
+    }
+  }
+  int n = poll(fds.empty() ? NULL : &fds[0], fds.size(), timeout_ms);
+  if (n < 0) {
+    return EINTR == errno ? 0 : -1;
+  }
+  int count = 0;
+  for (size_t i = 0; i < fds.size() && count < max; i++) {
+    if (0 == fds[i].revents) {
+      continue;
+    }
+    tags[count++] = fd_tags[i];
+    if (notify_fd == fds[i].fd) {
+      drain(notify_fd);
+    }
+  }
+  if (0 < timer_interval_ms && count < max) {
+    uint64_t now = socc_monotonic_us() / 1000;
+    if (timer_next_ms <= now) {
+      tags[count++] = timer_tag;
+      timer_next_ms += timer_interval_ms;
+      if (timer_next_ms <= now) {
+        timer_next_ms = now + timer_interval_ms;
+      }
+    }
+  }
+  return count;
+#endif
+}
@@ -0,0 +1,95 @@
+/**
+ * @file event_loop.h
+ * @brief Header file of the EventLoop.
+ */
+
+#ifndef __EVENT_LOOP_H__
+#define __EVENT_LOOP_H__
+
+#include <poll.h>
+#include <stdint.h>
+
+#include <vector>
+
+namespace com {
+namespace sony {
+namespace imaging {
+namespace remote {
+
+/**
+ * @brief Waits for the file descriptors, a periodic timer and the
+ * notifications of the other threads at once.
+ *
+ * Each source is registered with a tag, and wait() returns the tags of the
+ * ready sources. It is built on epoll, a timerfd and an eventfd on Linux, on
+ * kqueue on macOS, and on poll() with a pipe elsewhere. The sources are added
+ * and removed on the thread calling wait(), and notify() may be called from
+ * any thread.
+ */
+class EventLoop {
+ public:
+  EventLoop();
+  ~EventLoop();
+
+  /**
+   * @brief watches a file descriptor for the input and the hangup
+   * @return true on success
+   */
+  bool add(int fd, void *tag);
+
+  /**
+   * @brief stops watching a file descriptor. Call it before closing fd.
+   */
+  void remove(int fd);
+
+  /**
+   * @brief starts the periodic timer
+   * @param interval_ms the period
+   * @param tag returned by wait() at each expiration
+   * @return true on success
+   */
+  bool set_timer(uint32_t interval_ms, void *tag);
+
+  /**
+   * @brief sets up notify()
+   * @param tag returned by wait() once for the notifications since the last
+   * wait()
+   * @return true on success
+   */
+  bool set_notifier(void *tag);
+
+  /**
+   * @brief wakes up wait(), from any thread
+   */
+  void notify();
+
+  /**
+   * @brief waits for the sources
+   * @param [out]tags the tags of the ready sources
+   * @param max size of tags
+   * @param timeout_ms -1 to wait forever
+   * @return number of the tags, 0 on timeout, -1 on failure
+   */
+  int wait(void **tags, int max, int timeout_ms);
+
+ private:
+  int loop_fd;    //!< epoll or kqueue, -1 with poll()
+  int timer_fd;   //!< timerfd, -1 without
+  int notify_fd;  //!< eventfd, or the reading end of the pipe
+  int notify_write_fd;
+  void *timer_tag;
+  void *notify_tag;
+
+  // with poll()
+  std::vector<struct pollfd> fds;
+  std::vector<void *> fd_tags;
+  uint32_t timer_interval_ms;
+  uint64_t timer_next_ms;
+};
+
+}  // namespace remote
+}  // namespace imaging
+}  // namespace sony
+}  // namespace com
+
+#endif  // __EVENT_LOOP_H__
@@ -0,0 +1,321 @@
+#include "journal.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/file.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <time.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <map>
+
+#include "socc_types.h"
+
+using namespace com::sony::imaging::remote;
+
+#define JOURNAL_PATH_MAX_LEN 1024
+
+// the most bytes of the text written at once
+#define JOURNAL_WRITE_MAX_LEN (64 * 1024)
+
+static pthread_mutex_t instance_mutex = PTHREAD_MUTEX_INITIALIZER;
+static Journal *journal = NULL;
+static bool journal_tried = false;
+static bool hooks_registered = false;
+
+static size_t mapping_size(uint64_t capacity) {
+  return sizeof(JournalHeader) + capacity * sizeof(JournalRecord);
+}
+
+static void write_all(int fd, const std::string &text) {
+  const char *data = text.data();
+  size_t size = text.size();
+  while (size > 0) {
+    ssize_t ret = ::write(fd, data, size);
+    if (ret < 0) {
+      if (EINTR == errno) {
+        continue;
+      }
+      return;
+    }
+    data += ret;
+    size -= ret;
+  }
+}
+
+// replaces %d of the environment variable with the process ID
+static void journal_path(const char *env, char *path, size_t size) {
+  const char *pid = strstr(env, "%d");
+  if (NULL == pid) {
+    snprintf(path, size, "%s", env);
+  } else {
+    snprintf(path, size, "%.*s%d%s", (int)(pid - env), env, (int)getpid(),
+             pid + 2);
+  }
+}
+
+Journal::Journal() : fd(-1), header(NULL) {
+  pthread_mutex_init(&mutex, NULL);
+}
+
+Journal::~Journal() {
+  if (NULL != header) {
+    munmap(header, mapping_size(header->capacity));
+  }
+  if (-1 != fd) {
+    ::close(fd);
+  }
+  pthread_mutex_destroy(&mutex);
+}
+
+Journal *Journal::instance() {
+  pthread_mutex_lock(&instance_mutex);
+  if (false == journal_tried) {
+    journal_tried = true;
+    const char *env = getenv(JOURNAL_ENV);
+    if (NULL != env && '\0' != env[0]) {
+      char path[JOURNAL_PATH_MAX_LEN];
+      journal_path(env, path, sizeof(path));
+      journal = new Journal();
+      if (SOCC_OK != journal->open(path)) {
+        fprintf(stderr, "cannot open the journal %s\n", path);
+        delete journal;
+        journal = NULL;
+      }
+      if (false == hooks_registered) {
+        pthread_atfork(NULL, NULL, forget_parent);
+        hooks_registered = true;
+      }
+    }
+  }
+  Journal *ret = journal;
+  pthread_mutex_unlock(&instance_mutex);
+  return ret;
+}
+
+// the child of fork() opens its own journal, and must not write to the
+// mapping of its parent
+void Journal::forget_parent() {
+  pthread_mutex_init(&instance_mutex, NULL);
+  if (NULL != journal) {
+    pthread_mutex_init(&journal->mutex, NULL);
+    delete journal;
+    journal = NULL;
+  }
+  journal_tried = false;
+}
+
+int Journal::open(const char *path) {
+  fd = ::open(path, O_RDWR | O_CREAT | O_CLOEXEC, 0666);
+  if (-1 == fd) {
+    return SOCC_ERROR_FILE_IO;
+  }
+  // a single writer, another server has to take another file
+  if (0 != flock(fd, LOCK_EX | LOCK_NB)) {
+    fprintf(stderr, "the journal %s is used by another process\n", path);
+    return SOCC_ERROR_FILE_IO;
+  }
+  struct stat st;
+  if (0 != fstat(fd, &st)) {
+    return SOCC_ERROR_FILE_IO;
+  }
+
+  JournalHeader h;
+  if (0 == st.st_size) {
+    memset(&h, 0, sizeof(h));
+    h.magic = JOURNAL_MAGIC;
+    h.version = JOURNAL_VERSION;
+    h.record_size = sizeof(JournalRecord);
+    if (sizeof(h) != pwrite(fd, &h, sizeof(h), 0)) {
+      return SOCC_ERROR_FILE_IO;
+    }
+  } else if (sizeof(h) != pread(fd, &h, sizeof(h), 0) ||
+             JOURNAL_MAGIC != h.magic || JOURNAL_VERSION != h.version ||
+             sizeof(JournalRecord) != h.record_size ||
+             h.count > h.capacity ||
+             (off_t)mapping_size(h.capacity) > st.st_size) {
+    fprintf(stderr, "%s is not a journal\n", path);
+    return SOCC_ERROR_INVALID_PARAMETER;
+  }
+
+  void *p = mmap(NULL, mapping_size(h.capacity), PROT_READ | PROT_WRITE,
+                 MAP_SHARED, fd, 0);
+  if (MAP_FAILED == p) {
+    return SOCC_ERROR_FILE_IO;
+  }
+  header = (JournalHeader *)p;
+  if (header->count == header->capacity) {
+    return grow();
+  }
+  return SOCC_OK;
+}
+
+int Journal::grow() {
+  uint64_t capacity = header->capacity;
+  uint64_t new_capacity = capacity + JOURNAL_GROW_RECORDS;
+  size_t size = mapping_size(new_capacity);
+#if defined(__linux__)
+  // the blocks are allocated now, so a full disk is not a SIGBUS later
+  int err = posix_fallocate(fd, 0, size);
+#else
+  int err = ftruncate(fd, size);
+#endif
+  if (0 != err) {
+    return SOCC_ERROR_FILE_IO;
+  }
+  void *p = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+  if (MAP_FAILED == p) {
+    return SOCC_ERROR_FILE_IO;
+  }
+  munmap(header, mapping_size(capacity));
+  header = (JournalHeader *)p;
+  header->capacity = new_capacity;
+  return SOCC_OK;
+}
+
+void Journal::append(const JournalRecord &record) {
+  pthread_mutex_lock(&mutex);
+  if (header->count < header->capacity || SOCC_OK == grow()) {
+    JournalRecord *records = (JournalRecord *)(header + 1);
+    records[header->count] = record;
+    // counted after the record, for a reader of the file meanwhile
+    __atomic_store_n(&header->count, header->count + 1, __ATOMIC_RELEASE);
+  }
+  pthread_mutex_unlock(&mutex);
+}
+
+typedef struct summary_t {
+  uint64_t errors;
+  uint64_t bytes;
+  std::vector<uint32_t> latencies;
+} summary_t;
+
+static bool is_error(const JournalRecord &record) {
+  return SOCC_OK != record.ret || 0x2001 != record.response_code;
+}
+
+static void append_text(std::string &out, const JournalRecord &record) {
+  char buf[256];
+  time_t sec = record.time_us / 1000000;
+  struct tm tm_st;
+  localtime_r(&sec, &tm_st);
+  int len = snprintf(buf, sizeof(buf),
+                     "%04d-%02d-%02d %02d:%02d:%02d.%06ld %s code=0x%04X n=%d",
+                     tm_st.tm_year + 1900, tm_st.tm_mon + 1, tm_st.tm_mday,
+                     tm_st.tm_hour, tm_st.tm_min, tm_st.tm_sec,
+                     (long)(record.time_us % 1000000),
+                     JOURNAL_SEND == record.direction ? "send" : "recv",
+                     record.code, record.nparam);
+  out.append(buf, len);
+  for (int i = 0; i < record.nparam && i < 5; i++) {
+    len = snprintf(buf, sizeof(buf), " p%d=0x%08X", i + 1, record.params[i]);
+    out.append(buf, len);
+  }
+  len = snprintf(buf, sizeof(buf), " ret=%d response=0x%04X size=%u data=",
+                 record.ret, record.response_code, record.size);
+  out.append(buf, len);
+  uint32_t n = std::min<uint32_t>(record.size, JOURNAL_DATA_LEN);
+  if (0 == n) {
+    out.append("NA");
+  } else {
+    out.append("0x");
+    for (uint32_t i = 0; i < n; i++) {
+      snprintf(buf, sizeof(buf), "%02X", record.data[i]);
+      out.append(buf, 2);
+    }
+  }
+  len = snprintf(buf, sizeof(buf), " latency=%u us\n", record.latency_us);
+  out.append(buf, len);
+}
+
+static void append_summary(std::string &out,
+                           std::map<uint16_t, summary_t> &summaries) {
+  char buf[256];
+  int len = snprintf(buf, sizeof(buf),
+                     "%-8s %10s %8s %10s %10s %10s %10s %14s\n", "code",
+                     "count", "errors", "p50_us", "p90_us", "p99_us", "max_us",
+                     "bytes");
+  out.append(buf, len);
+  std::map<uint16_t, summary_t>::iterator it;
+  for (it = summaries.begin(); it != summaries.end(); it++) {
+    std::vector<uint32_t> &l = it->second.latencies;
+    std::sort(l.begin(), l.end());
+    len = snprintf(buf, sizeof(buf),
+                   "0x%04X   %10zu %8llu %10u %10u %10u %10u %14llu\n",
+                   it->first, l.size(),
+                   (unsigned long long)it->second.errors, l[l.size() / 2],
+                   l[l.size() * 90 / 100], l[l.size() * 99 / 100], l.back(),
+                   (unsigned long long)it->second.bytes);
+    out.append(buf, len);
+  }
+}
+
+int com::sony::imaging::remote::journal_decode(
+    const std::vector<std::string> &files, const JournalFilter &filter,
+    int outfd) {
+  std::map<uint16_t, summary_t> summaries;
+  std::string out;
+  for (size_t f = 0; f < files.size(); f++) {
+    const char *path = files[f].c_str();
+    int fd = ::open(path, O_RDONLY);
+    if (-1 == fd) {
+      fprintf(stderr, "cannot open %s: %s\n", path, strerror(errno));
+      return SOCC_ERROR_FILE_IO;
+    }
+    struct stat st;
+    if (0 != fstat(fd, &st) || st.st_size < (off_t)sizeof(JournalHeader)) {
+      fprintf(stderr, "%s is not a journal\n", path);
+      ::close(fd);
+      return SOCC_ERROR_INVALID_PARAMETER;
+    }
+    void *p = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    ::close(fd);
+    if (MAP_FAILED == p) {
+      return SOCC_ERROR_FILE_IO;
+    }
+    const JournalHeader *header = (const JournalHeader *)p;
+    if (JOURNAL_MAGIC != header->magic || JOURNAL_VERSION != header->version ||
+        sizeof(JournalRecord) != header->record_size) {
+      fprintf(stderr, "%s is not a journal\n", path);
+      munmap(p, st.st_size);
+      return SOCC_ERROR_INVALID_PARAMETER;
+    }
+    uint64_t count = std::min<uint64_t>(
+        header->count,
+        (st.st_size - sizeof(JournalHeader)) / sizeof(JournalRecord));
+    madvise(p, st.st_size, MADV_SEQUENTIAL);
+
+    const JournalRecord *records = (const JournalRecord *)(header + 1);
+    for (uint64_t i = 0; i < count; i++) {
+      const JournalRecord &record = records[i];
+      if ((0 != filter.code && filter.code != record.code) ||
+          (true == filter.errors && false == is_error(record)) ||
+          record.latency_us < filter.min_us) {
+        continue;
+      }
+      if (true == filter.summary) {
+        summary_t &s = summaries[record.code];
+        s.errors += is_error(record) ? 1 : 0;
+        s.bytes += record.size;
+        s.latencies.push_back(record.latency_us);
+        continue;
+      }
+      append_text(out, record);
+      if (JOURNAL_WRITE_MAX_LEN < out.size()) {
+        write_all(outfd, out);
+        out.clear();
+      }
+    }
+    munmap(p, st.st_size);
+  }
+  if (true == filter.summary) {
+    append_summary(out, summaries);
+  }
+  write_all(outfd, out);
+  return SOCC_OK;
+}
@@ -0,0 +1,123 @@
+/**
+ * @file journal.h
+ * @brief Header file of the transaction journal.
+ */
+
+#ifndef __JOURNAL_H__
+#define __JOURNAL_H__
+
+#include <pthread.h>
+#include <stdint.h>
+
+#include <string>
+#include <vector>
+
+// the environment variable of the journal file
+#define JOURNAL_ENV "SOCC_JOURNAL"
+
+#define JOURNAL_MAGIC 0x4C4E4A53  // "SJNL"
+#define JOURNAL_VERSION 1
+
+// the records added to the file when it is full, 4MB
+#define JOURNAL_GROW_RECORDS (64 * 1024)
+
+#define JOURNAL_DATA_LEN 16
+
+// JournalRecord::direction
+#define JOURNAL_SEND 1
+#define JOURNAL_RECV 2
+
+namespace com {
+namespace sony {
+namespace imaging {
+namespace remote {
+
+/**
+ * @brief the first 64 bytes of a journal file
+ */
+typedef struct JournalHeader {
+  uint32_t magic;        //!< JOURNAL_MAGIC
+  uint16_t version;      //!< JOURNAL_VERSION
+  uint16_t record_size;  //!< sizeof(JournalRecord)
+  uint64_t capacity;     //!< the records the file has room for
+  uint64_t count;        //!< the records written
+  uint8_t reserved[40];
+} JournalHeader;
+
+/**
+ * @brief a transaction, 64 bytes
+ */
+typedef struct JournalRecord {
+  uint64_t time_us;        //!< the start, in microseconds since the epoch
+  uint32_t latency_us;     //!< until the response
+  int32_t ret;             //!< the return code of the transaction
+  uint16_t code;           //!< OperationCode
+  uint16_t response_code;  //!< ResponseCode, 0 without a response
+  uint8_t direction;       //!< JOURNAL_SEND or JOURNAL_RECV
+  uint8_t nparam;          //!< the parameters used
+  uint16_t reserved;
+  uint32_t params[5];              //!< the parameters
+  uint32_t size;                   //!< bytes of the data phase
+  uint8_t data[JOURNAL_DATA_LEN];  //!< the first bytes of the data
+} JournalRecord;
+
+/**
+ * @brief the records decoded by journal_decode()
+ */
+typedef struct JournalFilter {
+  uint16_t code;    //!< OperationCode, 0 for all
+  bool errors;      //!< only the failed ones and the ones not OK(0x2001)
+  uint32_t min_us;  //!< only the ones taking as long
+  bool summary;     //!< the latency percentiles of each OperationCode instead
+} JournalFilter;
+
+/**
+ * @brief Appends the transactions to a preallocated file mapped in memory.
+ *
+ * The journal of the process is opened from the environment variable
+ * SOCC_JOURNAL=journalfile. A %d in journalfile is replaced by the process ID,
+ * for the servers of several cameras. An existing journal is continued. The
+ * file grows by JOURNAL_GROW_RECORDS records when it is full, so appending a
+ * record is a copy into the memory without a system call.
+ */
+class Journal {
+ public:
+  /**
+   * @brief the journal of the process
+   * @return NULL without SOCC_JOURNAL, or when it cannot be opened
+   */
+  static Journal *instance();
+
+  void append(const JournalRecord &record);
+
+ private:
+  Journal();
+  ~Journal();
+
+  int fd;
+  JournalHeader *header;  // the mapping of the file
+  pthread_mutex_t mutex;
+
+  int open(const char *path);
+  int grow();
+
+  static void forget_parent();
+};
+
+/**
+ * @brief writes the records of journals as text, or their summary
+ * @param [in]files the journal files
+ * @param [in]filter the records written
+ * @param [in]outfd the output
+ * @return 0 on success, SOCC_ERROR_FILE_IO if a file cannot be read,
+ * SOCC_ERROR_INVALID_PARAMETER if it is not a journal
+ */
+int journal_decode(const std::vector<std::string> &files,
+                   const JournalFilter &filter, int outfd);
+
+}  // namespace remote
+}  // namespace imaging
+}  // namespace sony
+}  // namespace com
+
+#endif  // __JOURNAL_H__
@@ -0,0 +1,360 @@
+#include "log_writer.h"
+
+#include <errno.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include <vector>
+
+#include "socc_types.h"
+
+using namespace com::sony::imaging::remote;
+
+// the writer polls the rings for a while after a line, then sleeps until a
+// line wakes it
+#define LOG_WRITER_POLL_US 1000
+#define LOG_WRITER_POLLS 50
+
+// the most bytes written at once, a message of the log socket
+#define LOG_WRITE_MAX_LEN (64 * 1024)
+
+#define LOG_DECODE_MAX_LEN (1024 * 1024)
+
+static thread_local void *local_buffer_vp = NULL;
+static pthread_key_t buffer_key;
+static pthread_once_t buffer_key_once = PTHREAD_ONCE_INIT;
+static LogWriter *writer = NULL;
+
+static uint64_t clock_ns(clockid_t clock) {
+  struct timespec ts;
+  clock_gettime(clock, &ts);
+  return (uint64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+static void write_all(int fd, const char *data, size_t size) {
+  while (size > 0) {
+    ssize_t ret = ::write(fd, data, size);
+    if (ret < 0) {
+      if (EINTR == errno) {
+        continue;
+      }
+      return;  // the reader has gone, as the old fprintf did not care either
+    }
+    data += ret;
+    size -= ret;
+  }
+}
+
+static bool read_all(int fd, void *data, size_t size) {
+  char *p = (char *)data;
+  while (size > 0) {
+    ssize_t ret = ::read(fd, p, size);
+    if (ret < 0 && EINTR == errno) {
+      continue;
+    }
+    if (ret <= 0) {
+      return false;
+    }
+    p += ret;
+    size -= ret;
+  }
+  return true;
+}
+
+LogWriter::LogWriter()
+    : buffers(NULL),
+      sleeping(false),
+      started(false),
+      offset_ns(0),
+      cached_sec(-1) {
+  pthread_mutex_init(&drain_mutex, NULL);
+  pthread_mutex_init(&wake_mutex, NULL);
+  pthread_cond_init(&wake_cond, NULL);
+  const char *env = getenv(LOG_BINARY_ENV);
+  binary_records = NULL != env && 0 == strcmp("1", env);
+  cached_hms[0] = '\0';
+}
+
+LogWriter *LogWriter::instance() {
+  static LogWriter *instance = create();
+  return instance;
+}
+
+LogWriter *LogWriter::create() {
+  writer = new LogWriter();
+  atexit(flush_at_exit);
+  pthread_atfork(NULL, NULL, forget_parent);
+  return writer;
+}
+
+bool LogWriter::binary() { return binary_records; }
+
+LogWriter::buffer_t *LogWriter::local_buffer() {
+  buffer_t *buffer = (buffer_t *)local_buffer_vp;
+  if (NULL == buffer) {
+    buffer = new buffer_t();
+    buffer->written.store(0);
+    buffer->drained.store(0);
+    buffer->next = buffers.load();
+    while (!buffers.compare_exchange_weak(buffer->next, buffer)) {
+    }
+    local_buffer_vp = buffer;
+    pthread_once(&buffer_key_once, create_buffer_key);
+    pthread_setspecific(buffer_key, buffer);
+  }
+  return buffer;
+}
+
+// the ring of a thread is freed when the thread exits, after its lines
+void LogWriter::release_buffer(void *vp) {
+  buffer_t *buffer = (buffer_t *)vp;
+
+  // the other threads only push to the head, and the drains read the list
+  // under the same lock
+  pthread_mutex_lock(&writer->drain_mutex);
+  writer->drain(buffer, buffer->written.load());
+  buffer_t *head = buffer;
+  if (!writer->buffers.compare_exchange_strong(head, buffer->next)) {
+    buffer_t *b = head;
+    while (b->next != buffer) {
+      b = b->next;
+    }
+    b->next = buffer->next;
+  }
+  pthread_mutex_unlock(&writer->drain_mutex);
+  local_buffer_vp = NULL;
+  delete buffer;
+}
+
+void LogWriter::create_buffer_key() {
+  pthread_key_create(&buffer_key, release_buffer);
+}
+
+void LogWriter::start() {
+  pthread_mutex_lock(&wake_mutex);
+  if (false == started.load()) {
+    pthread_attr_t attr;
+    pthread_attr_init(&attr);
+    pthread_attr_setdetachstate(&attr, PTHREAD_CREATE_DETACHED);
+    if (0 == pthread_create(&thread_id, &attr, writer_thread, this)) {
+      started.store(true);
+    }
+    pthread_attr_destroy(&attr);
+  }
+  pthread_mutex_unlock(&wake_mutex);
+}
+
+void LogWriter::wake() {
+  pthread_mutex_lock(&wake_mutex);
+  pthread_cond_signal(&wake_cond);
+  pthread_mutex_unlock(&wake_mutex);
+}
+
+void LogWriter::vlog(int fd, const char *format, va_list ap) {
+  uint64_t now = clock_ns(CLOCK_MONOTONIC);
+  buffer_t *buffer = local_buffer();
+  if (false == started.load()) {
+    start();
+  }
+  uint64_t index = buffer->written.load(std::memory_order_relaxed);
+  if (LOG_RECORDS_PER_THREAD <=
+      index - buffer->drained.load(std::memory_order_acquire)) {
+    flush();  // the writer is behind, so the thread writes itself
+  }
+
+  record_t *record = &buffer->records[index % LOG_RECORDS_PER_THREAD];
+  va_list copy;
+  va_copy(copy, ap);
+  int size = vsnprintf(record->text, sizeof(record->text), format, ap);
+  if (size < 0) {
+    va_end(copy);
+    return;
+  }
+  if ((int)sizeof(record->text) <= size) {
+    // too long for a record: writes it after the lines queued before
+    std::vector<char> text(size + 1);
+    vsnprintf(&text[0], text.size(), format, copy);
+    va_end(copy);
+    pthread_mutex_lock(&drain_mutex);
+    drain(buffer, buffer->written.load());
+    std::string out;
+    append(out, now, &text[0], size);
+    write_all(fd, out.data(), out.size());
+    pthread_mutex_unlock(&drain_mutex);
+    return;
+  }
+  va_end(copy);
+  record->fd = fd;
+  record->size = size;
+  record->time_ns = now;
+  buffer->written.store(index + 1);
+  if (true == sleeping.load()) {
+    wake();
+  }
+}
+
+void LogWriter::flush() {
+  buffer_t *buffer = (buffer_t *)local_buffer_vp;
+  if (NULL == buffer) {
+    return;
+  }
+  pthread_mutex_lock(&drain_mutex);
+  drain(buffer, buffer->written.load());
+  pthread_mutex_unlock(&drain_mutex);
+}
+
+void LogWriter::flush_all() {
+  pthread_mutex_lock(&drain_mutex);
+  drain();
+  pthread_mutex_unlock(&drain_mutex);
+}
+
+bool LogWriter::pending() {
+  bool ret = false;
+  pthread_mutex_lock(&drain_mutex);
+  for (buffer_t *b = buffers.load(); NULL != b && !ret; b = b->next) {
+    ret = b->drained.load() < b->written.load();
+  }
+  pthread_mutex_unlock(&drain_mutex);
+  return ret;
+}
+
+int LogWriter::drain() {
+  int count = 0;
+  for (buffer_t *b = buffers.load(); NULL != b; b = b->next) {
+    uint64_t end = b->written.load(std::memory_order_acquire);
+    uint64_t begin = b->drained.load(std::memory_order_relaxed);
+    if (begin < end) {
+      drain(b, end);
+      count += end - begin;
+    }
+  }
+  return count;
+}
+
+void LogWriter::drain(buffer_t *buffer, uint64_t end) {
+  uint64_t index = buffer->drained.load(std::memory_order_relaxed);
+  if (end <= index) {
+    return;
+  }
+  offset_ns = clock_ns(CLOCK_REALTIME) - clock_ns(CLOCK_MONOTONIC);
+  std::string out;
+  int fd = -1;
+  for (; index < end; index++) {
+    record_t *record = &buffer->records[index % LOG_RECORDS_PER_THREAD];
+    if ((fd != record->fd || LOG_WRITE_MAX_LEN < out.size()) &&
+        false == out.empty()) {
+      write_all(fd, out.data(), out.size());
+      out.clear();
+    }
+    fd = record->fd;
+    append(out, record->time_ns, record->text, record->size);
+  }
+  if (false == out.empty()) {
+    write_all(fd, out.data(), out.size());
+  }
+  buffer->drained.store(end, std::memory_order_release);
+}
+
+void LogWriter::append(std::string &out, uint64_t time_ns, const char *text,
+                       size_t size) {
+  uint64_t time_us = (time_ns + offset_ns) / 1000;
+  if (true == binary_records) {
+    LogRecordHeader header;
+    header.magic = LOG_RECORD_MAGIC;
+    header.size = size;
+    header.time_us = time_us;
+    out.append((const char *)&header, sizeof(header));
+    out.append(text, size);
+    return;
+  }
+  time_t sec = time_us / 1000000;
+  if (sec != cached_sec) {
+    struct tm tm_st;
+    localtime_r(&sec, &tm_st);
+    snprintf(cached_hms, sizeof(cached_hms), "%02d:%02d:%02d", tm_st.tm_hour,
+             tm_st.tm_min, tm_st.tm_sec);
+    cached_sec = sec;
+  }
+  char stamp[32];
+  int len = snprintf(stamp, sizeof(stamp), "%s.%06ld ", cached_hms,
+                     (long)(time_us % 1000000));
+  out.append(stamp, len);
+  out.append(text, size);
+}
+
+void *LogWriter::writer_thread(void *vp) {
+  LogWriter *self = (LogWriter *)vp;
+  int idle = 0;
+  while (true) {
+    pthread_mutex_lock(&self->drain_mutex);
+    int count = self->drain();
+    pthread_mutex_unlock(&self->drain_mutex);
+    if (0 < count) {
+      idle = 0;
+    } else {
+      idle++;
+    }
+    if (idle < LOG_WRITER_POLLS) {
+      usleep(LOG_WRITER_POLL_US);
+      continue;
+    }
+    pthread_mutex_lock(&self->wake_mutex);
+    self->sleeping.store(true);
+    // a line queued before sleeping was set has not woken the writer
+    if (false == self->pending()) {
+      pthread_cond_wait(&self->wake_cond, &self->wake_mutex);
+    }
+    self->sleeping.store(false);
+    pthread_mutex_unlock(&self->wake_mutex);
+    idle = 0;
+  }
+  return NULL;
+}
+
+void LogWriter::flush_at_exit() { writer->flush_all(); }
+
+// the child of fork() has no writer thread, and must not write the lines of
+// its parent again
+void LogWriter::forget_parent() {
+  for (buffer_t *b = writer->buffers.load(); NULL != b; b = b->next) {
+    b->drained.store(b->written.load());
+  }
+  pthread_mutex_init(&writer->drain_mutex, NULL);
+  pthread_mutex_init(&writer->wake_mutex, NULL);
+  pthread_cond_init(&writer->wake_cond, NULL);
+  writer->sleeping.store(false);
+  writer->started.store(false);
+}
+
+int LogWriter::decode(int infd, int outfd) {
+  LogRecordHeader header;
+  std::vector<char> text;
+  std::string out;
+  while (true == read_all(infd, &header, sizeof(header))) {
+    if (LOG_RECORD_MAGIC != header.magic || LOG_DECODE_MAX_LEN < header.size) {
+      return SOCC_ERROR_INVALID_PARAMETER;
+    }
+    text.resize(header.size);
+    if (0 < header.size && false == read_all(infd, &text[0], header.size)) {
+      return SOCC_ERROR_INVALID_PARAMETER;
+    }
+    time_t sec = header.time_us / 1000000;
+    struct tm tm_st;
+    localtime_r(&sec, &tm_st);
+    char stamp[32];
+    int len = snprintf(stamp, sizeof(stamp), "%02d:%02d:%02d.%06ld ",
+                       tm_st.tm_hour, tm_st.tm_min, tm_st.tm_sec,
+                       (long)(header.time_us % 1000000));
+    out.append(stamp, len);
+    out.append(text.data(), text.size());
+    if (LOG_WRITE_MAX_LEN < out.size()) {
+      write_all(outfd, out.data(), out.size());
+      out.clear();
+    }
+  }
+  write_all(outfd, out.data(), out.size());
+  return SOCC_OK;
+}
@@ -0,0 +1,140 @@
+/**
+ * @file log_writer.h
+ * @brief Header file of the LogWriter.
+ */
+
+#ifndef __LOG_WRITER_H__
+#define __LOG_WRITER_H__
+
+#include <pthread.h>
+#include <stdarg.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <time.h>
+
+#include <atomic>
+#include <string>
+
+// the environment variable which makes the logs binary records
+#define LOG_BINARY_ENV "SOCC_LOG_BINARY"
+
+#define LOG_RECORD_MAGIC 0x474F4C53  // "SLOG"
+#define LOG_LINE_MAX_LEN 496
+#define LOG_RECORDS_PER_THREAD 256
+
+namespace com {
+namespace sony {
+namespace imaging {
+namespace remote {
+
+/**
+ * @brief a binary log record, followed by its text
+ */
+typedef struct LogRecordHeader {
+  uint32_t magic;    //!< LOG_RECORD_MAGIC
+  uint32_t size;     //!< bytes of the text
+  uint64_t time_us;  //!< microseconds since the epoch
+} LogRecordHeader;
+
+/**
+ * @brief Writes the log lines of the process from a background thread.
+ *
+ * Each thread queues its lines into its own ring without locks, with the time
+ * of CLOCK_MONOTONIC. A writer thread formats the time and writes the lines,
+ * so the caller does not wait for the disk or the socket. The consecutive
+ * lines of a file descriptor are written at once. The ring of a thread is
+ * freed when the thread exits, after its lines are written. A thread waits
+ * only when its ring is full, or writes a line longer than LOG_LINE_MAX_LEN
+ * itself.
+ *
+ * With the environment variable SOCC_LOG_BINARY=1, the lines are written as
+ * LogRecordHeader and the text, without formatting the time, and decode()
+ * turns them back into the text.
+ */
+class LogWriter {
+ public:
+  /**
+   * @brief the writer of the process
+   */
+  static LogWriter *instance();
+
+  /**
+   * @brief queues a line for fd, stamped with the current time
+   */
+  void vlog(int fd, const char *format, va_list ap);
+
+  /**
+   * @brief writes the lines queued by the calling thread. Call it before
+   * closing their file descriptor.
+   */
+  void flush();
+
+  /**
+   * @brief writes the lines of every thread
+   */
+  void flush_all();
+
+  bool binary();
+
+  /**
+   * @brief turns binary records into the text of the log
+   * @return 0 on success, SOCC_ERROR_INVALID_PARAMETER on a broken record
+   */
+  static int decode(int infd, int outfd);
+
+ private:
+  LogWriter();
+
+  typedef struct record_t {
+    int fd;
+    uint32_t size;
+    uint64_t time_ns;  // CLOCK_MONOTONIC
+    char text[LOG_LINE_MAX_LEN];
+  } record_t;
+
+  // a ring with a single writer, the owner thread, and a single reader, the
+  // drain under drain_mutex
+  typedef struct buffer_t {
+    record_t records[LOG_RECORDS_PER_THREAD];
+    std::atomic<uint64_t> written;
+    std::atomic<uint64_t> drained;
+    buffer_t *next;
+  } buffer_t;
+
+  std::atomic<buffer_t *> buffers;
+  pthread_mutex_t drain_mutex;
+  pthread_mutex_t wake_mutex;
+  pthread_cond_t wake_cond;
+  std::atomic<bool> sleeping;  // the writer waits for wake_cond
+  std::atomic<bool> started;
+  bool binary_records;
+  pthread_t thread_id;
+
+  // the time of the text lines, under drain_mutex
+  uint64_t offset_ns;  // CLOCK_REALTIME - CLOCK_MONOTONIC
+  time_t cached_sec;
+  char cached_hms[16];
+
+  buffer_t *local_buffer();
+  void start();
+  void wake();
+  bool pending();
+  int drain();
+  void drain(buffer_t *buffer, uint64_t end);
+  void append(std::string &out, uint64_t time_ns, const char *text,
+              size_t size);
+
+  static LogWriter *create();
+  static void release_buffer(void *vp);
+  static void create_buffer_key();
+  static void *writer_thread(void *vp);
+  static void flush_at_exit();
+  static void forget_parent();
+};
+
+}  // namespace remote
+}  // namespace imaging
+}  // namespace sony
+}  // namespace com
+
+#endif  // __LOG_WRITER_H__
@@ -83,11 +83,21 @@ be called.
 to \em outfile.\n
  *   If \em infile which is the outfile by getting "recv" command is set, the
 parsing it is only executed.\n
- *   If \-\-if=\- is set, read a data from stdin.
+ *   If \-\-if=\- is set, read a data from stdin.\n
+ *   If \em infile is a directory or a glob pattern like 'dumps/\*.dat', its
+dumps are parsed in parallel by \-\-jobs=N threads, the processors by
+default. If \em outfile is a directory, each dump is written to a file of its
+name there, otherwise all of them to \em outfile or stdout in the order of
+their names.\n
+ *   \-\-format=text|json|csv|bin selects the output of the parsing. json
+writes a line of each dump, csv a row of each property, and bin an
+OfflineSummaryHeader and OfflineSummaryRecord of the properties, with the
+CRC-32C of the current value of an array or a string.
  * - control get DevicePropertyCode [\-\-if=infile] [\-\-of=outfile]
 [\-\-log=logfile] [\-\-bus=busn] [\-\-dev=devn]\n
  *   execute SONY_GETALLEXTDEVICEPROPINFO and then parse it and the dataset of
 \em DevicePropertyCode is output to \em outfile.\n
+ *   \-\-if, \-\-format and \-\-jobs are the ones of getall.\n
  * - control getobject handle [\-\-of=outfile] [\-\-log=logfile] [\-\-bus=busn]
 [\-\-dev=devn]\n
  *   execute GetObject command for \em handle. The object data output to \em
@@ -95,6 +105,114 @@ outfile.
  * - control getliveview [\-\-of=outfile] [\-\-log=logfile] [\-\-bus=busn]
 [\-\-dev=devn]\n
  *   get the LiveView image and output to \em outfile.
+ * - control burst count [\-\-of=outfile] [\-\-log=logfile] [\-\-bus=busn]
+[\-\-dev=devn]\n
+ *   shoot \em count images without waiting for each image, while the images
+buffered by the camera are downloaded in background.\n
+ *   \em outfile is a printf format which takes the number of the image, for
+example shoot%04u.jpg (default).
+ *   The statistics like shots/sec and the buffer depth output to stdout.
+ * - control stats [\-\-of=outfile] [\-\-bus=busn] [\-\-dev=devn]\n
+ *   output the statistics of the transactions since the server has started,
+as JSON to \em outfile.\n
+ *   For each operation code, the counts of the transactions, errors and
+stalls, the bytes transferred, the percentiles of the latency and the average
+time to each phase (request sent, first and last data, response).
+ * - control fleet operations [\-\-p1=code] [\-\-data=value] [\-\-size=size]
+[\-\-of=outfile] [\-\-log=logfile] [\-\-sony|\-\-fx30]\n
+ *   execute \em operations, separated by comma, on all the cameras (Sony
+cameras with \-\-sony, FX30 with \-\-fx30) in parallel in this process.\n
+ *   The operations are open, auth, set (the device property \em code to
+\em value of \em size bytes), trigger, sync (trigger at the same time on
+all the cameras, with the skew), download (the shot image to camNN.jpg) and
+close.
+ *   The result and the latency of each camera output to \em outfile.
+ *
+ * @par Batch
+ * - control batch \-\-script=scriptfile [\-\-of=outfile] [\-\-log=logfile]
+[\-\-bus=busn] [\-\-dev=devn]\n
+ *   execute the steps of \em scriptfile (stdin with \-\-script=\-) back to
+back in the server, without a process and a connection per step. The script is
+a JSON array of steps like {"op": "send", "code": "0x9205", "params":
+["0xD25A"], "data": 1, "size": 1}. The ops are send, recv, get, getall,
+getobject, wait, await (poll a property until its value), sleep, loop, open,
+close and auth. See @link batch.h batch.h @endlink.\n
+ *   The output of a step goes to its "of" file, or to \em outfile. The time
+of each step and the total are written in \em logfile.
+ *   frontend/scripts/shoot_an_image_and_get_it.json is the batch version of
+shoot_an_image_and_get_it.sh.
+ *
+ * @par Log
+ * The log lines are queued by the thread which logs, and written by a
+background thread of the process, so the time of the disk is not added to the
+transactions. The time of a line is the time of the log call.
+
+ *   With the environment variable SOCC_LOG_BINARY=1, the server writes binary
+records without formatting the time. Start the server with it.
+ * - control decodelog \-\-if=logfile [\-\-of=outfile]
+
+ *   turn the binary records of \em logfile into the text log.
+ *
+ * @par Journal
+ * With \-\-journal=journalfile or the environment variable
+SOCC_JOURNAL=journalfile, the server appends each transaction to
+\em journalfile as a record of 64 bytes: the time, the operation code, the
+parameters, the return code, the response code, the size and the first 16
+bytes of the data, and the latency. The file is preallocated and mapped in
+memory, and an existing journal is continued. A %d in \em journalfile is
+replaced by the process ID of the server, for the servers of several cameras.
+See @link journal.h journal.h @endlink.
+ * - control journal [\-\-op=OperationCode] [\-\-errors] [\-\-min-us=us]
+[\-\-summary] [\-\-of=outfile] journalfile...\n
+ *   output the transactions of \em journalfile as text, only the ones of
+\em OperationCode, the failed ones or the ones longer than \em us if set.
+With \-\-summary, output the count, the errors, the bytes and the latency
+percentiles of each operation code instead.
+ *
+ * @par Snapshot
+ * The server keeps the current values of the properties of the last 16
+snapshots. See @link socc_snapshot.h socc_snapshot.h @endlink.
+ * - control snapshot [\-\-of=outfile] [\-\-log=logfile]\n
+ *   execute SONY_GETALLEXTDEVICEPROPINFO and keep its snapshot.
+ * - control diff [N] [\-\-of=outfile] [\-\-log=logfile]\n
+ *   take a snapshot like snapshot, and output the properties changed since
+the \em N-th latest snapshot, 1 by default, as lines of "code: before ->
+after". An added or a removed property has "-" for its missing value.
+ * - control diff \-\-if=before after [\-\-format=text|json]
+[\-\-of=outfile]\n
+ *   output the properties changed from the dump \em before to the dump
+\em after, which are the outfiles of "recv \-\-op=0x9209".
+ *
+ * @par Authentication
+ * auth polls the camera with a growing interval until it accepts the version
+and reports its properties, and logs the time spent in each step.\n
+ *   With the environment variable SOCC_AUTH_CACHE=cachefile, the version
+accepted by each camera is kept in \em cachefile by its serial number, and
+asked first the next time.
+ *
+ * @par Trace
+ * With \-\-trace=tracefile or the environment variable SOCC_TRACE=tracefile,
+the client request, the dispatch in the server, the USB transfers of each phase
+and the writes of the output are recorded to \em tracefile in the Chrome trace
+event format, which can be opened by Perfetto or chrome://tracing.\n
+ *   The server records only if it is started with the trace, so stop the
+running server with "control close" before.
+ *
+ * @par Serial number
+ * With \-\-serial=serial, the command is sent to the camera of the serial
+number instead of a bus number and a device number, which change when the
+camera is plugged again. The server of the camera is named after the serial
+number and started with \-\-reconnect, so the commands reach the same server
+wherever the camera is plugged back.
+ *
+ * @par Reconnect
+ * With \-\-reconnect, the server started by the command survives the removal
+of the camera, like a glitch of the USB cable. When the camera of the same
+vendor ID, product ID and serial number comes back, the server reopens it and
+replays OpenSession, the authentication and the last value sent to each
+property by SDIO_SetExtDevicePropValue, then serves the commands which have
+waited meanwhile.\n
+ *   The time to get ready again is output to the stderr of the server.
  *
  * @section log_sample Log Sample
  * The following log is the log when
@@ -288,8 +406,15 @@ p3=0x00000000, p4=0x00000000, p5=0x00000000
 #include <unistd.h>
 #include <utime.h>
 
+#include <string>
+#include <vector>
+
+#include "batch.h"
 #include "command.h"
+#include "journal.h"
+#include "ports_usb_registry.h"
 #include "serverclient.h"
+#include "socc_trace.h"
 #include "socket.hpp"
 #include "websocket_integration.h"
 #include "sony_device_finder.h"
@@ -299,7 +424,8 @@ void usage() {
   fprintf(stderr,
           "Commands:\n"
           "  send, recv, wait, clear, reset, open, close, auth, getall, get, "
-          "getobject, getliveview, websocket, listsony\n");
+          "getobject, getliveview, burst, fleet, stats, batch, decodelog, "
+          "journal, snapshot, diff, websocket, listsony\n");
   fprintf(stderr,
           "Options:\n"
           "  --op=OPERATION-CODE          Operation code\n"
@@ -308,12 +434,19 @@ void usage() {
           "  --size=size                  Data size\n"
           "  --log=logfile                Output a log to logfile\n"
           "  --of=outfile                 Output a output to outfile\n"
-          "  --if=infile                  Input from infile\n"
+          "  --if=infile                  Input from infile, a directory or a glob\n"
+          "  --format=text|json|csv|bin   Output of the parsed infile\n"
+          "  --jobs=N                     Threads parsing a directory of infile\n"
           "  --bus=BUS-NUMBER             USB bus number\n"
           "  --dev=DEV-NUMBER             USB assigned device number\n"
+          "  --serial=SERIAL-NUMBER       Camera of the serial number\n"
+          "  --script=scriptfile          Batch script, - for stdin\n"
           "  --sony                       Auto-detect Sony camera (use first found)\n"
           "  --fx30                       Auto-detect Sony FX30 camera\n"
           "  --camera-index=N             Use camera index N (0-based, requires --sony or --fx30)\n"
+          "  --trace=tracefile            Record a trace to tracefile for Perfetto\n"
+          "  --journal=journalfile        Record the transactions to journalfile\n"
+          "  --reconnect                  Keep the server for the camera to come back\n"
           "\n"
           "WebSocket mode:\n"
           "  control websocket [PORT]     Start WebSocket server (default: 8080)\n"
@@ -323,6 +456,28 @@ void usage() {
           "\n");
 }
 
+static int read_script(const char *filename, std::string &script) {
+  FILE *fp = 0 == strcmp("-", filename) ? stdin : fopen(filename, "r");
+  if (NULL == fp) {
+    fprintf(stderr, "cannot open %s: %s\n", filename, strerror(errno));
+    return -1;
+  }
+  char buf[4096];
+  size_t size;
+  while (0 < (size = fread(buf, 1, sizeof(buf), fp))) {
+    script.append(buf, size);
+  }
+  if (stdin != fp) {
+    fclose(fp);
+  }
+  if (BATCH_SCRIPT_MAX_LEN < script.size()) {
+    fprintf(stderr, "the script(%s) is over %d bytes\n", filename,
+            BATCH_SCRIPT_MAX_LEN);
+    return -1;
+  }
+  return 0;
+}
+
 #define OPTCMP(value, str, COMMAND) \
   if (!strcmp(str, argv[1])) {      \
     value = COMMAND;                \
@@ -334,9 +489,17 @@ int main(int argc, char **argv) {
   bool auto_detect_sony = false;
   bool auto_detect_fx30 = false;
   int camera_index = 0;
+  bool reconnect = false;
+  const char *serial = NULL;
   com::sony::imaging::remote::PTPTransaction transaction;
   uint16_t device_property_code = 0;
   uint32_t handle = 0;
+  const char *fleet_ops = NULL;
+  const char *script_file = NULL;
+  com::sony::imaging::remote::JournalFilter journal_filter;
+  memset(&journal_filter, 0, sizeof(journal_filter));
+  int format = OFFLINE_FORMAT_TEXT;
+  int jobs = 0;
   char infilename[FILENAME_MAX_LEN];
   infilename[0] = 0;
   char outfilename[FILENAME_MAX_LEN];
@@ -351,7 +514,12 @@ int main(int argc, char **argv) {
       {"p5", 1, 0, 0},    {"size", 1, 0, 's'}, {"data", 1, 0, 'D'},
       {"log", 1, 0, 'l'}, {"op", 1, 0, 'O'},   {"if", 1, 0, 'i'},
       {"of", 1, 0, 'o'},  {"sony", 0, 0, 0},   {"fx30", 0, 0, 0},
-      {"camera-index", 1, 0, 0}, {0, 0, 0, 0}};
+      {"camera-index", 1, 0, 0}, {"trace", 1, 0, 0},
+      {"reconnect", 0, 0, 0},    {"serial", 1, 0, 0},
+      {"script", 1, 0, 0},       {"journal", 1, 0, 0},
+      {"errors", 0, 0, 0},       {"min-us", 1, 0, 0},
+      {"summary", 0, 0, 0},      {"format", 1, 0, 0},
+      {"jobs", 1, 0, 0},         {0, 0, 0, 0}};
 
   if (argc < 2) {
     usage();
@@ -397,6 +565,32 @@ int main(int argc, char **argv) {
     }
   }
   OPTCMP(command, "getliveview", GETLIVEVIEW);
+  OPTCMP(command, "burst", BURST);
+  if (BURST == command) {
+    char *endptr = NULL;
+    if (argc >= 3) {
+      transaction.params[0] = strtoul(argv[2], &endptr, 0);
+      transaction.nparam = 1;
+    }
+    if (argc < 3 || argv[2] == endptr) {
+      fprintf(stderr, "command: \"burst\" needs the number of shots\n");
+      return -1;
+    }
+  }
+  OPTCMP(command, "fleet", FLEET);
+  if (FLEET == command) {
+    if (argc < 3 || '-' == argv[2][0]) {
+      fprintf(stderr, "command: \"fleet\" needs operations\n");
+      return -1;
+    }
+    fleet_ops = argv[2];
+  }
+  OPTCMP(command, "stats", STATS);
+  OPTCMP(command, "batch", BATCH);
+  OPTCMP(command, "decodelog", DECODELOG);
+  OPTCMP(command, "journal", JOURNAL);
+  OPTCMP(command, "snapshot", SNAPSHOT);
+  OPTCMP(command, "diff", DIFF);
   OPTCMP(command, "websocket", WEBSOCKET);
   OPTCMP(command, "listsony", LISTSONY);
 
@@ -419,6 +613,47 @@ int main(int argc, char **argv) {
           camera_index = strtoll(optarg, NULL, 0);
           fprintf(stderr, "Camera index: %d\n", camera_index);
         }
+        if (!(strcmp("trace", loptions[option_index].name))) {
+          // inherited by the server forked from this process
+          setenv(SOCC_TRACE_ENV, optarg, 1);
+          fprintf(stderr, "trace: %s\n", optarg);
+        }
+        if (!(strcmp("reconnect", loptions[option_index].name))) {
+          reconnect = true;
+          fprintf(stderr, "reconnect: on\n");
+        }
+        if (!(strcmp("serial", loptions[option_index].name))) {
+          serial = optarg;
+          fprintf(stderr, "serial: %s\n", serial);
+        }
+        if (!(strcmp("script", loptions[option_index].name))) {
+          script_file = optarg;
+          fprintf(stderr, "script: %s\n", script_file);
+        }
+        if (!(strcmp("journal", loptions[option_index].name))) {
+          // inherited by the server forked from this process
+          setenv(JOURNAL_ENV, optarg, 1);
+          fprintf(stderr, "journal: %s\n", optarg);
+        }
+        if (!(strcmp("errors", loptions[option_index].name))) {
+          journal_filter.errors = true;
+        }
+        if (!(strcmp("min-us", loptions[option_index].name))) {
+          journal_filter.min_us = strtoul(optarg, NULL, 0);
+        }
+        if (!(strcmp("summary", loptions[option_index].name))) {
+          journal_filter.summary = true;
+        }
+        if (!(strcmp("format", loptions[option_index].name))) {
+          format = com::sony::imaging::remote::offline_format(optarg);
+          if (-1 == format) {
+            fprintf(stderr, "unknown format: %s\n", optarg);
+            return -1;
+          }
+        }
+        if (!(strcmp("jobs", loptions[option_index].name))) {
+          jobs = strtol(optarg, NULL, 0);
+        }
         if (!(strcmp("p1", loptions[option_index].name))) {
           uint32_t param = strtoll(optarg, NULL, 0);
           fprintf(stderr, "p1: %u\n", param);
@@ -547,6 +782,89 @@ int main(int argc, char **argv) {
     }
   }
 
+  if (SOCC_OK != com::sony::imaging::remote::socc_trace_start_from_env(
+                     "control")) {
+    fprintf(stderr, "cannot open the trace file: %s\n", strerror(errno));
+  }
+
+  // the images are written by the server, whose directory may differ
+  if (command == BURST) {
+    char cwd[PATH_MAX];
+    const char *format = outfilename[0] != 0 ? outfilename : "shoot%04u.jpg";
+    int len;
+    if (format[0] == '/' || NULL == getcwd(cwd, sizeof(cwd))) {
+      len = snprintf(transaction.data.file, FILENAME_MAX_LEN, "%s", format);
+    } else {
+      len = snprintf(transaction.data.file, FILENAME_MAX_LEN, "%s/%s", cwd,
+                     format);
+    }
+    if (FILENAME_MAX_LEN <= len) {
+      fprintf(stderr, "the file(%s) path is too long\n", format);
+      return 1;
+    }
+    fprintf(stderr, "images: %s\n", transaction.data.file);
+    outfilename[0] = 0;
+  }
+
+  // the steps run in the server, whose directory may differ
+  std::string script;
+  if (command == BATCH) {
+    if (NULL == script_file) {
+      fprintf(stderr, "command: \"batch\" needs --script\n");
+      return -1;
+    }
+    if (0 != read_script(script_file, script)) {
+      return 1;
+    }
+    if (NULL == getcwd(transaction.data.file, FILENAME_MAX_LEN)) {
+      transaction.data.file[0] = 0;
+    }
+  }
+
+  // the dumps are compared in this process, otherwise the server compares
+  // with its latest snapshot or the N-th latest
+  if (command == DIFF) {
+    if (0 != infilename[0]) {
+      if (optind >= argc) {
+        fprintf(stderr, "command: \"diff\" needs the later dump\n");
+        return -1;
+      }
+      return com::sony::imaging::remote::offline_diff(
+          infilename, argv[optind], outfilename, format);
+    }
+    handle = optind < argc ? strtoul(argv[optind], NULL, 0) : 1;
+  }
+
+  // the journals are read in this process
+  if (command == JOURNAL) {
+    std::vector<std::string> files;
+    if (0 != infilename[0]) {
+      files.push_back(infilename);
+    }
+    for (int i = optind; i < argc; i++) {
+      files.push_back(argv[i]);
+    }
+    if (files.empty()) {
+      fprintf(stderr, "command: \"journal\" needs journal files\n");
+      return -1;
+    }
+    journal_filter.code = transaction.code;
+    int outfd = STDOUT_FILENO;
+    if (0 != outfilename[0] && 0 != strcmp("-", outfilename)) {
+      outfd = open(outfilename, O_WRONLY | O_CREAT | O_TRUNC, 0666);
+      if (-1 == outfd) {
+        fprintf(stderr, "cannot open %s: %s\n", outfilename, strerror(errno));
+        return 1;
+      }
+    }
+    int ret = com::sony::imaging::remote::journal_decode(files, journal_filter,
+                                                         outfd);
+    if (STDOUT_FILENO != outfd) {
+      close(outfd);
+    }
+    return SOCC_OK == ret ? 0 : 1;
+  }
+
   // List Sony devices command
   if (command == LISTSONY) {
     com::sony::imaging::remote::SonyDeviceFinder finder;
@@ -586,6 +904,29 @@ int main(int argc, char **argv) {
     return 0;
   }
   
+  // Multi-camera command, every camera in this process without the server
+  if (command == FLEET) {
+    com::sony::imaging::remote::SonyDeviceFinder finder;
+    auto devices = auto_detect_fx30 ? finder.findFX30Cameras()
+                                    : finder.findSonyCameras();
+    if (devices.empty()) {
+      fprintf(stderr, "No %s cameras found\n",
+              auto_detect_fx30 ? "Sony FX30" : "Sony");
+      return 1;
+    }
+
+    com::sony::imaging::remote::socc_fleet fleet;
+    for (size_t i = 0; i < devices.size(); i++) {
+      if (fleet.add(devices[i].bus, devices[i].address) < 0) {
+        fprintf(stderr, "cannot add camera at bus %d, device %d\n",
+                devices[i].bus, devices[i].address);
+        return 1;
+      }
+    }
+    com::sony::imaging::remote::Command c(logfilename, outfilename);
+    return c.fleet(&fleet, fleet_ops, &transaction);
+  }
+
   // Auto-detect Sony camera if requested
   if (auto_detect_sony || auto_detect_fx30) {
     com::sony::imaging::remote::SonyDeviceFinder finder;
@@ -611,6 +952,17 @@ int main(int argc, char **argv) {
             camera_index, devices[camera_index].product_name.c_str(), busn, devn);
   }
 
+  if (NULL != serial && command == WEBSOCKET) {
+    com::sony::imaging::ports::usb_registry_entry_t entry;
+    if (SOCC_OK != com::sony::imaging::ports::ports_usb_registry::instance()
+                       ->find_serial(serial, entry)) {
+      fprintf(stderr, "No camera of the serial number %s\n", serial);
+      return 1;
+    }
+    busn = entry.info.busn;
+    devn = entry.info.devn;
+  }
+
   // WebSocket server mode
   if (command == WEBSOCKET) {
     int port = 8080; // Default WebSocket port
@@ -637,15 +989,21 @@ int main(int argc, char **argv) {
   // offline
   if (0 != strnlen(infilename, FILENAME_MAX_LEN)) {
     return com::sony::imaging::remote::offline(infilename, outfilename, command,
-                                               device_property_code);
+                                               device_property_code, format,
+                                               jobs);
   }
 
   // online
   com::sony::imaging::remote::SocketClient *server_port =
-      com::sony::imaging::remote::server_create(busn, devn);
+      NULL != serial
+          ? com::sony::imaging::remote::server_create(serial)
+          : com::sony::imaging::remote::server_create(busn, devn, reconnect);
+  if (NULL == server_port) {
+    return 1;
+  }
   int ret = com::sony::imaging::remote::client(
       server_port, logfilename, outfilename, command, &transaction,
-      device_property_code, handle);
+      device_property_code, handle, command == BATCH ? script.c_str() : NULL);
   delete server_port;
 
   return ret;
@@ -0,0 +1,87 @@
+#include "metrics.h"
+#include <stdio.h>
+
+namespace com {
+namespace sony {
+namespace imaging {
+namespace remote {
+
+ShardedCounter::ShardedCounter() {
+    for (int i = 0; i < kShards; i++) {
+        shards_[i].value.store(0, std::memory_order_relaxed);
+    }
+}
+
+int ShardedCounter::shard() {
+    static std::atomic<int> next(0);
+    static thread_local int index = next.fetch_add(1, std::memory_order_relaxed) % kShards;
+    return index;
+}
+
+void ShardedCounter::add(int64_t delta) {
+    shards_[shard()].value.fetch_add(delta, std::memory_order_relaxed);
+}
+
+int64_t ShardedCounter::value() const {
+    int64_t sum = 0;
+    for (int i = 0; i < kShards; i++) {
+        sum += shards_[i].value.load(std::memory_order_relaxed);
+    }
+    return sum;
+}
+
+void MetricsWriter::family(const char* name, const char* type, const char* help) {
+    text_ += "# HELP ";
+    text_ += name;
+    text_ += " ";
+    text_ += help;
+    text_ += "\n# TYPE ";
+    text_ += name;
+    text_ += " ";
+    text_ += type;
+    text_ += "\n";
+}
+
+void MetricsWriter::sample(const char* name, const std::string& labels, double value) {
+    char buf[64];
+    snprintf(buf, sizeof(buf), " %.15g\n", value);
+    text_ += name;
+    if (!labels.empty()) {
+        text_ += "{" + labels + "}";
+    }
+    text_ += buf;
+}
+
+void MetricsWriter::histogram(const char* name, const std::string& labels, const OperationStats& stats) {
+    static const uint64_t bounds_us[] = {100, 250, 500, 1000, 2500, 5000, 10000, 25000,
+                                         50000, 100000, 250000, 500000, 1000000,
+                                         2500000, 5000000, 10000000};
+    const int nbounds = sizeof(bounds_us) / sizeof(bounds_us[0]);
+    std::string bucket = std::string(name) + "_bucket";
+    std::string sum = std::string(name) + "_sum";
+    std::string count = std::string(name) + "_count";
+    char le[32];
+
+    // a bucket of socc_stats is counted where all of its latencies fit
+    uint64_t cumulative = 0;
+    int b = 0;
+    for (int i = 0; i < nbounds; i++) {
+        while (b < SOCC_STATS_BUCKETS && socc_stats::bucket_upper_us(b) <= bounds_us[i]) {
+            cumulative += stats.histogram[b++];
+        }
+        snprintf(le, sizeof(le), "le=\"%g\"", bounds_us[i] / 1000000.0);
+        sample(bucket.c_str(), labels + "," + le, cumulative);
+    }
+    uint64_t total = 0;
+    for (int i = 0; i < SOCC_STATS_BUCKETS; i++) {
+        total += stats.histogram[i];
+    }
+    sample(bucket.c_str(), labels + ",le=\"+Inf\"", total);
+    sample(sum.c_str(), labels, stats.total_us / 1000000.0);
+    sample(count.c_str(), labels, total);
+}
+
+} // namespace remote
+} // namespace imaging
+} // namespace sony
+} // namespace com
@@ -0,0 +1,64 @@
+#ifndef __METRICS_H__
+#define __METRICS_H__
+
+#include <stdint.h>
+#include <atomic>
+#include <string>
+#include "socc_stats.h"
+
+namespace com {
+namespace sony {
+namespace imaging {
+namespace remote {
+
+/**
+ * @brief Counter updated from many threads without locks.
+ *
+ * Each thread adds to its own cache line, so the updates do not bounce a
+ * shared line between the cores. Reading sums the shards. A negative delta
+ * makes it a gauge.
+ */
+class ShardedCounter {
+public:
+    ShardedCounter();
+
+    void add(int64_t delta = 1);
+    int64_t value() const;
+
+private:
+    static const int kShards = 16;
+
+    struct alignas(64) Shard {
+        std::atomic<int64_t> value;
+    };
+    Shard shards_[kShards];
+
+    static int shard();
+};
+
+/**
+ * @brief Builds the Prometheus text exposition format.
+ */
+class MetricsWriter {
+public:
+    void family(const char* name, const char* type, const char* help);
+    void sample(const char* name, const std::string& labels, double value);
+
+    /**
+     * @brief writes the histogram of an operation code of socc_stats in
+     * seconds, with the buckets from 100 us to 10 s
+     */
+    void histogram(const char* name, const std::string& labels, const OperationStats& stats);
+
+    const std::string& str() const { return text_; }
+
+private:
+    std::string text_;
+};
+
+} // namespace remote
+} // namespace imaging
+} // namespace sony
+} // namespace com
+
+#endif // __METRICS_H__
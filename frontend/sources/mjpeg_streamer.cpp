@@ -0,0 +1,246 @@
+#include "mjpeg_streamer.h"
+#include <sys/socket.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <signal.h>
+#include <errno.h>
+#include <cstdio>
+#include <cstring>
+#include <chrono>
+
+namespace com {
+namespace sony {
+namespace imaging {
+namespace remote {
+
+static const char* MJPEG_BOUNDARY = "frame";
+static const char* MJPEG_TRAILER = "\r\n";
+
+MjpegStreamer::MjpegStreamer(socc_liveview* liveview)
+    : liveview_(liveview), running_(false), held_(false), frames_sent_(0), frames_skipped_(0) {
+}
+
+MjpegStreamer::~MjpegStreamer() {
+    stop();
+}
+
+bool MjpegStreamer::start() {
+    if (running_) {
+        return true;
+    }
+    // a viewer going away must not kill the process
+    signal(SIGPIPE, SIG_IGN);
+    running_ = true;
+    thread_ = std::thread(&MjpegStreamer::streamLoop, this);
+    return true;
+}
+
+void MjpegStreamer::stop() {
+    running_ = false;
+    if (thread_.joinable()) {
+        thread_.join();
+    }
+
+    std::lock_guard<std::mutex> lock(mutex_);
+    for (auto& viewer : viewers_) {
+        closeViewer(viewer);
+    }
+    viewers_.clear();
+    held_ = false;
+    liveview_->stop();
+}
+
+bool MjpegStreamer::hold() {
+    std::lock_guard<std::mutex> lock(mutex_);
+    held_ = true;
+    return liveview_->start() == SOCC_OK;
+}
+
+bool MjpegStreamer::addViewer(int client_fd) {
+    // the engine is started and stopped under the lock of the viewers, not to
+    // race with the last viewer going away
+    std::lock_guard<std::mutex> lock(mutex_);
+    if (liveview_->start() != SOCC_OK) {
+        stopIdleEngine();
+        return false;
+    }
+
+    char response[256];
+    int len = snprintf(response, sizeof(response),
+                       "HTTP/1.1 200 OK\r\n"
+                       "Content-Type: multipart/x-mixed-replace; boundary=%s\r\n"
+                       "Cache-Control: no-cache, no-store\r\n"
+                       "Pragma: no-cache\r\n"
+                       "Connection: close\r\n"
+                       "\r\n",
+                       MJPEG_BOUNDARY);
+    if (send(client_fd, response, len, 0) != len) {
+        stopIdleEngine();
+        return false;
+    }
+
+    int flags = fcntl(client_fd, F_GETFL, 0);
+    fcntl(client_fd, F_SETFL, flags | O_NONBLOCK);
+
+    Viewer viewer;
+    memset(&viewer, 0, sizeof(viewer));
+    viewer.fd = client_fd;
+    viewers_.push_back(viewer);
+    return true;
+}
+
+size_t MjpegStreamer::viewerCount() {
+    std::lock_guard<std::mutex> lock(mutex_);
+    return viewers_.size();
+}
+
+void MjpegStreamer::streamLoop() {
+    uint64_t sequence = 0;
+    std::vector<struct pollfd> pfds;
+    std::vector<size_t> indexes;
+
+    while (running_) {
+        bool pending = false;
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            for (auto& viewer : viewers_) {
+                pending = pending || viewer.frame != NULL;
+            }
+        }
+
+        // one fetch from the camera per frame, whatever the number of viewers
+        LiveViewFrame* frame = NULL;
+        int ret = liveview_->acquire(&frame, sequence, pending ? 0 : 100);
+        if (ret == SOCC_OK) {
+            sequence = frame->sequence;
+            std::lock_guard<std::mutex> lock(mutex_);
+            for (auto& viewer : viewers_) {
+                if (viewer.frame == NULL) {
+                    liveview_->retain(frame);
+                    beginFrame(viewer, frame);
+                } else {
+                    // still sending an older frame, this one is skipped
+                    frames_skipped_++;
+                }
+            }
+            liveview_->release(frame);
+        } else if (ret != SOCC_ERROR_USB_TIMEOUT) {
+            std::this_thread::sleep_for(std::chrono::milliseconds(100));
+        }
+
+        pfds.clear();
+        indexes.clear();
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            for (size_t i = 0; i < viewers_.size(); i++) {
+                struct pollfd pfd;
+                pfd.fd = viewers_[i].fd;
+                pfd.events = viewers_[i].frame != NULL ? POLLOUT : 0;
+                pfd.revents = 0;
+                pfds.push_back(pfd);
+                indexes.push_back(i);
+            }
+        }
+        if (pfds.empty()) {
+            continue;
+        }
+
+        // viewers are only removed by this thread, so the indexes stay valid
+        poll(pfds.data(), pfds.size(), pending ? 10 : 0);
+
+        std::lock_guard<std::mutex> lock(mutex_);
+        for (size_t i = pfds.size(); i-- > 0;) {
+            Viewer& viewer = viewers_[indexes[i]];
+            bool alive = true;
+            if (pfds[i].revents & (POLLERR | POLLHUP | POLLNVAL)) {
+                alive = false;
+            } else if (pfds[i].revents & POLLOUT) {
+                alive = continueFrame(viewer);
+            }
+            if (!alive) {
+                closeViewer(viewer);
+                viewers_.erase(viewers_.begin() + indexes[i]);
+                stopIdleEngine();
+            }
+        }
+    }
+}
+
+void MjpegStreamer::beginFrame(Viewer& viewer, LiveViewFrame* frame) {
+    viewer.frame = frame;
+    viewer.sent = 0;
+    viewer.header_len = snprintf(viewer.header, sizeof(viewer.header),
+                                 "--%s\r\n"
+                                 "Content-Type: image/jpeg\r\n"
+                                 "Content-Length: %u\r\n"
+                                 "\r\n",
+                                 MJPEG_BOUNDARY, frame->jpeg_size);
+    // the write is tried at once, the rest is sent when the socket is writable
+    if (!continueFrame(viewer)) {
+        shutdown(viewer.fd, SHUT_RDWR);
+    }
+}
+
+bool MjpegStreamer::continueFrame(Viewer& viewer) {
+    LiveViewFrame* frame = viewer.frame;
+    size_t trailer_len = strlen(MJPEG_TRAILER);
+    size_t total = viewer.header_len + frame->jpeg_size + trailer_len;
+
+    while (viewer.sent < total) {
+        struct iovec iov[3];
+        int n = 0;
+        size_t offset = viewer.sent;
+
+        if (offset < viewer.header_len) {
+            iov[n].iov_base = viewer.header + offset;
+            iov[n++].iov_len = viewer.header_len - offset;
+            offset = 0;
+        } else {
+            offset -= viewer.header_len;
+        }
+        if (offset < frame->jpeg_size) {
+            iov[n].iov_base = frame->jpeg + offset;
+            iov[n++].iov_len = frame->jpeg_size - offset;
+            offset = 0;
+        } else {
+            offset -= frame->jpeg_size;
+        }
+        iov[n].iov_base = (void*)(MJPEG_TRAILER + offset);
+        iov[n++].iov_len = trailer_len - offset;
+
+        ssize_t written = writev(viewer.fd, iov, n);
+        if (written < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            return errno == EAGAIN || errno == EWOULDBLOCK;
+        }
+        viewer.sent += written;
+    }
+
+    liveview_->release(frame);
+    viewer.frame = NULL;
+    frames_sent_++;
+    return true;
+}
+
+void MjpegStreamer::closeViewer(Viewer& viewer) {
+    if (viewer.frame != NULL) {
+        liveview_->release(viewer.frame);
+        viewer.frame = NULL;
+    }
+    close(viewer.fd);
+}
+
+void MjpegStreamer::stopIdleEngine() {
+    // nobody is watching, so the camera is not polled for frames
+    if (viewers_.empty() && !held_) {
+        liveview_->stop();
+    }
+}
+
+} // namespace remote
+} // namespace imaging
+} // namespace sony
+} // namespace com
@@ -0,0 +1,79 @@
+#ifndef __MJPEG_STREAMER_H__
+#define __MJPEG_STREAMER_H__
+
+#include <sys/uio.h>
+#include <stdint.h>
+#include <atomic>
+#include <mutex>
+#include <thread>
+#include <vector>
+#include "socc_liveview.h"
+
+namespace com {
+namespace sony {
+namespace imaging {
+namespace remote {
+
+/**
+ * @brief Serves the LiveView frames of socc_liveview as multipart/x-mixed-replace
+ * MJPEG to any number of HTTP viewers.
+ *
+ * Each frame is fetched once from the camera and written to every viewer with
+ * writev() straight from the frame buffer. A viewer which cannot keep up skips
+ * to the latest frame instead of queueing. The engine is started with the
+ * first viewer and stopped after the last one, unless it is held.
+ */
+class MjpegStreamer {
+public:
+    MjpegStreamer(socc_liveview* liveview);
+    ~MjpegStreamer();
+
+    bool start();
+    void stop();
+
+    /**
+     * @brief sends the HTTP response header and adds the connection to the viewers.
+     * The streamer owns client_fd afterwards.
+     */
+    bool addViewer(int client_fd);
+
+    /**
+     * @brief starts the engine and keeps it running without viewers, until stop()
+     */
+    bool hold();
+
+    size_t viewerCount();
+    uint64_t framesSent() const { return frames_sent_; }
+    uint64_t framesSkipped() const { return frames_skipped_; }
+
+private:
+    struct Viewer {
+        int fd;
+        LiveViewFrame* frame;   // frame being sent, NULL when idle
+        char header[96];
+        size_t header_len;
+        size_t sent;            // bytes of header + jpeg + trailer already sent
+    };
+
+    socc_liveview* liveview_;
+    std::vector<Viewer> viewers_;
+    std::mutex mutex_;
+    std::thread thread_;
+    std::atomic<bool> running_;
+    bool held_;
+    std::atomic<uint64_t> frames_sent_;
+    std::atomic<uint64_t> frames_skipped_;
+
+    void streamLoop();
+    void beginFrame(Viewer& viewer, LiveViewFrame* frame);
+    bool continueFrame(Viewer& viewer);
+    void closeViewer(Viewer& viewer);
+    void stopIdleEngine();
+};
+
+} // namespace remote
+} // namespace imaging
+} // namespace sony
+} // namespace com
+
+#endif // __MJPEG_STREAMER_H__
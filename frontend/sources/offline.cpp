@@ -0,0 +1,527 @@
+#include "offline.h"
+
+#include <dirent.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <glob.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <atomic>
+#include <map>
+#include <vector>
+
+#include "parser.h"
+#include "socc_crc32c.h"
+#include "socc_snapshot.h"
+#include "socc_types.h"
+
+using namespace com::sony::imaging::remote;
+
+// the first read of the input which is not a regular file
+#define OFFLINE_READ_SIZE (64 * 1024)
+
+typedef struct job_t {
+  std::string path;
+  std::string out;
+  int ret;
+  bool done;
+} job_t;
+
+typedef struct batch_t {
+  std::vector<job_t> jobs;
+  std::atomic<size_t> next;
+  const char *outdir;  // NULL for a single output
+  uint16_t device_property_code;
+  int format;
+  pthread_mutex_t mutex;
+  pthread_cond_t cond;  // a job is done
+} batch_t;
+
+static const char *extensions[] = {"txt", "json", "csv", "bin"};
+
+static bool is_directory(const char *path) {
+  struct stat st;
+  return 0 == stat(path, &st) && S_ISDIR(st.st_mode);
+}
+
+static bool is_regular(const char *path) {
+  struct stat st;
+  return 0 == stat(path, &st) && S_ISREG(st.st_mode);
+}
+
+static void json_string(std::string &out, const char *value) {
+  out.append("\"");
+  for (const char *p = value; *p != 0; p++) {
+    uint8_t c = *p;
+    if ('"' == c || '\\' == c) {
+      out.append(1, '\\');
+      out.append(1, c);
+    } else if (c < 0x20) {
+      char buf[8];
+      snprintf(buf, sizeof(buf), "\\u%04x", c);
+      out.append(buf);
+    } else {
+      out.append(1, c);
+    }
+  }
+  out.append("\"");
+}
+
+static void csv_field(std::string &out, const std::string &value) {
+  if (std::string::npos == value.find_first_of(",\"\r\n")) {
+    out.append(value);
+    return;
+  }
+  out.append("\"");
+  for (size_t i = 0; i < value.size(); i++) {
+    if ('"' == value[i]) {
+      out.append("\"");
+    }
+    out.append(1, value[i]);
+  }
+  out.append("\"");
+}
+
+int com::sony::imaging::remote::offline_format(const char *name) {
+  const char *names[] = {"text", "json", "csv", "bin"};
+  for (int i = 0; i < 4; i++) {
+    if (0 == strcmp(names[i], name)) {
+      return i;
+    }
+  }
+  return -1;
+}
+
+bool com::sony::imaging::remote::offline_is_batch(const char *infile) {
+  return is_directory(infile) || NULL != strpbrk(infile, "*?[");
+}
+
+int com::sony::imaging::remote::offline_load(int fd, OfflineDump &dump) {
+  memset(&dump, 0, sizeof(dump));
+  struct stat st;
+  if (0 != fstat(fd, &st)) {
+    return SOCC_ERROR_FILE_IO;
+  }
+  if (S_ISREG(st.st_mode) && 0 < st.st_size) {
+    void *p = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    if (MAP_FAILED != p) {
+      dump.data = p;
+      dump.size = st.st_size;
+      dump.mapped = true;
+      return SOCC_OK;
+    }
+  }
+
+  // a pipe, or a file which cannot be mapped
+  size_t capacity = S_ISREG(st.st_mode) && 0 < st.st_size
+                        ? (size_t)st.st_size + 1
+                        : OFFLINE_READ_SIZE;
+  char *buf = (char *)malloc(capacity);
+  while (NULL != buf) {
+    if (dump.size == capacity) {
+      char *grown = (char *)realloc(buf, capacity * 2);
+      if (NULL == grown) {
+        break;
+      }
+      buf = grown;
+      capacity *= 2;
+    }
+    ssize_t ret = read(fd, buf + dump.size, capacity - dump.size);
+    if (ret < 0 && EINTR == errno) {
+      continue;
+    }
+    if (ret < 0) {
+      break;
+    }
+    if (0 == ret) {
+      dump.data = buf;
+      return SOCC_OK;
+    }
+    dump.size += ret;
+  }
+  free(buf);
+  dump.size = 0;
+  return SOCC_ERROR_FILE_IO;
+}
+
+void com::sony::imaging::remote::offline_unload(OfflineDump &dump) {
+  if (true == dump.mapped) {
+    munmap(dump.data, dump.size);
+  } else {
+    free(dump.data);
+  }
+  memset(&dump, 0, sizeof(dump));
+}
+
+bool com::sony::imaging::remote::offline_write_all(int fd,
+                                                  const std::string &out) {
+  const char *data = out.data();
+  size_t size = out.size();
+  while (size > 0) {
+    ssize_t ret = write(fd, data, size);
+    if (ret < 0) {
+      if (EINTR == errno) {
+        continue;
+      }
+      return false;
+    }
+    data += ret;
+    size -= ret;
+  }
+  return true;
+}
+
+int com::sony::imaging::remote::offline_format_dump(
+    const OfflineDump &dump, const char *name, uint16_t device_property_code,
+    int format, bool header, std::string &out) {
+  uint32_t size = UINT32_MAX < dump.size ? UINT32_MAX : dump.size;
+  SDIDevicePropInfoDatasetArray info(dump.data, size);
+  const std::map<uint16_t, SDIDevicePropInfoDataset *> &datasets =
+      info.datasets();
+  std::vector<SDIDevicePropInfoDataset *> selected;
+  std::map<uint16_t, SDIDevicePropInfoDataset *>::const_iterator it;
+  for (it = datasets.begin(); it != datasets.end(); it++) {
+    if (0 == device_property_code || device_property_code == it->first) {
+      selected.push_back(it->second);
+    }
+  }
+  if (0 != device_property_code && selected.empty()) {
+    fprintf(stderr, "%s: device_property_code: 0x%04X is not exist\n", name,
+            device_property_code);
+  }
+
+  std::string value;
+  switch (format) {
+    case OFFLINE_FORMAT_TEXT:
+      if (true == header) {
+        out.append("file: ").append(name).append("\n");
+      }
+      if (0 == device_property_code) {
+        info.toString(out);
+      } else {
+        for (size_t i = 0; i < selected.size(); i++) {
+          selected[i]->toString(out);
+        }
+      }
+      break;
+    case OFFLINE_FORMAT_JSON:
+      out.append("{\"file\": ");
+      json_string(out, name);
+      out.append(", \"num\": ").append(std::to_string(info.num));
+      out.append(", \"valid\": ").append(info.valid() ? "true" : "false");
+      out.append(", \"properties\": [");
+      for (size_t i = 0; i < selected.size(); i++) {
+        if (i > 0) {
+          out.append(", ");
+        }
+        selected[i]->toJson(out);
+      }
+      out.append("]}\n");
+      break;
+    case OFFLINE_FORMAT_CSV:
+      if (true == header) {
+        out.append("file,code,type,get_set,is_enable,form_flag,current\n");
+      }
+      for (size_t i = 0; i < selected.size(); i++) {
+        SDIDevicePropInfoDataset *d = selected[i];
+        char buf[64];
+        csv_field(out, name);
+        snprintf(buf, sizeof(buf), ",0x%04X,0x%04X,%u,%u,%u,",
+                 d->DevicePropertyCode, d->DataType, d->GetSet, d->IsEnable,
+                 d->FormFlag);
+        out.append(buf);
+        value.clear();
+        d->currentValueToString(value);
+        csv_field(out, value);
+        out.append("\n");
+      }
+      break;
+    case OFFLINE_FORMAT_BINARY: {
+      OfflineSummaryHeader h;
+      memset(&h, 0, sizeof(h));
+      h.magic = OFFLINE_SUMMARY_MAGIC;
+      h.name_len = strlen(name);
+      h.valid = info.valid() ? 1 : 0;
+      h.num = selected.size();
+      out.append((const char *)&h, sizeof(h));
+      out.append(name, h.name_len);
+      for (size_t i = 0; i < selected.size(); i++) {
+        SDIDevicePropInfoDataset *d = selected[i];
+        OfflineSummaryRecord r;
+        memset(&r, 0, sizeof(r));
+        r.code = d->DevicePropertyCode;
+        r.type = d->DataType;
+        r.get_set = d->GetSet;
+        r.is_enable = d->IsEnable;
+        r.form_flag = d->FormFlag;
+        value.clear();
+        d->currentValueToString(value);
+        if (0 == (d->DataType & 0xF000)) {
+          // the decimal of an integer, signed ones as two's complement
+          r.current = '-' == value[0]
+                          ? (uint64_t)strtoll(value.c_str(), NULL, 10)
+                          : strtoull(value.c_str(), NULL, 10);
+        } else {
+          r.current = socc_crc32c(0, value.data(), value.size());
+        }
+        out.append((const char *)&r, sizeof(r));
+      }
+      break;
+    }
+  }
+  return true == info.valid() ? SOCC_OK : SOCC_ERROR_INVALID_PARAMETER;
+}
+
+// the output of a dump in outdir: its name without the extension
+static std::string output_path(const char *outdir, const std::string &path,
+                               int format) {
+  size_t slash = path.rfind('/');
+  std::string base =
+      std::string::npos == slash ? path : path.substr(slash + 1);
+  size_t dot = base.rfind('.');
+  if (std::string::npos != dot && 0 < dot) {
+    base.resize(dot);
+  }
+  return std::string(outdir) + "/" + base + "." + extensions[format];
+}
+
+static int run_job(batch_t *batch, job_t &job) {
+  const char *path = job.path.c_str();
+  int fd = open(path, O_RDONLY);
+  if (-1 == fd) {
+    fprintf(stderr, "cannot open %s: %s\n", path, strerror(errno));
+    return SOCC_ERROR_FILE_IO;
+  }
+  OfflineDump dump;
+  int ret = offline_load(fd, dump);
+  close(fd);
+  if (SOCC_OK != ret) {
+    fprintf(stderr, "cannot read %s: %s\n", path, strerror(errno));
+    return ret;
+  }
+  // the name of each dump in a text, the header of a CSV once per file
+  bool header = OFFLINE_FORMAT_TEXT == batch->format ||
+                NULL != batch->outdir || &job == &batch->jobs[0];
+  ret = offline_format_dump(dump, path, batch->device_property_code,
+                            batch->format, header, job.out);
+  offline_unload(dump);
+  if (SOCC_OK != ret) {
+    fprintf(stderr, "%s is truncated or broken\n", path);
+  }
+  if (NULL == batch->outdir) {
+    return ret;
+  }
+
+  std::string out_path = output_path(batch->outdir, job.path, batch->format);
+  int outfd = open(out_path.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0666);
+  if (-1 == outfd || false == offline_write_all(outfd, job.out)) {
+    fprintf(stderr, "cannot write %s: %s\n", out_path.c_str(),
+            strerror(errno));
+    ret = SOCC_ERROR_FILE_IO;
+  }
+  if (-1 != outfd) {
+    close(outfd);
+  }
+  job.out.clear();
+  return ret;
+}
+
+static void *worker(void *vp) {
+  batch_t *batch = (batch_t *)vp;
+  size_t i;
+  while ((i = batch->next.fetch_add(1)) < batch->jobs.size()) {
+    job_t &job = batch->jobs[i];
+    int ret = run_job(batch, job);
+    pthread_mutex_lock(&batch->mutex);
+    job.ret = ret;
+    job.done = true;
+    pthread_cond_broadcast(&batch->cond);
+    pthread_mutex_unlock(&batch->mutex);
+  }
+  return NULL;
+}
+
+// the regular files of a directory or a glob pattern, sorted by name
+static void list_files(const char *infile, std::vector<std::string> &files) {
+  if (is_directory(infile)) {
+    DIR *dir = opendir(infile);
+    if (NULL == dir) {
+      return;
+    }
+    struct dirent *entry;
+    while (NULL != (entry = readdir(dir))) {
+      if ('.' == entry->d_name[0]) {
+        continue;
+      }
+      std::string path = std::string(infile) + "/" + entry->d_name;
+      if (is_regular(path.c_str())) {
+        files.push_back(path);
+      }
+    }
+    closedir(dir);
+    std::sort(files.begin(), files.end());
+    return;
+  }
+  glob_t g;
+  if (0 == glob(infile, 0, NULL, &g)) {
+    for (size_t i = 0; i < g.gl_pathc; i++) {
+      if (is_regular(g.gl_pathv[i])) {
+        files.push_back(g.gl_pathv[i]);
+      }
+    }
+  }
+  globfree(&g);
+}
+
+int com::sony::imaging::remote::offline_batch(const char *infile,
+                                              const char *outfile,
+                                              uint16_t device_property_code,
+                                              int format, int jobs) {
+  std::vector<std::string> files;
+  list_files(infile, files);
+  if (files.empty()) {
+    fprintf(stderr, "no dumps in %s\n", infile);
+    return -1;
+  }
+
+  batch_t batch;
+  batch.jobs.resize(files.size());
+  for (size_t i = 0; i < files.size(); i++) {
+    batch.jobs[i].path = files[i];
+    batch.jobs[i].ret = SOCC_OK;
+    batch.jobs[i].done = false;
+  }
+  batch.next.store(0);
+  batch.outdir = is_directory(outfile) ? outfile : NULL;
+  batch.device_property_code = device_property_code;
+  batch.format = format;
+  pthread_mutex_init(&batch.mutex, NULL);
+  pthread_cond_init(&batch.cond, NULL);
+
+  int outfd = STDOUT_FILENO;
+  if (NULL == batch.outdir && 0 != outfile[0] && 0 != strcmp("-", outfile)) {
+    outfd = open(outfile, O_WRONLY | O_CREAT | O_TRUNC, 0666);
+    if (-1 == outfd) {
+      fprintf(stderr, "cannot open %s: %s\n", outfile, strerror(errno));
+      return -1;
+    }
+  }
+
+  if (jobs <= 0) {
+    jobs = sysconf(_SC_NPROCESSORS_ONLN);
+  }
+  jobs = std::max(1, std::min(jobs, (int)files.size()));
+  std::vector<pthread_t> threads(jobs);
+  int started = 0;
+  for (int i = 0; i < jobs; i++) {
+    if (0 == pthread_create(&threads[started], NULL, worker, &batch)) {
+      started++;
+    }
+  }
+  if (0 == started) {
+    worker(&batch);
+  }
+
+  // the dumps are written in order while the later ones are parsed
+  int ret = 0;
+  for (size_t i = 0; i < batch.jobs.size(); i++) {
+    job_t &job = batch.jobs[i];
+    pthread_mutex_lock(&batch.mutex);
+    while (false == job.done) {
+      pthread_cond_wait(&batch.cond, &batch.mutex);
+    }
+    pthread_mutex_unlock(&batch.mutex);
+    if (SOCC_OK != job.ret) {
+      ret = -1;
+    }
+    if (NULL == batch.outdir) {
+      offline_write_all(outfd, job.out);
+      std::string().swap(job.out);
+    }
+  }
+  for (int i = 0; i < started; i++) {
+    pthread_join(threads[i], NULL);
+  }
+  if (STDOUT_FILENO != outfd) {
+    close(outfd);
+  }
+  pthread_cond_destroy(&batch.cond);
+  pthread_mutex_destroy(&batch.mutex);
+  fprintf(stderr, "%zu dumps, %d threads\n", files.size(),
+          0 < started ? started : 1);
+  return ret;
+}
+
+static int load_snapshot(const char *path, socc_snapshot &snap) {
+  int fd = open(path, O_RDONLY);
+  if (-1 == fd) {
+    fprintf(stderr, "cannot open %s: %s\n", path, strerror(errno));
+    return -1;
+  }
+  OfflineDump dump;
+  int ret = offline_load(fd, dump);
+  close(fd);
+  if (SOCC_OK != ret) {
+    fprintf(stderr, "cannot read %s: %s\n", path, strerror(errno));
+    return -1;
+  }
+  uint32_t size = UINT32_MAX < dump.size ? UINT32_MAX : dump.size;
+  ret = snap.parse(dump.data, size);
+  offline_unload(dump);
+  if (SOCC_OK != ret) {
+    fprintf(stderr, "%s is truncated or broken\n", path);
+    return -1;
+  }
+  return 0;
+}
+
+int com::sony::imaging::remote::offline_diff(const char *before,
+                                             const char *after,
+                                             const char *outfile,
+                                             int format) {
+  if (OFFLINE_FORMAT_TEXT != format && OFFLINE_FORMAT_JSON != format) {
+    fprintf(stderr, "diff is written as text or json\n");
+    return -1;
+  }
+  socc_snapshot a, b;
+  if (0 != load_snapshot(before, a) || 0 != load_snapshot(after, b)) {
+    return -1;
+  }
+  std::vector<SnapshotChange> changes;
+  socc_snapshot::diff(a, b, changes);
+
+  std::string out;
+  if (OFFLINE_FORMAT_JSON == format) {
+    out.append("{\"before\": ");
+    json_string(out, before);
+    out.append(", \"after\": ");
+    json_string(out, after);
+    out.append(", \"changes\": ");
+    socc_snapshot::changes_to_json(a, b, changes, out);
+    out.append("}\n");
+  } else {
+    socc_snapshot::changes_to_string(a, b, changes, out);
+  }
+
+  int outfd = STDOUT_FILENO;
+  if (0 != outfile[0] && 0 != strcmp("-", outfile)) {
+    outfd = open(outfile, O_WRONLY | O_CREAT | O_TRUNC, 0666);
+    if (-1 == outfd) {
+      fprintf(stderr, "cannot open %s: %s\n", outfile, strerror(errno));
+      return -1;
+    }
+  }
+  bool written = offline_write_all(outfd, out);
+  if (STDOUT_FILENO != outfd) {
+    close(outfd);
+  }
+  fprintf(stderr, "%zu properties changed\n", changes.size());
+  return written ? 0 : -1;
+}
@@ -0,0 +1,127 @@
+/**
+ * @file offline.h
+ * @brief Header file of the offline parsing of the dumps of
+ * GetAllExtDevicePropInfo.
+ */
+
+#ifndef __OFFLINE_H__
+#define __OFFLINE_H__
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include <string>
+
+// the formats of the parsed dumps
+#define OFFLINE_FORMAT_TEXT 0
+#define OFFLINE_FORMAT_JSON 1
+#define OFFLINE_FORMAT_CSV 2
+#define OFFLINE_FORMAT_BINARY 3
+
+#define OFFLINE_SUMMARY_MAGIC 0x4D555353  // "SSUM"
+
+namespace com {
+namespace sony {
+namespace imaging {
+namespace remote {
+
+/**
+ * @brief the binary summary of a dump, followed by its name and the records
+ */
+typedef struct OfflineSummaryHeader {
+  uint32_t magic;     //!< OFFLINE_SUMMARY_MAGIC
+  uint16_t name_len;  //!< bytes of the name of the dump
+  uint16_t valid;     //!< 1 if all the datasets have been parsed
+  uint32_t num;       //!< the OfflineSummaryRecord after the name
+  uint32_t reserved;
+} OfflineSummaryHeader;
+
+/**
+ * @brief a device property in the binary summary
+ */
+typedef struct OfflineSummaryRecord {
+  uint16_t code;      //!< DevicePropertyCode
+  uint16_t type;      //!< DataType
+  uint8_t get_set;    //!< GetSet
+  uint8_t is_enable;  //!< IsEnable
+  uint8_t form_flag;  //!< FormFlag
+  uint8_t reserved;
+  uint64_t current;  //!< the current value of an integer, or the CRC-32C of
+                     //!< the current value of an array and a string
+} OfflineSummaryRecord;
+
+/**
+ * @brief a dump in the memory, mapped if it is a file
+ */
+typedef struct OfflineDump {
+  void *data;   //!< the bytes of the dump
+  size_t size;  //!< the size of data
+  bool mapped;  //!< data is mapped, else allocated
+} OfflineDump;
+
+/**
+ * @brief the format of its name, text, json, csv or bin
+ * @return OFFLINE_FORMAT_*, -1 for an unknown name
+ */
+int offline_format(const char *name);
+
+/**
+ * @brief whether infile is a directory or a glob pattern of dumps
+ */
+bool offline_is_batch(const char *infile);
+
+/**
+ * @brief maps a regular file, or reads the others at once
+ * @return 0 on success, SOCC_ERROR_FILE_IO on failure
+ */
+int offline_load(int fd, OfflineDump &dump);
+
+void offline_unload(OfflineDump &dump);
+
+/**
+ * @brief writes the whole of out, again after a short write or EINTR
+ * @return false on an error of write(), which is left in errno
+ */
+bool offline_write_all(int fd, const std::string &out);
+
+/**
+ * @brief parses a dump and formats it
+ * @param [in]dump the dump
+ * @param [in]name the name of the dump in the output
+ * @param [in]device_property_code the property, 0 for all
+ * @param [in]format OFFLINE_FORMAT_*
+ * @param [in]header the header row of a CSV, or the name line of a text
+ * @param [out]out the formatted dump
+ * @return 0 on success, SOCC_ERROR_INVALID_PARAMETER if the dump is truncated
+ * or has an unsupported dataset, whose preceding datasets are formatted
+ */
+int offline_format_dump(const OfflineDump &dump, const char *name,
+                        uint16_t device_property_code, int format, bool header,
+                        std::string &out);
+
+/**
+ * @brief parses the dumps of a directory or a glob pattern in parallel
+ *
+ * If outfile is a directory, each dump is written to a file of its name with
+ * the extension of the format. Otherwise all the dumps are written to outfile,
+ * or stdout if it is empty or "-", in the order of their names.
+ * @param [in]jobs the threads, 0 for the processors
+ * @return 0 if all the dumps have been parsed, -1 otherwise
+ */
+int offline_batch(const char *infile, const char *outfile,
+                  uint16_t device_property_code, int format, int jobs);
+
+/**
+ * @brief writes the properties changed between two dumps
+ * @param [in]format OFFLINE_FORMAT_TEXT or OFFLINE_FORMAT_JSON
+ * @return 0 on success, -1 if a dump cannot be read or is broken
+ */
+int offline_diff(const char *before, const char *after, const char *outfile,
+                 int format);
+
+}  // namespace remote
+}  // namespace imaging
+}  // namespace sony
+}  // namespace com
+
+#endif  // __OFFLINE_H__
@@ -5,6 +5,7 @@
 #include <getopt.h>
 #include <netinet/in.h>
 #include <poll.h>
+#include <pthread.h>
 #include <signal.h>
 #include <stddef.h>
 #include <stdio.h>
@@ -15,15 +16,45 @@
 #include <sys/stat.h>
 #include <sys/types.h>
 #include <sys/un.h>
+#include <time.h>
 #include <unistd.h>
 #include <utime.h>
 
+#include <algorithm>
+#include <deque>
+#include <list>
+#include <map>
+#include <string>
+#include <vector>
+
+#include "batch.h"
 #include "command.h"
+#include "event_loop.h"
+#include "log_writer.h"
+#include "offline.h"
 #include "parser.h"
+#include "ports_usb_registry.h"
+#include "socc_snapshot.h"
+#include "socc_time.h"
+#include "socc_trace.h"
 #include "socket.hpp"
 
 using namespace com::sony::imaging::remote;
 
+// a camera just arrived may not accept the configuration yet
+#define RECONNECT_RETRIES 50
+#define RECONNECT_INTERVAL_US 20000
+// after the retries on the arrival, the camera is looked for this often
+#define RESTORE_INTERVAL_US 1000000
+
+// what the clients have set up on the camera, replayed after a reconnection
+typedef struct session_state_t {
+  bool opened;
+  bool authenticated;
+  // the last SDIO_SetExtDevicePropValue of each DevicePropertyCode
+  std::map<uint32_t, PTPTransaction> properties;
+} session_state_t;
+
 static int open_output_file(char *filename, int flag) {
   int outfd = STDOUT_FILENO;
   if (0 == strncmp("-", filename, FILENAME_MAX_LEN)) {
@@ -50,7 +81,8 @@ static void close_output_file(int fd) {
 int com::sony::imaging::remote::client(
     SocketClient *serverport, char *logfile, char *outfile, int command,
     com::sony::imaging::remote::PTPTransaction *transaction,
-    uint16_t device_property_code, uint32_t handle) {
+    uint16_t device_property_code, uint32_t handle, const char *script) {
+  uint64_t begin = socc_trace_now();
   char out_server2client[SOCKET_NAME_MAX_LEN];
   snprintf(out_server2client, SOCKET_NAME_MAX_LEN, "s2c%dout", getpid());
   SocketServer *out = new SocketServer(out_server2client);
@@ -69,6 +101,11 @@ int com::sony::imaging::remote::client(
                     sizeof(com::sony::imaging::remote::PTPTransaction));
   serverport->write(&device_property_code, sizeof(device_property_code));
   serverport->write(&handle, sizeof(handle));
+  if (NULL != script) {
+    uint32_t length = strlen(script);
+    serverport->write(&length, sizeof(length));
+    serverport->write(script, length);
+  }
 
   size_t buf_size = 1024 * 1024;
   char *buf = new char[buf_size];
@@ -88,7 +125,9 @@ int com::sony::imaging::remote::client(
     if (true == log->is_request_connect()) {
       log->accept();
     }
-    if (true == serverport->is_hup()) {
+    // a fast server may have answered and hung up already
+    if (true == serverport->is_hup() &&
+        (false == out->is_accepted() || false == log->is_accepted())) {
       delete[] buf;
       goto bail;
     }
@@ -98,7 +137,7 @@ int com::sony::imaging::remote::client(
 
   // open output files
   outfd = open_output_file(outfile, O_TRUNC);
-  logfd = open_output_file(logfile, O_SYNC | O_APPEND);
+  logfd = open_output_file(logfile, O_APPEND);
 
   ssize_t read_size;
   do {
@@ -113,7 +152,10 @@ int com::sony::imaging::remote::client(
         if (read_size < 0) {
           break;
         }
+        uint64_t write_begin = socc_trace_now();
         write(outfd, buf, read_size);
+        socc_trace_span("output write", "disk", write_begin, "bytes",
+                        read_size);
       } while (0 < read_size);
     }
     if (true == log->is_recv_data()) {
@@ -140,28 +182,64 @@ int com::sony::imaging::remote::client(
 bail:
   delete out;
   delete log;
+  socc_trace_span("client", "ipc", begin, "command", command);
 
   return 0;
 }
 
-SocketClient *com::sony::imaging::remote::server_create(int busn, int devn) {
+static void spawn_server(SocketClient *client, char *socket_name, int busn,
+                         int devn, bool reconnect) {
+  SocketServer *serverport = new SocketServer(socket_name);
+  if (0 == fork()) {
+    delete client;
+    server(busn, devn, serverport, reconnect);
+    delete serverport;
+    exit(0);
+  }
+  delete serverport;
+  if (false == client->connect()) {
+    fprintf(stderr, "cannot connect server: %s\n", strerror(errno));
+    exit(0);
+  }
+}
+
+SocketClient *com::sony::imaging::remote::server_create(int busn, int devn,
+                                                        bool reconnect) {
   char socket_name[SOCKET_NAME_MAX_LEN];
   snprintf(socket_name, SOCKET_NAME_MAX_LEN, "c2s%03d%03d", busn, devn);
   SocketClient *client = new SocketClient(socket_name);
 
   if (false == client->connect()) {
-    SocketServer *serverport = new SocketServer(socket_name);
-    if (0 == fork()) {
-      delete client;
-      server(busn, devn, serverport);
-      delete serverport;
-      exit(0);
+    spawn_server(client, socket_name, busn, devn, reconnect);
+  }
+
+  return client;
+}
+
+SocketClient *com::sony::imaging::remote::server_create(const char *serial) {
+  char socket_name[SOCKET_NAME_MAX_LEN];
+  int len = snprintf(socket_name, SOCKET_NAME_MAX_LEN, "c2s-%s", serial);
+  if (SOCKET_NAME_MAX_LEN <= len) {
+    fprintf(stderr, "the serial number(%s) is too long\n", serial);
+    return NULL;
+  }
+  for (char *p = socket_name; *p != 0; p++) {
+    if ('/' == *p) {
+      *p = '_';
     }
-    delete serverport;
-    if (false == client->connect()) {
-      fprintf(stderr, "cannot connect server: %s\n", strerror(errno));
-      exit(0);
+  }
+  SocketClient *client = new SocketClient(socket_name);
+
+  // the server of a camera survives its replug, wherever it is plugged back
+  if (false == client->connect()) {
+    com::sony::imaging::ports::usb_registry_entry_t entry;
+    if (SOCC_OK != com::sony::imaging::ports::ports_usb_registry::instance()
+                       ->find_serial(serial, entry)) {
+      fprintf(stderr, "no camera of the serial number %s\n", serial);
+      delete client;
+      return NULL;
     }
+    spawn_server(client, socket_name, entry.info.busn, entry.info.devn, true);
   }
 
   return client;
@@ -169,169 +247,885 @@ SocketClient *com::sony::imaging::remote::server_create(int busn, int devn) {
 
 static void hotplug_callback(socc_hotplug_event_t event, void *data) {
   int *fd = (int *)data;
-  if (SOCC_HOTPLUG_EVENT_REMOVED == event) {
-    close(*fd);
-    *fd = -1;
+  unsigned char e = event;
+  if (-1 != *fd) {
+    write(*fd, &e, sizeof(e));
   }
 }
 
-void com::sony::imaging::remote::server(int busn, int devn,
-                                        SocketServer *serverport) {
-#if 0
-    int wait = 1;
-    while(wait) {
-        sleep(1);
+static void record_session(session_state_t *state, int command,
+                           PTPTransaction *transaction, int ret) {
+  if (SOCC_OK != ret) {
+    return;
+  }
+  switch (command) {
+    case OPEN:
+      state->opened = true;
+      break;
+    case CLOSE:
+      state->opened = false;
+      state->authenticated = false;
+      state->properties.clear();
+      break;
+    case AUTH:
+      state->authenticated = true;
+      break;
+    case SEND:
+      if (0x9205 == transaction->code && 0 < transaction->nparam) {
+        state->properties[transaction->params[0]] = *transaction;
+      }
+      break;
+  }
+}
+
+static int restore_session(socc_ptp *ptp, session_state_t *state,
+                           int retries) {
+  int ret = SOCC_ERROR_USB_DEVICE_NOT_FOUND;
+  for (int i = 0; i < retries && SOCC_OK != ret; i++) {
+    if (0 < i) {
+      usleep(RECONNECT_INTERVAL_US);
     }
-#endif
-  int command = 0;
-  com::sony::imaging::remote::PTPTransaction transaction;
-  uint16_t device_property_code;
-  uint32_t handle;
-  char outfilename[SOCKET_NAME_MAX_LEN];
-  outfilename[0] = 0;
-  char logfilename[SOCKET_NAME_MAX_LEN];
-  logfilename[0] = 0;
-  int pipefd[2];
-  com::sony::imaging::remote::socc_ptp *ptp = NULL;
+    ret = ptp->reconnect();
+  }
+  if (SOCC_OK != ret) {
+    return ret;
+  }
 
-  ptp = new com::sony::imaging::remote::socc_ptp(busn, devn);
-  if (NULL == ptp) {
-    return;
+  char devnull[] = "/dev/null";
+  Command c(devnull, devnull);
+  if (state->opened && SOCC_OK != (ret = c.open(ptp))) {
+    return ret;
   }
-  pipe(pipefd);
-  ptp->set_hotplug_callback(hotplug_callback, &pipefd[1]);
+  if (state->authenticated && SOCC_OK != (ret = c.auth(ptp))) {
+    return ret;
+  }
+  std::map<uint32_t, PTPTransaction>::iterator it;
+  for (it = state->properties.begin(); it != state->properties.end(); ++it) {
+    PTPTransaction transaction = it->second;
+    if (SOCC_OK != (ret = c.send(ptp, &transaction))) {
+      return ret;
+    }
+  }
+  return SOCC_OK;
+}
 
-  if (SOCC_OK != ptp->connect()) {
-    fprintf(stderr, "cannot connect to the camera\n");
-    close(pipefd[1]);
-    pipefd[1] = -1;
-  }
-
-  struct pollfd accept_fds[2];
-  struct pollfd data_fds[1];
-  while (1) {
-    serverport->prepare_accept(&accept_fds[0]);
-    accept_fds[1].fd = pipefd[0];
-    accept_fds[1].events = POLLIN;
-    accept_fds[1].revents = 0;
-    if (poll(accept_fds, 2, -1) < 0) {
-      break;
-    };
-    if (true == serverport->is_request_connect()) {
-      serverport->accept();
+// the daemon loop wakes up this often, for the timeouts of the parked WAITs
+#define TIMER_INTERVAL_MS 100
+// a parked WAIT times out like the interrupt transfer of wait_event()
+#define WAIT_TIMEOUT_US 5000000
+// the events of the camera kept for the next WAITs
+#define CAMERA_EVENTS_MAX 64
+#define LOOP_EVENTS_MAX 16
+
+// the sources of the daemon loop, which are the tags of EventLoop
+typedef enum source_type_t {
+  SOURCE_LISTEN,   // a client is connecting
+  SOURCE_HOTPLUG,  // the pipe written by hotplug_callback
+  SOURCE_CAMERA,   // the event thread of socc_ptp has delivered events
+  SOURCE_TIMER,    // the periodic work
+  SOURCE_CLIENT,   // an accepted client has sent its request
+  SOURCE_WAITER,   // the client of a parked WAIT has hung up
+} source_type_t;
+
+typedef struct source_t {
+  source_type_t type;
+  int fd;
+} source_t;
+
+// a WAIT answered by the next event of the camera
+typedef struct waiter_t {
+  source_t source;  // first, so that the tag of the loop is the waiter
+  int request_fd;
+  Command *command;
+  SocketClient *out;
+  SocketClient *log;
+  uint64_t deadline_us;
+} waiter_t;
+
+// the events handed over by the event thread of socc_ptp
+typedef struct camera_events_t {
+  pthread_mutex_t mutex;
+  std::deque<AsyncResult> results;
+  EventLoop *loop;
+} camera_events_t;
+
+// a step done by a batch, recorded by the loop
+typedef struct batch_step_t {
+  int command;
+  PTPTransaction transaction;
+  int ret;
+} batch_step_t;
+
+// a batch script, run by its own thread so that the loop goes on with the
+// clients, the events and the camera meanwhile. The loop answers its WAITs and
+// records its steps, woken by notify() like for the events of the camera.
+typedef struct batch_t {
+  socc_ptp *ptp;
+  EventLoop *loop;
+  bool events;  // the loop answers the WAITs with the event thread
+  bool started;
+  pthread_t thread_id;
+  int request_fd;
+  Command *command;
+  SocketClient *out;
+  SocketClient *log;
+  std::string script;
+  char dir[FILENAME_MAX_LEN];
+  pthread_mutex_t mutex;
+  pthread_cond_t cond;  // the WAIT is answered or canceled
+  // under mutex
+  bool waiting;   // for an event
+  bool answered;  // event is set
+  AsyncResult event;
+  bool stopping;  // the daemon finishes, and cancels the WAITs
+  std::deque<batch_step_t> steps;  // done, not recorded yet
+  bool finished;
+} batch_t;
+
+typedef struct daemon_t {
+  socc_ptp *ptp;
+  EventLoop loop;
+  bool reconnect;
+  bool online;
+  bool connected;       // the camera was connected at the start
+  bool events_started;  // the event thread of ptp runs, from the first WAIT
+  bool closed;          // a batch has closed the session
+  uint64_t removed_at;
+  uint64_t arrived_at;
+  uint64_t restore_at;  // the next attempt after a failed one, 0 if none
+  session_state_t state;
+  int pipefd[2];  // written by hotplug_callback
+  source_t listen;
+  source_t hotplug;
+  source_t camera_source;
+  source_t timer;
+  std::list<source_t *> clients;   // accepted, the request not read yet
+  std::list<waiter_t *> waiters;   // the oldest first
+  std::deque<AsyncResult> events;  // not taken by a WAIT yet
+  std::deque<socc_snapshot *> snapshots;  // the oldest first
+  std::deque<batch_t *> batches;          // the running one first
+  camera_events_t camera;
+  // closed, and freed after the batch of wait() which may still have them
+  std::vector<source_t *> closed_clients;
+  std::vector<waiter_t *> closed_waiters;
+} daemon_t;
+
+// the camera is away: the clients wait in the backlog, and the accepted ones
+// are not read until it is back
+static void set_online(daemon_t *d, bool online) {
+  d->online = online;
+  std::list<source_t *>::iterator it;
+  if (online) {
+    d->loop.add(d->listen.fd, &d->listen);
+    for (it = d->clients.begin(); it != d->clients.end(); ++it) {
+      d->loop.add((*it)->fd, *it);
     }
-    if (0 != accept_fds[1].revents) {
-      break;
+  } else {
+    d->loop.remove(d->listen.fd);
+    for (it = d->clients.begin(); it != d->clients.end(); ++it) {
+      d->loop.remove((*it)->fd);
     }
-    serverport->prepare_wait_data(data_fds);
-    if (poll(data_fds, 1, -1) < 0) {
-      break;
-    };
-    if (true == serverport->is_recv_data()) {
-      serverport->read(logfilename, sizeof(logfilename));
-      serverport->read(outfilename, sizeof(outfilename));
-      serverport->read(&command, sizeof(command));
-      serverport->read(&transaction, sizeof(transaction));
-      serverport->read(&device_property_code, sizeof(device_property_code));
-      serverport->read(&handle, sizeof(handle));
+  }
+}
+
+static void close_client(daemon_t *d, source_t *client) {
+  d->loop.remove(client->fd);
+  close(client->fd);
+  d->clients.remove(client);
+  d->closed_clients.push_back(client);
+}
+
+static void free_closed(daemon_t *d) {
+  for (size_t i = 0; i < d->closed_clients.size(); i++) {
+    delete d->closed_clients[i];
+  }
+  d->closed_clients.clear();
+  for (size_t i = 0; i < d->closed_waiters.size(); i++) {
+    delete d->closed_waiters[i];
+  }
+  d->closed_waiters.clear();
+}
+
+static void camera_event_callback(const AsyncResult &result, void *vp) {
+  camera_events_t *events = (camera_events_t *)vp;
+  pthread_mutex_lock(&events->mutex);
+  if (events->results.size() < CAMERA_EVENTS_MAX) {
+    events->results.push_back(result);
+  }
+  pthread_mutex_unlock(&events->mutex);
+  events->loop->notify();
+}
+
+static void start_camera_events(daemon_t *d) {
+  d->events_started = SOCC_OK == d->ptp->set_event_callback(
+                                     camera_event_callback, &d->camera);
+}
+
+static void stop_camera_events(daemon_t *d) {
+  if (d->events_started) {
+    d->ptp->set_event_callback(NULL, NULL);
+  }
+}
+
+static void answer(daemon_t *d, waiter_t *waiter, int ret,
+                   const Container &res) {
+  d->loop.remove(waiter->source.fd);
+  d->waiters.remove(waiter);
+  waiter->command->wait_end(ret, res);
+  delete waiter->command;
+  delete waiter->log;
+  delete waiter->out;
+  close(waiter->request_fd);
+  d->closed_waiters.push_back(waiter);
+}
+
+static void answer_all(daemon_t *d, int ret) {
+  Container res;
+  memset(&res, 0, sizeof(res));
+  while (!d->waiters.empty()) {
+    answer(d, d->waiters.front(), ret, res);
+  }
+}
+
+// answers the WAIT of the running batch. Returns false if it waits for none.
+static bool answer_batch(daemon_t *d, const AsyncResult &result) {
+  if (d->batches.empty()) {
+    return false;
+  }
+  batch_t *batch = d->batches.front();
+  pthread_mutex_lock(&batch->mutex);
+  bool waiting = batch->waiting && !batch->answered;
+  if (waiting) {
+    batch->event = result;
+    batch->answered = true;
+    pthread_cond_signal(&batch->cond);
+  }
+  pthread_mutex_unlock(&batch->mutex);
+  return waiting;
+}
+
+// the oldest WAIT takes the event, which is kept for the next WAIT otherwise.
+// The WAIT of the running batch comes first.
+static void deliver_events(daemon_t *d) {
+  std::deque<AsyncResult> results;
+  pthread_mutex_lock(&d->camera.mutex);
+  results.swap(d->camera.results);
+  pthread_mutex_unlock(&d->camera.mutex);
+
+  std::deque<AsyncResult> &oldest = d->events.empty() ? results : d->events;
+  if (!oldest.empty() && answer_batch(d, oldest.front())) {
+    oldest.pop_front();
+  }
+
+  for (size_t i = 0; i < results.size(); i++) {
+    if (!d->waiters.empty()) {
+      answer(d, d->waiters.front(), results[i].ret, results[i].response);
+    } else if (SOCC_OK == results[i].ret) {
+      if (CAMERA_EVENTS_MAX <= d->events.size()) {
+        d->events.pop_front();
+      }
+      d->events.push_back(results[i]);
+    }
+  }
+}
+
+static void expire_waiters(daemon_t *d) {
+  Container res;
+  memset(&res, 0, sizeof(res));
+  uint64_t now = socc_monotonic_us();
+  std::list<waiter_t *>::iterator it = d->waiters.begin();
+  while (it != d->waiters.end()) {
+    waiter_t *waiter = *it++;
+    if (waiter->deadline_us <= now) {
+      answer(d, waiter, SOCC_ERROR_USB_TIMEOUT, res);
+    }
+  }
+}
+
+// an arrival is not notified again, so that a failed restoration is retried
+// from the timer until the camera is back
+static void restore(daemon_t *d, int retries) {
+  uint64_t begin = socc_trace_now();
+  int ret = restore_session(d->ptp, &d->state, retries);
+  socc_trace_span("reconnect", "daemon", begin, "ret", ret);
+  if (SOCC_OK == ret) {
+    uint64_t ready_at = socc_monotonic_us();
+    d->restore_at = 0;
+    set_online(d, true);
+    if (d->events_started) {
+      start_camera_events(d);
+    }
+    fprintf(stderr,
+            "the camera is ready in %.1f ms after the removal, %.1f ms "
+            "after the arrival, %zu properties restored\n",
+            (ready_at - d->removed_at) / 1000.0,
+            (ready_at - d->arrived_at) / 1000.0, d->state.properties.size());
+  } else {
+    if (0 == d->restore_at) {
+      fprintf(stderr, "cannot restore the camera(%d), still waiting for it\n",
+              ret);
+    }
+    d->restore_at = socc_monotonic_us() + RESTORE_INTERVAL_US;
+  }
+}
+
+// returns false when the daemon should finish
+static bool on_hotplug(daemon_t *d) {
+  unsigned char event;
+  if (read(d->pipefd[0], &event, sizeof(event)) <= 0) {
+    return false;
+  }
+  if (SOCC_HOTPLUG_EVENT_REMOVED == event) {
+    if (!d->reconnect) {
+      return false;
+    }
+    if (d->online) {
+      set_online(d, false);
+      d->removed_at = socc_monotonic_us();
+      stop_camera_events(d);
+      d->events.clear();
+      answer_all(d, SOCC_ERROR_USB_DISCONNECTED);
+      AsyncResult removed;
+      memset(&removed, 0, sizeof(removed));
+      removed.ret = SOCC_ERROR_USB_DISCONNECTED;
+      answer_batch(d, removed);
+      fprintf(stderr, "the camera is removed, waiting for it\n");
+    }
+  } else if (SOCC_HOTPLUG_EVENT_ARRIVED == event && !d->online) {
+    d->arrived_at = socc_monotonic_us();
+    if (d->batches.empty()) {
+      restore(d, RECONNECT_RETRIES);
     } else {
-      continue;
+      // not to reconnect under the transactions of the batch, the timer
+      // restores the session once it has finished
+      d->restore_at = d->arrived_at;
+    }
+  }
+  return true;
+}
+
+// a WAIT is answered by a kept event, or parked until the next one
+static void wait_event(daemon_t *d, int request_fd, Command *c,
+                       SocketClient *out, SocketClient *log) {
+  c->wait_begin();
+  if (!d->events.empty()) {
+    AsyncResult result = d->events.front();
+    d->events.pop_front();
+    c->wait_end(result.ret, result.response);
+  } else {
+    waiter_t *waiter = new waiter_t;
+    // the client never writes to the log socket, which is readable once
+    // the client has hung up
+    waiter->source.type = SOURCE_WAITER;
+    waiter->source.fd = log->getCommFD();
+    waiter->request_fd = request_fd;
+    waiter->command = c;
+    waiter->out = out;
+    waiter->log = log;
+    waiter->deadline_us = socc_monotonic_us() + WAIT_TIMEOUT_US;
+    d->loop.add(waiter->source.fd, waiter);
+    d->waiters.push_back(waiter);
+    return;
+  }
+  delete c;
+  delete log;
+  delete out;
+  close(request_fd);
+}
+
+// on the thread of the batch
+static void batch_step_done(const BatchStep &step, int ret, void *vp) {
+  batch_t *batch = (batch_t *)vp;
+  batch_step_t done = {step.command, step.transaction, ret};
+  pthread_mutex_lock(&batch->mutex);
+  batch->steps.push_back(done);
+  pthread_mutex_unlock(&batch->mutex);
+  batch->loop->notify();
+}
+
+// on the thread of the batch. The loop answers it with a kept event or the
+// next one of the event thread, like a WAIT of a client.
+static int batch_wait_event(Container &event, void *vp) {
+  batch_t *batch = (batch_t *)vp;
+  if (!batch->events) {
+    return batch->ptp->wait_event(event);
+  }
+
+  struct timespec deadline;
+  clock_gettime(CLOCK_REALTIME, &deadline);
+  deadline.tv_sec += WAIT_TIMEOUT_US / 1000000;
+  int ret = SOCC_ERROR_USB_TIMEOUT;
+  pthread_mutex_lock(&batch->mutex);
+  batch->waiting = !batch->stopping;
+  batch->answered = false;
+  batch->loop->notify();
+  while (batch->waiting && !batch->answered) {
+    if (0 != pthread_cond_timedwait(&batch->cond, &batch->mutex, &deadline)) {
+      break;
+    }
+  }
+  if (batch->answered) {
+    event = batch->event.response;
+    ret = batch->event.ret;
+  } else if (batch->stopping) {
+    ret = SOCC_ERROR_CANCELED;
+  }
+  batch->waiting = false;
+  batch->answered = false;
+  pthread_mutex_unlock(&batch->mutex);
+  return ret;
+}
+
+static void *batch_thread(void *vp) {
+  batch_t *batch = (batch_t *)vp;
+  BatchHooks hooks = {batch_step_done, batch_wait_event, batch};
+  batch->command->batch(batch->ptp, batch->script.c_str(), batch->dir,
+                        &hooks);
+  pthread_mutex_lock(&batch->mutex);
+  batch->finished = true;
+  pthread_mutex_unlock(&batch->mutex);
+  batch->loop->notify();
+  return NULL;
+}
+
+static void queue_batch(daemon_t *d, int request_fd, Command *c,
+                        SocketClient *out, SocketClient *log,
+                        std::string &script, const char *dir) {
+  batch_t *batch = new batch_t;
+  batch->ptp = d->ptp;
+  batch->loop = &d->loop;
+  batch->events = false;
+  batch->started = false;
+  batch->request_fd = request_fd;
+  batch->command = c;
+  batch->out = out;
+  batch->log = log;
+  batch->script.swap(script);
+  strncpy(batch->dir, dir, sizeof(batch->dir) - 1);
+  batch->dir[sizeof(batch->dir) - 1] = '\0';
+  pthread_mutex_init(&batch->mutex, NULL);
+  pthread_cond_init(&batch->cond, NULL);
+  batch->waiting = false;
+  batch->answered = false;
+  batch->stopping = false;
+  batch->finished = false;
+  d->batches.push_back(batch);
+}
+
+static void free_batch(batch_t *batch) {
+  delete batch->command;
+  delete batch->log;
+  delete batch->out;
+  close(batch->request_fd);
+  pthread_cond_destroy(&batch->cond);
+  pthread_mutex_destroy(&batch->mutex);
+  delete batch;
+}
+
+static void print_closed() {
+  fprintf(stderr,
+          "Please power off the camera or disconnect USB cable before next "
+          "operations.\n");
+}
+
+// starts the first batch, records the steps it has done, and frees it once
+// finished to start the next one. Returns false when the daemon should
+// finish.
+static bool update_batches(daemon_t *d) {
+  while (!d->batches.empty()) {
+    batch_t *batch = d->batches.front();
+    if (!batch->started) {
+      // a single reader of the interrupt endpoint for the batch and the
+      // clients
+      if (!d->events_started && d->connected) {
+        start_camera_events(d);
+      }
+      batch->events = d->events_started;
+      batch->started =
+          0 == pthread_create(&batch->thread_id, NULL, batch_thread, batch);
+      if (!batch->started) {
+        fprintf(stderr, "cannot start the batch\n");
+        batch->finished = true;
+      }
     }
-    logfilename[SOCKET_NAME_MAX_LEN - 1] = '\0';
-    outfilename[SOCKET_NAME_MAX_LEN - 1] = '\0';
 
-    SocketClient *out = new SocketClient(outfilename);
-    if (false == out->connect()) {
-      fprintf(stderr, "cannot connect client outfile: %s(%d)\n",
-              strerror(errno), errno);
-      exit(0);
+    std::deque<batch_step_t> steps;
+    pthread_mutex_lock(&batch->mutex);
+    steps.swap(batch->steps);
+    bool finished = batch->finished;
+    pthread_mutex_unlock(&batch->mutex);
+    for (size_t i = 0; i < steps.size(); i++) {
+      record_session(&d->state, steps[i].command, &steps[i].transaction,
+                     steps[i].ret);
+      if (CLOSE == steps[i].command) {
+        d->closed = true;
+      }
+    }
+    if (!finished) {
+      return true;
     }
 
-    SocketClient *log = new SocketClient(logfilename);
-    if (false == log->connect()) {
-      fprintf(stderr, "cannot connect client logfile: %s(%d)\n",
-              strerror(errno), errno);
-      exit(0);
+    if (batch->started) {
+      pthread_join(batch->thread_id, NULL);
+    }
+    d->batches.pop_front();
+    free_batch(batch);
+    if (d->closed) {
+      print_closed();
+      return false;
     }
+  }
+  return true;
+}
 
-    com::sony::imaging::remote::Command *c =
-        new com::sony::imaging::remote::Command(log->getCommFD(),
-                                                out->getCommFD());
+// lets the running batch finish with its WAITs canceled, and drops the others
+static void stop_batches(daemon_t *d) {
+  while (!d->batches.empty()) {
+    batch_t *batch = d->batches.front();
+    if (batch->started) {
+      pthread_mutex_lock(&batch->mutex);
+      batch->stopping = true;
+      batch->waiting = false;
+      pthread_cond_signal(&batch->cond);
+      pthread_mutex_unlock(&batch->mutex);
+      pthread_join(batch->thread_id, NULL);
+    }
+    d->batches.pop_front();
+    free_batch(batch);
+  }
+}
 
-    switch (command) {
-      case SEND:
-        c->send(ptp, &transaction);
-        break;
-      case RECV:
-        if (transaction.size > 64 * 1024) {
-          fprintf(stderr, "Incorrect transaction.size value");
-          break;
-        }
-        c->recv(ptp, &transaction);
-        break;
-      case WAIT:
-        c->wait(ptp);
-        break;
-      case RESET:
-        c->reset(ptp);
-        break;
-      case CLEARHALT:
-        c->clear_halt(ptp);
-        break;
-      case OPEN:
-        c->open(ptp);
-        break;
-      case CLOSE:
-        c->close(ptp);
-        break;
-      case AUTH:
-        c->auth(ptp);
-        break;
-      case GET:
-        c->get(ptp, device_property_code);
-        break;
-      case GETALL:
-        c->getall(ptp);
-        break;
-      case GETOBJECT:
-        c->getobject(ptp, handle);
-        break;
-      case GETLIVEVIEW:
-        c->getliveview(ptp);
-        break;
+static bool read_script(int fd, std::string &script) {
+  uint32_t length = 0;
+  if (read(fd, &length, sizeof(length)) != sizeof(length) ||
+      BATCH_SCRIPT_MAX_LEN < length) {
+    return false;
+  }
+  script.resize(length);
+  for (uint32_t done = 0; done < length;) {
+    ssize_t size = read(fd, &script[done], length - done);
+    if (size <= 0) {
+      return false;
     }
+    done += size;
+  }
+  return true;
+}
+
+// returns false when the daemon should finish
+static bool on_request(daemon_t *d, source_t *client) {
+  int command = 0;
+  com::sony::imaging::remote::PTPTransaction transaction;
+  uint16_t device_property_code;
+  uint32_t handle;
+  char outfilename[SOCKET_NAME_MAX_LEN];
+  char logfilename[SOCKET_NAME_MAX_LEN];
+  std::string script;
+
+  // a client sends a single request, and waits for the answer
+  int fd = client->fd;
+  d->loop.remove(fd);
+  d->clients.remove(client);
+  d->closed_clients.push_back(client);
+  if (read(fd, logfilename, sizeof(logfilename)) <= 0) {
+    close(fd);
+    return true;
+  }
+  read(fd, outfilename, sizeof(outfilename));
+  read(fd, &command, sizeof(command));
+  read(fd, &transaction, sizeof(transaction));
+  read(fd, &device_property_code, sizeof(device_property_code));
+  read(fd, &handle, sizeof(handle));
+  if (BATCH == command && !read_script(fd, script)) {
+    fprintf(stderr, "cannot read the batch script\n");
+    close(fd);
+    return true;
+  }
+  logfilename[SOCKET_NAME_MAX_LEN - 1] = '\0';
+  outfilename[SOCKET_NAME_MAX_LEN - 1] = '\0';
 
-    delete c;
+  SocketClient *out = new SocketClient(outfilename);
+  if (false == out->connect()) {
+    fprintf(stderr, "cannot connect client outfile: %s(%d)\n",
+            strerror(errno), errno);
+    delete out;
+    close(fd);
+    return true;
+  }
+
+  SocketClient *log = new SocketClient(logfilename);
+  if (false == log->connect()) {
+    fprintf(stderr, "cannot connect client logfile: %s(%d)\n",
+            strerror(errno), errno);
     delete log;
     delete out;
-    serverport->disconnect();
+    close(fd);
+    return true;
+  }
+
+  com::sony::imaging::remote::Command *c =
+      new com::sony::imaging::remote::Command(log->getCommFD(),
+                                              out->getCommFD());
 
-    if (CLOSE == command || RESET == command) {
-      fprintf(stderr,
-              "Please power off the camera or disconnect USB cable before next "
-              "operations.\n");
+  socc_ptp *ptp = d->ptp;
+  uint64_t begin = socc_trace_now();
+  int ret = SOCC_OK;
+  switch (command) {
+    case SEND:
+      ret = c->send(ptp, &transaction);
+      break;
+    case RECV:
+      if (transaction.size > 64 * 1024) {
+        fprintf(stderr, "Incorrect transaction.size value");
+        break;
+      }
+      c->recv(ptp, &transaction);
+      break;
+    case WAIT:
+      if (!d->events_started && d->connected) {
+        start_camera_events(d);
+      }
+      if (d->events_started) {
+        wait_event(d, fd, c, out, log);
+        socc_trace_span("dispatch", "daemon", begin, "command", command);
+        return true;
+      }
+      c->wait(ptp);
+      break;
+    case RESET:
+      c->reset(ptp);
+      break;
+    case CLEARHALT:
+      c->clear_halt(ptp);
+      break;
+    case OPEN:
+      ret = c->open(ptp);
+      break;
+    case CLOSE:
+      ret = c->close(ptp);
+      break;
+    case AUTH:
+      ret = c->auth(ptp);
+      break;
+    case GET:
+      c->get(ptp, device_property_code);
+      break;
+    case GETALL:
+      c->getall(ptp);
+      break;
+    case GETOBJECT:
+      c->getobject(ptp, handle);
+      break;
+    case GETLIVEVIEW:
+      c->getliveview(ptp);
+      break;
+    case BURST:
+      transaction.data.file[FILENAME_MAX_LEN - 1] = '\0';
+      c->burst(ptp, transaction.params[0], transaction.data.file);
+      break;
+    case STATS:
+      c->stats(ptp);
+      break;
+    case SNAPSHOT:
+    case DIFF: {
+      // DIFF compares with the handle-th latest snapshot
+      socc_snapshot *snap = new socc_snapshot();
+      const socc_snapshot *before =
+          0 < handle && handle <= d->snapshots.size()
+              ? d->snapshots[d->snapshots.size() - handle]
+              : NULL;
+      ret = SNAPSHOT == command ? c->snapshot(ptp, snap)
+                                : c->diff(ptp, before, snap);
+      if (SOCC_OK != ret) {
+        delete snap;
+        break;
+      }
+      d->snapshots.push_back(snap);
+      if (SOCC_SNAPSHOT_HISTORY < d->snapshots.size()) {
+        delete d->snapshots.front();
+        d->snapshots.pop_front();
+      }
       break;
     }
+    case BATCH:
+      // answered by its thread, after the batches queued before
+      transaction.data.file[FILENAME_MAX_LEN - 1] = '\0';
+      queue_batch(d, fd, c, out, log, script, transaction.data.file);
+      socc_trace_span("dispatch", "daemon", begin, "command", command);
+      return update_batches(d);
   }
 
-  if (NULL != ptp) {
-    ptp->disconnect();
-    delete ptp;
+  record_session(&d->state, command, &transaction, ret);
+
+  delete c;
+  delete log;
+  delete out;
+  close(fd);
+  socc_trace_span("dispatch", "daemon", begin, "command", command);
+  socc_trace_flush();
+
+  if (CLOSE == command || RESET == command || d->closed) {
+    print_closed();
+    return false;
   }
+  return true;
+}
 
-  close(pipefd[0]);
-  if (-1 != pipefd[1]) {
-    close(pipefd[1]);
+void com::sony::imaging::remote::server(int busn, int devn,
+                                        SocketServer *serverport,
+                                        bool reconnect) {
+  com::sony::imaging::remote::socc_ptp *ptp = NULL;
+
+  socc_trace_start_from_env("control server");
+
+  ptp = new com::sony::imaging::remote::socc_ptp(busn, devn);
+  if (NULL == ptp) {
+    return;
   }
+  server(ptp, serverport, reconnect);
+  delete ptp;
 
   fprintf(stderr, "server finished\n");
 }
 
+void com::sony::imaging::remote::server(
+    com::sony::imaging::remote::socc_ptp *ptp, SocketServer *serverport,
+    bool reconnect) {
+  daemon_t d;
+  d.ptp = ptp;
+  d.reconnect = reconnect;
+  d.online = true;
+  d.connected = true;
+  d.events_started = false;
+  d.closed = false;
+  d.removed_at = 0;
+  d.arrived_at = 0;
+  d.restore_at = 0;
+  d.state.opened = false;
+  d.state.authenticated = false;
+  d.listen.type = SOURCE_LISTEN;
+  d.listen.fd = serverport->getListenFD();
+  d.hotplug.type = SOURCE_HOTPLUG;
+  d.camera_source.type = SOURCE_CAMERA;
+  d.camera_source.fd = -1;
+  d.timer.type = SOURCE_TIMER;
+  d.timer.fd = -1;
+  pthread_mutex_init(&d.camera.mutex, NULL);
+  d.camera.loop = &d.loop;
+
+  pipe(d.pipefd);
+  d.hotplug.fd = d.pipefd[0];
+  ptp->set_hotplug_callback(hotplug_callback, &d.pipefd[1]);
+
+  if (SOCC_OK != ptp->connect()) {
+    fprintf(stderr, "cannot connect to the camera\n");
+    close(d.pipefd[1]);
+    d.pipefd[1] = -1;
+    d.connected = false;
+  }
+
+  d.loop.add(d.listen.fd, &d.listen);
+  d.loop.add(d.hotplug.fd, &d.hotplug);
+  d.loop.set_notifier(&d.camera_source);
+  d.loop.set_timer(TIMER_INTERVAL_MS, &d.timer);
+
+  bool running = true;
+  while (running) {
+    void *tags[LOOP_EVENTS_MAX];
+    int n = d.loop.wait(tags, LOOP_EVENTS_MAX, -1);
+    if (n < 0) {
+      break;
+    }
+    for (int i = 0; i < n && running; i++) {
+      // a client or a waiter closed by an earlier source is not freed yet
+      source_t *source = (source_t *)tags[i];
+      switch (source->type) {
+        case SOURCE_LISTEN: {
+          if (!d.online) {
+            break;
+          }
+          int fd = serverport->accept_client();
+          if (-1 != fd) {
+            source_t *client = new source_t;
+            client->type = SOURCE_CLIENT;
+            client->fd = fd;
+            d.loop.add(fd, client);
+            d.clients.push_back(client);
+          }
+          break;
+        }
+        case SOURCE_HOTPLUG:
+          running = on_hotplug(&d);
+          break;
+        case SOURCE_CAMERA:
+          deliver_events(&d);
+          running = update_batches(&d);
+          break;
+        case SOURCE_TIMER:
+          expire_waiters(&d);
+          if (!d.online && 0 != d.restore_at &&
+              d.restore_at <= socc_monotonic_us() && d.batches.empty()) {
+            restore(&d, 1);
+          }
+          break;
+        case SOURCE_CLIENT:
+          // it may have been closed by an earlier source of the same wait()
+          if (d.online && d.clients.end() != std::find(d.clients.begin(),
+                                                       d.clients.end(),
+                                                       source)) {
+            running = on_request(&d, source);
+          }
+          break;
+        case SOURCE_WAITER: {
+          waiter_t *waiter = (waiter_t *)source;
+          if (d.waiters.end() !=
+              std::find(d.waiters.begin(), d.waiters.end(), waiter)) {
+            // hung up before an event
+            Container res;
+            memset(&res, 0, sizeof(res));
+            answer(&d, waiter, SOCC_ERROR_USB_DISCONNECTED, res);
+          }
+          break;
+        }
+      }
+    }
+    free_closed(&d);
+  }
+
+  while (!d.clients.empty()) {
+    close_client(&d, d.clients.front());
+  }
+  answer_all(&d, SOCC_ERROR_USB_DISCONNECTED);
+  free_closed(&d);
+  stop_batches(&d);
+  // the event thread is joined before the transfers are stopped
+  stop_camera_events(&d);
+  pthread_mutex_destroy(&d.camera.mutex);
+  while (!d.snapshots.empty()) {
+    delete d.snapshots.front();
+    d.snapshots.pop_front();
+  }
+
+  ptp->disconnect();
+
+  close(d.pipefd[0]);
+  if (-1 != d.pipefd[1]) {
+    close(d.pipefd[1]);
+  }
+}
+
 int com::sony::imaging::remote::offline(char *infile, char *outfile,
                                         int command,
-                                        uint16_t device_property_code) {
+                                        uint16_t device_property_code,
+                                        int format, int jobs) {
   int ret = 0;
 
+  if (DECODELOG != command && offline_is_batch(infile)) {
+    return offline_batch(infile, outfile,
+                         GET == command ? device_property_code : 0, format,
+                         jobs);
+  }
+
   // open input file
   int infd = STDIN_FILENO;
   if (0 == strncmp("-", infile, FILENAME_MAX_LEN)) {
@@ -343,13 +1137,9 @@ int com::sony::imaging::remote::offline(char *infile, char *outfile,
   // open output file
   int outfd = open_output_file(outfile, O_TRUNC);
 
-  void *buf = NULL;
-  SDIDevicePropInfoDatasetArray *info = NULL;
-  SDIDevicePropInfoDataset *data = NULL;
-  SimpleArray<uint32_t> *array = NULL;
-  const int size_step = 1024;
-  int read_size;
-  char *_buf;
+  OfflineDump dump;
+  std::string out;
+  memset(&dump, 0, sizeof(dump));
 
   if (-1 == infd) {
     fprintf(stderr, "cannot open %s. the reason is %s\n", infile,
@@ -357,45 +1147,32 @@ int com::sony::imaging::remote::offline(char *infile, char *outfile,
     ret = -1;
     goto err;
   }
-  struct stat stat;
-  if (0 != fstat(infd, &stat)) {
-    fprintf(stderr, "cannot stat %s. the reason is %s\n", infile,
-            strerror(errno));
-    ret = -1;
-    goto err;
-  }
 
-  _buf = (char *)buf;
-  do {
-    void *new_buf;
-    new_buf = realloc(buf, _buf - (char *)buf + size_step);
-    _buf = (char *)new_buf + (_buf - (char *)buf);
-    if (NULL == new_buf) {
-      fprintf(stderr, "input data is too big. the size is over %ld\n",
-              _buf - (char *)buf);
+  if (DECODELOG == command) {
+    if (SOCC_OK != LogWriter::decode(infd, outfd)) {
+      fprintf(stderr, "%s has a broken record\n", infile);
       ret = -1;
-      goto err;
     }
-    buf = new_buf;
-    read_size = read(infd, _buf, size_step);
-    _buf += read_size;
-  } while (read_size > 0);
+    goto err;
+  }
 
-  switch (command) {
-    case GET:
-      info = new SDIDevicePropInfoDatasetArray(buf);
-      data = info->get(device_property_code);
-      if (NULL == data) {
-        fprintf(stderr, "device_property_code: 0x%04X is not exist\n",
-                device_property_code);
-      } else {
-        data->toString();
-      }
-      break;
-    case GETALL:
-      info = new SDIDevicePropInfoDatasetArray(buf);
-      info->toString();
-      break;
+  // mapped at once, or read into a buffer doubled as it fills
+  if (SOCC_OK != offline_load(infd, dump)) {
+    fprintf(stderr, "cannot read %s. the reason is %s\n", infile,
+            strerror(errno));
+    ret = -1;
+    goto err;
+  }
+  if (SOCC_OK != offline_format_dump(dump, infile,
+                                     GET == command ? device_property_code : 0,
+                                     format, false, out)) {
+    fprintf(stderr, "%s is truncated or broken\n", infile);
+    ret = -1;
+  }
+  if (false == offline_write_all(outfd, out)) {
+    fprintf(stderr, "cannot write the output. the reason is %s\n",
+            strerror(errno));
+    ret = -1;
   }
 
 err:
@@ -403,9 +1180,7 @@ err:
     close(infd);
   }
   close_output_file(outfd);
-  free(buf);
-  delete info;
-  delete array;
+  offline_unload(dump);
 
   return ret;
 }
@@ -7,6 +7,7 @@
 #define __SERVER_CLIENT__H__
 
 #include "command.h"
+#include "offline.h"
 
 #define SEND 1
 #define RECV 2
@@ -22,6 +23,14 @@
 #define GETLIVEVIEW 16
 #define WEBSOCKET 17
 #define LISTSONY 18
+#define BURST 19
+#define FLEET 20
+#define STATS 21
+#define BATCH 22
+#define DECODELOG 23
+#define JOURNAL 24
+#define SNAPSHOT 25
+#define DIFF 26
 
 namespace com {
 namespace sony {
@@ -31,15 +40,73 @@ namespace remote {
 class SocketClient;
 class SocketServer;
 
-com::sony::imaging::remote::SocketClient *server_create(int busn, int devn);
+/**
+ * @brief connects to the server of the camera, which is forked if it is not
+ * running yet
+ * @param reconnect the forked server waits for the camera to come back when
+ * it is removed. Ignored if the server is running already.
+ */
+com::sony::imaging::remote::SocketClient *server_create(int busn, int devn,
+                                                        bool reconnect = false);
+
+/**
+ * @brief connects to the server of the camera of a serial number, which is
+ * forked with reconnect if it is not running yet
+ *
+ * The socket of the server is named after the serial number, so the server
+ * keeps serving the camera when it is plugged back to another port. The camera
+ * is looked up only to fork the server, in the snapshot of the registry, and
+ * the server opens it without reading its strings again.
+ * @return NULL if no camera has the serial number
+ */
+com::sony::imaging::remote::SocketClient *server_create(const char *serial);
 void server(int busn, int devn,
-            com::sony::imaging::remote::SocketServer *serverport);
+            com::sony::imaging::remote::SocketServer *serverport,
+            bool reconnect = false);
+
+/**
+ * @brief serves the commands of the clients with an opened socc_ptp, until
+ * CLOSE or RESET or the camera is removed
+ *
+ * With reconnect, a removed camera is waited for instead. When the same
+ * camera comes back, it is reopened and the session set up by the clients is
+ * replayed: OpenSession, the authentication and the last value set to each
+ * property with SDIO_SetExtDevicePropValue. If that fails, it is tried again
+ * every second until it succeeds. Meanwhile the clients wait in the backlog of
+ * serverport, and are served once the camera is ready.
+ *
+ * A single EventLoop waits for the connecting clients, the requests of the
+ * accepted ones, the hotplug events, the events of the camera and a periodic
+ * timer, so none of them waits behind another client. A WAIT does not block
+ * the others: it is parked until the event thread of ptp delivers the next
+ * event, and times out after 5 seconds like wait_event(). The events arrived
+ * while no WAIT is parked are kept for the next ones. The event thread is
+ * started by the first WAIT, and joined when the server finishes.
+ */
+void server(com::sony::imaging::remote::socc_ptp *ptp,
+            com::sony::imaging::remote::SocketServer *serverport,
+            bool reconnect = false);
+
+/**
+ * @brief sends a command to the server, and writes its log and its output
+ * @param script the batch script of BATCH, NULL for the other commands
+ */
 int client(com::sony::imaging::remote::SocketClient *serverport, char *logfile,
            char *outfile, int command,
            com::sony::imaging::remote::PTPTransaction *transaction,
-           uint16_t device_property_code, uint32_t handle);
+           uint16_t device_property_code, uint32_t handle,
+           const char *script = NULL);
+
+/**
+ * @brief parses the dumps of GetAllExtDevicePropInfo, or decodes a binary log
+ * @param infile a dump, "-" for stdin, or a directory or a glob pattern of
+ * dumps parsed in parallel
+ * @param format OFFLINE_FORMAT_*
+ * @param jobs the threads of a directory, 0 for the processors
+ */
 int offline(char *infile, char *outfile, int command,
-            uint16_t device_property_code);
+            uint16_t device_property_code, int format = OFFLINE_FORMAT_TEXT,
+            int jobs = 0);
 
 }  // namespace remote
 }  // namespace imaging
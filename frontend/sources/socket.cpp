@@ -85,6 +85,10 @@ void SocketServer::disconnect() {
 
 void SocketServer::accept() { comm_fd = ::accept(listen_fd, NULL, NULL); }
 
+int SocketServer::accept_client() { return ::accept(listen_fd, NULL, NULL); }
+
+int SocketServer::getListenFD() { return listen_fd; }
+
 bool SocketServer::async_mode() {
   return -1 != fcntl(comm_fd, F_SETFL, O_NONBLOCK);
 }
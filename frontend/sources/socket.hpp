@@ -51,6 +51,14 @@ class SocketServer {
   int getCommFD();
   void disconnect();
   void accept();
+
+  /**
+   * @brief accepts a client besides the one of accept(), for the servers
+   * waiting for several clients at once
+   * @return the connected socket, which the caller closes. -1 on failure
+   */
+  int accept_client();
+  int getListenFD();
   bool is_accepted();
   bool is_request_connect();
   bool async_mode();
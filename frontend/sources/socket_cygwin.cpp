@@ -77,6 +77,10 @@ void SocketServer::accept() {
   used = true;
 }
 
+int SocketServer::accept_client() { return ::accept(listen_fd, NULL, NULL); }
+
+int SocketServer::getListenFD() { return listen_fd; }
+
 void SocketServer::async_mode() { fcntl(comm_fd, F_SETFL, O_NONBLOCK); }
 
 bool SocketServer::is_accepted() { return -1 != comm_fd; }
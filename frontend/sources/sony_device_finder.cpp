@@ -7,35 +7,35 @@ namespace sony {
 namespace imaging {
 namespace remote {
 
-SonyDeviceFinder::SonyDeviceFinder() : ctx_(nullptr) {
-    libusb_init(&ctx_);
+using com::sony::imaging::ports::ports_usb_registry;
+using com::sony::imaging::ports::usb_registry_entry_t;
+
+SonyDeviceFinder::SonyDeviceFinder() {
 }
 
 SonyDeviceFinder::~SonyDeviceFinder() {
-    if (ctx_) {
-        libusb_exit(ctx_);
-    }
 }
 
 std::vector<SonyDevice> SonyDeviceFinder::findSonyCameras() {
     std::vector<SonyDevice> devices;
-    libusb_device** devs;
-    
-    ssize_t cnt = libusb_get_device_list(ctx_, &devs);
-    if (cnt < 0) {
-        return devices;
-    }
+    std::vector<usb_registry_entry_t> entries;
     
-    for (ssize_t i = 0; i < cnt; i++) {
-        SonyDevice info;
-        if (getDeviceInfo(devs[i], info)) {
-            if (info.vendor_id == SONY_VENDOR_ID && isSonyPTPDevice(devs[i])) {
-                devices.push_back(info);
-            }
+    // only the PTP devices are registered
+    ports_usb_registry::instance()->devices(entries);
+    for (const auto& entry : entries) {
+        if (entry.info.idVendor != SONY_VENDOR_ID) {
+            continue;
         }
+        SonyDevice info;
+        info.bus = entry.info.busn;
+        info.address = entry.info.devn;
+        info.vendor_id = entry.info.idVendor;
+        info.product_id = entry.info.idProduct;
+        info.product_name = entry.product;
+        info.serial_number = entry.serial_number;
+        devices.push_back(info);
     }
     
-    libusb_free_device_list(devs, 1);
     return devices;
 }
 
@@ -79,44 +79,6 @@ bool SonyDeviceFinder::isSonyPTPDevice(libusb_device* device) {
     return isPTP;
 }
 
-bool SonyDeviceFinder::getDeviceInfo(libusb_device* device, SonyDevice& info) {
-    struct libusb_device_descriptor desc;
-    
-    if (libusb_get_device_descriptor(device, &desc) < 0) {
-        return false;
-    }
-    
-    info.bus = libusb_get_bus_number(device);
-    info.address = libusb_get_device_address(device);
-    info.vendor_id = desc.idVendor;
-    info.product_id = desc.idProduct;
-    
-    // Try to get product name and serial number
-    libusb_device_handle* handle;
-    if (libusb_open(device, &handle) == 0) {
-        info.product_name = getStringDescriptor(handle, desc.iProduct);
-        info.serial_number = getStringDescriptor(handle, desc.iSerialNumber);
-        libusb_close(handle);
-    }
-    
-    return true;
-}
-
-std::string SonyDeviceFinder::getStringDescriptor(libusb_device_handle* handle, uint8_t index) {
-    if (index == 0) {
-        return "";
-    }
-    
-    unsigned char buffer[256];
-    int ret = libusb_get_string_descriptor_ascii(handle, index, buffer, sizeof(buffer));
-    
-    if (ret > 0) {
-        return std::string(reinterpret_cast<char*>(buffer));
-    }
-    
-    return "";
-}
-
 } // namespace remote
 } // namespace imaging
 } // namespace sony
@@ -5,6 +5,8 @@
 #include <string>
 #include <libusb-1.0/libusb.h>
 
+#include "ports_usb_registry.h"
+
 namespace com {
 namespace sony {
 namespace imaging {
@@ -21,6 +23,8 @@ struct SonyDevice {
     std::string serial_number;
 };
 
+// Looks up the cameras in the USB registry of the process, which enumerates
+// the devices once and keeps them up to date with the hotplug events
 class SonyDeviceFinder {
 public:
     SonyDeviceFinder();
@@ -36,13 +40,8 @@ public:
     bool isSonyPTPDevice(libusb_device* device);
     
 private:
-    libusb_context* ctx_;
-    
     // Known Sony camera product IDs (can be extended)
     static const uint16_t FX30_PRODUCT_ID = 0x0CDC;  // This needs to be verified
-    
-    bool getDeviceInfo(libusb_device* device, SonyDevice& info);
-    std::string getStringDescriptor(libusb_device_handle* handle, uint8_t index);
 };
 
 } // namespace remote
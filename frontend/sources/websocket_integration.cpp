@@ -1,7 +1,10 @@
 #include "websocket_integration.h"
 #include <sstream>
 #include <iomanip>
+#include <cstdlib>
 #include <cstring>
+#include <sys/socket.h>
+#include "socc_stats.h"
 
 namespace com {
 namespace sony {
@@ -11,42 +14,113 @@ namespace remote {
 WebSocketIntegration::WebSocketIntegration(int port, int busn, int devn)
     : server_(std::make_unique<WebSocketServer>(port)),
       command_(std::make_unique<Command>(busn, devn)),
-      ptp_(nullptr),
-      busn_(busn), devn_(devn) {
+      busn_(busn), devn_(devn), device_removed_(false), device_arrived_(false) {
+    pthread_mutex_init(&ptp_mutex_, NULL);
 }
 
 WebSocketIntegration::~WebSocketIntegration() {
     stop();
+    pthread_mutex_destroy(&ptp_mutex_);
 }
 
 bool WebSocketIntegration::start() {
     // Register command handlers
     server_->registerCommand("open", [this](const std::string& msg) { return handleOpen(msg); });
     server_->registerCommand("close", [this](const std::string& msg) { return handleClose(msg); });
-    server_->registerCommand("send", [this](const std::string& msg) { return handleSend(msg); });
-    server_->registerCommand("recv", [this](const std::string& msg) { return handleRecv(msg); });
+    server_->registerCommand("send", [this](const std::string& msg) { return locked(&WebSocketIntegration::handleSend, msg); });
+    server_->registerCommand("recv", [this](const std::string& msg) { return locked(&WebSocketIntegration::handleRecv, msg); });
     server_->registerCommand("wait", [this](const std::string& msg) { return handleWait(msg); });
-    server_->registerCommand("auth", [this](const std::string& msg) { return handleAuth(msg); });
-    server_->registerCommand("getall", [this](const std::string& msg) { return handleGetAll(msg); });
-    server_->registerCommand("get", [this](const std::string& msg) { return handleGet(msg); });
-    server_->registerCommand("getobject", [this](const std::string& msg) { return handleGetObject(msg); });
-    server_->registerCommand("getliveview", [this](const std::string& msg) { return handleGetLiveView(msg); });
-    server_->registerCommand("reset", [this](const std::string& msg) { return handleReset(msg); });
-    server_->registerCommand("clear", [this](const std::string& msg) { return handleClearHalt(msg); });
+    server_->registerCommand("auth", [this](const std::string& msg) { return locked(&WebSocketIntegration::handleAuth, msg); });
+    server_->registerCommand("getall", [this](const std::string& msg) { return locked(&WebSocketIntegration::handleGetAll, msg); });
+    server_->registerCommand("get", [this](const std::string& msg) { return locked(&WebSocketIntegration::handleGet, msg); });
+    server_->registerCommand("getobject", [this](const std::string& msg) { return locked(&WebSocketIntegration::handleGetObject, msg); });
+    server_->registerCommand("getliveview", [this](const std::string& msg) { return locked(&WebSocketIntegration::handleGetLiveView, msg); });
+    server_->registerCommand("reset", [this](const std::string& msg) { return locked(&WebSocketIntegration::handleReset, msg); });
+    server_->registerCommand("clear", [this](const std::string& msg) { return locked(&WebSocketIntegration::handleClearHalt, msg); });
+    server_->registerCommand("liveview", [this](const std::string& msg) { return handleLiveView(msg); });
+    server_->registerCommand("snapshot", [this](const std::string& msg) { return locked(&WebSocketIntegration::handleSnapshot, msg); });
+    server_->registerCommand("diff", [this](const std::string& msg) { return locked(&WebSocketIntegration::handleDiff, msg); });
+
+    // MJPEG stream for <img> tags and ffmpeg
+    server_->registerHttpHandler("/liveview.mjpg", [this](int fd, const std::string& req) { return handleMjpegStream(fd, req); });
+    server_->registerHttpHandler("/metrics", [this](int fd, const std::string& req) { return handleMetrics(fd, req); });
     
     return server_->start();
 }
 
 void WebSocketIntegration::stop() {
     server_->stop();
+
+    std::lock_guard<std::mutex> lock(liveview_mutex_);
+    stopLiveView();
+}
+
+std::string WebSocketIntegration::locked(std::string (WebSocketIntegration::*handler)(const std::string&),
+                                         const std::string& message) {
+    pthread_mutex_lock(&ptp_mutex_);
+    reconnectIfArrived();
+    std::string result = (this->*handler)(message);
+    pthread_mutex_unlock(&ptp_mutex_);
+    return result;
+}
+
+bool WebSocketIntegration::startLiveView() {
+    // the streamer starts the engine for the viewers or hold()
+    if (!liveview_) {
+        liveview_.reset(new socc_liveview(ptp_.get(), &ptp_mutex_));
+    }
+    if (!mjpeg_) {
+        mjpeg_.reset(new MjpegStreamer(liveview_.get()));
+    }
+    return mjpeg_->start();
+}
+
+void WebSocketIntegration::onHotplug(socc_hotplug_event_t event, void* vp) {
+    WebSocketIntegration* self = static_cast<WebSocketIntegration*>(vp);
+    if (event == SOCC_HOTPLUG_EVENT_REMOVED) {
+        self->device_removed_ = true;
+    } else if (event == SOCC_HOTPLUG_EVENT_ARRIVED && self->device_removed_) {
+        self->device_arrived_ = true;
+    }
+}
+
+// reopens the camera which has come back after it was unplugged, with
+// ptp_mutex_ held. Not from the hotplug callback, which runs on the libusb
+// event thread.
+bool WebSocketIntegration::reconnectIfArrived() {
+    if (!ptp_ || !device_arrived_.exchange(false)) {
+        return false;
+    }
+    if (ptp_->reconnect() != SOCC_OK) {
+        return false;
+    }
+    device_removed_ = false;
+    reconnects_.add();
+    return true;
+}
+
+void WebSocketIntegration::stopLiveView() {
+    // the streamer holds frames of the engine
+    mjpeg_.reset();
+    liveview_.reset();
+}
+
+// disconnects the camera when the last user has dropped it
+static void closeCamera(socc_ptp* ptp) {
+    ptp->disconnect();
+    delete ptp;
 }
 
 std::string WebSocketIntegration::handleOpen(const std::string& message) {
+    // ptp_ is replaced under both locks, so that it is read under either
+    std::lock_guard<std::mutex> lock(liveview_mutex_);
+    pthread_mutex_lock(&ptp_mutex_);
     if (!ptp_) {
-        ptp_ = new socc_ptp(busn_, devn_);
+        ptp_.reset(new socc_ptp(busn_, devn_), closeCamera);
+        ptp_->set_hotplug_callback(&WebSocketIntegration::onHotplug, this);
     }
-    
-    int result = ptp_->connect();
+    int result = reconnectIfArrived() ? SOCC_OK : ptp_->connect();
+    pthread_mutex_unlock(&ptp_mutex_);
     if (result == 0) {
         return successToJson("Device opened successfully");
     }
@@ -54,11 +128,15 @@ std::string WebSocketIntegration::handleOpen(const std::string& message) {
 }
 
 std::string WebSocketIntegration::handleClose(const std::string& message) {
-    if (ptp_) {
-        ptp_->disconnect();
-        delete ptp_;
-        ptp_ = nullptr;
-    }
+    std::lock_guard<std::mutex> lock(liveview_mutex_);
+    // the engine takes ptp_mutex_ for its transfers until it is stopped
+    stopLiveView();
+    // a waiter keeps the camera until its wait returns
+    pthread_mutex_lock(&ptp_mutex_);
+    ptp_.reset();
+    pthread_mutex_unlock(&ptp_mutex_);
+    device_removed_ = false;
+    device_arrived_ = false;
     return successToJson("Device closed");
 }
 
@@ -68,7 +146,7 @@ std::string WebSocketIntegration::handleSend(const std::string& message) {
     }
     
     PTPTransaction transaction = parseTransaction(message);
-    int result = command_->send(ptp_, &transaction);
+    int result = command_->send(ptp_.get(), &transaction);
     if (result == 0) {
         return transactionToJson(transaction);
     }
@@ -81,7 +159,7 @@ std::string WebSocketIntegration::handleRecv(const std::string& message) {
     }
     
     PTPTransaction transaction = parseTransaction(message);
-    int result = command_->recv(ptp_, &transaction);
+    int result = command_->recv(ptp_.get(), &transaction);
     if (result == 0) {
         return transactionToJson(transaction);
     }
@@ -89,11 +167,18 @@ std::string WebSocketIntegration::handleRecv(const std::string& message) {
 }
 
 std::string WebSocketIntegration::handleWait(const std::string& message) {
-    if (!ptp_) {
+    // waits for seconds without ptp_mutex_, on a reference close cannot free
+    pthread_mutex_lock(&ptp_mutex_);
+    reconnectIfArrived();
+    std::shared_ptr<socc_ptp> ptp = ptp_;
+    pthread_mutex_unlock(&ptp_mutex_);
+    if (!ptp) {
         return errorToJson("Device not connected");
     }
     
-    int result = command_->wait(ptp_);
+    event_waiters_.add();
+    int result = command_->wait(ptp.get());
+    event_waiters_.add(-1);
     if (result == 0) {
         return successToJson("Event received");
     }
@@ -105,7 +190,7 @@ std::string WebSocketIntegration::handleAuth(const std::string& message) {
         return errorToJson("Device not connected");
     }
     
-    int result = command_->auth(ptp_);
+    int result = command_->auth(ptp_.get());
     if (result == 0) {
         return successToJson("Authentication successful");
     }
@@ -117,7 +202,7 @@ std::string WebSocketIntegration::handleGetAll(const std::string& message) {
         return errorToJson("Device not connected");
     }
     
-    int result = command_->getall(ptp_);
+    int result = command_->getall(ptp_.get());
     if (result == 0) {
         return successToJson("Get all properties successful");
     }
@@ -138,13 +223,79 @@ std::string WebSocketIntegration::handleGet(const std::string& message) {
     std::string params = message.substr(colonPos + 1);
     uint16_t propertyCode = std::stoi(params, nullptr, 0);
     
-    int result = command_->get(ptp_, propertyCode);
+    int result = command_->get(ptp_.get(), propertyCode);
     if (result == 0) {
         return successToJson("Get property successful");
     }
     return errorToJson("Get property failed");
 }
 
+int WebSocketIntegration::takeSnapshot(socc_snapshot& snapshot) {
+    Container response;
+    void* data = nullptr;
+    uint32_t size = 0;
+    int result = ptp_->receive(0x9209, NULL, 0, response, &data, size);
+    if (result == SOCC_OK) {
+        result = snapshot.parse(data, size);
+    }
+    ptp_->dispose_data(&data);
+    return result;
+}
+
+void WebSocketIntegration::keepSnapshot(std::unique_ptr<socc_snapshot> snapshot) {
+    snapshots_.push_back(std::move(snapshot));
+    if (snapshots_.size() > SOCC_SNAPSHOT_HISTORY) {
+        snapshots_.pop_front();
+    }
+}
+
+std::string WebSocketIntegration::handleSnapshot(const std::string& message) {
+    if (!ptp_) {
+        return errorToJson("Device not connected");
+    }
+
+    std::unique_ptr<socc_snapshot> snapshot(new socc_snapshot());
+    if (takeSnapshot(*snapshot) != SOCC_OK) {
+        return errorToJson("Snapshot failed");
+    }
+    uint32_t num = snapshot->num();
+    keepSnapshot(std::move(snapshot));
+    return "{\"success\": true, \"properties\": " + std::to_string(num) + "}";
+}
+
+std::string WebSocketIntegration::handleDiff(const std::string& message) {
+    if (!ptp_) {
+        return errorToJson("Device not connected");
+    }
+
+    // "diff:N" compares with the N-th latest snapshot, the latest by default
+    size_t back = 1;
+    size_t colonPos = message.find(':');
+    if (colonPos != std::string::npos && colonPos + 1 < message.size()) {
+        back = std::strtoul(message.c_str() + colonPos + 1, nullptr, 0);
+    }
+
+    std::unique_ptr<socc_snapshot> after(new socc_snapshot());
+    if (takeSnapshot(*after) != SOCC_OK) {
+        return errorToJson("Snapshot failed");
+    }
+    if (back == 0 || back > snapshots_.size()) {
+        // nothing to compare with: kept like a snapshot, as the CLI does
+        uint32_t num = after->num();
+        keepSnapshot(std::move(after));
+        return "{\"success\": true, \"properties\": " + std::to_string(num) + "}";
+    }
+    const socc_snapshot& before = *snapshots_[snapshots_.size() - back];
+    std::vector<SnapshotChange> changes;
+    socc_snapshot::diff(before, *after, changes);
+    std::string json = "{\"success\": true, \"properties\": " + std::to_string(after->num()) +
+                       ", \"changes\": ";
+    socc_snapshot::changes_to_json(before, *after, changes, json);
+    json += "}";
+    keepSnapshot(std::move(after));
+    return json;
+}
+
 std::string WebSocketIntegration::handleGetObject(const std::string& message) {
     if (!ptp_) {
         return errorToJson("Device not connected");
@@ -159,7 +310,7 @@ std::string WebSocketIntegration::handleGetObject(const std::string& message) {
     std::string params = message.substr(colonPos + 1);
     uint32_t handle = std::stoul(params, nullptr, 0);
     
-    int result = command_->getobject(ptp_, handle);
+    int result = command_->getobject(ptp_.get(), handle);
     if (result == 0) {
         return successToJson("Get object successful");
     }
@@ -171,7 +322,7 @@ std::string WebSocketIntegration::handleGetLiveView(const std::string& message)
         return errorToJson("Device not connected");
     }
     
-    int result = command_->getliveview(ptp_);
+    int result = command_->getliveview(ptp_.get());
     if (result == 0) {
         return successToJson("Get live view successful");
     }
@@ -183,7 +334,7 @@ std::string WebSocketIntegration::handleReset(const std::string& message) {
         return errorToJson("Device not connected");
     }
     
-    command_->reset(ptp_);
+    command_->reset(ptp_.get());
     return successToJson("Device reset");
 }
 
@@ -192,10 +343,216 @@ std::string WebSocketIntegration::handleClearHalt(const std::string& message) {
         return errorToJson("Device not connected");
     }
     
-    command_->clear_halt(ptp_);
+    command_->clear_halt(ptp_.get());
     return successToJson("Clear halt successful");
 }
 
+std::string WebSocketIntegration::handleLiveView(const std::string& message) {
+    std::lock_guard<std::mutex> lock(liveview_mutex_);
+
+    // "liveview:start", "liveview:stop", "liveview:info[,after=sequence]" or
+    // "liveview" for the statistics
+    size_t colonPos = message.find(':');
+    std::string action = (colonPos != std::string::npos) ? message.substr(colonPos + 1) : "";
+    if (action.compare(0, 4, "info") == 0) {
+        uint64_t after = 0;
+        size_t afterPos = action.find("after=");
+        if (afterPos != std::string::npos) {
+            after = std::stoull(action.substr(afterPos + 6), nullptr, 0);
+        }
+        return liveViewInfoToJson(after);
+    }
+    if (action == "start") {
+        if (!ptp_) {
+            return errorToJson("Device not connected");
+        }
+        if (!startLiveView() || !mjpeg_->hold()) {
+            return errorToJson("Failed to start live view");
+        }
+        return successToJson("Live view started");
+    }
+    if (action == "stop") {
+        stopLiveView();
+        return successToJson("Live view stopped");
+    }
+    if (!action.empty()) {
+        return errorToJson("Invalid liveview command format");
+    }
+
+    LiveViewStats stats;
+    memset(&stats, 0, sizeof(stats));
+    if (liveview_) {
+        liveview_->get_stats(stats);
+    }
+
+    std::stringstream json;
+    json << "{";
+    json << "\"running\": " << (liveview_ && liveview_->running() ? "true" : "false") << ",";
+    json << "\"frames\": " << stats.frames << ",";
+    json << "\"dropped\": " << stats.dropped << ",";
+    json << "\"duplicates\": " << stats.duplicates << ",";
+    json << "\"suppressed\": " << std::fixed << std::setprecision(3)
+         << (stats.frames + stats.duplicates > 0
+                 ? (double)stats.duplicates / (stats.frames + stats.duplicates)
+                 : 0.0)
+         << ",";
+    json << "\"not_ready\": " << stats.not_ready << ",";
+    json << "\"errors\": " << stats.errors << ",";
+    json << "\"fps\": " << std::fixed << std::setprecision(1) << stats.fps << ",";
+    json << "\"transfer_us\": {\"last\": " << stats.transfer_us_last
+         << ", \"avg\": " << stats.transfer_us_avg
+         << ", \"max\": " << stats.transfer_us_max << "},";
+    json << "\"age_us\": " << stats.age_us << ",";
+    json << "\"viewers\": " << (mjpeg_ ? mjpeg_->viewerCount() : 0) << ",";
+    json << "\"mjpeg_sent\": " << (mjpeg_ ? mjpeg_->framesSent() : 0) << ",";
+    json << "\"mjpeg_skipped\": " << (mjpeg_ ? mjpeg_->framesSkipped() : 0);
+    json << "}";
+    return json.str();
+}
+
+std::string WebSocketIntegration::liveViewInfoToJson(uint64_t after) {
+    if (!liveview_) {
+        return errorToJson("Live view not started");
+    }
+
+    LiveViewFrame* frame = NULL;
+    if (liveview_->acquire(&frame, after, 1000) != SOCC_OK) {
+        return errorToJson("No live view frame");
+    }
+
+    std::stringstream json;
+    json << "{";
+    json << "\"sequence\": " << frame->sequence << ",";
+    json << "\"jpeg_size\": " << frame->jpeg_size << ",";
+    json << "\"timestamp_us\": " << frame->timestamp_us << ",";
+    json << "\"transfer_us\": " << frame->transfer_us << ",";
+    json << "\"focal_frame_info\": ";
+    FocalFrameInfo info(frame->focal_frame_info, frame->focal_frame_info_size);
+    if (info.valid()) {
+        std::string str;
+        info.toJson(str);
+        json << str;
+    } else {
+        json << "null";
+    }
+    json << "}";
+    liveview_->release(frame);
+    return json.str();
+}
+
+bool WebSocketIntegration::handleMjpegStream(int client_fd, const std::string& request) {
+    std::lock_guard<std::mutex> lock(liveview_mutex_);
+
+    if (!ptp_ || !startLiveView()) {
+        static const char* unavailable =
+            "HTTP/1.1 503 Service Unavailable\r\n"
+            "Content-Length: 0\r\n"
+            "Connection: close\r\n"
+            "\r\n";
+        send(client_fd, unavailable, strlen(unavailable), 0);
+        return false;
+    }
+    return mjpeg_->addViewer(client_fd);
+}
+
+bool WebSocketIntegration::handleMetrics(int client_fd, const std::string& request) {
+    std::string body = metricsText();
+    std::stringstream response;
+    response << "HTTP/1.1 200 OK\r\n";
+    response << "Content-Type: text/plain; version=0.0.4\r\n";
+    response << "Content-Length: " << body.size() << "\r\n";
+    response << "Connection: close\r\n";
+    response << "\r\n";
+    response << body;
+
+    std::string responseStr = response.str();
+    send(client_fd, responseStr.data(), responseStr.size(), 0);
+    return false;
+}
+
+std::string WebSocketIntegration::metricsText() {
+    // keeps ptp_ and the LiveView engine alive while they are read
+    std::lock_guard<std::mutex> lock(liveview_mutex_);
+    MetricsWriter w;
+    char buf[64];
+    snprintf(buf, sizeof(buf), "camera=\"%03d-%03d\"", busn_, devn_);
+    std::string camera = buf;
+
+    std::vector<OperationStats> operations;
+    if (ptp_) {
+        operations.resize(SOCC_STATS_OPERATIONS + 1);
+        operations.resize(ptp_->stats()->get(operations.data(), operations.size()));
+    }
+    std::vector<std::string> labels;
+    uint64_t errors = 0, stalls = 0, timeouts = 0, bytes_in = 0, bytes_out = 0;
+    for (size_t i = 0; i < operations.size(); i++) {
+        snprintf(buf, sizeof(buf), ",code=\"0x%04X\"", operations[i].code);
+        labels.push_back(camera + buf);
+        errors += operations[i].errors;
+        stalls += operations[i].stalls;
+        timeouts += operations[i].timeouts;
+        bytes_in += operations[i].bytes_in;
+        bytes_out += operations[i].bytes_out;
+    }
+
+    w.family("socc_transactions_total", "counter", "PTP transactions by operation code.");
+    for (size_t i = 0; i < operations.size(); i++) {
+        w.sample("socc_transactions_total", labels[i], operations[i].count);
+    }
+    w.family("socc_transaction_errors_total", "counter", "PTP transactions failed in USB or in the container.");
+    for (size_t i = 0; i < operations.size(); i++) {
+        w.sample("socc_transaction_errors_total", labels[i], operations[i].errors);
+    }
+    w.family("socc_transaction_responses_ng_total", "counter", "PTP transactions completed with other than OK.");
+    for (size_t i = 0; i < operations.size(); i++) {
+        w.sample("socc_transaction_responses_ng_total", labels[i], operations[i].responses_ng);
+    }
+    w.family("socc_transaction_duration_seconds", "histogram", "Latency of PTP transactions.");
+    for (size_t i = 0; i < operations.size(); i++) {
+        w.histogram("socc_transaction_duration_seconds", labels[i], operations[i]);
+    }
+
+    w.family("socc_usb_bytes_total", "counter", "Bytes of the data phases.");
+    w.sample("socc_usb_bytes_total", camera + ",direction=\"in\"", bytes_in);
+    w.sample("socc_usb_bytes_total", camera + ",direction=\"out\"", bytes_out);
+    w.family("socc_usb_errors_total", "counter", "Failed transactions by the USB error.");
+    w.sample("socc_usb_errors_total", camera + ",reason=\"stall\"", stalls);
+    w.sample("socc_usb_errors_total", camera + ",reason=\"timeout\"", timeouts);
+    w.sample("socc_usb_errors_total", camera + ",reason=\"other\"", errors - stalls - timeouts);
+    w.family("socc_reconnects_total", "counter", "Camera reopened after it was unplugged.");
+    w.sample("socc_reconnects_total", camera, reconnects_.value());
+    w.family("socc_connected", "gauge", "Whether the camera is opened.");
+    w.sample("socc_connected", camera, ptp_ ? 1 : 0);
+    w.family("socc_auth_ready_seconds", "gauge", "Time from SDIO_Connect to the first usable property read, of the last authentication.");
+    w.sample("socc_auth_ready_seconds", camera, command_->auth_timing().total_us / 1e6);
+
+    LiveViewStats stats;
+    memset(&stats, 0, sizeof(stats));
+    if (liveview_) {
+        liveview_->get_stats(stats);
+    }
+    w.family("socc_liveview_fps", "gauge", "Recent rate of published LiveView frames.");
+    w.sample("socc_liveview_fps", camera, stats.fps);
+    w.family("socc_liveview_frames_total", "counter", "LiveView frames published.");
+    w.sample("socc_liveview_frames_total", camera, stats.frames);
+    w.family("socc_liveview_dropped_frames_total", "counter", "LiveView frames dropped before anyone has acquired them.");
+    w.sample("socc_liveview_dropped_frames_total", camera, stats.dropped);
+    w.family("socc_mjpeg_skipped_frames_total", "counter", "LiveView frames skipped by slow MJPEG viewers.");
+    w.sample("socc_mjpeg_skipped_frames_total", camera, mjpeg_ ? mjpeg_->framesSkipped() : 0);
+    w.family("socc_mjpeg_viewers", "gauge", "Connected MJPEG viewers.");
+    w.sample("socc_mjpeg_viewers", camera, mjpeg_ ? mjpeg_->viewerCount() : 0);
+
+    w.family("socc_event_waiters", "gauge", "Requests waiting for a PTP event.");
+    w.sample("socc_event_waiters", camera, event_waiters_.value());
+    w.family("socc_websocket_clients", "gauge", "Connected WebSocket clients.");
+    w.sample("socc_websocket_clients", "", server_->connectedClients());
+    w.family("socc_websocket_messages_total", "counter", "WebSocket commands received.");
+    w.sample("socc_websocket_messages_total", "", server_->messages());
+    w.family("socc_http_requests_total", "counter", "Plain HTTP requests received.");
+    w.sample("socc_http_requests_total", "", server_->httpRequests());
+    return w.str();
+}
+
 PTPTransaction WebSocketIntegration::parseTransaction(const std::string& params) {
     PTPTransaction transaction;
     memset(&transaction, 0, sizeof(transaction));
@@ -2,8 +2,17 @@
 #define __WEBSOCKET_INTEGRATION_H__
 
 #include "websocket_server.h"
+#include "mjpeg_streamer.h"
 #include "command.h"
+#include "metrics.h"
+#include "socc_liveview.h"
+#include "socc_snapshot.h"
+#include "parser.h"
+#include <pthread.h>
+#include <atomic>
+#include <deque>
 #include <memory>
+#include <mutex>
 
 namespace com {
 namespace sony {
@@ -21,9 +30,33 @@ public:
 private:
     std::unique_ptr<WebSocketServer> server_;
     std::unique_ptr<Command> command_;
-    socc_ptp* ptp_;
+    std::shared_ptr<socc_ptp> ptp_;  // replaced under both locks below
     int busn_;
     int devn_;
+
+    // LiveView engine shared by every stream, started on demand
+    std::unique_ptr<socc_liveview> liveview_;
+    std::unique_ptr<MjpegStreamer> mjpeg_;
+    std::mutex liveview_mutex_;
+    pthread_mutex_t ptp_mutex_;   // serializes transactions with the LiveView engine
+
+    // the latest snapshots of the properties for "diff", under ptp_mutex_
+    std::deque<std::unique_ptr<socc_snapshot>> snapshots_;
+
+    // counted on the request paths for /metrics
+    ShardedCounter event_waiters_;
+    ShardedCounter reconnects_;
+
+    // set by the hotplug callback, the camera is reopened by the next request
+    std::atomic<bool> device_removed_;
+    std::atomic<bool> device_arrived_;
+
+    bool startLiveView();
+    void stopLiveView();
+    static void onHotplug(socc_hotplug_event_t event, void* vp);
+    bool reconnectIfArrived();
+    std::string locked(std::string (WebSocketIntegration::*handler)(const std::string&),
+                       const std::string& message);
     
     // Command handlers
     std::string handleOpen(const std::string& message);
@@ -38,12 +71,21 @@ private:
     std::string handleGetLiveView(const std::string& message);
     std::string handleReset(const std::string& message);
     std::string handleClearHalt(const std::string& message);
+    std::string handleLiveView(const std::string& message);
+    std::string handleSnapshot(const std::string& message);
+    std::string handleDiff(const std::string& message);
+    bool handleMjpegStream(int client_fd, const std::string& request);
+    bool handleMetrics(int client_fd, const std::string& request);
+    std::string metricsText();
     
     // Helper functions
     PTPTransaction parseTransaction(const std::string& params);
     std::string transactionToJson(const PTPTransaction& transaction);
     std::string errorToJson(const std::string& error);
     std::string successToJson(const std::string& result = "");
+    std::string liveViewInfoToJson(uint64_t after);
+    int takeSnapshot(socc_snapshot& snapshot);
+    void keepSnapshot(std::unique_ptr<socc_snapshot> snapshot);
 };
 
 } // namespace remote
@@ -97,6 +97,11 @@ void WebSocketServer::registerCommand(const std::string& command, CommandHandler
     command_handlers_[command] = handler;
 }
 
+void WebSocketServer::registerHttpHandler(const std::string& path, HttpHandler handler) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    http_handlers_[path] = handler;
+}
+
 void WebSocketServer::serverLoop() {
     while (running_) {
         struct pollfd pfd;
@@ -119,11 +124,25 @@ void WebSocketServer::serverLoop() {
 }
 
 void WebSocketServer::handleClient(int client_fd) {
+    std::string request;
+    if (!readHttpRequest(client_fd, request)) {
+        close(client_fd);
+        return;
+    }
+
+    // Plain HTTP requests share the listener with WebSocket
+    if (request.find("Sec-WebSocket-Key: ") == std::string::npos) {
+        http_requests_.add();
+        processHttpRequest(client_fd, request);
+        return;
+    }
+
     // Perform WebSocket handshake
-    if (!performWebSocketHandshake(client_fd)) {
+    if (!performWebSocketHandshake(client_fd, request)) {
         close(client_fd);
         return;
     }
+    clients_.add();
     
     // Read WebSocket frames
     std::vector<uint8_t> buffer(4096);
@@ -135,12 +154,14 @@ void WebSocketServer::handleClient(int client_fd) {
         
         std::string message = decodeWebSocketFrame(std::vector<uint8_t>(buffer.begin(), buffer.begin() + n));
         if (!message.empty()) {
+            messages_.add();
             std::string response = processCommand(message);
             auto encoded = encodeWebSocketFrame(response);
             send(client_fd, encoded.data(), encoded.size(), 0);
         }
     }
     
+    clients_.add(-1);
     close(client_fd);
 }
 
@@ -159,6 +180,57 @@ std::string WebSocketServer::processCommand(const std::string& message) {
     return "{\"error\": \"Unknown command: " + command + "\"}";
 }
 
+bool WebSocketServer::readHttpRequest(int client_fd, std::string& request) {
+    char buffer[1024];
+    while (request.find("\r\n\r\n") == std::string::npos) {
+        if (request.size() > 8192) {
+            return false;
+        }
+        int n = recv(client_fd, buffer, sizeof(buffer), 0);
+        if (n <= 0) {
+            return false;
+        }
+        request.append(buffer, n);
+    }
+    return true;
+}
+
+void WebSocketServer::processHttpRequest(int client_fd, const std::string& request) {
+    // Request line: "GET /path?query HTTP/1.1"
+    std::string path;
+    size_t start = request.find(' ');
+    if (start != std::string::npos) {
+        size_t end = request.find_first_of(" ?", start + 1);
+        if (end != std::string::npos) {
+            path = request.substr(start + 1, end - start - 1);
+        }
+    }
+
+    HttpHandler handler;
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        auto it = http_handlers_.find(path);
+        if (it != http_handlers_.end()) {
+            handler = it->second;
+        }
+    }
+
+    if (handler) {
+        if (!handler(client_fd, request)) {
+            close(client_fd);
+        }
+        return;
+    }
+
+    static const char* not_found =
+        "HTTP/1.1 404 Not Found\r\n"
+        "Content-Length: 0\r\n"
+        "Connection: close\r\n"
+        "\r\n";
+    send(client_fd, not_found, strlen(not_found), 0);
+    close(client_fd);
+}
+
 std::string WebSocketServer::generateWebSocketAccept(const std::string& key) {
     std::string combined = key + WS_MAGIC_STRING;
     
@@ -183,16 +255,7 @@ std::string WebSocketServer::generateWebSocketAccept(const std::string& key) {
     return result;
 }
 
-bool WebSocketServer::performWebSocketHandshake(int client_fd) {
-    char buffer[1024];
-    int n = recv(client_fd, buffer, sizeof(buffer) - 1, 0);
-    if (n <= 0) {
-        return false;
-    }
-    buffer[n] = '\0';
-    
-    std::string request(buffer);
-    
+bool WebSocketServer::performWebSocketHandshake(int client_fd, const std::string& request) {
     // Extract WebSocket key
     std::string wsKey;
     size_t keyPos = request.find("Sec-WebSocket-Key: ");
@@ -7,6 +7,7 @@
 #include <vector>
 #include <thread>
 #include <mutex>
+#include "metrics.h"
 #include "socc_types.h"
 
 namespace com {
@@ -17,6 +18,8 @@ namespace remote {
 class WebSocketServer {
 public:
     typedef std::function<std::string(const std::string&)> CommandHandler;
+    // Returns true when the handler keeps client_fd, otherwise the server closes it
+    typedef std::function<bool(int client_fd, const std::string& request)> HttpHandler;
     
     WebSocketServer(int port);
     ~WebSocketServer();
@@ -26,6 +29,15 @@ public:
     bool isRunning() const { return running_; }
     
     void registerCommand(const std::string& command, CommandHandler handler);
+    void registerHttpHandler(const std::string& path, HttpHandler handler);
+
+    int64_t connectedClients() const { return clients_.value(); }
+    int64_t messages() const { return messages_.value(); }
+    int64_t httpRequests() const { return http_requests_.value(); }
+
+    // Frame codec, stateless
+    static std::string decodeWebSocketFrame(const std::vector<uint8_t>& data);
+    static std::vector<uint8_t> encodeWebSocketFrame(const std::string& message);
     
 private:
     int port_;
@@ -33,17 +45,21 @@ private:
     bool running_;
     std::thread server_thread_;
     std::map<std::string, CommandHandler> command_handlers_;
+    std::map<std::string, HttpHandler> http_handlers_;
     mutable std::mutex mutex_;
+    ShardedCounter clients_;
+    ShardedCounter messages_;
+    ShardedCounter http_requests_;
     
     void serverLoop();
     void handleClient(int client_fd);
     std::string processCommand(const std::string& message);
+    bool readHttpRequest(int client_fd, std::string& request);
+    void processHttpRequest(int client_fd, const std::string& request);
     
     // WebSocket specific
     std::string generateWebSocketAccept(const std::string& key);
-    bool performWebSocketHandshake(int client_fd);
-    std::string decodeWebSocketFrame(const std::vector<uint8_t>& data);
-    std::vector<uint8_t> encodeWebSocketFrame(const std::string& message);
+    bool performWebSocketHandshake(int client_fd, const std::string& request);
 };
 
 } // namespace remote
@@ -45,6 +45,28 @@ class SDIDevicePropInfoDataset {
    */
   static SDIDevicePropInfoDataset *create(void *data);
 
+  /**
+   * @brief measures a DevicePropCode dataset without parsing it
+   * @param data an address of a DevicePropCode dataset.
+   * @param size the bytes from \em data
+   * @param current the offset of CurrentValue in the dataset if not NULL,
+   * with the number of the values or the length of a string before it
+   * @param current_size the bytes of CurrentValue if not NULL
+   * @return the total bytes, or 0 if the dataset does not fit in \em size or
+   * its DataType is not supported
+   */
+  static uint32_t measure(const void *data, uint32_t size,
+                          uint32_t *current = NULL,
+                          uint32_t *current_size = NULL);
+
+  /**
+   * @brief the bytes of a value or an element of an array of \em DataType as
+   * parsed by create()
+   * @return the bytes, 0 for a string or an unsupported DataType
+   */
+  static uint32_t valueSize(uint16_t DataType);
+
+
   /**
    * @brief return the total bytes
    * @return the total bytes
@@ -74,7 +96,32 @@ class SDIDevicePropInfoDataset {
    */
   virtual void toString(std::string &str);
 
+  /**
+   * @brief stores the parsed contents to std::string as a JSON object
+   * @param str a reference of std::string to store it
+   */
+  virtual void toJson(std::string &str);
+
+  /**
+   * @brief stores the current value to std::string, in decimal for an
+   * integer, separated by spaces for an array
+   * @param str a reference of std::string to store it
+   */
+  virtual void currentValueToString(std::string &str);
+
+  /**
+   * @brief return the current value of an integer DataType
+   * @return the value, sign extended for a signed DataType. 0 for an array
+   * or a string
+   */
+  int64_t currentInteger();
+
  protected:
+  /**
+   * @brief stores the fields of this class as the beginning of a JSON object
+   */
+  void headToJson(std::string &str);
+
   /**
    * @brief parse a value section
    * @params data a double pointer of an address of start of a value section
@@ -124,6 +171,8 @@ class DataTypeInteger : public SDIDevicePropInfoDataset {
 
   virtual void toString();
   virtual void toString(std::string &str);
+  virtual void toJson(std::string &str);
+  virtual void currentValueToString(std::string &str);
   virtual ~DataTypeInteger();
 
  protected:
@@ -159,6 +208,8 @@ class DataTypeArray : public SDIDevicePropInfoDataset {
 
   virtual void toString();
   virtual void toString(std::string &str);
+  virtual void toJson(std::string &str);
+  virtual void currentValueToString(std::string &str);
   virtual ~DataTypeArray();
 
  protected:
@@ -192,6 +243,8 @@ class DataTypeSTR : public SDIDevicePropInfoDataset {
 
   virtual void toString();
   virtual void toString(std::string &str);
+  virtual void toJson(std::string &str);
+  virtual void currentValueToString(std::string &str);
   virtual ~DataTypeSTR();
 
  protected:
@@ -215,6 +268,7 @@ class DataTypeSTR : public SDIDevicePropInfoDataset {
 class SDIDevicePropInfoDatasetArray {
  private:
   std::map<uint16_t, SDIDevicePropInfoDataset *> dataset;
+  bool _valid;
 
  public:
   uint64_t num;  //<!
@@ -226,6 +280,25 @@ class SDIDevicePropInfoDatasetArray {
    */
   SDIDevicePropInfoDatasetArray(void *data);
 
+  /**
+   * @brief parses the data gotten by GetAllExtDevicePropInfo API, without
+   * reading beyond \em size bytes. The datasets before a truncated or an
+   * unsupported one are parsed.
+   * @param data an address of the data.
+   * @param size the bytes of the data.
+   */
+  SDIDevicePropInfoDatasetArray(const void *data, uint32_t size);
+
+  /**
+   * @brief returns whether all the \em num datasets have been parsed
+   */
+  bool valid();
+
+  /**
+   * @brief the parsed datasets by DevicePropertyCode
+   */
+  const std::map<uint16_t, SDIDevicePropInfoDataset *> &datasets();
+
   /**
    * @brief gets the specified SDIDevicePropInfoDataset as \em
    * device_property_code.
@@ -261,6 +334,8 @@ class LiveViewImage {
   uint32_t offset;
   uint32_t _size;
   uint8_t *data;
+  uint32_t ffi_offset;
+  uint32_t ffi_size;
 
  public:
   /**
@@ -280,6 +355,180 @@ class LiveViewImage {
    * as JPEG.
    */
   uint8_t *get();
+
+  /**
+   * @brief returns the size of the Focal Frame Info. 0 if it is absent.
+   */
+  uint32_t focalFrameInfoSize();
+
+  /**
+   * @brief returns the pointer of the Focal Frame Info to be parsed with
+   * FocalFrameInfo. NULL if it is absent.
+   */
+  uint8_t *focalFrameInfo();
+};
+
+/**
+ * @brief A frame in the Focal Frame Info.
+ *
+ * The position and the size are the numerators of the denominators in
+ * FocalFrameSection, e.g. the left edge is XNumerator / XDenominator of the
+ * LiveView image width.
+ */
+typedef struct {
+  uint16_t Type;      //!< FocusFrameType, FaceFrameType or TrackingFrameType
+  uint16_t State;     //!< FocusFrameState, FaceFrameState or TrackingFrameState
+  uint8_t Selection;  //!< SelectionState of a face frame. 0 for the others
+  uint8_t Priority;   //!< The smaller the value, the higher the priority
+  uint32_t XNumerator;
+  uint32_t YNumerator;
+  uint32_t Height;
+  uint32_t Width;
+} FocalFrame;
+
+/**
+ * @brief A section of frames in the Focal Frame Info.
+ */
+typedef struct {
+  uint32_t XDenominator;
+  uint32_t YDenominator;
+  uint16_t FrameNum;      //!< number of frames. 0 if the section is absent
+  const uint8_t *frames;  //!< the frames in the dataset
+} FocalFrameSection;
+
+/**
+ * @brief Focal Frame Info parser
+ *
+ * The Focal Frame Info follows the JPEG in the LiveView dataset and carries the
+ * focus frames, the face frames and the tracking frames (the last two for
+ * Version 1.01 or later). Nothing is copied. The frames are decoded from the
+ * dataset by frame(), so the dataset has to outlive this object.
+ */
+class FocalFrameInfo {
+ public:
+  /**
+   * \enum FocusFrameType
+   */
+  enum {
+    FOCUS_PHASE_DETECTION_AF_SENSOR = 0x0001,
+    FOCUS_PHASE_DETECTION_IMAGE_SENSOR = 0x0002,
+    FOCUS_WIDE = 0x0003,
+    FOCUS_ZONE = 0x0004,
+    FOCUS_CENTRAL_EMPHASIS = 0x0005,
+    FOCUS_CONTRAST_FLEXIBLE_MAIN = 0x0006,
+    FOCUS_CONTRAST_FLEXIBLE_ASSIST = 0x0007,
+    FOCUS_CONTRAST = 0x0008,
+    FOCUS_CONTRAST_UPPER_HALF = 0x0009,
+    FOCUS_CONTRAST_LOWER_HALF = 0x000A,
+    FOCUS_DUAL_AF_MAIN = 0x000B,
+    FOCUS_DUAL_AF_ASSIST = 0x000C,
+    FOCUS_NON_DUAL_AF_MAIN = 0x000D,
+    FOCUS_NON_DUAL_AF_ASSIST = 0x000E,
+    FOCUS_FRAME_SOMEWHERE = 0x000F,
+    FOCUS_CROSS = 0x0010,
+  };
+
+  /**
+   * \enum FocusFrameState
+   */
+  enum {
+    FOCUS_STATE_NOT_FOCUSED = 0x0001,
+    FOCUS_STATE_FOCUSED = 0x0002,
+    FOCUS_STATE_FOCUS_FRAME_SELECTION = 0x0003,
+    FOCUS_STATE_MOVING = 0x0004,
+    FOCUS_STATE_RANGE_LIMIT = 0x0005,
+    FOCUS_STATE_REGISTRATION_AF = 0x0006,
+    FOCUS_STATE_ISLAND = 0x0007,
+  };
+
+  /**
+   * \enum FaceFrameType
+   */
+  enum {
+    FACE_DETECTED = 0x0001,
+    FACE_AF_TARGET = 0x0002,
+    FACE_PERSONAL_RECOGNITION = 0x0003,
+    FACE_SMILE_DETECTION = 0x0004,
+    FACE_SELECTED = 0x0005,
+    FACE_AF_TARGET_SELECTION = 0x0006,
+    FACE_SMILE_DETECTION_SELECT = 0x0007,
+  };
+
+  /**
+   * \enum TrackingFrameType
+   */
+  enum {
+    TRACKING_NON_TARGET_AF = 0x0001,
+    TRACKING_TARGET_AF = 0x0002,
+  };
+
+  /**
+   * \enum FaceFrameState, TrackingFrameState
+   */
+  enum {
+    STATE_NOT_FOCUSED = 0x0001,
+    STATE_FOCUSED = 0x0002,
+  };
+
+  /**
+   * \enum SelectionState
+   */
+  enum {
+    SELECTION_UNSELECTED = 0x01,
+    SELECTION_SELECTED = 0x02,
+  };
+
+  uint16_t Version;            //!< 100 times the data version
+  FocalFrameSection Focus;     //!< focus frames
+  FocalFrameSection Face;      //!< face frames
+  FocalFrameSection Tracking;  //!< tracking frames
+
+  /**
+   * @brief parses the Focal Frame Info.
+   * @param data an address of the Focal Frame Info.
+   * @param size the size of the Focal Frame Info in byte.
+   */
+  FocalFrameInfo(const void *data, uint32_t size);
+  ~FocalFrameInfo();
+
+  /**
+   * @brief returns whether the Focal Frame Info has been parsed. The sections
+   * are empty if not.
+   */
+  bool valid();
+
+  /**
+   * @brief decodes a frame of a section
+   * @param section Focus, Face or Tracking
+   * @param index index of the frame in the section
+   * @param frame a reference to store the frame
+   * @return false if index is out of range
+   */
+  bool frame(const FocalFrameSection &section, uint16_t index,
+             FocalFrame &frame);
+
+  /**
+   * @brief print the parsed contents to stdio
+   */
+  void toString();
+
+  /**
+   * @brief stores the parsed contents to std::string
+   * @param str a reference of std::string to store it
+   */
+  void toString(std::string &str);
+
+  /**
+   * @brief stores the parsed contents to std::string as JSON
+   * @param str a reference of std::string to store it
+   */
+  void toJson(std::string &str);
+
+ private:
+  bool _valid;
+
+  void toJson(std::string &str, const char *name,
+              const FocalFrameSection &section, bool selection);
 };
 
 /**
@@ -0,0 +1,154 @@
+/**
+ * @file socc_auth.h
+ * @brief Bring-up of a camera: the authentication sequence of SDIO_Connect
+ * until the device properties are usable, with the timing of each step
+ */
+
+#ifndef __SOCC_AUTH_H__
+#define __SOCC_AUTH_H__
+
+#include <socc_types.h>
+
+/**
+ * @brief the environment variable of the file, where the frontend keeps the
+ * versions accepted by the cameras
+ */
+#define SOCC_AUTH_CACHE_ENV "SOCC_AUTH_CACHE"
+
+namespace com {
+namespace sony {
+namespace imaging {
+namespace remote {
+
+class socc_ptp;
+
+/**
+ * @brief Steps of socc_auth, in the order performed
+ */
+typedef enum {
+  SOCC_AUTH_CONNECT_1 = 0,  //!< SDIO_Connect phase 1
+  SOCC_AUTH_CONNECT_2,      //!< SDIO_Connect phase 2
+  SOCC_AUTH_VERSION,        //!< SDIO_GetExtDeviceInfo until a version is
+                            //!< reported
+  SOCC_AUTH_CONNECT_3,      //!< SDIO_Connect phase 3
+  SOCC_AUTH_PROPERTIES,     //!< SDIO_GetAllExtDevicePropInfo until a
+                            //!< property is reported
+  SOCC_AUTH_DONE,
+  SOCC_AUTH_STEPS = SOCC_AUTH_DONE
+} socc_auth_step_t;
+
+/**
+ * @brief Timing of a bring-up
+ */
+typedef struct AuthTiming {
+  uint64_t step_us[SOCC_AUTH_STEPS];  //!< time spent in each step
+  uint32_t polls[SOCC_AUTH_STEPS];    //!< transactions of each step
+  uint64_t total_us;  //!< from the first SDIO_Connect to the first usable
+                      //!< property read
+  uint16_t version;   //!< the version reported by the camera, 0 if not
+                      //!< reported yet when a cached camera got ready
+  bool cached;        //!< the version was requested from the cache
+} AuthTiming;
+
+/**
+ * @class socc_auth
+ * @brief Performs the bring-up of a camera after OpenSession.
+ *
+ * The camera answers SDIO_GetExtDeviceInfo with its version once it is
+ * ready, and reports no property until then. These steps are polled with
+ * an interval growing by half from 1 ms up to 16 ms, instead of back to back,
+ * so a camera which is still starting is not flooded with transactions, and
+ * is found ready soon after it is.\n
+ * The version reported by a camera is cached by its serial number. On the
+ * next bring-up of the same camera it is requested, and the version step is
+ * not polled when the properties are waited for: the camera is not ready
+ * until it reports them anyway. The cache is shared by the process, and can
+ * be kept in a file with load_cache() and save_cache().
+ */
+class socc_auth {
+ public:
+  /**
+   * @brief Constructor
+   * @param [in]ptp the camera, whose session is opened
+   */
+  socc_auth(socc_ptp* ptp);
+
+  /**
+   * @brief performs a transaction of the current step, and moves to the next
+   * step when it is completed
+   * @param [out]wait_us the time to wait before the next call, 0 to call it
+   * at once
+   * @return 0 on success, other on failure
+   */
+  int step(uint32_t& wait_us);
+
+  /**
+   * @brief performs the steps until SOCC_AUTH_DONE
+   * @param [in]properties waits for the properties too. If false, the
+   * sequence ends after SDIO_Connect phase 3.
+   * @return 0 on success, SOCC_ERROR_USB_TIMEOUT if the camera is not ready
+   * within 10 seconds, other on failure
+   */
+  int run(bool properties = true);
+
+  /**
+   * @brief the step to be performed by the next step()
+   */
+  socc_auth_step_t current();
+
+  /**
+   * @brief the timing of the steps performed
+   */
+  const AuthTiming& timing();
+
+  /**
+   * @brief the name of a step, like "connect 1"
+   */
+  static const char* step_name(socc_auth_step_t step);
+
+  /**
+   * @brief the version cached for a serial number, 0 if none
+   */
+  static uint16_t cached_version(const char* serial);
+
+  /**
+   * @brief caches the version reported by a camera
+   */
+  static void cache_version(const char* serial, uint16_t version);
+
+  /**
+   * @brief adds the versions kept in a file to the cache
+   * @return 0 on success, SOCC_ERROR_FILE_IO if the file cannot be read
+   */
+  static int load_cache(const char* path);
+
+  /**
+   * @brief writes the cache to a file, a line of a serial number and a
+   * version for each camera
+   * @return 0 on success, SOCC_ERROR_FILE_IO if the file cannot be written
+   */
+  static int save_cache(const char* path);
+
+ private:
+  socc_ptp* ptp;
+  socc_auth_step_t state;
+  AuthTiming result;
+  char serial[32];
+  uint16_t requested;
+  bool wait_properties;
+  uint32_t interval_us;
+  uint64_t begin_us;
+  uint64_t step_begin_us;
+  uint64_t trace_begin;
+
+  int receive(uint16_t code, uint32_t* params, uint8_t nparam, void* head,
+              uint32_t head_size);
+  int poll(bool ready, uint32_t& wait_us);
+  void next(uint32_t& wait_us);
+};
+
+}  // namespace remote
+}  // namespace imaging
+}  // namespace sony
+}  // namespace com
+#endif
@@ -0,0 +1,147 @@
+/**
+ * @file socc_capture.h
+ * @brief Shooting with background download of the captures
+ */
+
+#ifndef __SOCC_CAPTURE_H__
+#define __SOCC_CAPTURE_H__
+
+#include <pthread.h>
+#include <socc_download.h>
+#include <socc_types.h>
+
+namespace com {
+namespace sony {
+namespace imaging {
+namespace remote {
+
+class socc_ptp;
+
+/**
+ * @brief Statistics of socc_capture.
+ */
+typedef struct CaptureStats {
+  uint64_t triggered;   //!< shots released by trigger()
+  uint64_t announced;   //!< captures announced by the camera
+  uint64_t downloaded;  //!< captures written to the files
+  uint64_t errors;      //!< failed triggers and downloads
+  uint64_t bytes;       //!< bytes downloaded
+  uint32_t depth;       //!< captures announced and not downloaded yet
+  uint32_t max_depth;   //!< deepest the queue has been
+  double shots_per_sec;      //!< downloads per second since the first trigger
+  uint32_t trigger_us_avg;   //!< average time of trigger()
+  uint32_t download_us_avg;  //!< average time to download a capture
+} CaptureStats;
+
+/**
+ * @class socc_capture
+ * @brief Shoots with SDIO_ControlDevice while the captures buffered by the
+ * camera are downloaded by a worker thread.
+ *
+ * trigger() only presses and releases the shutter button, so the next shot
+ * can start as soon as the body is ready. An event thread queues a capture for
+ * each ObjectAdded(0xFFFFC001), and checks Shooting File Information(0xD215)
+ * on DevicePropChanged for captures announced without ObjectAdded. The worker
+ * drains the queue into numbered files with socc_download.
+ */
+class socc_capture {
+ public:
+  /**
+   * @brief Constructor
+   * @param [in]ptp connected and authenticated socc_ptp
+   * @param [in]ptp_mutex mutex to serialize the transactions with other users
+   * of ptp. NULL if ptp is used only by this object.
+   * @param [in]depth captures which can be queued before trigger() waits for
+   * the downloads
+   */
+  socc_capture(socc_ptp* ptp, pthread_mutex_t* ptp_mutex = NULL,
+               int depth = 8);
+
+  /**
+   * @brief Destructor. The threads are stopped if they are running.
+   */
+  ~socc_capture();
+
+  /**
+   * @brief starts the event and download threads
+   * @param [in]path_format printf() format of the file names, which takes the
+   * number of the capture starting from 1. e.g. "shoot%04u.jpg"
+   * @return 0 on success, SOCC_ERROR_INVALID_PARAMETER if the format doesn't
+   * take exactly one number, other on failure
+   */
+  int start(const char* path_format);
+
+  /**
+   * @brief stops the threads after the queued captures are downloaded
+   *
+   * The event thread is joined after its pending wait_event() returns, which
+   * takes up to the USB timeout.
+   * @return 0 on success, other on failure
+   */
+  int stop();
+
+  /**
+   * @brief shoots an image
+   *
+   * Presses the shutter button halfway and fully, then releases it. Waits
+   * while the queue is full.
+   * @return 0 on success, other on failure
+   */
+  int trigger();
+
+  /**
+   * @brief waits until every triggered shot has been downloaded
+   *
+   * Returns at once when no capture is queued or being downloaded and every
+   * triggered shot has been announced. A shot not announced within 5 seconds
+   * after the last trigger is not waited for.
+   * @param [in]timeout_ms time to wait in milli seconds. negative for infinite
+   * @return 0 on success, SOCC_ERROR_USB_TIMEOUT on timeout
+   */
+  int wait_idle(int timeout_ms = -1);
+
+  /**
+   * @brief copies the current statistics
+   */
+  void get_stats(CaptureStats& stats);
+
+ private:
+  socc_ptp* ptp;
+  pthread_mutex_t* ptp_mutex;
+  pthread_mutex_t own_ptp_mutex;
+  socc_download download;
+
+  pthread_mutex_t mutex;
+  pthread_cond_t cond;
+  pthread_t event_thread_id;
+  pthread_t download_thread_id;
+  bool threads_running;
+  bool stopping;
+  char path_format[256];
+
+  uint32_t max_depth;
+  uint32_t pending;
+  bool downloading;
+  bool probe;
+
+  CaptureStats stats;
+  uint64_t first_trigger_us;
+  uint64_t last_trigger_us;
+  uint64_t trigger_us_total;
+  uint64_t download_us_total;
+  uint32_t probed;
+
+  static void* event_thread(void* vp);
+  static void* download_thread(void* vp);
+  void run_events();
+  void run_downloads();
+  int control(uint16_t code, uint16_t value);
+  bool shooting_file_ready();
+  void announce();
+};
+
+}  // namespace remote
+}  // namespace imaging
+}  // namespace sony
+}  // namespace com
+#endif
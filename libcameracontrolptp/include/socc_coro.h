@@ -0,0 +1,625 @@
+/**
+ * @file socc_coro.h
+ * @brief C++20 coroutine interface of socc_ptp
+ *
+ * A workflow like scripts/shoot_an_image_and_get_it.sh is written as a
+ * coroutine which co_awaits the transactions and the events of a camera.
+ * The coroutines of many cameras run interleaved on the thread of a
+ * socc_executor, while the transactions are performed by the transfer
+ * threads of socc_ptp.
+ * \code
+    socc_task<int> shoot(socc_camera& cam) {
+      co_await cam.set(0xD25A, 0x01, 1);
+      co_await cam.until(0x5013, [](const PropertyValue& v) {
+        return v.is_enable == 1;
+      });
+      co_await cam.control(0xD2C2, 0x0002);
+      AsyncResult event = co_await cam.next_event(0xC201);
+      co_return event.ret;
+    }
+\endcode
+ * This header is the only part of libcameracontrolptp which needs C++20, and
+ * nothing of it is built into the library.
+ */
+
+#ifndef __SOCC_CORO_H__
+#define __SOCC_CORO_H__
+
+#if !defined(__cpp_impl_coroutine)
+#error "socc_coro.h needs C++20 coroutines. Compile with -std=c++20"
+#endif
+
+#include <parser.h>
+#include <socc_ptp.h>
+#include <socc_types.h>
+#include <string.h>
+
+#include <chrono>
+#include <condition_variable>
+#include <coroutine>
+#include <deque>
+#include <exception>
+#include <functional>
+#include <list>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <utility>
+
+namespace com {
+namespace sony {
+namespace imaging {
+namespace remote {
+
+class socc_executor;
+
+/**
+ * @brief What a coroutine of socc_task does at its start and its end.
+ */
+struct socc_task_promise_base {
+  std::coroutine_handle<> continuation;  //!< the awaiting coroutine
+  socc_executor* executor = nullptr;     //!< set if spawned
+
+  struct final_awaiter {
+    bool await_ready() noexcept { return false; }
+    template <typename P>
+    std::coroutine_handle<> await_suspend(std::coroutine_handle<P> h) noexcept;
+    void await_resume() noexcept {}
+  };
+
+  // started when awaited or spawned
+  std::suspend_always initial_suspend() noexcept { return {}; }
+  final_awaiter final_suspend() noexcept { return {}; }
+  void unhandled_exception() { std::terminate(); }
+};
+
+/**
+ * @class socc_task
+ * @brief Coroutine which returns T to the coroutine which co_awaits it.
+ */
+template <typename T = void>
+class socc_task {
+ public:
+  struct promise_type : socc_task_promise_base {
+    T value{};
+    socc_task get_return_object() {
+      return socc_task(std::coroutine_handle<promise_type>::from_promise(*this));
+    }
+    void return_value(T v) { value = std::move(v); }
+  };
+
+  socc_task(socc_task&& other) noexcept
+      : handle(std::exchange(other.handle, nullptr)) {}
+  ~socc_task() {
+    if (handle) {
+      handle.destroy();
+    }
+  }
+
+  bool await_ready() noexcept { return false; }
+  std::coroutine_handle<> await_suspend(std::coroutine_handle<> caller) {
+    handle.promise().continuation = caller;
+    return handle;
+  }
+  T await_resume() { return std::move(handle.promise().value); }
+
+ private:
+  friend class socc_executor;
+  explicit socc_task(std::coroutine_handle<promise_type> h) : handle(h) {}
+  std::coroutine_handle<promise_type> handle;
+};
+
+template <>
+class socc_task<void> {
+ public:
+  struct promise_type : socc_task_promise_base {
+    socc_task get_return_object() {
+      return socc_task(std::coroutine_handle<promise_type>::from_promise(*this));
+    }
+    void return_void() {}
+  };
+
+  socc_task(socc_task&& other) noexcept
+      : handle(std::exchange(other.handle, nullptr)) {}
+  ~socc_task() {
+    if (handle) {
+      handle.destroy();
+    }
+  }
+
+  bool await_ready() noexcept { return false; }
+  std::coroutine_handle<> await_suspend(std::coroutine_handle<> caller) {
+    handle.promise().continuation = caller;
+    return handle;
+  }
+  void await_resume() {}
+
+ private:
+  friend class socc_executor;
+  explicit socc_task(std::coroutine_handle<promise_type> h) : handle(h) {}
+  std::coroutine_handle<promise_type> handle;
+};
+
+/**
+ * @class socc_executor
+ * @brief Runs the coroutines on the thread which calls run().
+ *
+ * The completions of the transactions and the events are posted from the
+ * threads of socc_ptp, and the coroutines are resumed one at a time by run(),
+ * so they need no locks among them.
+ */
+class socc_executor {
+ public:
+  typedef std::chrono::steady_clock clock;
+
+  socc_executor() : tasks(0) {}
+
+  /**
+   * @brief starts a coroutine, which is destroyed when it ends
+   */
+  template <typename T>
+  void spawn(socc_task<T> task) {
+    auto h = std::exchange(task.handle, nullptr);
+    h.promise().executor = this;
+    std::lock_guard<std::mutex> lock(mutex);
+    tasks++;
+    ready.push_back([h] { h.resume(); });
+    cond.notify_one();
+  }
+
+  /**
+   * @brief runs a function on the executor. It can be called from any thread.
+   */
+  void post(std::function<void()> fn) {
+    std::lock_guard<std::mutex> lock(mutex);
+    ready.push_back(std::move(fn));
+    cond.notify_one();
+  }
+
+  /**
+   * @brief runs a function on the executor at a time
+   */
+  void post_at(clock::time_point at, std::function<void()> fn) {
+    std::lock_guard<std::mutex> lock(mutex);
+    timers.insert(std::make_pair(at, std::move(fn)));
+    cond.notify_one();
+  }
+
+  /**
+   * @brief runs the coroutines until all of the spawned ones end
+   */
+  void run() {
+    std::unique_lock<std::mutex> lock(mutex);
+    while (tasks > 0) {
+      std::function<void()> fn;
+      if (!ready.empty()) {
+        fn = std::move(ready.front());
+        ready.pop_front();
+      } else if (!timers.empty() && timers.begin()->first <= clock::now()) {
+        fn = std::move(timers.begin()->second);
+        timers.erase(timers.begin());
+      } else if (!timers.empty()) {
+        cond.wait_until(lock, timers.begin()->first);
+        continue;
+      } else {
+        cond.wait(lock);
+        continue;
+      }
+      lock.unlock();
+      fn();
+      lock.lock();
+    }
+  }
+
+  /**
+   * @brief co_await sleep(ms) suspends the coroutine for a while
+   */
+  auto sleep(uint32_t ms) {
+    struct awaiter {
+      socc_executor* executor;
+      uint32_t ms;
+      bool await_ready() { return ms == 0; }
+      void await_suspend(std::coroutine_handle<> h) {
+        executor->post_at(clock::now() + std::chrono::milliseconds(ms),
+                          [h] { h.resume(); });
+      }
+      void await_resume() {}
+    };
+    return awaiter{this, ms};
+  }
+
+ private:
+  friend struct socc_task_promise_base;
+
+  std::mutex mutex;
+  std::condition_variable cond;
+  std::deque<std::function<void()>> ready;
+  std::multimap<clock::time_point, std::function<void()>> timers;
+  int tasks;
+
+  void finished() {
+    std::lock_guard<std::mutex> lock(mutex);
+    tasks--;
+  }
+};
+
+template <typename P>
+std::coroutine_handle<> socc_task_promise_base::final_awaiter::await_suspend(
+    std::coroutine_handle<P> h) noexcept {
+  socc_task_promise_base& promise = h.promise();
+  if (promise.continuation) {
+    return promise.continuation;
+  }
+  // a spawned coroutine, which nobody awaits
+  socc_executor* executor = promise.executor;
+  h.destroy();
+  if (executor != nullptr) {
+    executor->finished();
+  }
+  return std::noop_coroutine();
+}
+
+/**
+ * @brief A property read by socc_camera::get()
+ */
+typedef struct PropertyValue {
+  int ret;            //!< 0 on success, other on failure
+  uint16_t code;      //!< DevicePropertyCode
+  uint8_t is_enable;  //!< IsEnable of the SDIDevicePropInfo Dataset
+  int64_t current;    //!< CurrentValue, if the DataType is an integer
+} PropertyValue;
+
+/**
+ * @class socc_camera
+ * @brief Awaitable transactions and events of a socc_ptp.
+ *
+ * The events are buffered until a coroutine awaits them with next_event(), up
+ * to SOCC_CORO_EVENTS of them.
+ */
+class socc_camera {
+ public:
+  static constexpr size_t SOCC_CORO_EVENTS = 64;
+  static constexpr int64_t POLL_MS = 100;
+
+  /**
+   * @brief Constructor
+   * @param [in]ptp connected socc_ptp. Its event callback is taken.
+   * @param [in]executor the executor of the coroutines of this camera
+   */
+  socc_camera(socc_ptp* ptp, socc_executor& executor)
+      : ptp_(ptp), state(std::make_shared<event_state>()) {
+    state->executor = &executor;
+    ptp_->set_event_callback(on_event, this);
+  }
+
+  /**
+   * @brief Destructor. The event thread of ptp is stopped.
+   */
+  ~socc_camera() { ptp_->set_event_callback(NULL, NULL); }
+
+  socc_ptp* ptp() { return ptp_; }
+
+  /**
+   * @brief Parameters of a transaction, written as {p1, p2, ...}
+   */
+  struct params_t {
+    uint32_t values[5];
+    uint8_t count;
+
+    template <typename... A>
+    params_t(A... a) : values{(uint32_t)a...}, count(sizeof...(A)) {
+      static_assert(sizeof...(A) <= 5, "up to 5 parameters");
+    }
+  };
+
+  /**
+   * @brief Awaitable transaction, which returns AsyncResult
+   */
+  class transaction {
+   public:
+    bool await_ready() { return false; }
+    bool await_suspend(std::coroutine_handle<> h) {
+      handle = h;
+      int ret = receive
+                    ? camera->ptp_->receive_async(code, params.values,
+                                                  params.count, completed, this)
+                    : camera->ptp_->send_async(code, params.values,
+                                               params.count, data, size,
+                                               completed, this);
+      if (ret != SOCC_OK) {
+        result.ret = ret;
+        return false;
+      }
+      return true;
+    }
+    AsyncResult await_resume() { return result; }
+
+   private:
+    friend class socc_camera;
+    socc_camera* camera;
+    bool receive;
+    uint16_t code;
+    params_t params;
+    void* data;
+    uint32_t size;
+    std::coroutine_handle<> handle;
+    AsyncResult result;
+
+    transaction(socc_camera* camera, bool receive, uint16_t code,
+                const params_t& params, void* data, uint32_t size)
+        : camera(camera),
+          receive(receive),
+          code(code),
+          params(params),
+          data(data),
+          size(size) {
+      memset(&result, 0, sizeof(result));
+    }
+
+    static void completed(const AsyncResult& result, void* vp) {
+      transaction* t = (transaction*)vp;
+      t->result = result;
+      std::coroutine_handle<> h = t->handle;
+      t->camera->state->executor->post([h] { h.resume(); });
+    }
+  };
+
+  /**
+   * @brief co_await send(...) performs a sending transaction
+   * @param [in]data must stay valid until resumed
+   */
+  transaction send(uint16_t code, params_t params = params_t(),
+                   void* data = NULL, uint32_t size = 0) {
+    return transaction(this, false, code, params, data, size);
+  }
+
+  /**
+   * @brief co_await receive(...) performs a receiving transaction. Dispose
+   * the data of the result with ptp()->dispose_data().
+   */
+  transaction receive(uint16_t code,
+                      params_t params = params_t()) {
+    return transaction(this, true, code, params, NULL, 0);
+  }
+
+  /**
+   * @brief OpenSession
+   */
+  socc_task<int> open_session(uint32_t session_id = 1) {
+    AsyncResult result = co_await send(0x1002, {session_id});
+    co_return check(result);
+  }
+
+  /**
+   * @brief the authentication of "control auth" with SDIO_Connect and
+   * SDIO_GetExtDeviceInfo
+   */
+  socc_task<int> auth() {
+    for (uint32_t phase = 1; phase <= 3; phase++) {
+      if (phase == 3) {
+        int ret = co_await wait_version();
+        if (ret != SOCC_OK) {
+          co_return ret;
+        }
+      }
+      AsyncResult result = co_await receive(0x9201, {phase, 0, 0});
+      ptp_->dispose_data(&result.data);
+      if (check(result) != SOCC_OK) {
+        co_return check(result);
+      }
+    }
+    co_return SOCC_OK;
+  }
+
+  /**
+   * @brief SDIO_SetExtDevicePropValue
+   * @param [in]code DevicePropertyCode
+   * @param [in]value the value in the little endian
+   * @param [in]size size in byte of the DataType of the property
+   */
+  socc_task<int> set(uint16_t code, uint64_t value, uint32_t size = 2) {
+    AsyncResult result = co_await send(0x9205, {code}, &value, size);
+    co_return check(result);
+  }
+
+  /**
+   * @brief SDIO_ControlDevice
+   */
+  socc_task<int> control(uint16_t code, uint16_t value) {
+    AsyncResult result = co_await send(0x9207, {code}, &value, sizeof(value));
+    co_return check(result);
+  }
+
+  /**
+   * @brief reads a property with SDIO_GetAllExtDevicePropInfo
+   */
+  socc_task<PropertyValue> get(uint16_t code) {
+    PropertyValue value;
+    memset(&value, 0, sizeof(value));
+    value.code = code;
+    AsyncResult result = co_await receive(0x9209);
+    value.ret = check(result);
+    if (value.ret == SOCC_OK) {
+      SDIDevicePropInfoDatasetArray info(result.data);
+      SDIDevicePropInfoDataset* d = info.get(code);
+      if (d == NULL) {
+        value.ret = SOCC_ERROR_NOT_SUPPORT;
+      } else {
+        value.is_enable = d->IsEnable;
+        value.current = d->currentInteger();
+      }
+    }
+    ptp_->dispose_data(&result.data);
+    co_return value;
+  }
+
+  /**
+   * @brief waits until a property satisfies a predicate
+   *
+   * The property is read again on every DevicePropChanged, or every POLL_MS
+   * if the camera does not tell the change.
+   * @return 0 on success, SOCC_ERROR_USB_TIMEOUT on timeout, other on failure
+   */
+  socc_task<int> until(uint16_t code,
+                       std::function<bool(const PropertyValue&)> pred,
+                       uint32_t timeout_ms = 10000) {
+    socc_executor::clock::time_point deadline =
+        socc_executor::clock::now() + std::chrono::milliseconds(timeout_ms);
+    for (;;) {
+      PropertyValue value = co_await get(code);
+      if (value.ret != SOCC_OK) {
+        co_return value.ret;
+      }
+      if (pred(value)) {
+        co_return SOCC_OK;
+      }
+      int64_t remaining = std::chrono::duration_cast<std::chrono::milliseconds>(
+                              deadline - socc_executor::clock::now())
+                              .count();
+      if (remaining <= 0) {
+        co_return SOCC_ERROR_USB_TIMEOUT;
+      }
+      co_await next_event(PTP_EC_DEVICEPROPCHANGED,
+                          remaining < POLL_MS ? remaining : POLL_MS);
+    }
+  }
+
+ private:
+  static constexpr uint16_t PTP_EC_DEVICEPROPCHANGED = 0xC203;
+
+  typedef struct event_waiter {
+    uint16_t code;
+    bool done;
+    std::coroutine_handle<> handle;
+    AsyncResult result;
+  } event_waiter;
+
+  // touched only on the executor
+  typedef struct event_state {
+    socc_executor* executor;
+    std::deque<Container> events;
+    std::list<std::shared_ptr<event_waiter>> waiters;
+
+    void dispatch(const Container& event) {
+      for (auto it = waiters.begin(); it != waiters.end(); ++it) {
+        std::shared_ptr<event_waiter> w = *it;
+        if (w->code == event.code) {
+          waiters.erase(it);
+          w->done = true;
+          w->result.response = event;
+          w->handle.resume();
+          return;
+        }
+      }
+      if (events.size() >= SOCC_CORO_EVENTS) {
+        events.pop_front();
+      }
+      events.push_back(event);
+    }
+  } event_state;
+
+ public:
+  /**
+   * @brief Awaitable event, which returns AsyncResult with the event in the
+   * response, or ret of SOCC_ERROR_USB_TIMEOUT on timeout
+   */
+  class event_wait {
+   public:
+    bool await_ready() {
+      for (auto it = state->events.begin(); it != state->events.end(); ++it) {
+        if (it->code == waiter->code) {
+          waiter->result.response = *it;
+          state->events.erase(it);
+          return true;
+        }
+      }
+      return false;
+    }
+    void await_suspend(std::coroutine_handle<> h) {
+      waiter->handle = h;
+      state->waiters.push_back(waiter);
+      std::shared_ptr<event_state> s = state;
+      std::shared_ptr<event_waiter> w = waiter;
+      state->executor->post_at(
+          socc_executor::clock::now() + std::chrono::milliseconds(timeout_ms),
+          [s, w] {
+            if (!w->done) {
+              w->done = true;
+              w->result.ret = SOCC_ERROR_USB_TIMEOUT;
+              s->waiters.remove(w);
+              w->handle.resume();
+            }
+          });
+    }
+    AsyncResult await_resume() { return waiter->result; }
+
+   private:
+    friend class socc_camera;
+    std::shared_ptr<event_state> state;
+    std::shared_ptr<event_waiter> waiter;
+    uint32_t timeout_ms;
+
+    event_wait(std::shared_ptr<event_state> state, uint16_t code,
+               uint32_t timeout_ms)
+        : state(state),
+          waiter(std::make_shared<event_waiter>()),
+          timeout_ms(timeout_ms) {
+      waiter->code = code;
+      waiter->done = false;
+      memset(&waiter->result, 0, sizeof(waiter->result));
+    }
+  };
+
+  /**
+   * @brief co_await next_event(code) returns the oldest event of the code
+   * which has not been awaited yet
+   */
+  event_wait next_event(uint16_t code, uint32_t timeout_ms = 10000) {
+    return event_wait(state, code, timeout_ms);
+  }
+
+ private:
+  socc_ptp* ptp_;
+  std::shared_ptr<event_state> state;
+
+  static void on_event(const AsyncResult& result, void* vp) {
+    if (result.ret != SOCC_OK) {
+      return;
+    }
+    std::shared_ptr<event_state> s = ((socc_camera*)vp)->state;
+    Container event = result.response;
+    s->executor->post([s, event] { s->dispatch(event); });
+  }
+
+  static int check(const AsyncResult& result) {
+    if (result.ret != SOCC_OK) {
+      return result.ret;
+    }
+    return result.response.code == 0x2001 ? SOCC_OK
+                                          : SOCC_PTP_ERROR_TRANSACTION;
+  }
+
+  // SDIO_GetExtDeviceInfo until the camera accepts the version 0x012C
+  socc_task<int> wait_version() {
+    for (;;) {
+      AsyncResult result = co_await receive(0x9202, {0x012C});
+      uint16_t version = 0;
+      if (result.size >= sizeof(version)) {
+        memcpy(&version, result.data, sizeof(version));
+      }
+      ptp_->dispose_data(&result.data);
+      if (check(result) != SOCC_OK) {
+        co_return check(result);
+      }
+      if (version == 0x012C) {
+        co_return SOCC_OK;
+      }
+    }
+  }
+};
+
+}  // namespace remote
+}  // namespace imaging
+}  // namespace sony
+}  // namespace com
+#endif
@@ -0,0 +1,33 @@
+/**
+ * @file socc_crc32c.h
+ * @brief CRC-32C (Castagnoli) checksum
+ */
+
+#ifndef __SOCC_CRC32C_H__
+#define __SOCC_CRC32C_H__
+
+#include <stddef.h>
+#include <stdint.h>
+
+namespace com {
+namespace sony {
+namespace imaging {
+namespace remote {
+
+/**
+ * @brief calculates CRC-32C of data
+ *
+ * The CRC instructions of SSE4.2 or ARMv8 are used when the CPU has them,
+ * otherwise a table is used.
+ * @param crc CRC-32C of the preceding data. 0 for the first call
+ * @param data the data to be calculated
+ * @param size the size of data in byte
+ * @return CRC-32C of the preceding data and data
+ */
+uint32_t socc_crc32c(uint32_t crc, const void* data, size_t size);
+
+}  // namespace remote
+}  // namespace imaging
+}  // namespace sony
+}  // namespace com
+#endif
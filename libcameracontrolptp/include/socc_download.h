@@ -0,0 +1,138 @@
+/**
+ * @file socc_download.h
+ * @brief Chunked object download
+ */
+
+#ifndef __SOCC_DOWNLOAD_H__
+#define __SOCC_DOWNLOAD_H__
+
+#include <pthread.h>
+#include <socc_types.h>
+
+namespace com {
+namespace sony {
+namespace imaging {
+namespace remote {
+
+class socc_ptp;
+
+/**
+ * @brief Statistics of socc_download.
+ */
+typedef struct DownloadStats {
+  uint64_t size;        //!< size of the object in byte
+  uint64_t offset;      //!< bytes written to the destination. resume from here
+  uint32_t chunks;      //!< GetPartialObject transactions succeeded
+  uint32_t retries;     //!< transactions retried after clear_halt()
+  bool partial;         //!< false if GetObject was used instead
+  uint64_t elapsed_us;  //!< time of the whole download
+  uint64_t usb_us;      //!< time spent in transactions
+  uint64_t write_us;    //!< time spent in writing the destination
+} DownloadStats;
+
+/**
+ * @class socc_download
+ * @brief Downloads an object in chunks with GetPartialObject.
+ *
+ * The next chunk is requested while the previous one is written by another
+ * thread, into a destination preallocated for the object size. A failed
+ * transaction is retried from the last good offset after clear_halt(), and a
+ * download aborted by a disconnection can be resumed with the offset in
+ * DownloadStats after reconnecting. If the device doesn't support
+ * GetPartialObject, the object is downloaded with GetObject.
+ *
+ * The throughput is that of GetObject, as the transfer dominates; the memory
+ * is bounded to two chunks whatever the object size.
+ */
+class socc_download {
+ public:
+  /**
+   * @brief Constructor
+   * @param [in]ptp connected socc_ptp to download with
+   * @param [in]ptp_mutex mutex to serialize the transactions with other users
+   * of ptp. NULL if ptp is used only by this object.
+   * @param [in]chunk_size bytes requested by each GetPartialObject
+   */
+  socc_download(socc_ptp* ptp, pthread_mutex_t* ptp_mutex = NULL,
+                uint32_t chunk_size = 1024 * 1024);
+
+  /**
+   * @brief Destructor
+   */
+  ~socc_download();
+
+  /**
+   * @brief sets the number of retries for a chunk before giving up
+   */
+  void set_max_retries(int retries);
+
+  /**
+   * @brief downloads an object to a file
+   * @param [in]handle ObjectHandle
+   * @param [in]path the destination. It is truncated unless offset is given.
+   * @param [in]offset offset to resume from. 0 to start over
+   * @return 0 on success, other on failure
+   */
+  int download(uint32_t handle, const char* path, uint64_t offset = 0);
+
+  /**
+   * @brief downloads an object to a file descriptor
+   * @param [in]handle ObjectHandle
+   * @param [in]fd the destination, which supports pwrite()
+   * @param [in]offset offset to resume from. 0 to start over
+   * @return 0 on success, other on failure
+   */
+  int download(uint32_t handle, int fd, uint64_t offset = 0);
+
+  /**
+   * @brief copies the statistics of the last download
+   */
+  void get_stats(DownloadStats& stats);
+
+  /**
+   * @brief checks a printf() format of file names to be given a number
+   *
+   * The format comes from the command line or from a client, so it may only
+   * convert one int with d, i, u, o, x or X, without length or '*', besides
+   * "%%".
+   * @return true if the format can be given to snprintf() with one int
+   */
+  static bool valid_path_format(const char* format);
+
+ private:
+  typedef struct {
+    uint8_t* data;
+    uint64_t offset;
+    uint32_t size;
+    bool full;
+  } chunk_t;
+
+  socc_ptp* ptp;
+  pthread_mutex_t* ptp_mutex;
+  uint32_t chunk_size;
+  int max_retries;
+
+  chunk_t chunks[2];
+  pthread_mutex_t mutex;
+  pthread_cond_t cond;
+  int fd;
+  bool finishing;
+  int write_error;
+
+  DownloadStats stats;
+
+  static void* writer_thread(void* vp);
+  void write_chunks();
+  int transaction(uint16_t code, uint32_t* params, uint8_t nparam,
+                  Container& response, void* data, uint32_t capacity,
+                  uint32_t& size);
+  int object_size(uint32_t handle, uint64_t& size);
+  int download_whole(uint32_t handle);
+  int recover(int error);
+};
+
+}  // namespace remote
+}  // namespace imaging
+}  // namespace sony
+}  // namespace com
+#endif
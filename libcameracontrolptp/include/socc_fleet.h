@@ -0,0 +1,225 @@
+/**
+ * @file socc_fleet.h
+ * @brief Control of multiple cameras in parallel
+ */
+
+#ifndef __SOCC_FLEET_H__
+#define __SOCC_FLEET_H__
+
+#include <pthread.h>
+#include <socc_types.h>
+
+#include <deque>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+struct libusb_context;
+
+namespace com {
+namespace sony {
+namespace imaging {
+namespace ports {
+class ports_usb;
+}  // namespace ports
+
+namespace remote {
+
+class socc_ptp;
+
+/**
+ * @brief Result of an operation on a camera of socc_fleet.
+ */
+typedef struct FleetResult {
+  int ret;                //!< 0 on success, other on failure
+  uint32_t latency_us;    //!< time from the submission to the completion
+  uint64_t completed_us;  //!< monotonic time when the operation completed
+  uint64_t issued_us;     //!< monotonic time when the synchronized request
+                          //!< was sent. 0 for the other operations
+} FleetResult;
+
+/**
+ * @brief Skew of the cameras in a synchronized trigger.
+ *
+ * The offsets are the times from the earliest camera to each camera sending
+ * the full press of the shutter button.
+ */
+typedef struct FleetSkew {
+  uint32_t min_us;   //!< smallest offset except the earliest camera
+  uint32_t max_us;   //!< spread between the earliest and the latest camera
+  uint32_t p99_us;   //!< 99th percentile of the offsets
+  uint32_t cameras;  //!< cameras which have sent the request
+} FleetSkew;
+
+/**
+ * @typedef operation run by socc_fleet on a camera
+ * @param ptp the camera
+ * @param index index of the camera in the fleet
+ * @param vp user data
+ * @return 0 on success, other on failure
+ */
+typedef int (*socc_fleet_func_t)(socc_ptp* ptp, int index, void* vp);
+
+/**
+ * @class socc_fleet
+ * @brief Controls cameras in parallel with a worker thread per camera.
+ *
+ * The cameras share the libusb context of the USB registry and its thread
+ * handling the events, instead of a context and a thread per camera. Each
+ * camera has a worker thread with its own queue of operations, so the
+ * transactions to a camera are serialized while the cameras run in parallel.
+ * The fleet-wide operations return when every camera has completed, with the
+ * result and the latency of each camera.
+ */
+class socc_fleet {
+ public:
+  /**
+   * @brief Constructor
+   */
+  socc_fleet();
+
+  /**
+   * @brief Destructor. The cameras are disconnected.
+   */
+  ~socc_fleet();
+
+  /**
+   * @brief adds a camera on the shared libusb context
+   * @param [in]busn USB bus number
+   * @param [in]devn USB device number
+   * @return index of the camera on success, negative value on failure
+   */
+  int add(int busn, int devn);
+
+  /**
+   * @brief adds a camera on another USB backend, which is deleted by the
+   * fleet
+   * @return index of the camera on success, negative value on failure
+   */
+  int add(com::sony::imaging::ports::ports_usb* usb);
+
+  /**
+   * @brief returns the number of the cameras
+   */
+  int size();
+
+  /**
+   * @brief returns a camera. It must be used only in the operations run on
+   * the fleet.
+   */
+  socc_ptp* camera(int index);
+
+  /**
+   * @brief returns the index of the camera of a serial number, in constant
+   * time. The serial numbers are known once the cameras are opened.
+   * @return the index, -1 if no camera has the serial number
+   */
+  int index_of(const char* serial);
+
+  /**
+   * @brief runs an operation on every camera in parallel and waits for them
+   * @param [in]func the operation
+   * @param [in]vp user data passed to func
+   * @param [out]results result of each camera, in the order of the index
+   * @return 0 if every camera has succeeded, the first error otherwise
+   */
+  int run(socc_fleet_func_t func, void* vp, std::vector<FleetResult>& results);
+
+  /**
+   * @brief connects every camera and opens the session
+   */
+  int open(std::vector<FleetResult>& results);
+
+  /**
+   * @brief closes the session and disconnects every camera
+   */
+  int close(std::vector<FleetResult>& results);
+
+  /**
+   * @brief performs the authentication sequence of SDIO_Connect on every
+   * camera, until its properties can be read
+   */
+  int auth(std::vector<FleetResult>& results);
+
+  /**
+   * @brief sets a device property of every camera with
+   * SDIO_SetExtDevicePropValue
+   * @param [in]code DevicePropertyCode
+   * @param [in]value the value, in the byte order of the camera
+   * @param [in]size size of the value in byte
+   */
+  int set_property(uint16_t code, const void* value, uint32_t size,
+                   std::vector<FleetResult>& results);
+
+  /**
+   * @brief presses and releases the shutter button of every camera
+   */
+  int trigger(std::vector<FleetResult>& results);
+
+  /**
+   * @brief presses the shutter button of every camera at the same time
+   *
+   * Every camera presses the button halfway, builds the containers of the
+   * full press in advance and waits for the others. They are released
+   * together, so nothing but the USB transfer is left between the release
+   * and the request reaching the camera. Each camera releases the button
+   * after its full press has completed.
+   * @param [out]results result of each camera, with issued_us
+   * @param [out]skew the skew of the cameras
+   */
+  int trigger_sync(std::vector<FleetResult>& results, FleetSkew& skew);
+
+  /**
+   * @brief downloads an object from every camera
+   * @param [in]handle ObjectHandle
+   * @param [in]path_format printf() format of the file names, which takes the
+   * index of the camera. e.g. "cam%02d.jpg"
+   * @return SOCC_ERROR_INVALID_PARAMETER without results if the format
+   * doesn't take exactly one number
+   */
+  int download(uint32_t handle, const char* path_format,
+               std::vector<FleetResult>& results);
+
+ private:
+  typedef struct batch_t {
+    pthread_mutex_t mutex;
+    pthread_cond_t cond;
+    int remaining;
+  } batch_t;
+
+  typedef struct job_t {
+    socc_fleet_func_t func;
+    void* vp;
+    FleetResult* result;
+    batch_t* batch;
+    uint64_t submitted_us;
+  } job_t;
+
+  typedef struct worker_t {
+    socc_fleet* fleet;
+    int index;
+    socc_ptp* ptp;
+    pthread_t thread_id;
+    pthread_mutex_t mutex;
+    pthread_cond_t cond;
+    std::deque<job_t> jobs;
+    bool stopping;
+    bool connected;
+  } worker_t;
+
+  std::vector<worker_t*> workers;
+  std::unordered_map<std::string, int> serials;
+
+  libusb_context* context;  // acquired from the registry
+
+  int add_camera(socc_ptp* ptp);
+  int init_context();
+  static void* worker_thread(void* vp);
+  void run_worker(worker_t* worker);
+};
+
+}  // namespace remote
+}  // namespace imaging
+}  // namespace sony
+}  // namespace com
+#endif
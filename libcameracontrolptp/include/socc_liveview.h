@@ -0,0 +1,185 @@
+/**
+ * @file socc_liveview.h
+ * @brief Continuous LiveView acquisition
+ */
+
+#ifndef __SOCC_LIVEVIEW_H__
+#define __SOCC_LIVEVIEW_H__
+
+#include <pthread.h>
+#include <socc_types.h>
+
+namespace com {
+namespace sony {
+namespace imaging {
+namespace remote {
+
+class socc_ptp;
+
+/**
+ * @brief A LiveView frame published by socc_liveview.
+ *
+ * A frame is valid until it is returned with socc_liveview::release().
+ */
+typedef struct LiveViewFrame {
+  uint64_t sequence;      //!< serial number of the frame, starts from 1
+  uint8_t* jpeg;          //!< LiveView image which can be decoded as JPEG
+  uint32_t jpeg_size;     //!< size of the LiveView image in byte
+  uint8_t* dataset;       //!< whole LiveView dataset
+  uint32_t dataset_size;  //!< size of the LiveView dataset in byte
+  uint8_t* focal_frame_info;  //!< Focal Frame Info to be parsed with
+                              //!< FocalFrameInfo. NULL if absent
+  uint32_t focal_frame_info_size;  //!< size of the Focal Frame Info in byte
+  uint64_t timestamp_us;  //!< monotonic time when the transfer completed
+  uint32_t transfer_us;   //!< time of the GetObject transaction
+  uint32_t entropy_offset;  //!< offset of the SOS marker in jpeg, 0 if none
+
+  uint32_t capacity;  //!< [internal] allocated size of dataset
+  int refcount;       //!< [internal] references from the engine and consumers
+  bool writing;       //!< [internal] the engine is receiving into this frame
+  bool consumed;      //!< [internal] acquired at least once
+} LiveViewFrame;
+
+/**
+ * @brief Statistics of socc_liveview.
+ */
+typedef struct LiveViewStats {
+  uint64_t frames;     //!< frames published
+  uint64_t errors;     //!< failed transactions
+  uint64_t not_ready;  //!< responses without LiveView image
+  uint64_t dropped;    //!< frames replaced before any consumer acquired them
+  uint64_t duplicates;  //!< frames same as the latest one, not published
+  double fps;          //!< recent rate of published frames
+  uint32_t transfer_us_last;  //!< time of the last GetObject transaction
+  uint32_t transfer_us_avg;   //!< average time of GetObject transactions
+  uint32_t transfer_us_max;   //!< longest GetObject transaction
+  uint64_t age_us;  //!< time since the latest frame has been received
+} LiveViewStats;
+
+/**
+ * @class socc_liveview
+ * @brief Receives LiveView images continuously on a dedicated thread.
+ *
+ * GetObject(0xFFFFC002) is issued back to back into preallocated frames, so
+ * no buffer is allocated per frame. The latest frame is published to the
+ * consumers with a reference count, and the frames still referenced are never
+ * overwritten.
+ */
+class socc_liveview {
+ public:
+  /**
+   * @brief Constructor
+   * @param [in]ptp connected socc_ptp to receive the images with
+   * @param [in]ptp_mutex mutex to serialize the transactions with other users
+   * of ptp. NULL if ptp is used only by this engine.
+   * @param [in]nframes number of frames to be preallocated. 3 at least
+   * @param [in]capacity initial size in byte of each frame. A frame grows when
+   * a bigger image arrives.
+   */
+  socc_liveview(socc_ptp* ptp, pthread_mutex_t* ptp_mutex = NULL,
+                int nframes = 3, uint32_t capacity = 512 * 1024);
+
+  /**
+   * @brief Destructor. The engine is stopped if it is running.
+   */
+  ~socc_liveview();
+
+  /**
+   * @brief starts the acquisition thread
+   * @return 0 on success, other on failure
+   */
+  int start();
+
+  /**
+   * @brief stops the acquisition thread and waits for it
+   * @return 0 on success, other on failure
+   */
+  int stop();
+
+  /**
+   * @brief returns whether the acquisition thread is running
+   */
+  bool running();
+
+  /**
+   * @brief sets the minimum interval between requests
+   *
+   * The default value is 0. A request for a frame not ready yet is answered
+   * at once and backed off, so that the rate follows the camera.
+   * @param [in]interval_us interval in micro seconds. 0 for back to back
+   */
+  void set_interval(uint32_t interval_us);
+
+  /**
+   * @brief sets whether a frame same as the latest one is published
+   *
+   * The camera returns the same image when it is polled faster than the
+   * LiveView is refreshed. Such frames are detected by comparing the entropy
+   * coded segment of the JPEG and the Focal Frame Info with the latest frame,
+   * without decoding, which stops at the first bytes of a new image. They are
+   * counted in LiveViewStats::duplicates and not published by default. A frame
+   * whose focus frames have moved is not a duplicate.
+   * @param [in]skip true not to publish duplicated frames
+   */
+  void set_skip_duplicates(bool skip);
+
+  /**
+   * @brief waits for a frame newer than the given sequence and takes a
+   * reference to it
+   * @param [out]frame the latest frame. release() it after use.
+   * @param [in]after sequence of the frame the consumer already has. 0 for
+   * any frame
+   * @param [in]timeout_ms time to wait in milli seconds. negative for infinite
+   * @return 0 on success, SOCC_ERROR_USB_TIMEOUT on timeout, other on failure
+   */
+  int acquire(LiveViewFrame** frame, uint64_t after = 0, int timeout_ms = -1);
+
+  /**
+   * @brief takes another reference to an acquired frame
+   */
+  void retain(LiveViewFrame* frame);
+
+  /**
+   * @brief returns a reference taken by acquire() or retain()
+   */
+  void release(LiveViewFrame* frame);
+
+  /**
+   * @brief copies the current statistics
+   */
+  void get_stats(LiveViewStats& stats);
+
+ private:
+  socc_ptp* ptp;
+  pthread_mutex_t* ptp_mutex;
+
+  pthread_mutex_t mutex;
+  pthread_cond_t cond;
+  pthread_t thread_id;
+  bool thread_running;
+  bool stopping;
+
+  int nframes;
+  LiveViewFrame* frames;
+  LiveViewFrame* latest;
+  uint64_t sequence;
+  uint32_t interval_us;
+  bool skip_duplicates;
+
+  LiveViewStats stats;
+  uint64_t transfer_us_total;
+  uint64_t last_publish_us;
+
+  static void* acquisition_thread(void* vp);
+  void run();
+  LiveViewFrame* take_free_frame();
+  int fill(LiveViewFrame* frame);
+  void publish(LiveViewFrame* frame);
+  void unref(LiveViewFrame* frame);
+};
+
+}  // namespace remote
+}  // namespace imaging
+}  // namespace sony
+}  // namespace com
+#endif
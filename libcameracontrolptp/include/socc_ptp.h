@@ -32,6 +32,14 @@ founded in enumeration, if both bus number and device address are zero.\n
  * com::sony::imaging::remote::socc_ptp::disconnect()\n
  * disconnect() should disconnect from the target device, and release every
 resources if needed\n
+ * \n
+ * com::sony::imaging::remote::socc_ptp::reconnect() [OPTIONAL]\n
+ * reconnect() should open again the target device after it has been removed
+and has come back, without initializing the whole backend again.\n
+ * Our implementation reopens the device of the same vendor ID, product ID and
+serial number, reported by the hotplug callback with
+socc_hotplug_event_t::SOCC_HOTPLUG_EVENT_ARRIVED after the removal.
+The session is not restored, OpenSession is needed again.\n
  * \n
  * @par Synchronous transaction
  * com::sony::imaging::remote::socc_ptp::send(uint16_t code, uint32_t* params,
@@ -80,6 +88,31 @@ translate each field.
  * com::sony::imaging::remote::socc_ptp::dispose_data(void** data)\n
  * dispose_data() should free allocated buffer by receive(), and set it's
 pointer to NULL.\n
+ * @par Asynchronous transaction
+ * com::sony::imaging::remote::socc_ptp::send_async() and
+com::sony::imaging::remote::socc_ptp::receive_async() queue a transaction to
+the transfer thread of socc_ptp, and return immediately.\n
+ * The result is passed to a callback function of
+socc_async_callback_func_t, or to the returned std::future.\n
+ * The transactions are performed one at a time in the order queued, and the
+synchronous transactions of other threads are serialized with them.\n
+ * \n
+ * @par Thread safety
+ * A socc_ptp can be shared by many threads. Every transaction, synchronous or
+not, takes its turn in a lock-free queue, and the TransactionID is assigned
+when the transaction is dispatched, so the containers of two transactions are
+never interleaved on the bulk endpoints.\n
+ * A synchronous transaction is performed on the calling thread when its turn
+comes, and an asynchronous one on the transfer thread. A synchronous
+transaction called from a callback of send_async() or receive_async(), or
+between issue_prepared() and complete_prepared(), is performed at once. A
+callback can also call the transactions of another socc_ptp, which take their
+turn there.\n
+ * wait_event() reads the interrupt endpoint concurrently with the
+transactions.\n
+ * com::sony::imaging::remote::socc_ptp::set_event_callback() delivers the
+events from an event thread in the same way.\n
+ * \n
  * @par Hotplug
  * com::sony::imaging::remote::socc_ptp::set_hotplug_callback(socc_hotplug_callback_func_t callback_func, void* vp)\n
  * set_hotplug_callback() registers callback function for USB hot plug
@@ -125,9 +158,13 @@ at sametime, if paramter "what" is zero.\n
 
 #ifndef __SOCC_PTP_H__
 #define __SOCC_PTP_H__
+#include <pthread.h>
 #include <socc_types.h>
 #include <stdio.h>
 
+#include <atomic>
+#include <future>
+
 namespace com {
 namespace sony {
 namespace imaging {
@@ -144,6 +181,8 @@ namespace sony {
 namespace imaging {
 namespace remote {
 
+class socc_stats;
+
 /**
  * @class socc_ptp
  * @brief Class for USB/PTP connection and PTP transfer
@@ -158,6 +197,14 @@ class socc_ptp {
    */
   socc_ptp(int32_t bus = 0, int32_t dev = 0);
 
+  /**
+   * @brief Constructor with your own USB backend
+   *
+   * @param [in]usb USB backend to perform PTP transfers on. socc_ptp takes the
+   * ownership and deletes it in the destructor.
+   */
+  socc_ptp(com::sony::imaging::ports::ports_usb* usb);
+
   /**
    * @brief Destructor
    */
@@ -176,6 +223,23 @@ class socc_ptp {
    */
   int disconnect();
 
+  /**
+   * @brief [OPTIONAL] Open again the target device, which has been removed
+   * and has come back
+   * @return 0 on success, SOCC_ERROR_USB_DEVICE_NOT_FOUND if the device has
+   * not come back yet, other on failure
+   */
+  int reconnect();
+
+  /**
+   * @brief [OPTIONAL] The serial number of the target device
+   * @param [out]buffer the serial number, terminated by NUL
+   * @param [in]size the size of buffer
+   * @return 0 on success, SOCC_ERROR_NOT_SUPPORT if the backend does not tell
+   * it, other on failure
+   */
+  int serial_number(char* buffer, size_t size);
+
   /**
    * @brief [MANDATORY] Register callback function for USB hot plug detection
    * @param [in]callback_func the function to be invoked on USB connection or
@@ -214,6 +278,116 @@ class socc_ptp {
   int receive(uint16_t code, uint32_t* params, uint8_t nparam,
               Container& response, void** data, uint32_t& size);
 
+  /**
+   * @brief Perform receiving transaction with data phase into a buffer given by
+   * the caller
+   *
+   * Same as receive(), but nothing is allocated. This is for the transactions
+   * repeated at high rate like the LiveView image.
+   * @param [in]code OperationCode
+   * @param [in]params  uint32_t array of parameters
+   * @param [in]nparam number of parameters
+   * @param [out]response Response Dataset
+   * @param [out]*data buffer to store the transferred data
+   * @param [in]capacity size in byte of data
+   * @param [out]size actual transferred data size in byte. If the data phase
+   * is bigger than capacity, the needed size is set and
+   * SOCC_ERROR_USB_OVERFLOW is returned after the transaction is completed.
+   * @return 0 on success, other on failure
+   */
+  int receive_into(uint16_t code, uint32_t* params, uint8_t nparam,
+                   Container& response, void* data, uint32_t capacity,
+                   uint32_t& size);
+
+  /**
+   * @brief Build the containers of a sending transaction in advance
+   *
+   * The transaction is started with issue_prepared() and completed with
+   * complete_prepared(), so nothing is built between a trigger and the USB
+   * transfer. This is for the operations which should reach several cameras
+   * at the same time like the shutter.
+   * @param [in]code OperationCode
+   * @param [in]params  uint32_t array of parameters
+   * @param [in]nparam number of parameters
+   * @param [in]*data data to transfer in data phase. Set NULL if data is absent
+   * @param [in]size size in byte of data, up to 52 bytes
+   * @param [out]prepared the containers
+   * @return 0 on success, other on failure
+   */
+  int prepare_send(uint16_t code, uint32_t* params, uint8_t nparam, void* data,
+                   uint32_t size, PreparedTransaction& prepared);
+
+  /**
+   * @brief Send the Command Block and the Data Block of a prepared transaction
+   *
+   * The other transactions of this object are held off until
+   * complete_prepared() is called by the same thread.
+   * @param [in]prepared the containers built by prepare_send(). It can be
+   * issued again.
+   * @return 0 on success, other on failure
+   */
+  int issue_prepared(PreparedTransaction& prepared);
+
+  /**
+   * @brief Receive the response of the issued transaction
+   * @param [out]response Response Dataset
+   * @return 0 on success, SOCC_ERROR_INVALID_PARAMETER if no transaction has
+   * been issued, other on failure
+   */
+  int complete_prepared(Container& response);
+
+  /**
+   * @brief Perform sending transaction asynchronously
+   *
+   * The transaction is queued and performed by the transfer thread of this
+   * object, which is started by the first asynchronous transaction. The
+   * transactions are performed one at a time in the order queued, serialized
+   * with the synchronous ones, so a thread can drive many cameras without
+   * blocking.
+   * @param [in]code OperationCode
+   * @param [in]params  uint32_t array of parameters, copied
+   * @param [in]nparam number of parameters
+   * @param [in]*data data to transfer in data phase, which must stay valid
+   * until callback is invoked. Set NULL if data is absent
+   * @param [in]size size in byte of data. Set 0 if data is absent
+   * @param [in]callback the function invoked on the transfer thread with the
+   * result. ret of the result is SOCC_ERROR_CANCELED if this object is
+   * deleted before the transaction is performed.
+   * @param [in]vp user data
+   * @return 0 if queued, other on failure
+   */
+  int send_async(uint16_t code, uint32_t* params, uint8_t nparam, void* data,
+                 uint32_t size, socc_async_callback_func_t callback, void* vp);
+
+  /**
+   * @brief Perform receiving transaction asynchronously
+   *
+   * Same as send_async(), but the data received is set in the result. Dispose
+   * it with dispose_data().
+   * @param [in]code OperationCode
+   * @param [in]params  uint32_t array of parameters, copied
+   * @param [in]nparam number of parameters
+   * @param [in]callback the function invoked on the transfer thread with the
+   * result
+   * @param [in]vp user data
+   * @return 0 if queued, other on failure
+   */
+  int receive_async(uint16_t code, uint32_t* params, uint8_t nparam,
+                    socc_async_callback_func_t callback, void* vp);
+
+  /**
+   * @brief send_async() which returns a future of the result
+   */
+  std::future<AsyncResult> send_async(uint16_t code, uint32_t* params,
+                                      uint8_t nparam, void* data,
+                                      uint32_t size);
+
+  /**
+   * @brief receive_async() which returns a future of the result
+   */
+  std::future<AsyncResult> receive_async(uint16_t code, uint32_t* params,
+                                         uint8_t nparam);
+
   /**
    * @brief [MANDATORY] Wait for event
    * @param [out]container acquired container in Event Dataset format
@@ -221,6 +395,19 @@ class socc_ptp {
    */
   int wait_event(Container& container);
 
+  /**
+   * @brief Deliver the events to a callback function
+   *
+   * An event thread waits for the events concurrently with the transactions,
+   * and invokes callback with each of them in the response of the result.
+   * The errors other than SOCC_ERROR_USB_TIMEOUT are delivered too.
+   * @param [in]callback the function invoked on the event thread. NULL to stop
+   * the event thread, which is joined after its pending wait_event() returns.
+   * @param [in]vp user data
+   * @return 0 on success, other on failure
+   */
+  int set_event_callback(socc_async_callback_func_t callback, void* vp);
+
   /**
    * @brief [MANDATORY] Dispose data buffer allocated in receive method, and set
    * the pointer to NULL.
@@ -241,11 +428,68 @@ class socc_ptp {
    */
   int reset();
 
+  /**
+   * @brief Statistics of the transactions, like the latencies of each phase
+   * and the bytes transferred for each OperationCode
+   * @return the statistics, owned by this object
+   */
+  socc_stats* stats();
+
  private:
+  struct async_request;
+
   int32_t busn;
   int32_t devn;
   com::sony::imaging::ports::ports_usb* usb;
   com::sony::imaging::ports::ports_ptp* ptp;
+
+  // the transactions waiting for their turn, pushed by any thread and popped
+  // by the dispatching thread only
+  std::atomic<async_request*> queue_head;
+  async_request* queue_tail;
+  async_request* queue_stub;
+  // owned by the thread performing the transactions, and passed on to the
+  // thread of the next request
+  std::atomic<bool> dispatching;
+  // the thread holding the dispatching, told by the address of its own
+  // thread local waiter. a callback can call another object, so that this is
+  // kept per object and not per thread.
+  std::atomic<const void*> owner;
+  // between issue_prepared() and complete_prepared()
+  bool prepared_issued;
+  bool prepared_nested;
+
+  pthread_mutex_t transfer_mutex;
+  pthread_cond_t transfer_cond;
+  pthread_t transfer_thread_id;
+  bool transfer_running;
+  std::atomic<bool> transfer_stopping;
+  async_request* transfer_next;
+
+  pthread_t event_thread_id;
+  bool event_running;
+  std::atomic<bool> event_stopping;
+  socc_async_callback_func_t event_callback;
+  void* event_vp;
+
+  void init();
+  void push(async_request* request);
+  async_request* pop();
+  bool acquire();
+  void grant(async_request* request);
+  void pass_on();
+  bool begin_transaction();
+  void end_transaction(bool nested);
+  int queue(bool receive, uint16_t code, uint32_t* params, uint8_t nparam,
+            void* data, uint32_t size, socc_async_callback_func_t callback,
+            void* vp);
+  void stop_transfer_thread();
+  void stop_event_thread();
+  static void* transfer_thread(void* vp);
+  static void* event_thread(void* vp);
+  static void fulfill(const AsyncResult& result, void* vp);
+  void run_transfers();
+  void run_events();
 };
 
 }  // namespace remote
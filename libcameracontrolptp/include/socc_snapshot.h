@@ -0,0 +1,146 @@
+/**
+ * @file socc_snapshot.h
+ * @brief Snapshots of the device properties and the changes between them
+ */
+
+#ifndef __SOCC_SNAPSHOT_H__
+#define __SOCC_SNAPSHOT_H__
+
+#include <socc_types.h>
+
+#include <string>
+#include <vector>
+
+namespace com {
+namespace sony {
+namespace imaging {
+namespace remote {
+
+/**
+ * number of the snapshots kept by a server, for the diffs with the latest ones
+ */
+#define SOCC_SNAPSHOT_HISTORY 16
+
+/**
+ * @brief A property which differs between two snapshots.
+ */
+typedef struct SnapshotChange {
+  uint16_t code;   //!< DevicePropertyCode
+  int32_t before;  //!< the index in the earlier snapshot, -1 if added
+  int32_t after;   //!< the index in the later snapshot, -1 if removed
+} SnapshotChange;
+
+/**
+ * @class socc_snapshot
+ * @brief The current values of the properties of a dataset of
+ * GetAllExtDevicePropInfo(0x9209), in columns sorted by DevicePropertyCode.
+ *
+ * The current values are kept as their bytes on the wire, back to back in a
+ * single buffer, with the number of the values of an array and the length of
+ * a string before them. A snapshot is a few vectors instead of a dataset
+ * object per property, and two snapshots of the same camera are usually laid
+ * out alike, so that diff() compares the buffers in blocks and looks at the
+ * properties only where a block differs.
+ */
+class socc_snapshot {
+ public:
+  socc_snapshot();
+  ~socc_snapshot();
+
+  /**
+   * @brief takes the current values of a dataset of GetAllExtDevicePropInfo
+   * @param [in]data the dataset
+   * @param [in]size the bytes of data
+   * @return SOCC_OK, or SOCC_ERROR_INVALID_PARAMETER if the dataset is
+   * truncated or has an unsupported DataType. The properties before it are
+   * taken.
+   */
+  int parse(const void* data, uint32_t size);
+
+  /**
+   * @brief number of the properties
+   */
+  uint32_t num() const;
+
+  /**
+   * @brief DevicePropertyCode of the i-th property, in ascending order
+   */
+  uint16_t code(uint32_t i) const;
+
+  /**
+   * @brief DataType of the i-th property
+   */
+  uint16_t type(uint32_t i) const;
+
+  /**
+   * @brief the index of a property
+   * @return the index, -1 if the snapshot does not have it
+   */
+  int32_t find(uint16_t code) const;
+
+  /**
+   * @brief stores the current value of the i-th property, like
+   * SDIDevicePropInfoDataset::currentValueToString()
+   */
+  void value_to_string(uint32_t i, std::string& str) const;
+
+  /**
+   * @brief stores the current value of the i-th property as a JSON number,
+   * array or string
+   */
+  void value_to_json(uint32_t i, std::string& str) const;
+
+  /**
+   * @brief the time of parse(), in micro seconds since the epoch
+   */
+  uint64_t time_us() const;
+
+  /**
+   * @brief finds the properties changed, added or removed from before to
+   * after
+   * @param [in]before the earlier snapshot
+   * @param [in]after the later snapshot
+   * @param [out]changes the changes in the order of DevicePropertyCode
+   */
+  static void diff(const socc_snapshot& before, const socc_snapshot& after,
+                   std::vector<SnapshotChange>& changes);
+
+  /**
+   * @brief stores the changes as lines of "code: before -> after", with "-"
+   * for the value of an added or a removed property
+   */
+  static void changes_to_string(const socc_snapshot& before,
+                                const socc_snapshot& after,
+                                const std::vector<SnapshotChange>& changes,
+                                std::string& str);
+
+  /**
+   * @brief stores the changes as a JSON array of objects of "code", "type",
+   * "before" and "after", with null for the value of an added or a removed
+   * property
+   */
+  static void changes_to_json(const socc_snapshot& before,
+                              const socc_snapshot& after,
+                              const std::vector<SnapshotChange>& changes,
+                              std::string& str);
+
+ private:
+  std::vector<uint16_t> codes_;
+  std::vector<uint16_t> types_;
+  std::vector<uint32_t> offsets_;  // num() + 1 offsets of values_
+  std::vector<uint8_t> values_;    // the current values on the wire
+  uint64_t time_us_;
+
+  static void diff_aligned(const socc_snapshot& before,
+                           const socc_snapshot& after,
+                           std::vector<SnapshotChange>& changes);
+  static void diff_merged(const socc_snapshot& before,
+                          const socc_snapshot& after,
+                          std::vector<SnapshotChange>& changes);
+};
+
+}  // namespace remote
+}  // namespace imaging
+}  // namespace sony
+}  // namespace com
+#endif
@@ -0,0 +1,194 @@
+/**
+ * @file socc_stats.h
+ * @brief Latency and traffic statistics of the PTP transactions
+ */
+
+#ifndef __SOCC_STATS_H__
+#define __SOCC_STATS_H__
+
+#include <socc_types.h>
+
+#include <atomic>
+#include <string>
+
+namespace com {
+namespace sony {
+namespace imaging {
+namespace remote {
+
+/**
+ * number of the buckets of a latency histogram. The latencies in micro
+ * seconds are counted exactly below 16, and with 8 buckets per power of two
+ * above, that is within 12.5%, up to 2^32 us.
+ */
+#define SOCC_STATS_BUCKETS 240
+
+/**
+ * number of the operation codes counted separately. The others are counted
+ * together with the code 0.
+ */
+#define SOCC_STATS_OPERATIONS 64
+
+/**
+ * the phases of one transaction in this many of an operation code are timed,
+ * starting from the first one. The latency of every transaction is counted.
+ */
+#define SOCC_STATS_PHASE_SAMPLING 16
+
+/**
+ * @brief Times of the phases of a transaction, in micro seconds from its
+ * start.
+ */
+typedef struct PhaseTimes {
+  uint64_t request_us;     //!< the Command Block has been sent
+  uint64_t first_data_us;  //!< the first packet of the data phase
+  uint64_t last_data_us;   //!< the last packet of the data phase
+  uint64_t response_us;    //!< the Response Block has been received
+} PhaseTimes;
+
+/**
+ * @brief Statistics of an operation code.
+ */
+typedef struct OperationStats {
+  uint16_t code;          //!< OperationCode. 0 for the others
+  uint64_t count;         //!< transactions
+  uint64_t errors;        //!< transactions failed in USB or in the container
+  uint64_t stalls;        //!< failed with SOCC_ERROR_USB_ENDPOINT_HALTED
+  uint64_t timeouts;      //!< failed with SOCC_ERROR_USB_TIMEOUT
+  uint64_t responses_ng;  //!< completed with other than OK(0x2001)
+  uint64_t bytes_in;      //!< bytes received in the data phase
+  uint64_t bytes_out;     //!< bytes sent in the data phase
+  uint64_t total_us;      //!< sum of the latencies
+  uint64_t max_us;        //!< longest latency
+  uint64_t phases_count;  //!< transactions whose phases have been timed
+  PhaseTimes phases_sum;  //!< sum of the phase times of those
+  PhaseTimes last;        //!< phase times of the last one timed
+  uint32_t histogram[SOCC_STATS_BUCKETS];  //!< counts of the latencies
+} OperationStats;
+
+/**
+ * @class socc_stats
+ * @brief Collects the statistics of the transactions of a session.
+ *
+ * The transactions of a session are serialized, so the counters have a single
+ * writer and are updated without read-modify-write instructions. They are
+ * atomic only to be read from other threads while being updated.
+ *
+ * A transaction reads the clock at its start and its end, and a few plain
+ * stores; a sampled one reads it also at its phases. bench_stats measures 65
+ * to 90 ns a transaction with the clock read through the vDSO, a fifth of a
+ * transaction on the mock backend and more under a slower clock source. The
+ * collection can be disabled where it matters.
+ */
+class socc_stats {
+ public:
+  socc_stats();
+  ~socc_stats();
+
+  /**
+   * @brief enables or disables the collection. Enabled by default.
+   */
+  void set_enabled(bool enabled);
+
+  /**
+   * @brief whether the collection is enabled
+   */
+  bool enabled();
+
+  /**
+   * @brief clears the statistics
+   */
+  void reset();
+
+  /**
+   * @brief marks the start of a transaction
+   * @param [in]code OperationCode
+   */
+  void begin(uint16_t code);
+
+  /**
+   * @brief marks that the Command Block has been sent
+   */
+  void request_sent();
+
+  /**
+   * @brief marks a packet of the data phase
+   * @param [in]bytes payload bytes of the packet
+   * @param [in]out true if the data is sent to the device
+   */
+  void data(uint32_t bytes, bool out);
+
+  /**
+   * @brief marks the end of the transaction
+   * @param [in]rc return code of the transaction
+   * @param [in]response_code ResponseCode. 0 if no response has been received
+   */
+  void end(int rc, uint16_t response_code);
+
+  /**
+   * @brief copies the statistics of the operation codes
+   * @param [out]stats statistics of each operation code seen, up to size
+   * @param [in]size number of the elements of stats
+   * @return number of the operation codes copied
+   */
+  int get(OperationStats* stats, int size);
+
+  /**
+   * @brief latency at a percentile from a histogram of OperationStats
+   * @param [in]stats the statistics
+   * @param [in]percentile 0 to 100
+   * @return upper bound of the bucket in micro seconds
+   */
+  static uint64_t percentile(const OperationStats& stats, double percentile);
+
+  /**
+   * @brief the largest latency counted in a bucket of the histogram
+   * @param [in]bucket index of OperationStats::histogram
+   * @return the latency in micro seconds
+   */
+  static uint64_t bucket_upper_us(int bucket);
+
+  /**
+   * @brief writes the statistics as JSON
+   * @param [out]json the statistics of each operation code and the totals
+   */
+  void to_json(std::string& json);
+
+ private:
+  typedef struct counters_t {
+    std::atomic<uint32_t> code;
+    std::atomic<uint64_t> count;
+    std::atomic<uint64_t> errors;
+    std::atomic<uint64_t> stalls;
+    std::atomic<uint64_t> timeouts;
+    std::atomic<uint64_t> responses_ng;
+    std::atomic<uint64_t> bytes_in;
+    std::atomic<uint64_t> bytes_out;
+    std::atomic<uint64_t> total_us;
+    std::atomic<uint64_t> max_us;
+    std::atomic<uint64_t> phases_count;
+    std::atomic<uint64_t> phases_sum[4];
+    std::atomic<uint64_t> last[4];
+    std::atomic<uint32_t> histogram[SOCC_STATS_BUCKETS];
+  } counters_t;
+
+  std::atomic<bool> on;
+  counters_t* operations;
+
+  // the transaction in progress
+  counters_t* current;
+  bool timing;  // the phases are timed
+  uint64_t start_ns;
+  uint64_t phases[4];
+  uint64_t bytes_in;
+  uint64_t bytes_out;
+
+  counters_t* find(uint16_t code);
+  static int bucket(uint64_t us);
+};
+
+}  // namespace remote
+}  // namespace imaging
+}  // namespace sony
+}  // namespace com
+#endif
@@ -0,0 +1,37 @@
+/**
+ * @file socc_time.h
+ * @brief Monotonic clock for the intervals and the timeouts
+ */
+
+#ifndef __SOCC_TIME_H__
+#define __SOCC_TIME_H__
+
+#include <stdint.h>
+#include <time.h>
+
+namespace com {
+namespace sony {
+namespace imaging {
+namespace remote {
+
+/**
+ * @brief returns CLOCK_MONOTONIC in nano seconds
+ */
+static inline uint64_t socc_monotonic_ns() {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (uint64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+/**
+ * @brief returns CLOCK_MONOTONIC in micro seconds
+ */
+static inline uint64_t socc_monotonic_us() {
+  return socc_monotonic_ns() / 1000;
+}
+
+}  // namespace remote
+}  // namespace imaging
+}  // namespace sony
+}  // namespace com
+#endif
@@ -0,0 +1,80 @@
+/**
+ * @file socc_trace.h
+ * @brief Trace of the USB, PTP and daemon activities in the Chrome trace
+ * event format
+ */
+
+#ifndef __SOCC_TRACE_H__
+#define __SOCC_TRACE_H__
+
+#include <stddef.h>
+#include <stdint.h>
+
+/**
+ * name of the environment variable which enables the trace. The value is the
+ * path of the trace file.
+ */
+#define SOCC_TRACE_ENV "SOCC_TRACE"
+
+namespace com {
+namespace sony {
+namespace imaging {
+namespace remote {
+
+/**
+ * @brief starts tracing into a file
+ *
+ * Each thread records the spans into its own buffer without locks, and
+ * socc_trace_flush() appends them to the file as the JSON Array Format of the
+ * Chrome trace events. The processes can share a file, since the array is
+ * left open and every flush is a single append, so that the client and the
+ * server are shown together by Perfetto or chrome://tracing. The spans are
+ * flushed at exit too.
+ * @param path the trace file
+ * @param process_name the name shown for this process
+ * @return 0 on success, other on failure
+ */
+int socc_trace_start(const char* path, const char* process_name);
+
+/**
+ * @brief starts tracing into the file given by SOCC_TRACE_ENV, if it is set
+ * @param process_name the name shown for this process
+ * @return 0 on success or if it is not set, other on failure
+ */
+int socc_trace_start_from_env(const char* process_name);
+
+/**
+ * @brief flushes and stops tracing
+ */
+void socc_trace_stop();
+
+/**
+ * @brief appends the recorded spans to the trace file
+ * @return 0 on success, other on failure
+ */
+int socc_trace_flush();
+
+/**
+ * @brief the beginning of a span
+ * @return monotonic time in nano seconds, 0 if not tracing
+ */
+uint64_t socc_trace_now();
+
+/**
+ * @brief records a span, which ends now
+ * @param name name of the span, which must be a literal
+ * @param category category of the span, which must be a literal
+ * @param begin the beginning returned by socc_trace_now(). Nothing is
+ * recorded if it is 0.
+ * @param arg_name name of the argument, which must be a literal. NULL if
+ * absent
+ * @param arg value of the argument
+ */
+void socc_trace_span(const char* name, const char* category, uint64_t begin,
+                     const char* arg_name = NULL, uint32_t arg = 0);
+
+}  // namespace remote
+}  // namespace imaging
+}  // namespace sony
+}  // namespace com
+#endif
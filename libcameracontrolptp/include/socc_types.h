@@ -22,6 +22,7 @@ enum {
   SOCC_OK = 0,
   SOCC_ERROR_NOT_SUPPORT = -1,
   SOCC_ERROR_INVALID_PARAMETER = -2,
+  SOCC_ERROR_CANCELED = -3,
 
   SOCC_ERROR_USB_INIT = -101,
   SOCC_ERROR_USB_DEVICE_NOT_FOUND = -102,
@@ -36,6 +37,8 @@ enum {
   SOCC_ERROR_THREAD_CREATE = -202,
 
   SOCC_PTP_ERROR_TRANSACTION = -301,
+
+  SOCC_ERROR_FILE_IO = -401,
 };
 
 /**
@@ -74,6 +77,34 @@ typedef struct Container {
   uint8_t nparam;           //!< number of valid parameters above
 } Container;
 
+/**
+ * \struct PreparedTransaction Command Block and Data Block of a sending
+ * transaction built in advance
+ */
+typedef struct PreparedTransaction {
+  uint8_t request[32];    //!< Command Block
+  uint32_t request_size;  //!< size of the Command Block in byte
+  uint8_t data[64];       //!< Data Block
+  uint32_t data_size;     //!< size of the Data Block in byte. 0 if absent
+} PreparedTransaction;
+
+/**
+ * \struct AsyncResult Result of a transaction performed asynchronously
+ */
+typedef struct AsyncResult {
+  int ret;             //!< 0 on success, other on failure
+  Container response;  //!< Response Dataset, or Event Dataset of an event
+  void* data;     //!< data received by receive_async(). Dispose it with
+                  //!< socc_ptp::dispose_data()
+  uint32_t size;  //!< size in byte of data
+} AsyncResult;
+
+/**
+ * \typedef type of the callback function of the asynchronous transactions
+ */
+typedef void (*socc_async_callback_func_t)(const AsyncResult& result,
+                                           void* vp);
+
 }  // namespace remote
 }  // namespace imaging
 }  // namespace sony
@@ -20,7 +20,20 @@ class ports_ptp {
   virtual int receive(uint16_t code, uint32_t* parameters, uint8_t num,
                       com::sony::imaging::remote::Container& response,
                       void** data, uint32_t& size) = 0;
+  virtual int receive_into(uint16_t code, uint32_t* parameters, uint8_t num,
+                           com::sony::imaging::remote::Container& response,
+                           void* data, uint32_t capacity,
+                           uint32_t& size) = 0;
+  virtual int prepare_send(
+      uint16_t code, uint32_t* parameters, uint8_t num, void* data,
+      uint32_t size,
+      com::sony::imaging::remote::PreparedTransaction& prepared) = 0;
+  virtual int issue_prepared(
+      com::sony::imaging::remote::PreparedTransaction& prepared) = 0;
+  virtual int complete_prepared(
+      com::sony::imaging::remote::Container& response) = 0;
   virtual int wait_event(com::sony::imaging::remote::Container& container) = 0;
+  virtual com::sony::imaging::remote::socc_stats* stats() = 0;
   virtual void dispose_data(void** data) = 0;
 };
 
@@ -1,5 +1,6 @@
 #include "ports_ptp_impl.h"
 
+#include <socc_trace.h>
 #include <socc_types.h>
 #include <stdio.h>
 #include <stdlib.h>
@@ -9,6 +10,8 @@
 #include "ports_usb_impl.h"
 
 using namespace com::sony::imaging::ports;
+using com::sony::imaging::remote::socc_trace_now;
+using com::sony::imaging::remote::socc_trace_span;
 
 ports_ptp_impl::ports_ptp_impl(int busn, int devn, uint32_t session_id,
                                uint32_t transaction_id, ports_usb* usb)
@@ -25,26 +28,21 @@ int ports_ptp_impl::send(uint16_t code, uint32_t* parameters, uint8_t num,
     session_id = 0;
     transaction_id = 0;
   }
+  uint32_t tid = transaction_id.fetch_add(1);
 
-  rc = sendreq(code, parameters, num);
-  if (rc != 0) {
-    return rc;
+  transaction_stats.begin(code);
+  rc = sendreq(code, parameters, num, tid);
+  if (rc == 0 && data != NULL && size > 0) {
+    rc = senddata(code, parameters, num, data, size, tid);
   }
-
-  if (data != NULL && size > 0) {
-    rc = senddata(code, parameters, num, data, size);
-    if (rc != 0) {
-      return rc;
-    }
+  if (rc == 0) {
+    rc = getresp(response);
   }
-
-  rc = getresp(response);
+  transaction_stats.end(rc, response.code);
   if (rc != 0) {
     return rc;
   }
 
-  transaction_id++;
-
   return SOCC_OK;
 }
 
@@ -55,23 +53,125 @@ int ports_ptp_impl::receive(uint16_t code, uint32_t* parameters, uint8_t num,
   memset(&response, 0, sizeof(response));
   size = 0;
 
-  rc = sendreq(code, parameters, num);
-
+  transaction_stats.begin(code);
+  rc = sendreq(code, parameters, num, transaction_id.fetch_add(1));
+  if (rc == 0) {
+    rc = getdata(data, size);
+  }
+  if (rc == 0) {
+    rc = getresp(response);
+  }
+  transaction_stats.end(rc, response.code);
   if (rc != 0) {
     return rc;
   }
 
-  rc = getdata(data, size);
+  return SOCC_OK;
+}
+
+int ports_ptp_impl::receive_into(
+    uint16_t code, uint32_t* parameters, uint8_t num,
+    com::sony::imaging::remote::Container& response, void* data,
+    uint32_t capacity, uint32_t& size) {
+  int rc;
+  int data_rc;
+  memset(&response, 0, sizeof(response));
+  size = 0;
+
+  transaction_stats.begin(code);
+  rc = sendreq(code, parameters, num, transaction_id.fetch_add(1));
   if (rc != 0) {
+    transaction_stats.end(rc, 0);
     return rc;
   }
 
+  // an overflowed data phase is drained completely, so the response phase is
+  // still read and the session stays in step.
+  data_rc = getdata_into(data, capacity, size);
+  if (data_rc != 0 && data_rc != SOCC_ERROR_USB_OVERFLOW) {
+    transaction_stats.end(data_rc, 0);
+    return data_rc;
+  }
+
   rc = getresp(response);
+  transaction_stats.end(rc, response.code);
   if (rc != 0) {
     return rc;
   }
 
-  transaction_id++;
+  return data_rc;
+}
+
+int ports_ptp_impl::prepare_send(
+    uint16_t code, uint32_t* parameters, uint8_t num, void* data,
+    uint32_t size, com::sony::imaging::remote::PreparedTransaction& prepared) {
+  GenericBulkContainerHeader* header;
+
+  if (num > 5 || sizeof(GenericBulkContainerHeader) + size >
+                     sizeof(prepared.data)) {
+    return SOCC_ERROR_INVALID_PARAMETER;
+  }
+  memset(&prepared, 0, sizeof(prepared));
+
+  prepared.request_size =
+      sizeof(GenericBulkContainerHeader) + sizeof(uint32_t) * num;
+  header = (GenericBulkContainerHeader*)prepared.request;
+  header->length = prepared.request_size;
+  header->type = 0x0001; /* Command Block */
+  header->code = code;
+  memcpy(header + 1, parameters, sizeof(uint32_t) * num);
+
+  if (data != NULL && size > 0) {
+    prepared.data_size = sizeof(GenericBulkContainerHeader) + size;
+    header = (GenericBulkContainerHeader*)prepared.data;
+    header->length = prepared.data_size;
+    header->type = 0x0002; /* Data Block */
+    header->code = code;
+    memcpy(header + 1, data, size);
+  }
+  return SOCC_OK;
+}
+
+int ports_ptp_impl::issue_prepared(
+    com::sony::imaging::remote::PreparedTransaction& prepared) {
+  GenericBulkContainerHeader* header =
+      (GenericBulkContainerHeader*)prepared.request;
+
+  // only the TransactionID is filled at the last moment
+  uint32_t tid = transaction_id.fetch_add(1);
+  header->transaction_id = tid;
+  transaction_stats.begin(header->code);
+  uint64_t begin = socc_trace_now();
+  int actual = usb->write(prepared.request, prepared.request_size);
+  socc_trace_span("sendreq", "usb", begin, "code", header->code);
+  if (actual < 0) {
+    transaction_stats.end(actual, 0);
+    return actual;
+  }
+  transaction_stats.request_sent();
+
+  if (prepared.data_size > 0) {
+    ((GenericBulkContainerHeader*)prepared.data)->transaction_id = tid;
+    actual = usb->write(prepared.data, prepared.data_size);
+    if (actual < 0) {
+      transaction_stats.end(actual, 0);
+      return actual;
+    }
+    transaction_stats.data(
+        prepared.data_size - sizeof(GenericBulkContainerHeader), true);
+  }
+  return SOCC_OK;
+}
+
+int ports_ptp_impl::complete_prepared(
+    com::sony::imaging::remote::Container& response) {
+  memset(&response, 0, sizeof(response));
+
+  int rc = getresp(response);
+  transaction_stats.end(rc, response.code);
+  if (rc != 0) {
+    return rc;
+  }
 
   return SOCC_OK;
 }
@@ -95,7 +195,12 @@ void ports_ptp_impl::dispose_data(void** data) {
   *data = NULL;
 }
 
-int ports_ptp_impl::sendreq(uint16_t code, uint32_t* parameters, uint8_t num) {
+com::sony::imaging::remote::socc_stats* ports_ptp_impl::stats() {
+  return &transaction_stats;
+}
+
+int ports_ptp_impl::sendreq(uint16_t code, uint32_t* parameters, uint8_t num,
+                            uint32_t tid) {
   int ret;
   GenericBulkContainerHeader* header;
   uint32_t* payload;
@@ -107,24 +212,27 @@ int ports_ptp_impl::sendreq(uint16_t code, uint32_t* parameters, uint8_t num) {
   header->length = length;
   header->type = 0x0001; /* Command Block */
   header->code = code;
-  header->transaction_id = transaction_id;
+  header->transaction_id = tid;
 
   header++;
 
   payload = (uint32_t*)header;
   memcpy(payload, parameters, sizeof(uint32_t) * num);
 
+  uint64_t begin = socc_trace_now();
   int actual = usb->write(vp, length);
+  socc_trace_span("sendreq", "usb", begin, "code", code);
   free(vp);
 
   if (actual < 0) {
     return actual;
   }
+  transaction_stats.request_sent();
   return SOCC_OK;
 }
 
 int ports_ptp_impl::senddata(uint16_t code, uint32_t* parameters, uint8_t num,
-                             void* data, unsigned int size) {
+                             void* data, unsigned int size, uint32_t tid) {
   int ret;
   GenericBulkContainerHeader* header;
   uint32_t* payload;
@@ -135,19 +243,22 @@ int ports_ptp_impl::senddata(uint16_t code, uint32_t* parameters, uint8_t num,
   header->length = length;
   header->type = 0x0002; /* Data Block */
   header->code = code;
-  header->transaction_id = transaction_id;
+  header->transaction_id = tid;
 
   header++;
 
   payload = (uint32_t*)header;
   memcpy(payload, data, size);
 
+  uint64_t begin = socc_trace_now();
   int actual = usb->write(vp, length);
+  socc_trace_span("senddata", "usb", begin, "bytes", size);
   free(vp);
 
   if (actual < 0) {
     return actual;
   }
+  transaction_stats.data(size, true);
   return SOCC_OK;
 }
 
@@ -159,7 +270,9 @@ int ports_ptp_impl::getdata(void** data, uint32_t& size) {
   void* vp = calloc(1, BULK_MAX_PACKET_SIZE);
   length = BULK_MAX_PACKET_SIZE;
 
+  uint64_t begin = socc_trace_now();
   int actual = usb->read(vp, length);
+  socc_trace_span("getdata", "usb", begin, "bytes", actual);
 
   if (actual < 0) {
     free(vp);
@@ -179,13 +292,17 @@ int ports_ptp_impl::getdata(void** data, uint32_t& size) {
     header++;
     memcpy(cp, header, actual - sizeof(GenericBulkContainerHeader));
     cp += actual - sizeof(GenericBulkContainerHeader);
+    transaction_stats.data(actual - sizeof(GenericBulkContainerHeader), false);
 
     while (actual < payload_length) {
+      begin = socc_trace_now();
       int rs = usb->read(cp, payload_length - actual);
+      socc_trace_span("getdata", "usb", begin, "bytes", rs);
       if (rs < 0) {
         free(vp);
         return rs;
       }
+      transaction_stats.data(rs, false);
       actual += rs;
       cp += rs;
     }
@@ -198,6 +315,87 @@ int ports_ptp_impl::getdata(void** data, uint32_t& size) {
   return SOCC_OK;
 }
 
+int ports_ptp_impl::getdata_into(void* data, uint32_t capacity,
+                                 uint32_t& size) {
+  GenericBulkContainerHeader* header;
+  unsigned char first[BULK_MAX_PACKET_SIZE];
+  unsigned char* cp = (unsigned char*)data;
+  uint32_t copied;
+  uint32_t received;
+  uint32_t payload_length;
+  uint32_t remain;
+
+  uint64_t begin = socc_trace_now();
+  int actual = usb->read(first, sizeof(first));
+  socc_trace_span("getdata", "usb", begin, "bytes", actual);
+
+  if (actual < 0) {
+    return actual;
+  }
+  if (actual < (int)sizeof(GenericBulkContainerHeader)) {
+    return SOCC_PTP_ERROR_TRANSACTION;
+  }
+
+  header = (GenericBulkContainerHeader*)first;
+
+  if (header->type != 0x0002 ||
+      header->length < sizeof(GenericBulkContainerHeader)) {
+    return SOCC_PTP_ERROR_TRANSACTION;
+  }
+
+  payload_length = header->length - sizeof(GenericBulkContainerHeader);
+  received = actual - sizeof(GenericBulkContainerHeader);
+  if (received > payload_length) {
+    received = payload_length;
+  }
+  remain = payload_length - received;
+  copied = (received < capacity) ? received : capacity;
+  memcpy(cp, header + 1, copied);
+  transaction_stats.data(received, false);
+
+  // read straight into the caller's buffer as long as it has room. a read
+  // shorter than the rest of the data phase must be a whole number of packets.
+  while (remain > 0 && copied < capacity) {
+    uint32_t room = capacity - copied;
+    if (remain > room) {
+      room &= ~(uint32_t)(BULK_MAX_PACKET_SIZE - 1);
+      if (room == 0) {
+        break;
+      }
+    }
+    begin = socc_trace_now();
+    int rs = usb->read(cp + copied, remain < room ? remain : room);
+    socc_trace_span("getdata", "usb", begin, "bytes", rs);
+    if (rs < 0) {
+      return rs;
+    }
+    transaction_stats.data(rs, false);
+    copied += rs;
+    remain -= rs;
+  }
+
+  // the caller's buffer is full, throw the rest away
+  while (remain > 0) {
+    unsigned char drain[BULK_MAX_PACKET_SIZE * 8];
+    begin = socc_trace_now();
+    int rs = usb->read(drain, remain < sizeof(drain) ? remain : sizeof(drain));
+    socc_trace_span("getdata", "usb", begin, "bytes", rs);
+    if (rs < 0) {
+      return rs;
+    }
+    transaction_stats.data(rs, false);
+    remain -= rs;
+  }
+
+  if (payload_length > capacity) {
+    size = payload_length;
+    return SOCC_ERROR_USB_OVERFLOW;
+  }
+
+  size = copied;
+  return SOCC_OK;
+}
+
 int ports_ptp_impl::getresp(com::sony::imaging::remote::Container& response) {
   GenericBulkContainerHeader* header;
   uint32_t* payload;
@@ -205,7 +403,9 @@ int ports_ptp_impl::getresp(com::sony::imaging::remote::Container& response) {
   void* vp = calloc(1, BULK_MAX_PACKET_SIZE);
   length = BULK_MAX_PACKET_SIZE;
 
+  uint64_t begin = socc_trace_now();
   int actual = usb->read(vp, length);
+  socc_trace_span("getresp", "usb", begin);
 
   if (actual < 0) {
     free(vp);
@@ -1,8 +1,11 @@
 #ifndef __PORTS_PTP_IMPL_H__
 #define __PORTS_PTP_IMPL_H__
 
+#include <socc_stats.h>
 #include <socc_types.h>
 
+#include <atomic>
+
 #include "ports_ptp.h"
 
 namespace com {
@@ -50,18 +53,31 @@ class ports_ptp_impl : public ports_ptp {
   int receive(uint16_t code, uint32_t* parameters, uint8_t num,
               com::sony::imaging::remote::Container& response, void** data,
               uint32_t& size);
+  int receive_into(uint16_t code, uint32_t* parameters, uint8_t num,
+                   com::sony::imaging::remote::Container& response, void* data,
+                   uint32_t capacity, uint32_t& size);
+  int prepare_send(uint16_t code, uint32_t* parameters, uint8_t num,
+                   void* data, uint32_t size,
+                   com::sony::imaging::remote::PreparedTransaction& prepared);
+  int issue_prepared(com::sony::imaging::remote::PreparedTransaction& prepared);
+  int complete_prepared(com::sony::imaging::remote::Container& response);
   int wait_event(com::sony::imaging::remote::Container& container);
   void dispose_data(void** data);
+  com::sony::imaging::remote::socc_stats* stats();
 
  private:
-  uint32_t session_id;
-  uint32_t transaction_id;
+  std::atomic<uint32_t> session_id;
+  // taken by each transaction when it is dispatched
+  std::atomic<uint32_t> transaction_id;
   ports_usb* usb;
+  com::sony::imaging::remote::socc_stats transaction_stats;
 
-  int sendreq(uint16_t code, uint32_t* parameters, uint8_t num);
+  int sendreq(uint16_t code, uint32_t* parameters, uint8_t num,
+              uint32_t tid);
   int senddata(uint16_t code, uint32_t* parameters, uint8_t num, void* data,
-               unsigned int size);
+               unsigned int size, uint32_t tid);
   int getdata(void** data, uint32_t& size);
+  int getdata_into(void* data, uint32_t capacity, uint32_t& size);
   int getresp(com::sony::imaging::remote::Container& response);
   int getevent(com::sony::imaging::remote::Container& event);
 };
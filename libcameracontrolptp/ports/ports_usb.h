@@ -32,6 +32,11 @@ class ports_usb {
   virtual ~ports_usb(){};
   virtual int open() = 0;
   virtual int close() = 0;
+  /**
+   * @brief opens again the device which has been removed and has come back,
+   * identified by its vendor ID, product ID and serial number
+   */
+  virtual int reopen() = 0;
   virtual int write(void* bytes, unsigned int size) = 0;
   virtual int read(void* bytes, unsigned int size) = 0;
   virtual int read_interrupt(void* bytes, unsigned int size) = 0;
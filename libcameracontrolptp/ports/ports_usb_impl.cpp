@@ -8,6 +8,8 @@
 
 #include <cstddef>
 
+#include "ports_usb_registry.h"
+
 using namespace com::sony::imaging::ports;
 
 const int ports_usb_impl::bulk_transfer_max_size = 10 * 1024 * 1024;
@@ -23,43 +25,154 @@ ports_usb_impl::ports_usb_impl(int _busn, int _devn)
       alternate_setting(-1),
       user_callback_func(NULL),
       user_callback_data(NULL),
+      context(NULL),
+      shared_context(false),
+      device(NULL),
+      device_handle(NULL),
+      hotplug_callback_handle(0),
+      device_left(false),
+      arrived_device(NULL),
+      target_device(NULL) {
+  memset(&current_device, 0, sizeof(current_device));
+}
+
+ports_usb_impl::ports_usb_impl(int _busn, int _devn,
+                               libusb_context* _shared_context)
+    : busn(_busn),
+      devn(_devn),
+      inep(-1),
+      outep(-1),
+      intep(-1),
+      configuration_value(-1),
+      interface_number(-1),
+      alternate_setting(-1),
+      user_callback_func(NULL),
+      user_callback_data(NULL),
+      context(_shared_context),
+      shared_context(true),
       device(NULL),
       device_handle(NULL),
-      context(NULL),
       hotplug_callback_handle(0),
-      thread_id(0),
+      device_left(false),
+      arrived_device(NULL),
       target_device(NULL) {
   memset(&current_device, 0, sizeof(current_device));
 }
 int ports_usb_impl::open() {
   int ret = SOCC_OK;
-  int count;
-  libusb_device** devs = NULL;
 
-  ret = libusb_init(&context);
-  if (ret != 0) {
-    close();
-    return SOCC_ERROR_USB_INIT;
+  if (!shared_context) {
+    context = ports_usb_registry::instance()->acquire();
+    if (context == NULL) {
+      return SOCC_ERROR_USB_INIT;
+    }
   }
-  libusb_set_option(context, LIBUSB_OPTION_LOG_LEVEL, LIBUSB_LOG_LEVEL_ERROR);
 
-  ret = pthread_attr_init(&thread_attr);
-  if (ret != 0) {
+  ret = open_device(busn, devn);
+  if (ret != SOCC_OK) {
     close();
-    return SOCC_ERROR_THREAD_INIT;
+    return ret;
   }
 
-  ret = pthread_create(&thread_id, &thread_attr, &event_thread, this);
-  if (ret != 0) {
-    close();
-    return SOCC_ERROR_THREAD_CREATE;
+  if (libusb_has_capability(LIBUSB_CAP_HAS_HOTPLUG) != 0) {
+    libusb_hotplug_register_callback(
+        context,
+        (libusb_hotplug_event)(LIBUSB_HOTPLUG_EVENT_DEVICE_ARRIVED |
+                               LIBUSB_HOTPLUG_EVENT_DEVICE_LEFT),
+        LIBUSB_HOTPLUG_ENUMERATE, current_device.idVendor,
+        current_device.idProduct, LIBUSB_HOTPLUG_MATCH_ANY,
+        hotplug_callback_entry, this, &hotplug_callback_handle);
   }
 
-  target_device = new ports_usb_impl_target_device(context);
+  return SOCC_OK;
+}
+
+int ports_usb_impl::reopen() {
+  int ret;
+  usb_device_info_t previous = current_device;
+
+  if (!device_left) {
+    return SOCC_OK;
+  }
+
+  close_device();
+  libusb_device* arrived = arrived_device.exchange(NULL);
+  if (arrived != NULL) {
+    // the device of the hotplug event, without enumeration nor libusb_init()
+    ret = open_device(arrived, NULL);
+  } else {
+    // the arrival has been missed, or the device arrived was another one:
+    // looked up by the serial number in the registry
+    usb_registry_entry_t entry;
+    ret = ports_usb_registry::instance()->find_serial(
+        (const char*)previous.ascii_SerialNumber, entry);
+    if (ret == SOCC_OK) {
+      ret = open_device(entry.info.busn, entry.info.devn);
+    }
+  }
+  bool another =
+      ret == SOCC_OK &&
+      (current_device.idVendor != previous.idVendor ||
+       current_device.idProduct != previous.idProduct ||
+       memcmp(current_device.ascii_SerialNumber, previous.ascii_SerialNumber,
+              sizeof(previous.ascii_SerialNumber)) != 0);
+  if (another) {
+    // another body of the same model
+    ret = SOCC_ERROR_USB_DEVICE_NOT_FOUND;
+  }
+  if (ret != SOCC_OK) {
+    close_device();
+    current_device = previous;
+  }
+  if (ret != SOCC_OK && !another && arrived != NULL) {
+    // not ready yet, tried again by the next reopen() unless another device
+    // has arrived meanwhile
+    libusb_device* expected = NULL;
+    if (arrived_device.compare_exchange_strong(expected, arrived)) {
+      arrived = NULL;
+    }
+  }
+  if (arrived != NULL) {
+    libusb_unref_device(arrived);
+  }
+  if (ret != SOCC_OK) {
+    return ret;
+  }
+
+  device_left = false;
+  return SOCC_OK;
+}
+
+int ports_usb_impl::open_device(int busn, int devn) {
+  usb_registry_entry_t entry;
 
+  // the device kept by the registry, without enumeration
+  libusb_device* registered = ports_usb_registry::instance()->find_device(
+      context, busn, devn, entry);
+  if (registered != NULL) {
+    int ret = open_device(registered, entry.named ? &entry : NULL);
+    libusb_unref_device(registered);
+    return ret;
+  }
+
+  // a context of another owner, or a device unknown to the registry
+  target_device = new ports_usb_impl_target_device(context);
   device = target_device->find_device(busn, devn, LIBUSB_CLASS_PTP);
+  return claim_device(NULL);
+}
+
+int ports_usb_impl::open_device(libusb_device* candidate,
+                                const usb_registry_entry_t* entry) {
+  target_device = new ports_usb_impl_target_device(context);
+  device = target_device->select_device(candidate, LIBUSB_CLASS_PTP);
+  return claim_device(entry);
+}
+
+// opens the device found by target_device, with the strings of entry if any
+int ports_usb_impl::claim_device(const usb_registry_entry_t* entry) {
+  int ret;
+
   if (device == NULL) {
-    close();
     return SOCC_ERROR_USB_DEVICE_NOT_FOUND;
   }
 
@@ -71,11 +184,18 @@ int ports_usb_impl::open() {
 
   ret = libusb_open(device, &device_handle);
   if (ret != 0) {
-    close();
     return SOCC_ERROR_USB_OPEN;
   }
 
-  if (ret == LIBUSB_SUCCESS) {
+  if (entry != NULL && entry->info.idVendor == current_device.idVendor &&
+      entry->info.idProduct == current_device.idProduct) {
+    memcpy(current_device.ascii_Manufacturer, entry->info.ascii_Manufacturer,
+           sizeof(current_device.ascii_Manufacturer));
+    memcpy(current_device.ascii_Product, entry->info.ascii_Product,
+           sizeof(current_device.ascii_Product));
+    memcpy(current_device.ascii_SerialNumber, entry->info.ascii_SerialNumber,
+           sizeof(current_device.ascii_SerialNumber));
+  } else if (ret == LIBUSB_SUCCESS) {
     libusb_get_string_descriptor_ascii(
         device_handle, current_device.iManufacturer,
         current_device.ascii_Manufacturer,
@@ -89,16 +209,6 @@ int ports_usb_impl::open() {
         sizeof(current_device.ascii_SerialNumber));
   }
 
-  if (libusb_has_capability(LIBUSB_CAP_HAS_HOTPLUG) != 0) {
-    libusb_hotplug_register_callback(
-        context,
-        (libusb_hotplug_event)(LIBUSB_HOTPLUG_EVENT_DEVICE_ARRIVED |
-                               LIBUSB_HOTPLUG_EVENT_DEVICE_LEFT),
-        LIBUSB_HOTPLUG_ENUMERATE, current_device.idVendor,
-        current_device.idProduct, LIBUSB_HOTPLUG_MATCH_ANY,
-        hotplug_callback_entry, this, &hotplug_callback_handle);
-  }
-
   if (libusb_has_capability(LIBUSB_CAP_SUPPORTS_DETACH_KERNEL_DRIVER) != 0) {
     ret = libusb_kernel_driver_active(device_handle, 0);
     if (ret == 1) {
@@ -109,13 +219,11 @@ int ports_usb_impl::open() {
 
   ret = libusb_set_configuration(device_handle, configuration_value);
   if (ret != 0) {
-    close();
     return SOCC_ERROR_USB_DEVICE_NOT_FOUND;
   }
 
   ret = libusb_claim_interface(device_handle, interface_number);
   if (ret != 0) {
-    close();
     return SOCC_ERROR_USB_DEVICE_NOT_FOUND;
   }
 
@@ -131,18 +239,31 @@ int ports_usb_impl::open() {
 }
 
 int ports_usb_impl::close() {
-  pthread_cancel(thread_id);
-  pthread_join(thread_id, NULL);
-  pthread_attr_destroy(&thread_attr);
+  if (context != NULL && hotplug_callback_handle != 0) {
+    libusb_hotplug_deregister_callback(context, hotplug_callback_handle);
+    hotplug_callback_handle = 0;
+  }
 
-  libusb_hotplug_deregister_callback(context, hotplug_callback_handle);
+  close_device();
+  libusb_device* arrived = arrived_device.exchange(NULL);
+  if (arrived != NULL) {
+    libusb_unref_device(arrived);
+  }
+  if (!shared_context && context != NULL) {
+    ports_usb_registry::instance()->release();
+    context = NULL;
+  }
 
+  return SOCC_OK;
+}
+
+void ports_usb_impl::close_device() {
   delete target_device;
+  target_device = NULL;
+  device = NULL;
 
   libusb_close(device_handle);
-  libusb_exit(context);
-
-  return SOCC_OK;
+  device_handle = NULL;
 }
 
 int ports_usb_impl::write(void* bytes, unsigned int size) {
@@ -300,20 +421,6 @@ int ports_usb_impl::bulk_read(int ep, void* bytes, unsigned int size) {
   return transferred;
 }
 
-void* ports_usb_impl::event_thread(void* vp) {
-  int ret;
-  ports_usb_impl* o = static_cast<ports_usb_impl*>(vp);
-  struct timeval tv;
-  tv.tv_sec = 1;
-  tv.tv_usec = 0;
-  while (1) {
-    pthread_testcancel();
-    pthread_setcancelstate(PTHREAD_CANCEL_DISABLE, NULL);
-    libusb_handle_events_timeout_completed(o->context, &tv, NULL);
-    pthread_setcancelstate(PTHREAD_CANCEL_ENABLE, NULL);
-  }
-  pthread_exit(NULL);
-}
 int LIBUSB_CALL ports_usb_impl::hotplug_callback_entry(
     libusb_context* ctx, libusb_device* device, libusb_hotplug_event event,
     void* user_data) {
@@ -325,6 +432,7 @@ int LIBUSB_CALL ports_usb_impl::hotplug_callback_entry(
       hotplug_event = SOCC_HOTPLUG_EVENT_ARRIVED;
     } else if (event == LIBUSB_HOTPLUG_EVENT_DEVICE_LEFT) {
       hotplug_event = SOCC_HOTPLUG_EVENT_REMOVED;
+      o->device_left = true;
     } else {
       hotplug_event = SOCC_HOTPLUG_EVENT_UNKNOWN;
     }
@@ -332,6 +440,17 @@ int LIBUSB_CALL ports_usb_impl::hotplug_callback_entry(
     if (o->user_callback_func != NULL) {
       o->user_callback_func(hotplug_event, o->user_callback_data);
     }
+  } else if (event == LIBUSB_HOTPLUG_EVENT_DEVICE_ARRIVED && o->device_left) {
+    // the same VID/PID after the device has left. reopen() checks the serial
+    // number, which cannot be read in this callback.
+    libusb_device* previous =
+        o->arrived_device.exchange(libusb_ref_device(device));
+    if (previous != NULL) {
+      libusb_unref_device(previous);
+    }
+    if (o->user_callback_func != NULL) {
+      o->user_callback_func(SOCC_HOTPLUG_EVENT_ARRIVED, o->user_callback_data);
+    }
   }
 
   return SOCC_OK;
@@ -360,50 +479,53 @@ libusb_device* ports_usb_impl_target_device::find_device(
     int busn, int devn, libusb_class_code code) {
   int count;
   libusb_device** devs = NULL;
-  bool found = false;
 
   device = NULL;
 
   count = libusb_get_device_list(context, &devs);
 
-  for (int i = 0; i < count && found == false; i++) {
-    int index = 0;
-    while (found == false) {
-      struct libusb_config_descriptor* config_descriptor = NULL;
-      const struct libusb_interface_descriptor* altsetting = NULL;
+  for (int i = 0; i < count && device == NULL; i++) {
+    if ((busn != 0 && devn != 0) &&
+        (busn != libusb_get_bus_number(devs[i]) ||
+         devn != libusb_get_device_address(devs[i]))) {
+      // not to read the descriptors of the other devices
+      continue;
+    }
+    select_device(devs[i], code);
+  }
 
-      config_descriptor = find_configurations(*(devs[i]), index++);
-      if (config_descriptor == NULL) {
-        break;
-      }
+  libusb_free_device_list(devs, 1);
+  return device;
+}
 
-      configuration_value = config_descriptor->bConfigurationValue;
+libusb_device* ports_usb_impl_target_device::select_device(
+    libusb_device* candidate, libusb_class_code code) {
+  int index = 0;
 
-      if ((busn != 0 && devn != 0) &&
-          (busn != current_device.busn || devn != current_device.devn)) {
-        continue;
-      }
+  device = NULL;
 
-      altsetting =
-          find_altsetting_by_class_code(*config_descriptor, LIBUSB_CLASS_PTP);
-      if (altsetting != NULL) {
-        interface_number = altsetting->bInterfaceNumber;
-        alternate_setting = altsetting->bAlternateSetting;
+  while (device == NULL) {
+    struct libusb_config_descriptor* config_descriptor = NULL;
+    const struct libusb_interface_descriptor* altsetting = NULL;
 
-        if (configure_endpoint(*altsetting, inep, outep, intep)) {
-          found = true;
-          device = devs[i];
-        }
-      }
-      libusb_free_config_descriptor(config_descriptor);
+    config_descriptor = find_configurations(*candidate, index++);
+    if (config_descriptor == NULL) {
+      break;
     }
-  }
 
-  if (found == true) {
-    libusb_ref_device(device);
-  }
+    configuration_value = config_descriptor->bConfigurationValue;
 
-  libusb_free_device_list(devs, 1);
+    altsetting = find_altsetting_by_class_code(*config_descriptor, code);
+    if (altsetting != NULL) {
+      interface_number = altsetting->bInterfaceNumber;
+      alternate_setting = altsetting->bAlternateSetting;
+
+      if (configure_endpoint(*altsetting, inep, outep, intep)) {
+        device = libusb_ref_device(candidate);
+      }
+    }
+    libusb_free_config_descriptor(config_descriptor);
+  }
   return device;
 }
 
@@ -5,6 +5,8 @@
 #include <pthread.h>
 #include <socc_types.h>
 
+#include <atomic>
+
 #include "ports_usb.h"
 
 namespace com {
@@ -13,12 +15,23 @@ namespace imaging {
 namespace ports {
 
 class ports_usb_impl_target_device;
+struct usb_registry_entry_t;
 
 class ports_usb_impl : public ports_usb {
  public:
+  /**
+   * @brief uses the libusb context of ports_usb_registry, whose thread
+   * handles its events while the device is opened
+   */
   ports_usb_impl(int busn, int devn);
+  /**
+   * @brief uses a libusb context shared with other devices. The owner of the
+   * context initializes it, handles its events and exits it.
+   */
+  ports_usb_impl(int busn, int devn, libusb_context* shared_context);
   int open();
   int close();
+  int reopen();
   int write(void* bytes, unsigned int size);
   int read(void* bytes, unsigned int size);
   int read_interrupt(void* bytes, unsigned int size);
@@ -45,19 +58,26 @@ class ports_usb_impl : public ports_usb {
   void* user_callback_data;
 
   libusb_context* context;
+  bool shared_context;
   libusb_device* device;
   libusb_device_handle* device_handle;
   libusb_hotplug_callback_handle hotplug_callback_handle;
 
-  ports_usb_impl_target_device* target_device;
+  // set by the hotplug callback when the device has left, and the same model
+  // arrived after that, referenced until reopen() takes it
+  std::atomic<bool> device_left;
+  std::atomic<libusb_device*> arrived_device;
 
-  pthread_t thread_id;
-  pthread_attr_t thread_attr;
+  ports_usb_impl_target_device* target_device;
 
+  int open_device(int busn, int devn);
+  int open_device(libusb_device* candidate,
+                  const usb_registry_entry_t* entry);
+  int claim_device(const usb_registry_entry_t* entry);
+  void close_device();
   int bulk_write(int ep, void* bytes, unsigned int size);
   int bulk_read(int ep, void* bytes, unsigned int size);
 
-  static void* event_thread(void* vp);
   static int LIBUSB_CALL hotplug_callback_entry(libusb_context* ctx,
                                                 libusb_device* device,
                                                 libusb_hotplug_event event,
@@ -71,6 +91,8 @@ class ports_usb_impl_target_device {
   ~ports_usb_impl_target_device();
 
   libusb_device* find_device(int busn, int devn, libusb_class_code code);
+  libusb_device* select_device(libusb_device* candidate,
+                               libusb_class_code code);
   void get_settings(int& config, int& inter, int& alt);
   void get_endpoint(int& inep, int& outep, int& intep);
 
@@ -0,0 +1,647 @@
+#include "ports_usb_mock.h"
+
+#include <socc_time.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/time.h>
+#include <time.h>
+
+#include <atomic>
+
+#include "ports_ptp_impl.h"
+
+using namespace com::sony::imaging::ports;
+using com::sony::imaging::remote::socc_monotonic_us;
+
+#define PTP_RC_OK 0x2001
+#define PTP_RC_OPERATION_NOT_SUPPORTED 0x2005
+#define PTP_RC_INVALID_OBJECTHANDLE 0x2009
+#define PTP_RC_ACCESS_DENIED 0x200F
+
+#define SHOT_HANDLE 0xFFFFC001
+#define SHOT_READY 0x8000
+#define LIVEVIEW_HANDLE 0xFFFFC002
+#define LIVEVIEW_IMAGE_OFFSET 32
+#define SDI_EXTENSION_VERSION 0x012C
+
+static std::atomic<uint32_t> mock_count(0);
+
+ports_usb_mock::ports_usb_mock()
+    : opened(false),
+      plugged(true),
+      latency_us(0),
+      bytes_per_sec(0),
+      request_code(0),
+      request_transaction_id(0),
+      request_nparam(0),
+      response_pending(false),
+      bulk_in_pos(0),
+      bulk_in_total(0),
+      halt_at(0),
+      halted(false),
+      captures(0),
+      liveview_size(200 * 1024),
+      liveview_repeat(1),
+      liveview_count(0),
+      version_delay_us(0),
+      properties_delay_us(0),
+      user_callback_func(NULL),
+      user_callback_data(NULL) {
+  pthread_mutex_init(&mutex, NULL);
+  pthread_cond_init(&event_cond, NULL);
+  memset(request_params, 0, sizeof(request_params));
+  memset(connected_at, 0, sizeof(connected_at));
+
+  // every mock is a camera of its own serial number
+  memset(&device_info, 0, sizeof(device_info));
+  device_info.idVendor = 0x054C;
+  device_info.bInterfaceClass = 0x06;  // Still Imaging
+  device_info.devn = ++mock_count;
+  snprintf((char*)device_info.ascii_Manufacturer,
+           sizeof(device_info.ascii_Manufacturer), "Sony");
+  snprintf((char*)device_info.ascii_Product, sizeof(device_info.ascii_Product),
+           "Mock");
+  snprintf((char*)device_info.ascii_SerialNumber,
+           sizeof(device_info.ascii_SerialNumber), "MOCK%08u",
+           device_info.devn);
+  reset_properties();
+}
+
+ports_usb_mock::~ports_usb_mock() {
+  pthread_cond_destroy(&event_cond);
+  pthread_mutex_destroy(&mutex);
+}
+
+void ports_usb_mock::reset_properties() {
+  // a few properties used by the sample scripts
+  property_t p;
+  p.get_set = 1;
+  p.is_enable = 1;
+  p.data_type = 0x0006;  // UINT32
+  p.current = 0x00000001;
+  properties[0x5013] = p;  // Still Capture Mode
+  p.data_type = 0x0002;    // UINT8
+  p.current = 0x00;
+  properties[0xD25A] = p;  // Position Key Setting
+  p.data_type = 0x0002;    // UINT8
+  p.current = 0x01;
+  properties[0xD221] = p;  // Live View Status
+  p.data_type = 0x0004;    // UINT16
+  p.current = 0x0001;
+  properties[0xD222] = p;  // Save Media
+  p.get_set = 0;
+  p.data_type = 0x0004;  // UINT16
+  p.current = 0x0000;
+  properties[0xD215] = p;  // Shooting File Information
+}
+
+int ports_usb_mock::open() {
+  pthread_mutex_lock(&mutex);
+  if (!plugged) {
+    pthread_mutex_unlock(&mutex);
+    return SOCC_ERROR_USB_DEVICE_NOT_FOUND;
+  }
+  opened = true;
+  pthread_mutex_unlock(&mutex);
+  return SOCC_OK;
+}
+
+int ports_usb_mock::reopen() { return open(); }
+
+int ports_usb_mock::close() {
+  pthread_mutex_lock(&mutex);
+  opened = false;
+  bulk_in.clear();
+  bulk_in_pos = 0;
+  response_pending = false;
+  pthread_cond_broadcast(&event_cond);
+  pthread_mutex_unlock(&mutex);
+  return SOCC_OK;
+}
+
+int ports_usb_mock::write(void* bytes, unsigned int size) {
+  GenericBulkContainerHeader* header = (GenericBulkContainerHeader*)bytes;
+  uint32_t latency = 0;
+
+  if (size < sizeof(GenericBulkContainerHeader)) {
+    return SOCC_ERROR_INVALID_PARAMETER;
+  }
+
+  pthread_mutex_lock(&mutex);
+  if (!opened) {
+    pthread_mutex_unlock(&mutex);
+    return SOCC_ERROR_USB_DISCONNECTED;
+  }
+
+  if (header->type == 0x0001) {
+    /* Command Block */
+    request_code = header->code;
+    request_transaction_id = header->transaction_id;
+    request_nparam =
+        (size - sizeof(GenericBulkContainerHeader)) / sizeof(uint32_t);
+    if (request_nparam > 5) {
+      request_nparam = 5;
+    }
+    memset(request_params, 0, sizeof(request_params));
+    memcpy(request_params, header + 1, request_nparam * sizeof(uint32_t));
+    request_data.clear();
+    request(request_code);
+    latency = latency_us;
+  } else if (header->type == 0x0002) {
+    /* Data Block */
+    unsigned char* payload = (unsigned char*)(header + 1);
+    request_data.assign(payload,
+                        payload + size - sizeof(GenericBulkContainerHeader));
+  }
+  pthread_mutex_unlock(&mutex);
+
+  if (latency > 0) {
+    struct timespec ts = {(time_t)(latency / 1000000),
+                          (long)(latency % 1000000) * 1000};
+    nanosleep(&ts, NULL);
+  }
+  simulate(size);
+
+  return size;
+}
+
+int ports_usb_mock::read(void* bytes, unsigned int size) {
+  unsigned int actual;
+
+  pthread_mutex_lock(&mutex);
+  if (!opened) {
+    pthread_mutex_unlock(&mutex);
+    return SOCC_ERROR_USB_DISCONNECTED;
+  }
+  if (halted) {
+    pthread_mutex_unlock(&mutex);
+    return SOCC_ERROR_USB_ENDPOINT_HALTED;
+  }
+  if (bulk_in.empty() && response_pending) {
+    respond(request_code, &request_data);
+  }
+  if (bulk_in.empty()) {
+    pthread_mutex_unlock(&mutex);
+    return SOCC_ERROR_USB_TIMEOUT;
+  }
+
+  std::vector<unsigned char>& front = bulk_in.front();
+  actual = front.size() - bulk_in_pos;
+  if (actual > size) {
+    actual = size;
+  }
+  memcpy(bytes, &front[bulk_in_pos], actual);
+  bulk_in_pos += actual;
+  if (bulk_in_pos >= front.size()) {
+    bulk_in.pop_front();
+    bulk_in_pos = 0;
+  }
+  bulk_in_total += actual;
+  if (halt_at != 0 && bulk_in_total >= halt_at) {
+    // the rest of the transaction is lost
+    halt_at = 0;
+    halted = true;
+    bulk_in.clear();
+    bulk_in_pos = 0;
+    response_pending = false;
+  }
+  pthread_mutex_unlock(&mutex);
+
+  simulate(actual);
+
+  return actual;
+}
+
+int ports_usb_mock::read_interrupt(void* bytes, unsigned int size) {
+  int ret;
+  struct timeval now;
+  struct timespec deadline;
+
+  gettimeofday(&now, NULL);
+  deadline.tv_sec = now.tv_sec + 5;
+  deadline.tv_nsec = now.tv_usec * 1000;
+
+  pthread_mutex_lock(&mutex);
+  while (opened && interrupt_in.empty()) {
+    if (pthread_cond_timedwait(&event_cond, &mutex, &deadline) != 0) {
+      break;
+    }
+  }
+  if (!opened) {
+    ret = SOCC_ERROR_USB_DISCONNECTED;
+  } else if (interrupt_in.empty()) {
+    ret = SOCC_ERROR_USB_TIMEOUT;
+  } else {
+    std::vector<unsigned char>& front = interrupt_in.front();
+    ret = front.size() < size ? front.size() : size;
+    memcpy(bytes, &front[0], ret);
+    interrupt_in.pop_front();
+  }
+  pthread_mutex_unlock(&mutex);
+
+  return ret;
+}
+
+int ports_usb_mock::clear_halt(int what) {
+  if (what != 0) {
+    return SOCC_ERROR_INVALID_PARAMETER;
+  }
+  pthread_mutex_lock(&mutex);
+  bulk_in.clear();
+  bulk_in_pos = 0;
+  response_pending = false;
+  halted = false;
+  pthread_mutex_unlock(&mutex);
+  return SOCC_OK;
+}
+
+int ports_usb_mock::reset() { return clear_halt(0); }
+
+void ports_usb_mock::set_hotplug_callback(
+    socc_hotplug_callback_func_t callback_func, void* vp) {
+  user_callback_func = callback_func;
+  user_callback_data = vp;
+}
+
+int ports_usb_mock::snatch_device_handle(socc_device_handle_info_t& info) {
+  info.device_handle = NULL;
+  info.device_handle_description = "ports_usb_mock";
+  info.option = &device_info;
+  info.option_description = "usb_device_info_t";
+  return SOCC_OK;
+}
+
+void ports_usb_mock::set_timing(uint32_t latency_us, uint32_t bytes_per_sec) {
+  pthread_mutex_lock(&mutex);
+  this->latency_us = latency_us;
+  this->bytes_per_sec = bytes_per_sec;
+  pthread_mutex_unlock(&mutex);
+}
+
+void ports_usb_mock::set_bringup(uint32_t version_delay_us,
+                                 uint32_t properties_delay_us) {
+  pthread_mutex_lock(&mutex);
+  this->version_delay_us = version_delay_us;
+  this->properties_delay_us = properties_delay_us;
+  pthread_mutex_unlock(&mutex);
+}
+
+void ports_usb_mock::set_liveview(uint32_t image_size, uint32_t repeat) {
+  pthread_mutex_lock(&mutex);
+  liveview_size = image_size < 64 ? 64 : image_size;
+  liveview_repeat = repeat == 0 ? 1 : repeat;
+  liveview_count = 0;
+  liveview_image.clear();
+  pthread_mutex_unlock(&mutex);
+}
+
+void ports_usb_mock::set_object(uint32_t size) {
+  pthread_mutex_lock(&mutex);
+  object.resize(size);
+  for (uint32_t i = 0; i < size; i++) {
+    object[i] = (unsigned char)((i * 2654435761u) >> 24);
+  }
+  pthread_mutex_unlock(&mutex);
+}
+
+void ports_usb_mock::inject_halt(uint64_t after_bytes) {
+  pthread_mutex_lock(&mutex);
+  halt_at = bulk_in_total + after_bytes;
+  pthread_mutex_unlock(&mutex);
+}
+
+void ports_usb_mock::unplug() {
+  pthread_mutex_lock(&mutex);
+  plugged = false;
+  opened = false;
+  bulk_in.clear();
+  bulk_in_pos = 0;
+  response_pending = false;
+  interrupt_in.clear();
+  pthread_cond_broadcast(&event_cond);
+  pthread_mutex_unlock(&mutex);
+  if (user_callback_func != NULL) {
+    user_callback_func(SOCC_HOTPLUG_EVENT_REMOVED, user_callback_data);
+  }
+}
+
+void ports_usb_mock::replug() {
+  pthread_mutex_lock(&mutex);
+  plugged = true;
+  halted = false;
+  captures = 0;
+  reset_properties();
+  pthread_mutex_unlock(&mutex);
+  if (user_callback_func != NULL) {
+    user_callback_func(SOCC_HOTPLUG_EVENT_ARRIVED, user_callback_data);
+  }
+}
+
+uint64_t ports_usb_mock::property(uint16_t code) {
+  uint64_t value = 0;
+  pthread_mutex_lock(&mutex);
+  std::map<uint16_t, property_t>::iterator it = properties.find(code);
+  if (it != properties.end()) {
+    value = it->second.current;
+  }
+  pthread_mutex_unlock(&mutex);
+  return value;
+}
+
+void ports_usb_mock::push_event(uint16_t code, uint32_t param) {
+  pthread_mutex_lock(&mutex);
+  queue_event(code, param);
+  pthread_mutex_unlock(&mutex);
+}
+
+void ports_usb_mock::queue_event(uint16_t code, uint32_t param) {
+  GenericBulkContainerHeader header;
+  std::vector<unsigned char> event(sizeof(header) + sizeof(param));
+
+  header.length = event.size();
+  header.type = 0x0004; /* Event Block */
+  header.code = code;
+  header.transaction_id = 0xFFFFFFFF;
+  memcpy(&event[0], &header, sizeof(header));
+  memcpy(&event[sizeof(header)], &param, sizeof(param));
+
+  interrupt_in.push_back(event);
+  pthread_cond_signal(&event_cond);
+}
+
+void ports_usb_mock::request(uint16_t code) {
+  std::vector<unsigned char> data;
+
+  response_pending = false;
+  switch (code) {
+    case 0x9201:  // SDIO_Connect
+      if (request_params[0] < 4) {
+        connected_at[request_params[0]] = socc_monotonic_us();
+      }
+      data.assign(8, 0);
+      respond(code, &data);
+      break;
+    case 0x9202:  // SDIO_GetExtDeviceInfo
+      data.assign(8, 0);
+      if (socc_monotonic_us() - connected_at[2] >= version_delay_us) {
+        data[0] = SDI_EXTENSION_VERSION & 0xFF;
+        data[1] = SDI_EXTENSION_VERSION >> 8;
+      }
+      respond(code, &data);
+      break;
+    case 0x9209:  // SDIO_GetAllExtDevicePropInfo
+      if (socc_monotonic_us() - connected_at[3] >= properties_delay_us) {
+        build_all_properties(data);
+      } else {
+        data.assign(sizeof(uint64_t), 0);
+      }
+      respond(code, &data);
+      break;
+    case 0x1009:  // GetObject
+      if (request_params[0] == LIVEVIEW_HANDLE &&
+          properties[0xD221].current == 0x01) {
+        build_liveview(data);
+        respond(code, &data);
+      } else if (request_params[0] == SHOT_HANDLE && !object.empty()) {
+        respond(code, &object);
+        take_capture();
+      } else {
+        queue_container(0x0003, PTP_RC_INVALID_OBJECTHANDLE, NULL, 0);
+      }
+      break;
+    case 0x1008:  // GetObjectInfo
+      if (request_params[0] == SHOT_HANDLE && !object.empty()) {
+        build_object_info(data);
+        respond(code, &data);
+      } else {
+        queue_container(0x0003, PTP_RC_INVALID_OBJECTHANDLE, NULL, 0);
+      }
+      break;
+    case 0x101B:  // GetPartialObject
+      if (request_params[0] == SHOT_HANDLE &&
+          request_params[1] < object.size()) {
+        uint32_t n = object.size() - request_params[1];
+        if (n > request_params[2]) {
+          n = request_params[2];
+        }
+        data.assign(object.begin() + request_params[1],
+                    object.begin() + request_params[1] + n);
+        respond(code, &data);
+        if (request_params[1] + n == object.size()) {
+          take_capture();
+        }
+      } else {
+        queue_container(0x0003, PTP_RC_INVALID_OBJECTHANDLE, NULL, 0);
+      }
+      break;
+    default:
+      // the response is made after the data phase from the host, if any
+      response_pending = true;
+      break;
+  }
+}
+
+void ports_usb_mock::respond(uint16_t code,
+                             const std::vector<unsigned char>* data) {
+  uint16_t rc = PTP_RC_OK;
+
+  response_pending = false;
+  switch (code) {
+    case 0x9201:
+    case 0x9202:
+    case 0x9209:
+    case 0x1008:
+    case 0x1009:
+      if (data->empty()) {
+        rc = PTP_RC_ACCESS_DENIED;
+      }
+      queue_container(0x0002, code, data->empty() ? NULL : &(*data)[0],
+                      data->size());
+      break;
+    case 0x101B: {
+      // the response has the number of bytes sent
+      uint32_t n = data->size();
+      queue_container(0x0002, code, n > 0 ? &(*data)[0] : NULL, n);
+      queue_container(0x0003, rc, &n, sizeof(n));
+      return;
+    }
+    case 0x1002:  // OpenSession
+    case 0x1003:  // CloseSession
+      break;
+    case 0x9207:  // SDIO_ControlDevice
+      control_device(request_params[0], *data);
+      break;
+    case 0x9205:  // SDIO_SetExtDevicePropValue
+      set_property(request_params[0], *data);
+      break;
+    default:
+      rc = PTP_RC_OPERATION_NOT_SUPPORTED;
+      break;
+  }
+  queue_container(0x0003, rc, NULL, 0);
+}
+
+void ports_usb_mock::queue_container(uint16_t type, uint16_t code,
+                                     const void* payload, uint32_t size) {
+  GenericBulkContainerHeader header;
+  std::vector<unsigned char> container(sizeof(header) + size);
+
+  header.length = container.size();
+  header.type = type;
+  header.code = code;
+  header.transaction_id = request_transaction_id;
+  memcpy(&container[0], &header, sizeof(header));
+  if (size > 0) {
+    memcpy(&container[sizeof(header)], payload, size);
+  }
+  bulk_in.push_back(container);
+}
+
+void ports_usb_mock::set_property(uint16_t code,
+                                  const std::vector<unsigned char>& data) {
+  std::map<uint16_t, property_t>::iterator it = properties.find(code);
+  if (it == properties.end() || data.empty()) {
+    return;
+  }
+  uint64_t value = 0;
+  memcpy(&value, &data[0], data.size() < sizeof(value) ? data.size() : 8);
+  it->second.current = value;
+}
+
+void ports_usb_mock::control_device(uint16_t code,
+                                    const std::vector<unsigned char>& data) {
+  uint16_t value = 0;
+  memcpy(&value, &data[0], data.size() < sizeof(value) ? data.size() : 2);
+
+  // pressing the shutter button fully (D2C2 Down) shoots an image, which is
+  // buffered until it is downloaded
+  if (code == 0xD2C2 && value == 0x0002 && !object.empty()) {
+    captures++;
+    properties[0xD215].current = SHOT_READY | (captures & 0x7FFF);
+    queue_event(0xC201, SHOT_HANDLE);  // ObjectAdded
+    queue_event(0xC203, 0xD215);       // DevicePropChanged
+  }
+}
+
+void ports_usb_mock::take_capture() {
+  if (captures == 0) {
+    return;
+  }
+  captures--;
+  properties[0xD215].current =
+      captures > 0 ? SHOT_READY | (captures & 0x7FFF) : 0x0000;
+  queue_event(0xC203, 0xD215);
+}
+
+void ports_usb_mock::build_object_info(std::vector<unsigned char>& out) {
+  // ObjectInfo dataset with empty Filename, CaptureDate, ModificationDate and
+  // Keywords
+  uint32_t storage_id = 0x00010001;
+  uint16_t format = 0x3801;  // EXIF/JPEG
+  uint32_t size = object.size();
+
+  out.assign(56, 0);
+  memcpy(&out[0], &storage_id, sizeof(storage_id));
+  memcpy(&out[4], &format, sizeof(format));
+  memcpy(&out[8], &size, sizeof(size));
+}
+
+static size_t data_type_size(uint16_t data_type) {
+  switch (data_type) {
+    case 0x0001:
+    case 0x0002:
+      return 1;
+    case 0x0003:
+    case 0x0004:
+      return 2;
+    case 0x0005:
+    case 0x0006:
+      return 4;
+    default:
+      return 8;
+  }
+}
+
+void ports_usb_mock::build_all_properties(std::vector<unsigned char>& out) {
+  uint64_t num = properties.size();
+  out.assign((unsigned char*)&num, (unsigned char*)&num + sizeof(num));
+
+  std::map<uint16_t, property_t>::iterator it;
+  for (it = properties.begin(); it != properties.end(); it++) {
+    const property_t& p = it->second;
+    size_t n = data_type_size(p.data_type);
+    unsigned char head[6];
+    memcpy(&head[0], &it->first, 2);
+    memcpy(&head[2], &p.data_type, 2);
+    head[4] = p.get_set;
+    head[5] = p.is_enable;
+    out.insert(out.end(), head, head + sizeof(head));
+    out.insert(out.end(), (unsigned char*)&p.current,
+               (unsigned char*)&p.current + n);  // DefaultValue
+    out.insert(out.end(), (unsigned char*)&p.current,
+               (unsigned char*)&p.current + n);  // CurrentValue
+    out.push_back(0x00);                         // FormFlag: None
+  }
+}
+
+void ports_usb_mock::build_liveview(std::vector<unsigned char>& out) {
+  if (liveview_image.empty() || liveview_count % liveview_repeat == 0) {
+    // SOI, APP0, COM with a frame counter, SOS, entropy coded data and EOI
+    static const unsigned char head[] = {
+        0xFF, 0xD8, 0xFF, 0xE0, 0x00, 0x10, 'J',  'F',  'I',  'F',
+        0x00, 0x01, 0x01, 0x00, 0x00, 0x01, 0x00, 0x01, 0x00, 0x00,
+        0xFF, 0xFE, 0x00, 0x06, 0x00, 0x00, 0x00, 0x00, 0xFF, 0xDA,
+        0x00, 0x08, 0x01, 0x01, 0x00, 0x00, 0x3F, 0x00};
+    uint32_t seed = liveview_count / liveview_repeat * 2654435761u + 1;
+
+    liveview_image.assign(head, head + sizeof(head));
+    liveview_image.resize(liveview_size - 2);
+    for (size_t i = sizeof(head); i < liveview_image.size(); i++) {
+      seed ^= seed << 13;
+      seed ^= seed >> 17;
+      seed ^= seed << 5;
+      unsigned char c = (unsigned char)seed;
+      liveview_image[i] = c == 0xFF ? 0xFE : c;
+    }
+    liveview_image.push_back(0xFF);
+    liveview_image.push_back(0xD9);
+  }
+  memcpy(&liveview_image[24], &liveview_count, sizeof(liveview_count));
+
+  // Focal Frame Info version 1.01: a focus frame moving with the image and a
+  // selected face, no tracking frame
+  uint32_t image_index = liveview_count / liveview_repeat;
+  unsigned char ffi[56 + 16 + 24 + 16 + 24 + 16];
+  memset(ffi, 0, sizeof(ffi));
+  uint16_t u16 = 101;
+  memcpy(&ffi[0], &u16, 2);
+  uint32_t focus[] = {640, 480, 1};
+  memcpy(&ffi[56], focus, sizeof(focus));
+  uint32_t focus_frame[] = {0x00020002, 0x00000001, 40 + image_index % 480, 200,
+                            60, 80};
+  memcpy(&ffi[72], focus_frame, sizeof(focus_frame));
+  memcpy(&ffi[96], focus, sizeof(focus));
+  uint32_t face_frame[] = {0x00020005, 0x00000102, 300, 120, 90, 90};
+  memcpy(&ffi[112], face_frame, sizeof(face_frame));
+  liveview_count++;
+
+  uint32_t ffi_offset = LIVEVIEW_IMAGE_OFFSET + liveview_image.size();
+  uint32_t header[4] = {LIVEVIEW_IMAGE_OFFSET, (uint32_t)liveview_image.size(),
+                        ffi_offset, sizeof(ffi)};
+  out.assign(LIVEVIEW_IMAGE_OFFSET, 0);
+  memcpy(&out[0], header, sizeof(header));
+  out.insert(out.end(), liveview_image.begin(), liveview_image.end());
+  out.insert(out.end(), ffi, ffi + sizeof(ffi));
+}
+
+void ports_usb_mock::simulate(uint64_t bytes) {
+  uint32_t rate = bytes_per_sec;
+  if (rate == 0 || bytes == 0) {
+    return;
+  }
+  uint64_t ns = bytes * 1000000000ull / rate;
+  struct timespec ts = {(time_t)(ns / 1000000000ull),
+                        (long)(ns % 1000000000ull)};
+  nanosleep(&ts, NULL);
+}
@@ -0,0 +1,169 @@
+#ifndef __PORTS_USB_MOCK_H__
+#define __PORTS_USB_MOCK_H__
+
+#include <pthread.h>
+#include <socc_types.h>
+
+#include <deque>
+#include <map>
+#include <vector>
+
+#include "ports_usb.h"
+
+namespace com {
+namespace sony {
+namespace imaging {
+namespace ports {
+
+/**
+ * @brief USB backend which emulates a camera in memory.
+ *
+ * The containers written by ports_ptp_impl are answered like a Sony body does,
+ * so the whole PTP layer can be run and measured without any device.
+ * The transfer time of a real USB link can be simulated with set_timing().
+ */
+class ports_usb_mock : public ports_usb {
+ public:
+  ports_usb_mock();
+  ~ports_usb_mock();
+  int open();
+  int close();
+  int reopen();
+  int write(void* bytes, unsigned int size);
+  int read(void* bytes, unsigned int size);
+  int read_interrupt(void* bytes, unsigned int size);
+  int clear_halt(int what = 0);
+  int reset();
+  void set_hotplug_callback(socc_hotplug_callback_func_t callback_func,
+                            void* vp);
+  int snatch_device_handle(socc_device_handle_info_t& info);
+
+  /**
+   * @brief simulates the timing of the USB link
+   * @param latency_us turnaround time of a transaction in micro seconds
+   * @param bytes_per_sec bulk throughput. 0 for unlimited
+   */
+  void set_timing(uint32_t latency_us, uint32_t bytes_per_sec);
+
+  /**
+   * @brief sets the LiveView image to be returned for 0xFFFFC002
+   * @param image_size the size of the JPEG data in bytes
+   * @param repeat the number of GetObject which return the same image
+   */
+  void set_liveview(uint32_t image_size, uint32_t repeat);
+
+  /**
+   * @brief sets the shot image to be returned for 0xFFFFC001
+   *
+   * Pressing the shutter button with SDIO_ControlDevice buffers a capture,
+   * which is announced with ObjectAdded and DevicePropChanged(0xD215) and
+   * removed when it is downloaded.
+   * @param size the size of the image in bytes. 0 for no image
+   */
+  void set_object(uint32_t size);
+
+  /**
+   * @brief halts the bulk in endpoint once the given number of bytes have
+   * been read. The endpoint stays halted until clear_halt().
+   */
+  void inject_halt(uint64_t after_bytes);
+
+  /**
+   * @brief queues an event to be read from the interrupt endpoint
+   */
+  void push_event(uint16_t code, uint32_t param);
+
+  /**
+   * @brief pulls the cable. The transfers fail until replug(), and the
+   * hotplug callback is invoked with SOCC_HOTPLUG_EVENT_REMOVED.
+   */
+  void unplug();
+
+  /**
+   * @brief plugs the cable back after unplug(). The camera comes back with
+   * its properties of the power on, and the hotplug callback is invoked with
+   * SOCC_HOTPLUG_EVENT_ARRIVED.
+   */
+  void replug();
+
+  /**
+   * @brief the current value of a property, 0 if unknown
+   */
+  uint64_t property(uint16_t code);
+
+  /**
+   * @brief simulates a camera which is still starting up. SDIO_GetExtDeviceInfo
+   * reports the version 0 until the given time has passed after SDIO_Connect
+   * phase 2, and SDIO_GetAllExtDevicePropInfo reports no property until the
+   * given time has passed after phase 3.
+   */
+  void set_bringup(uint32_t version_delay_us, uint32_t properties_delay_us);
+
+ private:
+  typedef struct {
+    uint16_t data_type;
+    uint8_t get_set;
+    uint8_t is_enable;
+    uint64_t current;
+  } property_t;
+
+  pthread_mutex_t mutex;
+  pthread_cond_t event_cond;
+
+  bool opened;
+  bool plugged;
+  usb_device_info_t device_info;
+  uint32_t latency_us;
+  uint32_t bytes_per_sec;
+
+  uint16_t request_code;
+  uint32_t request_transaction_id;
+  uint32_t request_params[5];
+  int request_nparam;
+  bool response_pending;
+  std::vector<unsigned char> request_data;
+
+  std::deque<std::vector<unsigned char> > bulk_in;
+  size_t bulk_in_pos;
+  uint64_t bulk_in_total;
+  uint64_t halt_at;
+  bool halted;
+  uint32_t captures;
+  std::deque<std::vector<unsigned char> > interrupt_in;
+
+  std::map<uint16_t, property_t> properties;
+
+  uint32_t liveview_size;
+  uint32_t liveview_repeat;
+  uint32_t liveview_count;
+  std::vector<unsigned char> liveview_image;
+
+  std::vector<unsigned char> object;
+
+  uint32_t version_delay_us;
+  uint32_t properties_delay_us;
+  uint64_t connected_at[4];
+
+  socc_hotplug_callback_func_t user_callback_func;
+  void* user_callback_data;
+
+  void reset_properties();
+  void request(uint16_t code);
+  void respond(uint16_t code, const std::vector<unsigned char>* data);
+  void queue_container(uint16_t type, uint16_t code, const void* payload,
+                       uint32_t size);
+  void queue_event(uint16_t code, uint32_t param);
+  void control_device(uint16_t code, const std::vector<unsigned char>& data);
+  void take_capture();
+  void build_object_info(std::vector<unsigned char>& out);
+  void set_property(uint16_t code, const std::vector<unsigned char>& data);
+  void build_all_properties(std::vector<unsigned char>& out);
+  void build_liveview(std::vector<unsigned char>& out);
+  void simulate(uint64_t bytes);
+};
+
+}  // namespace ports
+}  // namespace imaging
+}  // namespace sony
+}  // namespace com
+#endif
@@ -0,0 +1,477 @@
+#include "ports_usb_registry.h"
+
+#include <socc_time.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+using namespace com::sony::imaging::ports;
+using com::sony::imaging::remote::socc_monotonic_us;
+
+// how long the entries are trusted without the hotplug events
+#define REGISTRY_TTL_US 1000000
+
+typedef struct {
+  libusb_device* device;
+  usb_registry_entry_t* entry;
+  pthread_t thread;
+  bool started;
+} string_job_t;
+
+static int key(int busn, int devn) { return (busn << 8) | devn; }
+
+// the strings of usb_device_info_t are shorter
+static void copy_string(unsigned char* out, size_t size, const char* in) {
+  size_t length = strnlen(in, size - 1);
+  memcpy(out, in, length);
+  out[length] = '\0';
+}
+
+ports_usb_registry* ports_usb_registry::instance() {
+  // never deleted, as the devices opened may use its context until the
+  // process exits. A forked child has its own, as the libusb context of the
+  // parent is not usable.
+  static pthread_mutex_t instance_mutex = PTHREAD_MUTEX_INITIALIZER;
+  static ports_usb_registry* registry = NULL;
+  static pid_t owner = 0;
+  pthread_mutex_lock(&instance_mutex);
+  if (registry == NULL || owner != getpid()) {
+    ports_usb_registry* parent = registry;
+    registry = new ports_usb_registry();
+    if (parent != NULL) {
+      registry->inherit(parent);
+    }
+    owner = getpid();
+  }
+  ports_usb_registry* ret = registry;
+  pthread_mutex_unlock(&instance_mutex);
+  return ret;
+}
+
+ports_usb_registry::ports_usb_registry()
+    : context(NULL),
+      hotplug(false),
+      enumerated(false),
+      enumerated_at(0),
+      users(0),
+      watching(false),
+      stopping(false) {
+  pthread_mutex_init(&mutex, NULL);
+  pthread_mutex_init(&users_mutex, NULL);
+  pthread_mutex_init(&pending_mutex, NULL);
+
+  if (libusb_init(&context) != 0) {
+    context = NULL;
+    return;
+  }
+  libusb_set_option(context, LIBUSB_OPTION_LOG_LEVEL, LIBUSB_LOG_LEVEL_ERROR);
+
+  if (libusb_has_capability(LIBUSB_CAP_HAS_HOTPLUG) != 0) {
+    libusb_hotplug_callback_handle handle;
+    hotplug = libusb_hotplug_register_callback(
+                  context,
+                  (libusb_hotplug_event)(LIBUSB_HOTPLUG_EVENT_DEVICE_ARRIVED |
+                                         LIBUSB_HOTPLUG_EVENT_DEVICE_LEFT),
+                  LIBUSB_HOTPLUG_NO_FLAGS, LIBUSB_HOTPLUG_MATCH_ANY,
+                  LIBUSB_HOTPLUG_MATCH_ANY, LIBUSB_HOTPLUG_MATCH_ANY,
+                  hotplug_callback_entry, this, &handle) == 0;
+  }
+}
+
+int ports_usb_registry::devices(std::vector<usb_registry_entry_t>& out) {
+  pthread_mutex_lock(&mutex);
+  int ret = refresh();
+  name_devices();
+  out.clear();
+  std::map<int, usb_registry_entry_t>::iterator it;
+  for (it = entries.begin(); it != entries.end(); it++) {
+    out.push_back(it->second);
+  }
+  pthread_mutex_unlock(&mutex);
+  return ret;
+}
+
+// the key of the entry at a location, -1 if none
+int ports_usb_registry::locate(int busn, int devn) {
+  for (int retry = 0; retry < 2; retry++) {
+    if (retry > 0) {
+      // the hotplug event of a new device may not have come yet
+      enumerated = false;
+    }
+    if (refresh() != SOCC_OK) {
+      break;
+    }
+    std::map<int, usb_registry_entry_t>::iterator it;
+    if (busn == 0 && devn == 0) {
+      it = entries.begin();
+    } else {
+      it = entries.find(key(busn, devn));
+    }
+    if (it != entries.end()) {
+      return it->first;
+    }
+  }
+  return -1;
+}
+
+int ports_usb_registry::find(int busn, int devn, usb_registry_entry_t& entry) {
+  pthread_mutex_lock(&mutex);
+  int k = locate(busn, devn);
+  if (k >= 0) {
+    entry = entries[k];
+  }
+  pthread_mutex_unlock(&mutex);
+  return k >= 0 ? SOCC_OK : SOCC_ERROR_USB_DEVICE_NOT_FOUND;
+}
+
+libusb_device* ports_usb_registry::find_device(libusb_context* ctx, int busn,
+                                               int devn,
+                                               usb_registry_entry_t& entry) {
+  libusb_device* device = NULL;
+  if (ctx == NULL || ctx != context) {
+    return NULL;
+  }
+  pthread_mutex_lock(&mutex);
+  int k = locate(busn, devn);
+  if (k >= 0) {
+    entry = entries[k];
+    device = libusb_ref_device(usb_devices[k]);
+  }
+  pthread_mutex_unlock(&mutex);
+  return device;
+}
+
+int ports_usb_registry::find_serial(const char* serial,
+                                    usb_registry_entry_t& entry) {
+  int ret = SOCC_ERROR_USB_DEVICE_NOT_FOUND;
+  pthread_mutex_lock(&mutex);
+  // the snapshot, with the hotplug events applied. The devices are enumerated
+  // only by the first lookup of the process, and only the devices arrived
+  // since are read.
+  bool listed = enumerated;
+  if (listed) {
+    update();
+  }
+  if (listed || refresh() == SOCC_OK) {
+    name_devices();
+    std::unordered_map<std::string, int>::iterator it = serials.find(serial);
+    if (it != serials.end()) {
+      entry = entries[it->second];
+      ret = SOCC_OK;
+    }
+  }
+  pthread_mutex_unlock(&mutex);
+  return ret;
+}
+
+void ports_usb_registry::invalidate() {
+  pthread_mutex_lock(&mutex);
+  enumerated = false;
+  pthread_mutex_unlock(&mutex);
+}
+
+libusb_context* ports_usb_registry::acquire() {
+  if (context == NULL) {
+    return NULL;
+  }
+  pthread_mutex_lock(&users_mutex);
+  if (users++ == 0 && hotplug) {
+    // the events come while nobody has handled them are dropped, and the
+    // devices are enumerated again at the next lookup
+    struct timeval zero = {0, 0};
+    libusb_handle_events_timeout_completed(context, &zero, NULL);
+    invalidate();
+    stopping = false;
+    watching = pthread_create(&thread, NULL, &event_thread, this) == 0;
+  }
+  pthread_mutex_unlock(&users_mutex);
+  return context;
+}
+
+void ports_usb_registry::release() {
+  pthread_mutex_lock(&users_mutex);
+  if (--users == 0 && watching) {
+    watching = false;
+    stopping = true;
+    libusb_interrupt_event_handler(context);
+    pthread_join(thread, NULL);
+  }
+  pthread_mutex_unlock(&users_mutex);
+}
+
+void ports_usb_registry::inherit(ports_usb_registry* parent) {
+  // locked by a thread which does not exist in the child
+  if (pthread_mutex_trylock(&parent->mutex) != 0) {
+    return;
+  }
+  std::map<int, usb_registry_entry_t>::iterator it;
+  for (it = parent->entries.begin(); it != parent->entries.end(); it++) {
+    if (it->second.named) {
+      inherited[it->first] = it->second;
+    }
+  }
+  pthread_mutex_unlock(&parent->mutex);
+}
+
+int ports_usb_registry::refresh() {
+  if (context == NULL) {
+    return SOCC_ERROR_USB_INIT;
+  }
+  if (!enumerated ||
+      (!watching && socc_monotonic_us() - enumerated_at > REGISTRY_TTL_US)) {
+    return enumerate();
+  }
+  update();
+  return SOCC_OK;
+}
+
+int ports_usb_registry::enumerate() {
+  pthread_mutex_lock(&pending_mutex);
+  std::vector<libusb_device*> arrived_devices;
+  arrived_devices.swap(arrived);
+  left.clear();
+  pthread_mutex_unlock(&pending_mutex);
+
+  // the whole list has the devices of the pending events
+  for (size_t i = 0; i < arrived_devices.size(); i++) {
+    libusb_unref_device(arrived_devices[i]);
+  }
+  libusb_device** devs = NULL;
+  ssize_t count = libusb_get_device_list(context, &devs);
+  if (count < 0) {
+    return SOCC_ERROR_USB_OTHER;
+  }
+  std::map<int, usb_registry_entry_t> named;
+  named.swap(inherited);
+  while (!entries.empty()) {
+    std::map<int, usb_registry_entry_t>::iterator it = entries.begin();
+    if (it->second.named) {
+      named[it->first] = it->second;
+    }
+    erase(it->first);
+  }
+  read_devices(devs, count);
+  libusb_free_device_list(devs, 1);
+
+  // a device still at its location is the same one, as a device plugged
+  // again gets another address: its strings are not read again
+  std::map<int, usb_registry_entry_t>::iterator it;
+  for (it = entries.begin(); it != entries.end(); it++) {
+    std::map<int, usb_registry_entry_t>::iterator known =
+        named.find(it->first);
+    if (known == named.end() ||
+        known->second.info.idVendor != it->second.info.idVendor ||
+        known->second.info.idProduct != it->second.info.idProduct) {
+      continue;
+    }
+    it->second = known->second;
+    if (it->second.serial_number[0] != '\0') {
+      serials[it->second.serial_number] = it->first;
+    }
+  }
+  enumerated = true;
+  enumerated_at = socc_monotonic_us();
+  return SOCC_OK;
+}
+
+void ports_usb_registry::update() {
+  pthread_mutex_lock(&pending_mutex);
+  std::vector<libusb_device*> arrived_devices;
+  std::vector<int> left_keys;
+  arrived_devices.swap(arrived);
+  left_keys.swap(left);
+  pthread_mutex_unlock(&pending_mutex);
+
+  // a device may have arrived and left since the last lookup
+  if (!arrived_devices.empty()) {
+    read_devices(&arrived_devices[0], arrived_devices.size());
+    for (size_t i = 0; i < arrived_devices.size(); i++) {
+      libusb_unref_device(arrived_devices[i]);
+    }
+  }
+  for (size_t i = 0; i < left_keys.size(); i++) {
+    erase(left_keys[i]);
+  }
+}
+
+void ports_usb_registry::erase(int key) {
+  std::map<int, usb_registry_entry_t>::iterator it = entries.find(key);
+  if (it == entries.end()) {
+    return;
+  }
+  std::unordered_map<std::string, int>::iterator serial =
+      serials.find(it->second.serial_number);
+  if (serial != serials.end() && serial->second == key) {
+    serials.erase(serial);
+  }
+  entries.erase(it);
+  libusb_unref_device(usb_devices[key]);
+  usb_devices.erase(key);
+}
+
+// the descriptors only, without opening the devices
+void ports_usb_registry::read_devices(libusb_device** devs, int count) {
+  for (int i = 0; i < count; i++) {
+    usb_registry_entry_t entry;
+    if (describe(devs[i], entry)) {
+      int k = key(entry.info.busn, entry.info.devn);
+      erase(k);
+      entries[k] = entry;
+      usb_devices[k] = libusb_ref_device(devs[i]);
+    }
+  }
+}
+
+void ports_usb_registry::name_devices() {
+  std::vector<int> keys;
+  std::map<int, usb_registry_entry_t>::iterator it;
+  for (it = entries.begin(); it != entries.end(); it++) {
+    if (!it->second.named) {
+      keys.push_back(it->first);
+    }
+  }
+
+  // each device answers its string descriptors at its own pace
+  std::vector<string_job_t> jobs(keys.size());
+  for (size_t i = 0; i < jobs.size(); i++) {
+    jobs[i].device = usb_devices[keys[i]];
+    jobs[i].entry = &entries[keys[i]];
+    jobs[i].started =
+        pthread_create(&jobs[i].thread, NULL, &read_strings, &jobs[i]) == 0;
+    if (!jobs[i].started) {
+      read_strings(&jobs[i]);
+    }
+  }
+  for (size_t i = 0; i < jobs.size(); i++) {
+    if (jobs[i].started) {
+      pthread_join(jobs[i].thread, NULL);
+    }
+    usb_registry_entry_t& entry = entries[keys[i]];
+    entry.named = true;
+    if (entry.serial_number[0] != '\0') {
+      serials[entry.serial_number] = keys[i];
+    }
+  }
+}
+
+bool ports_usb_registry::describe(libusb_device* device,
+                                  usb_registry_entry_t& entry) {
+  struct libusb_device_descriptor descriptor;
+  if (libusb_get_device_descriptor(device, &descriptor) != 0) {
+    return false;
+  }
+
+  memset(&entry, 0, sizeof(entry));
+  entry.info.idVendor = descriptor.idVendor;
+  entry.info.idProduct = descriptor.idProduct;
+  entry.info.iManufacturer = descriptor.iManufacturer;
+  entry.info.iProduct = descriptor.iProduct;
+  entry.info.iSerialNumber = descriptor.iSerialNumber;
+  entry.info.busn = libusb_get_bus_number(device);
+  entry.info.devn = libusb_get_device_address(device);
+
+  // the first PTP interface with an endpoint, like ports_usb_impl
+  for (int c = 0; c < descriptor.bNumConfigurations; c++) {
+    struct libusb_config_descriptor* config = NULL;
+    if (libusb_get_config_descriptor(device, c, &config) != 0) {
+      continue;
+    }
+    for (int i = 0; i < config->bNumInterfaces; i++) {
+      for (int a = 0; a < config->interface[i].num_altsetting; a++) {
+        const struct libusb_interface_descriptor* altsetting =
+            &config->interface[i].altsetting[a];
+        if (altsetting->bInterfaceClass != LIBUSB_CLASS_PTP) {
+          continue;
+        }
+        entry.info.inep = entry.info.outep = entry.info.intep = -1;
+        for (int e = 0; e < altsetting->bNumEndpoints; e++) {
+          const struct libusb_endpoint_descriptor* endpoint =
+              &altsetting->endpoint[e];
+          int type = endpoint->bmAttributes & LIBUSB_TRANSFER_TYPE_MASK;
+          if (type == LIBUSB_TRANSFER_TYPE_BULK) {
+            if (endpoint->bEndpointAddress & LIBUSB_ENDPOINT_IN) {
+              entry.info.inep = endpoint->bEndpointAddress;
+            } else {
+              entry.info.outep = endpoint->bEndpointAddress;
+            }
+          } else if (type == LIBUSB_TRANSFER_TYPE_INTERRUPT &&
+                     (endpoint->bEndpointAddress & LIBUSB_ENDPOINT_IN)) {
+            entry.info.intep = endpoint->bEndpointAddress;
+          }
+        }
+        if (entry.info.inep >= 0 || entry.info.outep >= 0 ||
+            entry.info.intep >= 0) {
+          entry.info.bInterfaceClass = LIBUSB_CLASS_PTP;
+          entry.configuration_value = config->bConfigurationValue;
+          entry.interface_number = altsetting->bInterfaceNumber;
+          entry.alternate_setting = altsetting->bAlternateSetting;
+          libusb_free_config_descriptor(config);
+          return true;
+        }
+      }
+    }
+    libusb_free_config_descriptor(config);
+  }
+  return false;
+}
+
+void* ports_usb_registry::read_strings(void* vp) {
+  string_job_t* job = static_cast<string_job_t*>(vp);
+  usb_registry_entry_t* entry = job->entry;
+  libusb_device_handle* handle = NULL;
+
+  if (libusb_open(job->device, &handle) != 0) {
+    return NULL;
+  }
+  if (entry->info.iManufacturer != 0) {
+    libusb_get_string_descriptor_ascii(handle, entry->info.iManufacturer,
+                                       (unsigned char*)entry->manufacturer,
+                                       sizeof(entry->manufacturer));
+  }
+  if (entry->info.iProduct != 0) {
+    libusb_get_string_descriptor_ascii(handle, entry->info.iProduct,
+                                       (unsigned char*)entry->product,
+                                       sizeof(entry->product));
+  }
+  if (entry->info.iSerialNumber != 0) {
+    libusb_get_string_descriptor_ascii(handle, entry->info.iSerialNumber,
+                                       (unsigned char*)entry->serial_number,
+                                       sizeof(entry->serial_number));
+  }
+  libusb_close(handle);
+
+  copy_string(entry->info.ascii_Manufacturer,
+           sizeof(entry->info.ascii_Manufacturer), entry->manufacturer);
+  copy_string(entry->info.ascii_Product, sizeof(entry->info.ascii_Product),
+           entry->product);
+  copy_string(entry->info.ascii_SerialNumber,
+           sizeof(entry->info.ascii_SerialNumber), entry->serial_number);
+  return NULL;
+}
+
+void* ports_usb_registry::event_thread(void* vp) {
+  ports_usb_registry* o = static_cast<ports_usb_registry*>(vp);
+  struct timeval tv = {1, 0};
+  while (!o->stopping) {
+    // the hotplug callbacks of the registry and of the devices opened
+    libusb_handle_events_timeout_completed(o->context, &tv, NULL);
+  }
+  return NULL;
+}
+
+int LIBUSB_CALL ports_usb_registry::hotplug_callback_entry(
+    libusb_context* ctx, libusb_device* device, libusb_hotplug_event event,
+    void* user_data) {
+  ports_usb_registry* o = static_cast<ports_usb_registry*>(user_data);
+
+  pthread_mutex_lock(&o->pending_mutex);
+  if (event == LIBUSB_HOTPLUG_EVENT_DEVICE_ARRIVED) {
+    // no transfer in the callback, the descriptors are read at the next lookup
+    o->arrived.push_back(libusb_ref_device(device));
+  } else if (event == LIBUSB_HOTPLUG_EVENT_DEVICE_LEFT) {
+    o->left.push_back(
+        key(libusb_get_bus_number(device), libusb_get_device_address(device)));
+  }
+  pthread_mutex_unlock(&o->pending_mutex);
+  return 0;
+}
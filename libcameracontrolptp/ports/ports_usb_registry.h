@@ -0,0 +1,160 @@
+#ifndef __PORTS_USB_REGISTRY_H__
+#define __PORTS_USB_REGISTRY_H__
+
+#include <libusb-1.0/libusb.h>
+#include <pthread.h>
+#include <socc_types.h>
+
+#include <atomic>
+#include <map>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#include "ports_usb.h"
+
+namespace com {
+namespace sony {
+namespace imaging {
+namespace ports {
+
+#define USB_REGISTRY_STRING_MAX_LEN 64
+
+/**
+ * @brief a PTP device known to ports_usb_registry
+ */
+typedef struct usb_registry_entry_t {
+  usb_device_info_t info;  //!< the strings are truncated like ports_usb_impl
+  int configuration_value;
+  int interface_number;
+  int alternate_setting;
+  char manufacturer[USB_REGISTRY_STRING_MAX_LEN];
+  char product[USB_REGISTRY_STRING_MAX_LEN];
+  char serial_number[USB_REGISTRY_STRING_MAX_LEN];
+  bool named;  //!< the strings have been read
+} usb_registry_entry_t;
+
+/**
+ * @brief The PTP devices on the USB buses, enumerated once per process.
+ *
+ * The first lookup lists the devices, and keeps a reference to the PTP ones
+ * with their descriptors. Their string descriptors are read only by the
+ * lookups which need them, devices() and find_serial(), in parallel with one
+ * thread per device, so a device is opened to read them at most once.\n
+ * The libusb context of the registry is shared with the devices opened by
+ * ports_usb_impl, from acquire() to release(), and its events are handled by
+ * a thread while it is acquired. The entries are updated by the hotplug events
+ * meanwhile: a device which has left is removed, and only the devices which
+ * have arrived are read at the next lookup. Otherwise, the entries are
+ * enumerated again when they are older than a second, and the strings are
+ * kept for the devices still at their locations.\n
+ * A forked child has a registry of its own, which starts with the strings of
+ * the parent, so a server forked for a camera opens it without reading them.
+ */
+class ports_usb_registry {
+ public:
+  /**
+   * @brief the registry of the process
+   */
+  static ports_usb_registry* instance();
+
+  /**
+   * @brief the PTP devices, ordered by bus number and device address
+   */
+  int devices(std::vector<usb_registry_entry_t>& entries);
+
+  /**
+   * @brief the PTP device at a location. The strings are not read for it.
+   * @param busn bus number, 0 with devn 0 for the first PTP device
+   * @param devn device address
+   * @return 0 on success, SOCC_ERROR_USB_DEVICE_NOT_FOUND if none
+   */
+  int find(int busn, int devn, usb_registry_entry_t& entry);
+
+  /**
+   * @brief the PTP device at a location like find(), to be opened
+   * @param ctx the context of the caller. The device is not found if it is
+   * not the one of the registry.
+   * @return the device referenced for the caller, who unreferences it. NULL
+   * if none
+   */
+  libusb_device* find_device(libusb_context* ctx, int busn, int devn,
+                             usb_registry_entry_t& entry);
+
+  /**
+   * @brief the PTP device of a serial number, in constant time. It is looked
+   * up in the entries with the hotplug events applied, which are enumerated
+   * only by the first lookup of the process, and the strings are read only
+   * for the devices arrived since.
+   * @return 0 on success, SOCC_ERROR_USB_DEVICE_NOT_FOUND if none
+   */
+  int find_serial(const char* serial, usb_registry_entry_t& entry);
+
+  /**
+   * @brief forgets the entries, to enumerate the devices at the next lookup
+   */
+  void invalidate();
+
+  /**
+   * @brief the libusb context of the registry for a device to be opened. Its
+   * events are handled by the thread of the registry until the last
+   * release().
+   * @return the context, NULL if libusb cannot be initialized
+   */
+  libusb_context* acquire();
+
+  /**
+   * @brief releases the context acquired. The thread handling its events is
+   * stopped with the last one.
+   */
+  void release();
+
+ private:
+  ports_usb_registry();
+
+  pthread_mutex_t mutex;
+  libusb_context* context;
+  bool hotplug;
+  bool enumerated;
+  uint64_t enumerated_at;
+  std::map<int, usb_registry_entry_t> entries;
+  std::map<int, libusb_device*> usb_devices;     //!< referenced
+  std::unordered_map<std::string, int> serials;  //!< to the key of entries
+  std::map<int, usb_registry_entry_t> inherited;  //!< named by the parent
+
+  // the users of the context, and the thread handling its events for them
+  pthread_mutex_t users_mutex;
+  int users;
+  pthread_t thread;
+  std::atomic<bool> watching;  //!< the hotplug events are applied
+  std::atomic<bool> stopping;
+
+  // the hotplug events not applied yet. The callback takes only this lock,
+  // as the event thread may be needed by the transfers under the other.
+  pthread_mutex_t pending_mutex;
+  std::vector<libusb_device*> arrived;
+  std::vector<int> left;
+
+  int refresh();
+  int enumerate();
+  void update();
+  void inherit(ports_usb_registry* parent);
+  int locate(int busn, int devn);
+  void erase(int key);
+  void read_devices(libusb_device** devs, int count);
+  void name_devices();
+
+  static bool describe(libusb_device* device, usb_registry_entry_t& entry);
+  static void* read_strings(void* vp);
+  static void* event_thread(void* vp);
+  static int LIBUSB_CALL hotplug_callback_entry(libusb_context* ctx,
+                                                libusb_device* device,
+                                                libusb_hotplug_event event,
+                                                void* user_data);
+};
+
+}  // namespace ports
+}  // namespace imaging
+}  // namespace sony
+}  // namespace com
+#endif
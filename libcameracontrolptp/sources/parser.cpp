@@ -105,6 +105,131 @@ SDIDevicePropInfoDataset *SDIDevicePropInfoDataset::create(void *data) {
   return ret->parse(data);
 }
 
+uint32_t SDIDevicePropInfoDataset::valueSize(uint16_t DataType) {
+  switch (DataType & 0x0FFF) {
+    case 0x0001:
+    case 0x0002:
+      return 1;
+    case 0x0003:
+    case 0x0004:
+      return 2;
+    case 0x0005:
+    case 0x0006:
+      return 4;
+    case 0x0007:
+    case 0x0008:
+    case 0x0009:  // parsed as 64 bits
+    case 0x000A:
+      return 8;
+  }
+  return 0;
+}
+
+int64_t SDIDevicePropInfoDataset::currentInteger() {
+  switch (DataType) {
+    case 0x0001:
+      return ((DataTypeInteger<int8_t> *)this)->CurrentValue;
+    case 0x0002:
+      return ((DataTypeInteger<uint8_t> *)this)->CurrentValue;
+    case 0x0003:
+      return ((DataTypeInteger<int16_t> *)this)->CurrentValue;
+    case 0x0004:
+      return ((DataTypeInteger<uint16_t> *)this)->CurrentValue;
+    case 0x0005:
+      return ((DataTypeInteger<int32_t> *)this)->CurrentValue;
+    case 0x0006:
+      return ((DataTypeInteger<uint32_t> *)this)->CurrentValue;
+    case 0x0007:
+    case 0x0009:  // parsed as 64 bits
+      return ((DataTypeInteger<int64_t> *)this)->CurrentValue;
+    case 0x0008:
+    case 0x000A:
+      return ((DataTypeInteger<uint64_t> *)this)->CurrentValue;
+  }
+  return 0;
+}
+
+uint32_t SDIDevicePropInfoDataset::measure(const void *data, uint32_t size,
+                                           uint32_t *current,
+                                           uint32_t *current_size) {
+  const char *_data = (const char *)data;
+  uint32_t pos = 6;  // DevicePropertyCode, DataType, GetSet and IsEnable
+  uint32_t value_pos;  // CurrentValue
+  if (NULL == data || size < pos) {
+    return 0;
+  }
+  uint16_t DataType = *(uint16_t *)(_data + 2);
+  uint32_t unit = valueSize(DataType);
+
+#define NEED(n)                     \
+  if ((uint64_t)size - pos < (n)) { \
+    return 0;                       \
+  }
+#define CURRENT(begin, end)          \
+  if (NULL != current) {             \
+    *current = (begin);              \
+  }                                  \
+  if (NULL != current_size) {        \
+    *current_size = (end) - (begin); \
+  }
+
+  if (0xFFFF == DataType) {
+    for (int i = 0; i < 2; i++) {
+      NEED(1);
+      value_pos = pos;
+      uint8_t len = *(uint8_t *)(_data + pos);
+      pos += 1;
+      NEED((uint64_t)len * 2);
+      pos += len * 2;
+    }
+    NEED(1);  // FormFlag, the form is not supported
+    CURRENT(value_pos, pos);
+    return pos + 1;
+  }
+  uint16_t kind = DataType & 0xF000;
+  if (0 == unit || (0x4000 != kind && 0 != kind)) {
+    return 0;
+  }
+  if (0x4000 == kind) {
+    for (int i = 0; i < 2; i++) {
+      NEED(4);
+      value_pos = pos;
+      uint32_t n = *(uint32_t *)(_data + pos);
+      pos += 4;
+      NEED((uint64_t)n * unit);
+      pos += n * unit;
+    }
+    NEED(1);  // FormFlag, the form is not supported
+    CURRENT(value_pos, pos);
+    return pos + 1;
+  }
+
+  NEED(2 * unit + 1);
+  value_pos = pos + unit;
+  pos += 2 * unit;
+  CURRENT(value_pos, pos);
+  uint8_t FormFlag = *(uint8_t *)(_data + pos);
+  pos += 1;
+  switch (FormFlag) {
+    case 0x01:  // Range-Form
+      NEED(3 * unit);
+      pos += 3 * unit;
+      break;
+    case 0x02:  // Enumeration-Form, with the second list of ver300
+      for (int i = 0; i < 2; i++) {
+        NEED(2);
+        uint16_t n = *(uint16_t *)(_data + pos);
+        pos += 2;
+        NEED((uint64_t)n * unit);
+        pos += n * unit;
+      }
+      break;
+  }
+#undef CURRENT
+#undef NEED
+  return pos;
+}
+
 SDIDevicePropInfoDataset::~SDIDevicePropInfoDataset() {}
 
 void SDIDevicePropInfoDataset::parseValues(char **data) {}
@@ -125,6 +250,60 @@ void SDIDevicePropInfoDataset::toString() {
   printf("%s", str.c_str());
 }
 
+void SDIDevicePropInfoDataset::headToJson(std::string &str) {
+  strsprintf(str,
+             "{\"code\": \"0x%04X\", \"type\": \"0x%04X\", \"get_set\": %u, "
+             "\"is_enable\": %u, \"form_flag\": %u",
+             DevicePropertyCode, DataType, GetSet, IsEnable, FormFlag);
+}
+
+void SDIDevicePropInfoDataset::toJson(std::string &str) {
+  headToJson(str);
+  str.append("}");
+}
+
+void SDIDevicePropInfoDataset::currentValueToString(std::string &str) {}
+
+// a value of T in decimal
+template <typename T>
+static void valueToString(std::string &str, T value) {
+  if ((T)-1 < 0) {
+    strsprintf(str, "%lld", (long long)value);
+  } else {
+    strsprintf(str, "%llu", (unsigned long long)value);
+  }
+}
+
+template <typename T>
+static void arrayToJson(std::string &str, const T *values, uint32_t num) {
+  str.append("[");
+  for (uint32_t i = 0; i < num; i++) {
+    if (i > 0) {
+      str.append(", ");
+    }
+    valueToString(str, values[i]);
+  }
+  str.append("]");
+}
+
+// a string of a DataTypeSTR as a JSON string. The characters are the lower
+// bytes of UCS-2, so the others than ASCII are escaped as Latin-1.
+static void stringToJson(std::string &str, const char *value, uint8_t length) {
+  str.append("\"");
+  for (uint8_t i = 0; i < length && value[i] != 0; i++) {
+    uint8_t c = value[i];
+    if ('"' == c || '\\' == c) {
+      str.append(1, '\\');
+      str.append(1, c);
+    } else if (c < 0x20 || c >= 0x7F) {
+      strsprintf(str, "\\u%04x", c);
+    } else {
+      str.append(1, c);
+    }
+  }
+  str.append("\"");
+}
+
 SDIDevicePropInfoDataset *SDIDevicePropInfoDataset::parse(void *data) {
   char *_data = (char *)data;
   DevicePropertyCode = *(uint16_t *)_data;
@@ -230,6 +409,35 @@ void DataTypeInteger<T>::toString(std::string &str) {
   }
 }
 
+template <typename T>
+void DataTypeInteger<T>::toJson(std::string &str) {
+  headToJson(str);
+  str.append(", \"default\": ");
+  valueToString(str, DefaultValue);
+  str.append(", \"current\": ");
+  valueToString(str, CurrentValue);
+  switch (FormFlag) {
+    case 0x01:  // Range-Form
+      str.append(", \"min\": ");
+      valueToString(str, MinimumValue);
+      str.append(", \"max\": ");
+      valueToString(str, MaximumValue);
+      str.append(", \"step\": ");
+      valueToString(str, StepSize);
+      break;
+    case 0x02:  // Enumeration-Form, Values holds the second list
+      str.append(", \"values\": ");
+      arrayToJson(str, Values, NumOfValues_2nd);
+      break;
+  }
+  str.append("}");
+}
+
+template <typename T>
+void DataTypeInteger<T>::currentValueToString(std::string &str) {
+  valueToString(str, CurrentValue);
+}
+
 template <typename T>
 void DataTypeInteger<T>::toString() {
   std::string str;
@@ -272,10 +480,10 @@ void DataTypeArray<T>::parseValues(char **data) {
 template <typename T>
 void DataTypeArray<T>::parseForm(char **data) {
   if (0x00 != FormFlag) {
-    printf(
-        "DevicePropertyCode: 0x%04X: FormFlag is not 0, this is not "
-        "supported\n",
-        DevicePropertyCode);
+    fprintf(stderr,
+            "DevicePropertyCode: 0x%04X: FormFlag is not 0, this is not "
+            "supported\n",
+            DevicePropertyCode);
   }
 }
 
@@ -294,6 +502,26 @@ void DataTypeArray<T>::toString(std::string &str) {
   }
 }
 
+template <typename T>
+void DataTypeArray<T>::toJson(std::string &str) {
+  headToJson(str);
+  str.append(", \"default\": ");
+  arrayToJson(str, DefaultValues, NumOfDefaultValues);
+  str.append(", \"current\": ");
+  arrayToJson(str, CurrentValues, NumOfCurrentValues);
+  str.append("}");
+}
+
+template <typename T>
+void DataTypeArray<T>::currentValueToString(std::string &str) {
+  for (uint32_t i = 0; i < NumOfCurrentValues; i++) {
+    if (i > 0) {
+      str.append(" ");
+    }
+    valueToString(str, CurrentValues[i]);
+  }
+}
+
 template <typename T>
 void DataTypeArray<T>::toString() {
   std::string str;
@@ -331,10 +559,10 @@ void DataTypeSTR::parseValues(char **data) {
 
 void DataTypeSTR::parseForm(char **data) {
   if (0x00 != FormFlag) {
-    printf(
-        "DevicePropertyCode: 0x%04X: FormFlag is not 0, this is not "
-        "supported\n",
-        DevicePropertyCode);
+    fprintf(stderr,
+            "DevicePropertyCode: 0x%04X: FormFlag is not 0, this is not "
+            "supported\n",
+            DevicePropertyCode);
   }
 }
 
@@ -344,13 +572,27 @@ void DataTypeSTR::toString(std::string &str) {
   strsprintf(str, "  dataset CurrentValue: \"%s\"\n", CurrentValue);
 }
 
+void DataTypeSTR::toJson(std::string &str) {
+  headToJson(str);
+  str.append(", \"default\": ");
+  stringToJson(str, DefaultValue, length_DefaultValue);
+  str.append(", \"current\": ");
+  stringToJson(str, CurrentValue, length_CurrentValue);
+  str.append("}");
+}
+
+void DataTypeSTR::currentValueToString(std::string &str) {
+  str.append(CurrentValue, strnlen(CurrentValue, length_CurrentValue));
+}
+
 void DataTypeSTR::toString() {
   std::string str;
   toString(str);
   printf("%s", str.c_str());
 }
 
-SDIDevicePropInfoDatasetArray::SDIDevicePropInfoDatasetArray(void *data) {
+SDIDevicePropInfoDatasetArray::SDIDevicePropInfoDatasetArray(void *data)
+    : _valid(false) {
   char *_data = (char *)data;
 
   num = 0;
@@ -358,6 +600,7 @@ SDIDevicePropInfoDatasetArray::SDIDevicePropInfoDatasetArray(void *data) {
   if (NULL == data) {
     goto bail;
   }
+  _valid = true;
 
   num = *(uint64_t *)_data;
   _data += sizeof(uint64_t);
@@ -375,6 +618,41 @@ bail:
   return;
 }
 
+SDIDevicePropInfoDatasetArray::SDIDevicePropInfoDatasetArray(const void *data,
+                                                             uint32_t size)
+    : _valid(false), num(0) {
+  const char *_data = (const char *)data;
+  uint32_t pos = sizeof(uint64_t);
+
+  if (NULL == data || size < pos) {
+    return;
+  }
+  num = *(uint64_t *)_data;
+
+  for (uint64_t i = 0; i < num; i++) {
+    uint32_t dataset_size =
+        SDIDevicePropInfoDataset::measure(_data + pos, size - pos);
+    if (0 == dataset_size) {
+      return;
+    }
+    SDIDevicePropInfoDataset *d =
+        SDIDevicePropInfoDataset::create((void *)(_data + pos));
+    if (dataset.find(d->DevicePropertyCode) != dataset.end()) {
+      delete dataset[d->DevicePropertyCode];
+    }
+    dataset[d->DevicePropertyCode] = d;
+    pos += dataset_size;
+  }
+  _valid = true;
+}
+
+bool SDIDevicePropInfoDatasetArray::valid() { return _valid; }
+
+const std::map<uint16_t, SDIDevicePropInfoDataset *>
+    &SDIDevicePropInfoDatasetArray::datasets() {
+  return dataset;
+}
+
 SDIDevicePropInfoDataset *SDIDevicePropInfoDatasetArray::get(
     uint16_t device_property_code) {
   SDIDevicePropInfoDataset *ret = NULL;
@@ -420,6 +698,10 @@ LiveViewImage::LiveViewImage(void *data) {
   _data += sizeof(uint32_t);
   _size = *(uint32_t *)_data;
   _data += sizeof(uint32_t);
+  ffi_offset = *(uint32_t *)_data;
+  _data += sizeof(uint32_t);
+  ffi_size = *(uint32_t *)_data;
+  _data += sizeof(uint32_t);
   this->data = (uint8_t *)data + offset;
 }
 
@@ -429,6 +711,166 @@ uint32_t LiveViewImage::size() { return _size; }
 
 uint8_t *LiveViewImage::get() { return data; }
 
+uint32_t LiveViewImage::focalFrameInfoSize() {
+  return ffi_offset != 0 ? ffi_size : 0;
+}
+
+uint8_t *LiveViewImage::focalFrameInfo() {
+  return (ffi_offset != 0 && ffi_size != 0) ? (uint8_t *)org_data + ffi_offset
+                                            : NULL;
+}
+
+#define FFI_RESERVED_ARRAY_NUM_OFFSET 48
+#define FFI_RESERVED_ARRAY_OFFSET 56
+#define FFI_SECTION_HEADER_SIZE 16
+#define FFI_FRAME_SIZE 24
+
+static uint16_t read_u16(const uint8_t *p) {
+  uint16_t v;
+  memcpy(&v, p, sizeof(v));
+  return v;
+}
+
+static uint32_t read_u32(const uint8_t *p) {
+  uint32_t v;
+  memcpy(&v, p, sizeof(v));
+  return v;
+}
+
+// parses a section at *pos, and moves *pos to the next section
+static bool parse_section(const uint8_t *data, uint32_t size, uint32_t *pos,
+                          FocalFrameSection &section) {
+  if (size - *pos < FFI_SECTION_HEADER_SIZE) {
+    return false;
+  }
+  const uint8_t *p = data + *pos;
+  uint16_t num = read_u16(p + 8);
+  if ((size - *pos - FFI_SECTION_HEADER_SIZE) / FFI_FRAME_SIZE < num) {
+    return false;
+  }
+  section.XDenominator = read_u32(p);
+  section.YDenominator = read_u32(p + 4);
+  section.FrameNum = num;
+  section.frames = p + FFI_SECTION_HEADER_SIZE;
+  *pos += FFI_SECTION_HEADER_SIZE + num * FFI_FRAME_SIZE;
+  return true;
+}
+
+FocalFrameInfo::FocalFrameInfo(const void *data, uint32_t size)
+    : Version(0), _valid(false) {
+  const uint8_t *_data = (const uint8_t *)data;
+  memset(&Focus, 0, sizeof(Focus));
+  memset(&Face, 0, sizeof(Face));
+  memset(&Tracking, 0, sizeof(Tracking));
+
+  if (_data == NULL || size < FFI_RESERVED_ARRAY_OFFSET) {
+    return;
+  }
+  Version = read_u16(_data);
+
+  uint32_t reserved_num = read_u16(_data + FFI_RESERVED_ARRAY_NUM_OFFSET);
+  if ((size - FFI_RESERVED_ARRAY_OFFSET) / FFI_FRAME_SIZE < reserved_num) {
+    return;
+  }
+  uint32_t pos = FFI_RESERVED_ARRAY_OFFSET + reserved_num * FFI_FRAME_SIZE;
+
+  if (!parse_section(_data, size, &pos, Focus)) {
+    return;
+  }
+  _valid = true;
+
+  // Version 1.01 or later
+  if (Version >= 101 && parse_section(_data, size, &pos, Face)) {
+    parse_section(_data, size, &pos, Tracking);
+  }
+}
+
+FocalFrameInfo::~FocalFrameInfo() {}
+
+bool FocalFrameInfo::valid() { return _valid; }
+
+bool FocalFrameInfo::frame(const FocalFrameSection &section, uint16_t index,
+                           FocalFrame &frame) {
+  if (index >= section.FrameNum) {
+    return false;
+  }
+  const uint8_t *p = section.frames + index * FFI_FRAME_SIZE;
+  frame.Type = read_u16(p);
+  frame.State = read_u16(p + 2);
+  if (&section == &Face) {
+    frame.Selection = p[4];
+    frame.Priority = p[5];
+  } else {
+    frame.Selection = 0;
+    frame.Priority = p[4];
+  }
+  frame.XNumerator = read_u32(p + 8);
+  frame.YNumerator = read_u32(p + 12);
+  frame.Height = read_u32(p + 16);
+  frame.Width = read_u32(p + 20);
+  return true;
+}
+
+void FocalFrameInfo::toString(std::string &str) {
+  const char *names[] = {"FocusFrame", "FaceFrame", "TrackingFrame"};
+  FocalFrameSection *sections[] = {&Focus, &Face, &Tracking};
+  FocalFrame f;
+
+  strsprintf(str, "FocalFrameInfo Version: %d.%02d\n", Version / 100,
+             Version % 100);
+  for (int i = 0; i < 3; i++) {
+    FocalFrameSection &section = *sections[i];
+    strsprintf(str, "  %s num: %d (denominator %u x %u)\n", names[i],
+               section.FrameNum, section.XDenominator, section.YDenominator);
+    for (uint16_t j = 0; frame(section, j, f); j++) {
+      strsprintf(str,
+                 "    Type: %04X State: %04X Selection: %02X Priority: %d "
+                 "X: %u Y: %u Width: %u Height: %u\n",
+                 f.Type, f.State, f.Selection, f.Priority, f.XNumerator,
+                 f.YNumerator, f.Width, f.Height);
+    }
+  }
+}
+
+void FocalFrameInfo::toString() {
+  std::string str;
+  toString(str);
+  printf("%s", str.c_str());
+}
+
+void FocalFrameInfo::toJson(std::string &str, const char *name,
+                            const FocalFrameSection &section, bool selection) {
+  FocalFrame f;
+
+  strsprintf(str,
+             "\"%s\": {\"x_denominator\": %u, \"y_denominator\": %u, "
+             "\"frames\": [",
+             name, section.XDenominator, section.YDenominator);
+  for (uint16_t i = 0; frame(section, i, f); i++) {
+    strsprintf(str,
+               "%s{\"type\": %u, \"state\": %u, \"priority\": %u, "
+               "\"x\": %u, \"y\": %u, \"width\": %u, \"height\": %u",
+               i > 0 ? ", " : "", f.Type, f.State, f.Priority, f.XNumerator,
+               f.YNumerator, f.Width, f.Height);
+    if (selection) {
+      strsprintf(str, ", \"selected\": %s",
+                 f.Selection == SELECTION_SELECTED ? "true" : "false");
+    }
+    str.append("}");
+  }
+  str.append("]}");
+}
+
+void FocalFrameInfo::toJson(std::string &str) {
+  strsprintf(str, "{\"version\": %u, ", Version);
+  toJson(str, "focus", Focus, false);
+  str.append(", ");
+  toJson(str, "face", Face, true);
+  str.append(", ");
+  toJson(str, "tracking", Tracking, false);
+  str.append("}");
+}
+
 template <typename T>
 SimpleArray<T>::SimpleArray(void *data) {
   char *_data = (char *)data;
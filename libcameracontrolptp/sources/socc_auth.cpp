@@ -0,0 +1,260 @@
+#include <pthread.h>
+#include <socc_auth.h>
+#include <socc_ptp.h>
+#include <socc_time.h>
+#include <socc_trace.h>
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include <map>
+#include <string>
+
+using namespace com::sony::imaging::remote;
+
+#define PTP_OC_SDIO_CONNECT 0x9201
+#define PTP_OC_SDIO_GETEXTDEVICEINFO 0x9202
+#define PTP_OC_SDIO_GETALLEXTDEVICEPROPINFO 0x9209
+#define PTP_RC_OK 0x2001
+
+#define SDI_EXTENSION_VERSION 0x012C
+
+#define POLL_INTERVAL_MIN_US 1000
+#define POLL_INTERVAL_MAX_US 16000
+#define AUTH_TIMEOUT_US 10000000
+
+static pthread_mutex_t cache_mutex = PTHREAD_MUTEX_INITIALIZER;
+static std::map<std::string, uint16_t> cache;
+
+socc_auth::socc_auth(socc_ptp* ptp)
+    : ptp(ptp),
+      state(SOCC_AUTH_CONNECT_1),
+      wait_properties(true),
+      interval_us(POLL_INTERVAL_MIN_US),
+      begin_us(0),
+      step_begin_us(0),
+      trace_begin(0) {
+  memset(&result, 0, sizeof(result));
+  if (ptp->serial_number(serial, sizeof(serial)) != SOCC_OK) {
+    serial[0] = '\0';
+  }
+  requested = cached_version(serial);
+  result.cached = requested != 0;
+  if (requested == 0) {
+    requested = SDI_EXTENSION_VERSION;
+  }
+}
+
+int socc_auth::receive(uint16_t code, uint32_t* params, uint8_t nparam,
+                       void* head, uint32_t head_size) {
+  Container response;
+  void* data = NULL;
+  uint32_t size = 0;
+  int ret = ptp->receive(code, params, nparam, response, &data, size);
+  if (head != NULL) {
+    memset(head, 0, head_size);
+    if (data != NULL) {
+      memcpy(head, data, size < head_size ? size : head_size);
+    }
+  }
+  ptp->dispose_data(&data);
+  if (ret == SOCC_OK && response.code != PTP_RC_OK) {
+    ret = SOCC_PTP_ERROR_TRANSACTION;
+  }
+  return ret;
+}
+
+// not ready yet: the next poll comes later and later, up to the maximum
+int socc_auth::poll(bool ready, uint32_t& wait_us) {
+  if (ready) {
+    next(wait_us);
+    return SOCC_OK;
+  }
+  wait_us = interval_us;
+  interval_us += interval_us / 2;
+  if (interval_us > POLL_INTERVAL_MAX_US) {
+    interval_us = POLL_INTERVAL_MAX_US;
+  }
+  return SOCC_OK;
+}
+
+void socc_auth::next(uint32_t& wait_us) {
+  uint64_t now = socc_monotonic_us();
+  result.step_us[state] = now - step_begin_us;
+  socc_trace_span(step_name(state), "auth", trace_begin, "polls",
+                  result.polls[state]);
+  state = (socc_auth_step_t)(state + 1);
+  if (state == SOCC_AUTH_DONE) {
+    result.total_us = now - begin_us;
+  }
+  interval_us = POLL_INTERVAL_MIN_US;
+  step_begin_us = now;
+  trace_begin = socc_trace_now();
+  wait_us = 0;
+}
+
+int socc_auth::step(uint32_t& wait_us) {
+  if (state == SOCC_AUTH_DONE) {
+    wait_us = 0;
+    return SOCC_OK;
+  }
+  if (begin_us == 0) {
+    begin_us = step_begin_us = socc_monotonic_us();
+    trace_begin = socc_trace_now();
+  }
+  result.polls[state]++;
+
+  int ret;
+  switch (state) {
+    case SOCC_AUTH_CONNECT_1:
+    case SOCC_AUTH_CONNECT_2:
+    case SOCC_AUTH_CONNECT_3: {
+      uint32_t params[3] = {
+          (uint32_t)(state == SOCC_AUTH_CONNECT_3 ? 3 : state + 1), 0, 0};
+      ret = receive(PTP_OC_SDIO_CONNECT, params, 3, NULL, 0);
+      if (ret == SOCC_OK) {
+        next(wait_us);
+      }
+      return ret;
+    }
+    case SOCC_AUTH_VERSION: {
+      uint32_t params[1] = {requested};
+      uint16_t version = 0;
+      ret = receive(PTP_OC_SDIO_GETEXTDEVICEINFO, params, 1, &version,
+                    sizeof(version));
+      if (ret != SOCC_OK) {
+        return ret;
+      }
+      if (version != 0) {
+        // not always the requested one
+        result.version = version;
+        cache_version(serial, version);
+      } else if (result.cached && wait_properties) {
+        // a camera seen before is not waited for here, but by the properties
+        // step, which asks the version once it is ready
+        return poll(true, wait_us);
+      }
+      return poll(version != 0, wait_us);
+    }
+    case SOCC_AUTH_PROPERTIES: {
+      uint64_t count = 0;
+      ret = receive(PTP_OC_SDIO_GETALLEXTDEVICEPROPINFO, NULL, 0, &count,
+                    sizeof(count));
+      if (ret != SOCC_OK) {
+        return ret;
+      }
+      if (count > 0 && result.version == 0) {
+        uint32_t params[1] = {requested};
+        uint16_t version = 0;
+        ret = receive(PTP_OC_SDIO_GETEXTDEVICEINFO, params, 1, &version,
+                      sizeof(version));
+        if (ret != SOCC_OK) {
+          return ret;
+        }
+        if (version != 0) {
+          result.version = version;
+          cache_version(serial, version);
+        }
+      }
+      return poll(count > 0, wait_us);
+    }
+    default:
+      return SOCC_ERROR_INVALID_PARAMETER;
+  }
+}
+
+int socc_auth::run(bool properties) {
+  uint64_t deadline = socc_monotonic_us() + AUTH_TIMEOUT_US;
+  socc_auth_step_t last = properties ? SOCC_AUTH_DONE : SOCC_AUTH_PROPERTIES;
+  wait_properties = properties;
+  while (state < last) {
+    uint32_t wait_us = 0;
+    int ret = step(wait_us);
+    if (ret != SOCC_OK) {
+      return ret;
+    }
+    if (wait_us > 0) {
+      if (socc_monotonic_us() + wait_us > deadline) {
+        return SOCC_ERROR_USB_TIMEOUT;
+      }
+      usleep(wait_us);
+    }
+  }
+  if (!properties) {
+    result.total_us = socc_monotonic_us() - begin_us;
+  }
+  return SOCC_OK;
+}
+
+socc_auth_step_t socc_auth::current() { return state; }
+
+const AuthTiming& socc_auth::timing() { return result; }
+
+const char* socc_auth::step_name(socc_auth_step_t step) {
+  switch (step) {
+    case SOCC_AUTH_CONNECT_1:
+      return "connect 1";
+    case SOCC_AUTH_CONNECT_2:
+      return "connect 2";
+    case SOCC_AUTH_VERSION:
+      return "version";
+    case SOCC_AUTH_CONNECT_3:
+      return "connect 3";
+    case SOCC_AUTH_PROPERTIES:
+      return "properties";
+    default:
+      return "done";
+  }
+}
+
+uint16_t socc_auth::cached_version(const char* serial) {
+  uint16_t version = 0;
+  if (serial == NULL || serial[0] == '\0') {
+    return 0;
+  }
+  pthread_mutex_lock(&cache_mutex);
+  std::map<std::string, uint16_t>::iterator it = cache.find(serial);
+  if (it != cache.end()) {
+    version = it->second;
+  }
+  pthread_mutex_unlock(&cache_mutex);
+  return version;
+}
+
+void socc_auth::cache_version(const char* serial, uint16_t version) {
+  if (serial == NULL || serial[0] == '\0') {
+    return;
+  }
+  pthread_mutex_lock(&cache_mutex);
+  cache[serial] = version;
+  pthread_mutex_unlock(&cache_mutex);
+}
+
+int socc_auth::load_cache(const char* path) {
+  FILE* fp = fopen(path, "r");
+  if (fp == NULL) {
+    return SOCC_ERROR_FILE_IO;
+  }
+  char serial[32];
+  unsigned int version;
+  while (fscanf(fp, "%31s %x", serial, &version) == 2) {
+    cache_version(serial, (uint16_t)version);
+  }
+  fclose(fp);
+  return SOCC_OK;
+}
+
+int socc_auth::save_cache(const char* path) {
+  FILE* fp = fopen(path, "w");
+  if (fp == NULL) {
+    return SOCC_ERROR_FILE_IO;
+  }
+  pthread_mutex_lock(&cache_mutex);
+  std::map<std::string, uint16_t>::iterator it;
+  for (it = cache.begin(); it != cache.end(); it++) {
+    fprintf(fp, "%s 0x%04X\n", it->first.c_str(), it->second);
+  }
+  pthread_mutex_unlock(&cache_mutex);
+  return fclose(fp) == 0 ? SOCC_OK : SOCC_ERROR_FILE_IO;
+}
@@ -0,0 +1,363 @@
+#include <errno.h>
+#include <parser.h>
+#include <socc_capture.h>
+#include <socc_ptp.h>
+#include <socc_time.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/time.h>
+#include <time.h>
+
+using namespace com::sony::imaging::remote;
+
+#define SHOT_HANDLE 0xFFFFC001
+#define PTP_OC_SDIO_CONTROLDEVICE 0x9207
+#define PTP_OC_SDIO_GETALLEXTDEVICEPROPINFO 0x9209
+#define PTP_EC_OBJECTADDED 0xC201
+#define PTP_EC_DEVICEPROPCHANGED 0xC203
+#define PTP_RC_OK 0x2001
+
+#define DPC_SHOOTING_FILE_INFO 0xD215
+#define DPC_S1_BUTTON 0xD2C1
+#define DPC_S2_BUTTON 0xD2C2
+#define BUTTON_UP 0x0001
+#define BUTTON_DOWN 0x0002
+#define SHOOTING_FILE_READY 0x8000
+
+#define ERROR_BACKOFF_US 100000
+#define ANNOUNCE_TIMEOUT_US 5000000
+
+static void sleep_us(uint64_t us) {
+  struct timespec ts = {(time_t)(us / 1000000), (long)(us % 1000000) * 1000};
+  nanosleep(&ts, NULL);
+}
+
+socc_capture::socc_capture(socc_ptp* ptp, pthread_mutex_t* ptp_mutex,
+                           int depth)
+    : ptp(ptp),
+      ptp_mutex(ptp_mutex != NULL ? ptp_mutex : &own_ptp_mutex),
+      download(ptp, this->ptp_mutex),
+      threads_running(false),
+      stopping(false),
+      max_depth(depth < 1 ? 1 : depth),
+      pending(0),
+      downloading(false),
+      probe(false),
+      first_trigger_us(0),
+      last_trigger_us(0),
+      trigger_us_total(0),
+      download_us_total(0),
+      probed(0) {
+  pthread_mutex_init(&own_ptp_mutex, NULL);
+  pthread_mutex_init(&mutex, NULL);
+  pthread_cond_init(&cond, NULL);
+  memset(&stats, 0, sizeof(stats));
+  path_format[0] = '\0';
+}
+
+socc_capture::~socc_capture() {
+  stop();
+  pthread_cond_destroy(&cond);
+  pthread_mutex_destroy(&mutex);
+  pthread_mutex_destroy(&own_ptp_mutex);
+}
+
+int socc_capture::start(const char* path_format) {
+  if (path_format == NULL || strlen(path_format) >= sizeof(this->path_format) ||
+      !socc_download::valid_path_format(path_format)) {
+    return SOCC_ERROR_INVALID_PARAMETER;
+  }
+
+  pthread_mutex_lock(&mutex);
+  if (threads_running) {
+    pthread_mutex_unlock(&mutex);
+    return SOCC_OK;
+  }
+  strncpy(this->path_format, path_format, sizeof(this->path_format));
+  stopping = false;
+  if (pthread_create(&event_thread_id, NULL, &event_thread, this) != 0) {
+    pthread_mutex_unlock(&mutex);
+    return SOCC_ERROR_THREAD_CREATE;
+  }
+  if (pthread_create(&download_thread_id, NULL, &download_thread, this) !=
+      0) {
+    stopping = true;
+    pthread_mutex_unlock(&mutex);
+    pthread_join(event_thread_id, NULL);
+    return SOCC_ERROR_THREAD_CREATE;
+  }
+  threads_running = true;
+  pthread_mutex_unlock(&mutex);
+  return SOCC_OK;
+}
+
+int socc_capture::stop() {
+  pthread_mutex_lock(&mutex);
+  if (!threads_running) {
+    pthread_mutex_unlock(&mutex);
+    return SOCC_OK;
+  }
+  stopping = true;
+  pthread_cond_broadcast(&cond);
+  pthread_mutex_unlock(&mutex);
+
+  pthread_join(download_thread_id, NULL);
+  pthread_join(event_thread_id, NULL);
+
+  pthread_mutex_lock(&mutex);
+  threads_running = false;
+  pthread_cond_broadcast(&cond);
+  pthread_mutex_unlock(&mutex);
+  return SOCC_OK;
+}
+
+int socc_capture::trigger() {
+  pthread_mutex_lock(&mutex);
+  // back pressure, the camera buffer is not unlimited
+  while (threads_running && !stopping && pending >= max_depth) {
+    pthread_cond_wait(&cond, &mutex);
+  }
+  if (!threads_running || stopping) {
+    pthread_mutex_unlock(&mutex);
+    return SOCC_ERROR_INVALID_PARAMETER;
+  }
+  pthread_mutex_unlock(&mutex);
+
+  uint64_t begin = socc_monotonic_us();
+  int ret = control(DPC_S1_BUTTON, BUTTON_DOWN);
+  if (ret == SOCC_OK) {
+    ret = control(DPC_S2_BUTTON, BUTTON_DOWN);
+    // the buttons are released even if the shutter has failed
+    int up = control(DPC_S2_BUTTON, BUTTON_UP);
+    if (ret == SOCC_OK) {
+      ret = up;
+    }
+  }
+  int up = control(DPC_S1_BUTTON, BUTTON_UP);
+  if (ret == SOCC_OK) {
+    ret = up;
+  }
+  uint64_t end = socc_monotonic_us();
+
+  pthread_mutex_lock(&mutex);
+  if (ret == SOCC_OK) {
+    if (stats.triggered == 0) {
+      first_trigger_us = begin;
+    }
+    stats.triggered++;
+    last_trigger_us = end;
+    trigger_us_total += end - begin;
+    stats.trigger_us_avg = trigger_us_total / stats.triggered;
+  } else {
+    stats.errors++;
+  }
+  pthread_mutex_unlock(&mutex);
+  return ret;
+}
+
+int socc_capture::wait_idle(int timeout_ms) {
+  uint64_t deadline_us = socc_monotonic_us() + (uint64_t)timeout_ms * 1000;
+  int ret = SOCC_OK;
+
+  pthread_mutex_lock(&mutex);
+  for (;;) {
+    uint64_t now_us = socc_monotonic_us();
+    // a shot not announced in time is not coming, e.g. the camera has not
+    // released the shutter or keeps the file on its card
+    uint64_t announce_us = last_trigger_us + ANNOUNCE_TIMEOUT_US;
+    bool announcing =
+        stats.announced < stats.triggered && now_us < announce_us;
+    if (pending == 0 && !downloading && !announcing) {
+      break;
+    }
+    if (timeout_ms >= 0 && now_us >= deadline_us) {
+      ret = SOCC_ERROR_USB_TIMEOUT;
+      break;
+    }
+
+    uint64_t until_us = timeout_ms >= 0 ? deadline_us : UINT64_MAX;
+    if (announcing && announce_us < until_us) {
+      until_us = announce_us;
+    }
+    if (until_us == UINT64_MAX) {
+      pthread_cond_wait(&cond, &mutex);
+      continue;
+    }
+    struct timeval now;
+    struct timespec deadline;
+    gettimeofday(&now, NULL);
+    uint64_t nsec = now.tv_usec * 1000ULL + (until_us - now_us) * 1000ULL;
+    deadline.tv_sec = now.tv_sec + nsec / 1000000000;
+    deadline.tv_nsec = nsec % 1000000000;
+    pthread_cond_timedwait(&cond, &mutex, &deadline);
+  }
+  pthread_mutex_unlock(&mutex);
+  return ret;
+}
+
+void socc_capture::get_stats(CaptureStats& stats) {
+  pthread_mutex_lock(&mutex);
+  this->stats.depth = pending + (downloading ? 1 : 0);
+  if (this->stats.downloaded > 0) {
+    uint64_t elapsed = socc_monotonic_us() - first_trigger_us;
+    this->stats.shots_per_sec =
+        elapsed > 0 ? this->stats.downloaded * 1000000.0 / elapsed : 0;
+  }
+  stats = this->stats;
+  pthread_mutex_unlock(&mutex);
+}
+
+void* socc_capture::event_thread(void* vp) {
+  ((socc_capture*)vp)->run_events();
+  return NULL;
+}
+
+void* socc_capture::download_thread(void* vp) {
+  ((socc_capture*)vp)->run_downloads();
+  return NULL;
+}
+
+void socc_capture::run_events() {
+  for (;;) {
+    pthread_mutex_lock(&mutex);
+    bool quit = stopping;
+    pthread_mutex_unlock(&mutex);
+    if (quit) {
+      break;
+    }
+
+    // the interrupt endpoint is independent of the transactions
+    Container event;
+    int ret = ptp->wait_event(event);
+    if (ret == SOCC_ERROR_USB_TIMEOUT) {
+      continue;
+    }
+    if (ret != SOCC_OK) {
+      sleep_us(ERROR_BACKOFF_US);
+      continue;
+    }
+
+    pthread_mutex_lock(&mutex);
+    if (event.code == PTP_EC_OBJECTADDED && event.param1 == SHOT_HANDLE) {
+      if (probed > 0) {
+        // already queued by the check of 0xD215
+        probed--;
+      } else {
+        announce();
+      }
+    } else if (event.code == PTP_EC_DEVICEPROPCHANGED &&
+               event.param1 == DPC_SHOOTING_FILE_INFO) {
+      probe = true;
+      pthread_cond_broadcast(&cond);
+    }
+    pthread_mutex_unlock(&mutex);
+  }
+}
+
+void socc_capture::run_downloads() {
+  char path[sizeof(path_format) + 32];
+
+  pthread_mutex_lock(&mutex);
+  for (;;) {
+    while (pending == 0 && !probe && !stopping) {
+      pthread_cond_wait(&cond, &mutex);
+    }
+
+    if (pending > 0) {
+      pending--;
+      downloading = true;
+      snprintf(path, sizeof(path), path_format,
+               (unsigned)(stats.downloaded + 1));
+      pthread_cond_broadcast(&cond);
+      pthread_mutex_unlock(&mutex);
+
+      uint64_t begin = socc_monotonic_us();
+      int ret = download.download(SHOT_HANDLE, path);
+      uint64_t end = socc_monotonic_us();
+      DownloadStats result;
+      download.get_stats(result);
+
+      pthread_mutex_lock(&mutex);
+      downloading = false;
+      if (ret == SOCC_OK) {
+        stats.downloaded++;
+        stats.bytes += result.size;
+        download_us_total += end - begin;
+        stats.download_us_avg = download_us_total / stats.downloaded;
+      } else {
+        stats.errors++;
+      }
+      pthread_cond_broadcast(&cond);
+      continue;
+    }
+
+    if (probe) {
+      // a shot triggered but not announced yet is still in the camera, if
+      // the file is ready with an empty queue
+      probe = false;
+      if (stats.announced >= stats.triggered) {
+        continue;
+      }
+      pthread_mutex_unlock(&mutex);
+      bool ready = shooting_file_ready();
+      pthread_mutex_lock(&mutex);
+      if (ready && pending == 0 && !downloading &&
+          stats.announced < stats.triggered) {
+        probed++;
+        announce();
+      }
+      continue;
+    }
+
+    // stopping, and nothing is left to download
+    break;
+  }
+  pthread_mutex_unlock(&mutex);
+}
+
+int socc_capture::control(uint16_t code, uint16_t value) {
+  uint32_t params[1] = {code};
+  Container response;
+
+  pthread_mutex_lock(ptp_mutex);
+  int ret = ptp->send(PTP_OC_SDIO_CONTROLDEVICE, params, 1, response, &value,
+                      sizeof(value));
+  pthread_mutex_unlock(ptp_mutex);
+  if (ret == SOCC_OK && response.code != PTP_RC_OK) {
+    ret = SOCC_PTP_ERROR_TRANSACTION;
+  }
+  return ret;
+}
+
+bool socc_capture::shooting_file_ready() {
+  Container response;
+  void* data = NULL;
+  uint32_t size = 0;
+  bool ready = false;
+
+  pthread_mutex_lock(ptp_mutex);
+  int ret = ptp->receive(PTP_OC_SDIO_GETALLEXTDEVICEPROPINFO, NULL, 0,
+                         response, &data, size);
+  pthread_mutex_unlock(ptp_mutex);
+  if (ret == SOCC_OK && response.code == PTP_RC_OK && data != NULL) {
+    SDIDevicePropInfoDatasetArray info(data, size);
+    SDIDevicePropInfoDataset* file_info = info.get(DPC_SHOOTING_FILE_INFO);
+    if (file_info != NULL && file_info->DataType == 0x0004) {
+      ready = (static_cast<DataTypeInteger<uint16_t>*>(file_info)
+                   ->CurrentValue &
+               SHOOTING_FILE_READY) != 0;
+    }
+  }
+  ptp->dispose_data(&data);
+  return ready;
+}
+
+void socc_capture::announce() {
+  stats.announced++;
+  pending++;
+  uint32_t depth = pending + (downloading ? 1 : 0);
+  if (depth > stats.max_depth) {
+    stats.max_depth = depth;
+  }
+  pthread_cond_broadcast(&cond);
+}
@@ -0,0 +1,97 @@
+#include <socc_crc32c.h>
+#include <string.h>
+
+#if defined(__x86_64__)
+#include <nmmintrin.h>
+#define CRC32C_SSE42
+#elif defined(__aarch64__) && defined(__ARM_FEATURE_CRC32)
+#include <arm_acle.h>
+#define CRC32C_ARMV8
+#endif
+
+using namespace com::sony::imaging::remote;
+
+#define CRC32C_POLY 0x82F63B78  // reflected 0x1EDC6F41
+
+namespace {
+
+struct crc32c_table {
+  uint32_t t[256];
+  crc32c_table() {
+    for (uint32_t i = 0; i < 256; i++) {
+      uint32_t c = i;
+      for (int k = 0; k < 8; k++) {
+        c = (c & 1) ? (c >> 1) ^ CRC32C_POLY : c >> 1;
+      }
+      t[i] = c;
+    }
+  }
+};
+
+uint32_t crc32c_sw(uint32_t crc, const uint8_t* p, size_t size) {
+  static const crc32c_table table;
+  while (size--) {
+    crc = table.t[(crc ^ *p++) & 0xFF] ^ (crc >> 8);
+  }
+  return crc;
+}
+
+#if defined(CRC32C_SSE42)
+__attribute__((target("sse4.2"))) uint32_t crc32c_hw(uint32_t crc,
+                                                     const uint8_t* p,
+                                                     size_t size) {
+  uint64_t c = crc;
+  while (size > 0 && ((uintptr_t)p & 7) != 0) {
+    c = _mm_crc32_u8((uint32_t)c, *p++);
+    size--;
+  }
+  while (size >= 8) {
+    uint64_t v;
+    memcpy(&v, p, sizeof(v));
+    c = _mm_crc32_u64(c, v);
+    p += 8;
+    size -= 8;
+  }
+  while (size--) {
+    c = _mm_crc32_u8((uint32_t)c, *p++);
+  }
+  return (uint32_t)c;
+}
+
+bool crc32c_hw_available() { return __builtin_cpu_supports("sse4.2"); }
+#elif defined(CRC32C_ARMV8)
+uint32_t crc32c_hw(uint32_t crc, const uint8_t* p, size_t size) {
+  while (size > 0 && ((uintptr_t)p & 7) != 0) {
+    crc = __crc32cb(crc, *p++);
+    size--;
+  }
+  while (size >= 8) {
+    uint64_t v;
+    memcpy(&v, p, sizeof(v));
+    crc = __crc32cd(crc, v);
+    p += 8;
+    size -= 8;
+  }
+  while (size--) {
+    crc = __crc32cb(crc, *p++);
+  }
+  return crc;
+}
+
+bool crc32c_hw_available() { return true; }
+#endif
+
+}  // namespace
+
+uint32_t com::sony::imaging::remote::socc_crc32c(uint32_t crc,
+                                                 const void* data,
+                                                 size_t size) {
+  const uint8_t* p = (const uint8_t*)data;
+#if defined(CRC32C_SSE42) || defined(CRC32C_ARMV8)
+  static const bool hw = crc32c_hw_available();
+  if (hw) {
+    return ~crc32c_hw(~crc, p, size);
+  }
+#endif
+  return ~crc32c_sw(~crc, p, size);
+}
@@ -0,0 +1,380 @@
+#include <errno.h>
+#include <fcntl.h>
+#include <socc_download.h>
+#include <socc_ptp.h>
+#include <socc_time.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <time.h>
+#include <unistd.h>
+
+using namespace com::sony::imaging::remote;
+
+#define PTP_OC_GETOBJECTINFO 0x1008
+#define PTP_OC_GETOBJECT 0x1009
+#define PTP_OC_GETPARTIALOBJECT 0x101B
+#define PTP_RC_OK 0x2001
+#define PTP_RC_OPERATION_NOT_SUPPORTED 0x2005
+
+#define OBJECTINFO_COMPRESSED_SIZE_OFFSET 8
+#define RETRY_BACKOFF_US 10000
+
+static void preallocate(int fd, uint64_t size) {
+#if defined(__APPLE__)
+  fstore_t store = {F_ALLOCATECONTIG, F_PEOFPOSMODE, 0, (off_t)size, 0};
+  if (fcntl(fd, F_PREALLOCATE, &store) == -1) {
+    store.fst_flags = F_ALLOCATEALL;
+    fcntl(fd, F_PREALLOCATE, &store);
+  }
+#elif defined(__linux__)
+  posix_fallocate(fd, 0, size);
+#endif
+  ftruncate(fd, size);
+}
+
+static int pwrite_all(int fd, const uint8_t* data, uint32_t size,
+                      uint64_t offset) {
+  while (size > 0) {
+    ssize_t written = pwrite(fd, data, size, offset);
+    if (written < 0) {
+      if (errno == EINTR) {
+        continue;
+      }
+      return SOCC_ERROR_FILE_IO;
+    }
+    data += written;
+    size -= written;
+    offset += written;
+  }
+  return SOCC_OK;
+}
+
+socc_download::socc_download(socc_ptp* ptp, pthread_mutex_t* ptp_mutex,
+                             uint32_t chunk_size)
+    : ptp(ptp),
+      ptp_mutex(ptp_mutex),
+      chunk_size(chunk_size == 0 ? 1024 * 1024 : chunk_size),
+      max_retries(3),
+      fd(-1),
+      finishing(false),
+      write_error(SOCC_OK) {
+  pthread_mutex_init(&mutex, NULL);
+  pthread_cond_init(&cond, NULL);
+  memset(&stats, 0, sizeof(stats));
+  for (int i = 0; i < 2; i++) {
+    chunks[i].data = (uint8_t*)malloc(this->chunk_size);
+    chunks[i].full = false;
+  }
+}
+
+socc_download::~socc_download() {
+  for (int i = 0; i < 2; i++) {
+    free(chunks[i].data);
+  }
+  pthread_cond_destroy(&cond);
+  pthread_mutex_destroy(&mutex);
+}
+
+void socc_download::set_max_retries(int retries) { max_retries = retries; }
+
+int socc_download::download(uint32_t handle, const char* path,
+                            uint64_t offset) {
+  int flags = O_WRONLY | O_CREAT | (offset == 0 ? O_TRUNC : 0);
+  int fd = open(path, flags, S_IRUSR | S_IWUSR | S_IRGRP | S_IROTH);
+  if (fd < 0) {
+    return SOCC_ERROR_FILE_IO;
+  }
+  int ret = download(handle, fd, offset);
+  if (close(fd) != 0 && ret == SOCC_OK) {
+    ret = SOCC_ERROR_FILE_IO;
+  }
+  return ret;
+}
+
+int socc_download::download(uint32_t handle, int fd, uint64_t offset) {
+  uint64_t begin = socc_monotonic_us();
+  uint64_t size = 0;
+  pthread_t thread_id;
+  bool whole = false;
+  int ret;
+
+  if (chunks[0].data == NULL || chunks[1].data == NULL) {
+    return SOCC_ERROR_INVALID_PARAMETER;
+  }
+
+  pthread_mutex_lock(&mutex);
+  memset(&stats, 0, sizeof(stats));
+  stats.partial = true;
+  stats.offset = offset;
+  pthread_mutex_unlock(&mutex);
+
+  ret = object_size(handle, size);
+  if (ret != SOCC_OK) {
+    return ret;
+  }
+  if (offset > size) {
+    return SOCC_ERROR_INVALID_PARAMETER;
+  }
+  pthread_mutex_lock(&mutex);
+  stats.size = size;
+  pthread_mutex_unlock(&mutex);
+  preallocate(fd, size);
+
+  this->fd = fd;
+  finishing = false;
+  write_error = SOCC_OK;
+  chunks[0].full = chunks[1].full = false;
+  if (pthread_create(&thread_id, NULL, &writer_thread, this) != 0) {
+    return SOCC_ERROR_THREAD_CREATE;
+  }
+
+  uint64_t next = offset;
+  int index = 0;
+  int failures = 0;
+  while (!whole && next < size) {
+    chunk_t* chunk = &chunks[index];
+
+    pthread_mutex_lock(&mutex);
+    while (chunk->full && write_error == SOCC_OK) {
+      pthread_cond_wait(&cond, &mutex);
+    }
+    ret = write_error;
+    pthread_mutex_unlock(&mutex);
+    if (ret != SOCC_OK) {
+      break;
+    }
+
+    // the previous chunk is being written meanwhile
+    uint32_t want = size - next < chunk_size ? size - next : chunk_size;
+    uint32_t params[3] = {handle, (uint32_t)next, want};
+    Container response;
+    uint32_t received = 0;
+    ret = transaction(PTP_OC_GETPARTIALOBJECT, params, 3, response,
+                      chunk->data, chunk_size, received);
+    if (ret == SOCC_OK && response.code == PTP_RC_OPERATION_NOT_SUPPORTED &&
+        stats.chunks == 0) {
+      whole = true;
+      break;
+    }
+    if (ret == SOCC_OK &&
+        (response.code != PTP_RC_OK || received == 0 || received > want)) {
+      ret = SOCC_PTP_ERROR_TRANSACTION;
+    }
+    if (ret != SOCC_OK) {
+      if (++failures > max_retries || recover(ret) != SOCC_OK) {
+        break;
+      }
+      pthread_mutex_lock(&mutex);
+      stats.retries++;
+      pthread_mutex_unlock(&mutex);
+      continue;
+    }
+    failures = 0;
+
+    pthread_mutex_lock(&mutex);
+    stats.chunks++;
+    chunk->offset = next;
+    chunk->size = received;
+    chunk->full = true;
+    pthread_cond_broadcast(&cond);
+    pthread_mutex_unlock(&mutex);
+
+    next += received;
+    index ^= 1;
+  }
+
+  pthread_mutex_lock(&mutex);
+  finishing = true;
+  pthread_cond_broadcast(&cond);
+  pthread_mutex_unlock(&mutex);
+  pthread_join(thread_id, NULL);
+
+  if (ret == SOCC_OK) {
+    ret = whole ? download_whole(handle) : write_error;
+  }
+  pthread_mutex_lock(&mutex);
+  stats.elapsed_us = socc_monotonic_us() - begin;
+  pthread_mutex_unlock(&mutex);
+  return ret;
+}
+
+void socc_download::get_stats(DownloadStats& stats) {
+  pthread_mutex_lock(&mutex);
+  stats = this->stats;
+  pthread_mutex_unlock(&mutex);
+}
+
+void* socc_download::writer_thread(void* vp) {
+  ((socc_download*)vp)->write_chunks();
+  return NULL;
+}
+
+void socc_download::write_chunks() {
+  int index = 0;
+
+  for (;;) {
+    chunk_t* chunk = &chunks[index];
+
+    pthread_mutex_lock(&mutex);
+    while (!chunk->full && !finishing) {
+      pthread_cond_wait(&cond, &mutex);
+    }
+    if (!chunk->full) {
+      pthread_mutex_unlock(&mutex);
+      break;
+    }
+    pthread_mutex_unlock(&mutex);
+
+    uint64_t begin = socc_monotonic_us();
+    int ret = pwrite_all(fd, chunk->data, chunk->size, chunk->offset);
+    uint64_t end = socc_monotonic_us();
+
+    pthread_mutex_lock(&mutex);
+    stats.write_us += end - begin;
+    if (ret == SOCC_OK) {
+      stats.offset = chunk->offset + chunk->size;
+    } else {
+      write_error = ret;
+    }
+    chunk->full = false;
+    pthread_cond_broadcast(&cond);
+    pthread_mutex_unlock(&mutex);
+
+    if (ret != SOCC_OK) {
+      break;
+    }
+    index ^= 1;
+  }
+}
+
+int socc_download::transaction(uint16_t code, uint32_t* params, uint8_t nparam,
+                               Container& response, void* data,
+                               uint32_t capacity, uint32_t& size) {
+  uint64_t begin = socc_monotonic_us();
+  if (ptp_mutex != NULL) {
+    pthread_mutex_lock(ptp_mutex);
+  }
+  int ret =
+      ptp->receive_into(code, params, nparam, response, data, capacity, size);
+  if (ptp_mutex != NULL) {
+    pthread_mutex_unlock(ptp_mutex);
+  }
+  uint64_t end = socc_monotonic_us();
+
+  pthread_mutex_lock(&mutex);
+  stats.usb_us += end - begin;
+  pthread_mutex_unlock(&mutex);
+  return ret;
+}
+
+int socc_download::object_size(uint32_t handle, uint64_t& size) {
+  uint8_t info[256];
+  uint32_t params[1] = {handle};
+  Container response;
+  uint32_t received = 0;
+
+  // the ObjectInfo dataset is small, but has variable length strings
+  int ret = transaction(PTP_OC_GETOBJECTINFO, params, 1, response, info,
+                        sizeof(info), received);
+  if (ret != SOCC_OK && ret != SOCC_ERROR_USB_OVERFLOW) {
+    return ret;
+  }
+  if (response.code != PTP_RC_OK ||
+      received < OBJECTINFO_COMPRESSED_SIZE_OFFSET + sizeof(uint32_t)) {
+    return SOCC_PTP_ERROR_TRANSACTION;
+  }
+  uint32_t compressed_size;
+  memcpy(&compressed_size, info + OBJECTINFO_COMPRESSED_SIZE_OFFSET,
+         sizeof(compressed_size));
+  size = compressed_size;
+  return SOCC_OK;
+}
+
+int socc_download::download_whole(uint32_t handle) {
+  uint32_t params[1] = {handle};
+  Container response;
+  void* data = NULL;
+  uint32_t size = 0;
+
+  pthread_mutex_lock(&mutex);
+  stats.partial = false;
+  pthread_mutex_unlock(&mutex);
+  uint64_t begin = socc_monotonic_us();
+  if (ptp_mutex != NULL) {
+    pthread_mutex_lock(ptp_mutex);
+  }
+  int ret = ptp->receive(PTP_OC_GETOBJECT, params, 1, response, &data, size);
+  if (ptp_mutex != NULL) {
+    pthread_mutex_unlock(ptp_mutex);
+  }
+  uint64_t end = socc_monotonic_us();
+
+  pthread_mutex_lock(&mutex);
+  stats.usb_us += end - begin;
+  pthread_mutex_unlock(&mutex);
+  if (ret == SOCC_OK && response.code != PTP_RC_OK) {
+    ret = SOCC_PTP_ERROR_TRANSACTION;
+  }
+
+  if (ret == SOCC_OK) {
+    begin = socc_monotonic_us();
+    ret = pwrite_all(fd, (uint8_t*)data, size, 0);
+    end = socc_monotonic_us();
+
+    pthread_mutex_lock(&mutex);
+    stats.write_us += end - begin;
+    bool truncate = ret == SOCC_OK && size != stats.size;
+    if (ret == SOCC_OK) {
+      stats.offset = size;
+      stats.size = size;
+    }
+    pthread_mutex_unlock(&mutex);
+    if (truncate) {
+      ftruncate(fd, size);
+    }
+  }
+  ptp->dispose_data(&data);
+  return ret;
+}
+
+bool socc_download::valid_path_format(const char* format) {
+  int conversions = 0;
+  for (const char* p = format; *p != '\0'; p++) {
+    if (*p != '%') {
+      continue;
+    }
+    p++;
+    if (*p == '%') {
+      continue;
+    }
+    p += strspn(p, "-+ #0");
+    p += strspn(p, "0123456789");
+    if (*p == '.') {
+      p++;
+      p += strspn(p, "0123456789");
+    }
+    if (*p == '\0' || strchr("diuoxX", *p) == NULL) {
+      return false;
+    }
+    conversions++;
+  }
+  return conversions == 1;
+}
+
+int socc_download::recover(int error) {
+  if (error == SOCC_ERROR_USB_DISCONNECTED) {
+    // resumed by the caller after reconnecting
+    return error;
+  }
+  if (ptp_mutex != NULL) {
+    pthread_mutex_lock(ptp_mutex);
+  }
+  int ret = ptp->clear_halt(0);
+  if (ptp_mutex != NULL) {
+    pthread_mutex_unlock(ptp_mutex);
+  }
+  struct timespec ts = {0, RETRY_BACKOFF_US * 1000};
+  nanosleep(&ts, NULL);
+  return ret;
+}
@@ -0,0 +1,384 @@
+#include <ports_usb.h>
+#include <ports_usb_impl.h>
+#include <ports_usb_registry.h>
+#include <sched.h>
+#include <socc_auth.h>
+#include <socc_download.h>
+#include <socc_fleet.h>
+#include <socc_ptp.h>
+#include <socc_time.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/time.h>
+#include <time.h>
+
+#include <algorithm>
+#include <atomic>
+
+using namespace com::sony::imaging::remote;
+using com::sony::imaging::ports::ports_usb_registry;
+
+#define PTP_OC_OPENSESSION 0x1002
+#define PTP_OC_CLOSESESSION 0x1003
+#define PTP_OC_SDIO_SETEXTDEVICEPROPVALUE 0x9205
+#define PTP_OC_SDIO_CONTROLDEVICE 0x9207
+#define PTP_RC_OK 0x2001
+
+#define DPC_S1_BUTTON 0xD2C1
+#define DPC_S2_BUTTON 0xD2C2
+#define BUTTON_UP 0x0001
+#define BUTTON_DOWN 0x0002
+
+static int check(int ret, const Container& response) {
+  if (ret == SOCC_OK && response.code != PTP_RC_OK) {
+    ret = SOCC_PTP_ERROR_TRANSACTION;
+  }
+  return ret;
+}
+
+static int send(socc_ptp* ptp, uint16_t code, uint32_t* params,
+                uint8_t nparam, const void* data, uint32_t size) {
+  Container response;
+  int ret = ptp->send(code, params, nparam, response, (void*)data, size);
+  return check(ret, response);
+}
+
+static int open_camera(socc_ptp* ptp, int index, void* vp) {
+  int ret = ptp->connect();
+  if (ret != SOCC_OK) {
+    return ret;
+  }
+  uint32_t params[1] = {1};
+  return send(ptp, PTP_OC_OPENSESSION, params, 1, NULL, 0);
+}
+
+static int close_camera(socc_ptp* ptp, int index, void* vp) {
+  int ret = send(ptp, PTP_OC_CLOSESESSION, NULL, 0, NULL, 0);
+  ptp->disconnect();
+  return ret;
+}
+
+static int auth_camera(socc_ptp* ptp, int index, void* vp) {
+  socc_auth auth(ptp);
+  return auth.run();
+}
+
+typedef struct {
+  uint16_t code;
+  const void* value;
+  uint32_t size;
+} property_t;
+
+static int set_property_camera(socc_ptp* ptp, int index, void* vp) {
+  property_t* property = (property_t*)vp;
+  uint32_t params[1] = {property->code};
+  return send(ptp, PTP_OC_SDIO_SETEXTDEVICEPROPVALUE, params, 1,
+              property->value, property->size);
+}
+
+static int control(socc_ptp* ptp, uint16_t code, uint16_t value) {
+  uint32_t params[1] = {code};
+  return send(ptp, PTP_OC_SDIO_CONTROLDEVICE, params, 1, &value,
+              sizeof(value));
+}
+
+static int trigger_camera(socc_ptp* ptp, int index, void* vp) {
+  int ret = control(ptp, DPC_S1_BUTTON, BUTTON_DOWN);
+  if (ret == SOCC_OK) {
+    ret = control(ptp, DPC_S2_BUTTON, BUTTON_DOWN);
+    int up = control(ptp, DPC_S2_BUTTON, BUTTON_UP);
+    if (ret == SOCC_OK) {
+      ret = up;
+    }
+  }
+  int up = control(ptp, DPC_S1_BUTTON, BUTTON_UP);
+  return ret == SOCC_OK ? up : ret;
+}
+
+typedef struct {
+  std::atomic<int> arrived;
+  std::atomic<bool> released;
+  int cameras;
+  std::vector<uint64_t> issued;
+} sync_trigger_t;
+
+static int sync_trigger_camera(socc_ptp* ptp, int index, void* vp) {
+  sync_trigger_t* sync = (sync_trigger_t*)vp;
+  uint32_t params[1] = {DPC_S2_BUTTON};
+  uint16_t value = BUTTON_DOWN;
+  PreparedTransaction prepared;
+  Container response;
+
+  int ret = control(ptp, DPC_S1_BUTTON, BUTTON_DOWN);
+  if (ret == SOCC_OK) {
+    ret = ptp->prepare_send(PTP_OC_SDIO_CONTROLDEVICE, params, 1, &value,
+                            sizeof(value), prepared);
+  }
+
+  // the cameras failed above arrive too, not to keep the others waiting.
+  // the last one releases everyone. spinning, since waking the threads from a
+  // condition variable one by one would be the skew itself.
+  if (sync->arrived.fetch_add(1) + 1 == sync->cameras) {
+    sync->released.store(true);
+  }
+  while (!sync->released.load()) {
+    sched_yield();
+  }
+
+  if (ret == SOCC_OK) {
+    ret = ptp->issue_prepared(prepared);
+    sync->issued[index] = socc_monotonic_us();
+    if (ret == SOCC_OK) {
+      ret = check(ptp->complete_prepared(response), response);
+    }
+    int up = control(ptp, DPC_S2_BUTTON, BUTTON_UP);
+    if (ret == SOCC_OK) {
+      ret = up;
+    }
+  }
+  int up = control(ptp, DPC_S1_BUTTON, BUTTON_UP);
+  return ret == SOCC_OK ? up : ret;
+}
+
+typedef struct {
+  uint32_t handle;
+  const char* path_format;
+} download_t;
+
+static int download_camera(socc_ptp* ptp, int index, void* vp) {
+  download_t* download = (download_t*)vp;
+  char path[1024];
+  snprintf(path, sizeof(path), download->path_format, index);
+  socc_download downloader(ptp);
+  return downloader.download(download->handle, path);
+}
+
+socc_fleet::socc_fleet() : context(NULL) {}
+
+socc_fleet::~socc_fleet() {
+  for (size_t i = 0; i < workers.size(); i++) {
+    worker_t* worker = workers[i];
+    pthread_mutex_lock(&worker->mutex);
+    worker->stopping = true;
+    pthread_cond_signal(&worker->cond);
+    pthread_mutex_unlock(&worker->mutex);
+    pthread_join(worker->thread_id, NULL);
+    if (worker->connected) {
+      worker->ptp->disconnect();
+    }
+    delete worker->ptp;
+    pthread_cond_destroy(&worker->cond);
+    pthread_mutex_destroy(&worker->mutex);
+    delete worker;
+  }
+
+  if (context != NULL) {
+    ports_usb_registry::instance()->release();
+  }
+}
+
+int socc_fleet::add(int busn, int devn) {
+  int ret = init_context();
+  if (ret != SOCC_OK) {
+    return ret;
+  }
+  return add_camera(
+      new socc_ptp(new com::sony::imaging::ports::ports_usb_impl(busn, devn,
+                                                                 context)));
+}
+
+int socc_fleet::add(com::sony::imaging::ports::ports_usb* usb) {
+  return add_camera(new socc_ptp(usb));
+}
+
+int socc_fleet::size() { return workers.size(); }
+
+socc_ptp* socc_fleet::camera(int index) {
+  if (index < 0 || index >= (int)workers.size()) {
+    return NULL;
+  }
+  return workers[index]->ptp;
+}
+
+int socc_fleet::index_of(const char* serial) {
+  std::unordered_map<std::string, int>::iterator it = serials.find(serial);
+  return it == serials.end() ? -1 : it->second;
+}
+
+int socc_fleet::run(socc_fleet_func_t func, void* vp,
+                    std::vector<FleetResult>& results) {
+  batch_t batch;
+
+  results.assign(workers.size(), FleetResult());
+  if (workers.empty()) {
+    return SOCC_OK;
+  }
+  pthread_mutex_init(&batch.mutex, NULL);
+  pthread_cond_init(&batch.cond, NULL);
+  batch.remaining = workers.size();
+
+  uint64_t now = socc_monotonic_us();
+  for (size_t i = 0; i < workers.size(); i++) {
+    job_t job = {func, vp, &results[i], &batch, now};
+    pthread_mutex_lock(&workers[i]->mutex);
+    workers[i]->jobs.push_back(job);
+    pthread_cond_signal(&workers[i]->cond);
+    pthread_mutex_unlock(&workers[i]->mutex);
+  }
+
+  pthread_mutex_lock(&batch.mutex);
+  while (batch.remaining > 0) {
+    pthread_cond_wait(&batch.cond, &batch.mutex);
+  }
+  pthread_mutex_unlock(&batch.mutex);
+  pthread_cond_destroy(&batch.cond);
+  pthread_mutex_destroy(&batch.mutex);
+
+  for (size_t i = 0; i < results.size(); i++) {
+    if (results[i].ret != SOCC_OK) {
+      return results[i].ret;
+    }
+  }
+  return SOCC_OK;
+}
+
+int socc_fleet::open(std::vector<FleetResult>& results) {
+  int ret = run(open_camera, NULL, results);
+  for (size_t i = 0; i < workers.size(); i++) {
+    workers[i]->connected =
+        workers[i]->connected || results[i].ret == SOCC_OK;
+    char serial[32];
+    if (results[i].ret == SOCC_OK &&
+        workers[i]->ptp->serial_number(serial, sizeof(serial)) == SOCC_OK &&
+        serial[0] != '\0') {
+      serials[serial] = i;
+    }
+  }
+  return ret;
+}
+
+int socc_fleet::close(std::vector<FleetResult>& results) {
+  int ret = run(close_camera, NULL, results);
+  for (size_t i = 0; i < workers.size(); i++) {
+    workers[i]->connected = false;
+  }
+  return ret;
+}
+
+int socc_fleet::auth(std::vector<FleetResult>& results) {
+  return run(auth_camera, NULL, results);
+}
+
+int socc_fleet::set_property(uint16_t code, const void* value, uint32_t size,
+                             std::vector<FleetResult>& results) {
+  property_t property = {code, value, size};
+  return run(set_property_camera, &property, results);
+}
+
+int socc_fleet::trigger(std::vector<FleetResult>& results) {
+  return run(trigger_camera, NULL, results);
+}
+
+int socc_fleet::trigger_sync(std::vector<FleetResult>& results,
+                             FleetSkew& skew) {
+  sync_trigger_t sync;
+  sync.arrived = 0;
+  sync.released = false;
+  sync.cameras = workers.size();
+  sync.issued.assign(workers.size(), 0);
+
+  int ret = run(sync_trigger_camera, &sync, results);
+
+  std::vector<uint64_t> issued;
+  for (size_t i = 0; i < results.size(); i++) {
+    results[i].issued_us = sync.issued[i];
+    if (sync.issued[i] != 0) {
+      issued.push_back(sync.issued[i]);
+    }
+  }
+
+  memset(&skew, 0, sizeof(skew));
+  skew.cameras = issued.size();
+  if (issued.size() > 1) {
+    std::sort(issued.begin(), issued.end());
+    skew.min_us = issued[1] - issued[0];
+    skew.max_us = issued.back() - issued[0];
+    skew.p99_us = issued[(issued.size() * 99 + 99) / 100 - 1] - issued[0];
+  }
+  return ret;
+}
+
+int socc_fleet::download(uint32_t handle, const char* path_format,
+                         std::vector<FleetResult>& results) {
+  if (path_format == NULL || !socc_download::valid_path_format(path_format)) {
+    results.clear();
+    return SOCC_ERROR_INVALID_PARAMETER;
+  }
+  download_t download = {handle, path_format};
+  return run(download_camera, &download, results);
+}
+
+int socc_fleet::add_camera(socc_ptp* ptp) {
+  worker_t* worker = new worker_t;
+  worker->fleet = this;
+  worker->index = workers.size();
+  worker->ptp = ptp;
+  worker->stopping = false;
+  worker->connected = false;
+  pthread_mutex_init(&worker->mutex, NULL);
+  pthread_cond_init(&worker->cond, NULL);
+
+  if (pthread_create(&worker->thread_id, NULL, &worker_thread, worker) != 0) {
+    pthread_cond_destroy(&worker->cond);
+    pthread_mutex_destroy(&worker->mutex);
+    delete worker;
+    delete ptp;
+    return SOCC_ERROR_THREAD_CREATE;
+  }
+  workers.push_back(worker);
+  return worker->index;
+}
+
+int socc_fleet::init_context() {
+  if (context != NULL) {
+    return SOCC_OK;
+  }
+  context = ports_usb_registry::instance()->acquire();
+  return context != NULL ? SOCC_OK : SOCC_ERROR_USB_INIT;
+}
+
+void* socc_fleet::worker_thread(void* vp) {
+  worker_t* worker = (worker_t*)vp;
+  worker->fleet->run_worker(worker);
+  return NULL;
+}
+
+void socc_fleet::run_worker(worker_t* worker) {
+  pthread_mutex_lock(&worker->mutex);
+  for (;;) {
+    while (worker->jobs.empty() && !worker->stopping) {
+      pthread_cond_wait(&worker->cond, &worker->mutex);
+    }
+    if (worker->jobs.empty()) {
+      break;
+    }
+    job_t job = worker->jobs.front();
+    worker->jobs.pop_front();
+    pthread_mutex_unlock(&worker->mutex);
+
+    int ret = job.func(worker->ptp, worker->index, job.vp);
+    uint64_t now = socc_monotonic_us();
+    job.result->ret = ret;
+    job.result->latency_us = now - job.submitted_us;
+    job.result->completed_us = now;
+
+    pthread_mutex_lock(&job.batch->mutex);
+    if (--job.batch->remaining == 0) {
+      pthread_cond_signal(&job.batch->cond);
+    }
+    pthread_mutex_unlock(&job.batch->mutex);
+
+    pthread_mutex_lock(&worker->mutex);
+  }
+  pthread_mutex_unlock(&worker->mutex);
+}
@@ -0,0 +1,391 @@
+#include <errno.h>
+#include <parser.h>
+#include <socc_liveview.h>
+#include <socc_ptp.h>
+#include <socc_time.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/time.h>
+#include <time.h>
+
+using namespace com::sony::imaging::remote;
+
+#define LIVEVIEW_HANDLE 0xFFFFC002
+#define PTP_OC_GETOBJECT 0x1009
+#define PTP_RC_OK 0x2001
+#define LIVEVIEW_HEADER_SIZE 16
+
+#define CAPACITY_ALIGN (64 * 1024)
+#define ERROR_BACKOFF_US 100000
+#define NOT_READY_BACKOFF_US 5000
+
+// returns the offset of the SOS marker, where the entropy coded segment starts
+static uint32_t entropy_offset(const uint8_t* jpeg, uint32_t size) {
+  uint32_t pos = 2;
+
+  if (size < 4 || jpeg[0] != 0xFF || jpeg[1] != 0xD8) {
+    return 0;
+  }
+  while (pos + 4 <= size && jpeg[pos] == 0xFF) {
+    uint8_t marker = jpeg[pos + 1];
+    if (marker == 0xFF) {
+      // fill byte
+      pos++;
+      continue;
+    }
+    if (marker == 0xDA) {
+      return pos;
+    }
+    pos += 2 + ((jpeg[pos + 2] << 8) | jpeg[pos + 3]);
+  }
+  return 0;
+}
+
+// the same image as the latest one, compared from the SOS marker, which stops
+// at the first byte of a new image
+static bool same_image(const LiveViewFrame* a, const LiveViewFrame* b) {
+  return a->jpeg_size == b->jpeg_size &&
+         a->entropy_offset == b->entropy_offset &&
+         a->focal_frame_info_size == b->focal_frame_info_size &&
+         memcmp(a->jpeg + a->entropy_offset, b->jpeg + b->entropy_offset,
+                a->jpeg_size - a->entropy_offset) == 0 &&
+         (a->focal_frame_info_size == 0 ||
+          memcmp(a->focal_frame_info, b->focal_frame_info,
+                 a->focal_frame_info_size) == 0);
+}
+
+static void sleep_us(uint64_t us) {
+  struct timespec ts = {(time_t)(us / 1000000), (long)(us % 1000000) * 1000};
+  nanosleep(&ts, NULL);
+}
+
+socc_liveview::socc_liveview(socc_ptp* ptp, pthread_mutex_t* ptp_mutex,
+                             int nframes, uint32_t capacity)
+    : ptp(ptp),
+      ptp_mutex(ptp_mutex),
+      thread_running(false),
+      stopping(false),
+      nframes(nframes < 3 ? 3 : nframes),
+      latest(NULL),
+      sequence(0),
+      interval_us(0),
+      skip_duplicates(true),
+      transfer_us_total(0),
+      last_publish_us(0) {
+  pthread_mutex_init(&mutex, NULL);
+  pthread_cond_init(&cond, NULL);
+  memset(&stats, 0, sizeof(stats));
+
+  frames = new LiveViewFrame[this->nframes];
+  memset(frames, 0, sizeof(LiveViewFrame) * this->nframes);
+  for (int i = 0; i < this->nframes; i++) {
+    frames[i].dataset = (uint8_t*)malloc(capacity);
+    frames[i].capacity = frames[i].dataset != NULL ? capacity : 0;
+  }
+}
+
+socc_liveview::~socc_liveview() {
+  stop();
+  for (int i = 0; i < nframes; i++) {
+    free(frames[i].dataset);
+  }
+  delete[] frames;
+  pthread_cond_destroy(&cond);
+  pthread_mutex_destroy(&mutex);
+}
+
+int socc_liveview::start() {
+  pthread_mutex_lock(&mutex);
+  if (thread_running) {
+    pthread_mutex_unlock(&mutex);
+    return SOCC_OK;
+  }
+  stopping = false;
+  if (pthread_create(&thread_id, NULL, &acquisition_thread, this) != 0) {
+    pthread_mutex_unlock(&mutex);
+    return SOCC_ERROR_THREAD_CREATE;
+  }
+  thread_running = true;
+  pthread_mutex_unlock(&mutex);
+  return SOCC_OK;
+}
+
+int socc_liveview::stop() {
+  pthread_mutex_lock(&mutex);
+  if (!thread_running) {
+    pthread_mutex_unlock(&mutex);
+    return SOCC_OK;
+  }
+  stopping = true;
+  pthread_cond_broadcast(&cond);
+  pthread_mutex_unlock(&mutex);
+
+  pthread_join(thread_id, NULL);
+
+  pthread_mutex_lock(&mutex);
+  thread_running = false;
+  pthread_cond_broadcast(&cond);
+  pthread_mutex_unlock(&mutex);
+  return SOCC_OK;
+}
+
+bool socc_liveview::running() {
+  pthread_mutex_lock(&mutex);
+  bool ret = thread_running;
+  pthread_mutex_unlock(&mutex);
+  return ret;
+}
+
+void socc_liveview::set_interval(uint32_t interval_us) {
+  pthread_mutex_lock(&mutex);
+  this->interval_us = interval_us;
+  pthread_mutex_unlock(&mutex);
+}
+
+void socc_liveview::set_skip_duplicates(bool skip) {
+  pthread_mutex_lock(&mutex);
+  skip_duplicates = skip;
+  pthread_mutex_unlock(&mutex);
+}
+
+int socc_liveview::acquire(LiveViewFrame** frame, uint64_t after,
+                           int timeout_ms) {
+  struct timeval now;
+  struct timespec deadline;
+
+  if (frame == NULL) {
+    return SOCC_ERROR_INVALID_PARAMETER;
+  }
+  if (timeout_ms >= 0) {
+    gettimeofday(&now, NULL);
+    uint64_t ns = (uint64_t)now.tv_usec * 1000 + (uint64_t)timeout_ms * 1000000;
+    deadline.tv_sec = now.tv_sec + ns / 1000000000;
+    deadline.tv_nsec = ns % 1000000000;
+  }
+
+  pthread_mutex_lock(&mutex);
+  while (latest == NULL || latest->sequence <= after) {
+    if (!thread_running || stopping) {
+      pthread_mutex_unlock(&mutex);
+      return SOCC_ERROR_NOT_SUPPORT;
+    }
+    if (timeout_ms < 0) {
+      pthread_cond_wait(&cond, &mutex);
+    } else if (pthread_cond_timedwait(&cond, &mutex, &deadline) ==
+               ETIMEDOUT) {
+      pthread_mutex_unlock(&mutex);
+      return SOCC_ERROR_USB_TIMEOUT;
+    }
+  }
+  latest->refcount++;
+  latest->consumed = true;
+  *frame = latest;
+  pthread_mutex_unlock(&mutex);
+  return SOCC_OK;
+}
+
+void socc_liveview::retain(LiveViewFrame* frame) {
+  pthread_mutex_lock(&mutex);
+  frame->refcount++;
+  pthread_mutex_unlock(&mutex);
+}
+
+void socc_liveview::release(LiveViewFrame* frame) {
+  pthread_mutex_lock(&mutex);
+  unref(frame);
+  pthread_mutex_unlock(&mutex);
+}
+
+void socc_liveview::get_stats(LiveViewStats& stats) {
+  pthread_mutex_lock(&mutex);
+  stats = this->stats;
+  stats.age_us = latest != NULL ? socc_monotonic_us() - latest->timestamp_us : 0;
+  pthread_mutex_unlock(&mutex);
+}
+
+void* socc_liveview::acquisition_thread(void* vp) {
+  ((socc_liveview*)vp)->run();
+  return NULL;
+}
+
+void socc_liveview::run() {
+  uint64_t last_request_us = 0;
+
+  for (;;) {
+    LiveViewFrame* frame = take_free_frame();
+    if (frame == NULL) {
+      break;
+    }
+
+    pthread_mutex_lock(&mutex);
+    uint32_t interval = interval_us;
+    bool skip = skip_duplicates;
+    pthread_mutex_unlock(&mutex);
+    uint64_t now = socc_monotonic_us();
+    if (last_request_us != 0 && now - last_request_us < interval) {
+      sleep_us(interval - (now - last_request_us));
+    }
+    last_request_us = socc_monotonic_us();
+
+    int ret = fill(frame);
+    if (ret == SOCC_ERROR_USB_OVERFLOW) {
+      // the frame has been grown for the image
+      ret = fill(frame);
+    }
+
+    // the latest frame is replaced only by this thread, and never written
+    // while it is the latest, so that it is compared without the lock
+    bool duplicate = ret == SOCC_OK && frame->jpeg_size > 0 && skip &&
+                     latest != NULL && same_image(frame, latest);
+
+    pthread_mutex_lock(&mutex);
+    if (duplicate) {
+      // the camera has not refreshed the image yet
+      frame->writing = false;
+      stats.duplicates++;
+      pthread_cond_broadcast(&cond);
+    } else if (ret == SOCC_OK && frame->jpeg_size > 0) {
+      publish(frame);
+    } else {
+      frame->writing = false;
+      if (ret == SOCC_OK) {
+        stats.not_ready++;
+      } else {
+        stats.errors++;
+      }
+      pthread_cond_broadcast(&cond);
+    }
+    pthread_mutex_unlock(&mutex);
+
+    if (ret != SOCC_OK) {
+      sleep_us(ERROR_BACKOFF_US);
+    } else if (frame->jpeg_size == 0 && interval < NOT_READY_BACKOFF_US) {
+      sleep_us(NOT_READY_BACKOFF_US - interval);
+    }
+  }
+}
+
+LiveViewFrame* socc_liveview::take_free_frame() {
+  LiveViewFrame* ret = NULL;
+
+  pthread_mutex_lock(&mutex);
+  while (!stopping) {
+    for (int i = 0; i < nframes; i++) {
+      LiveViewFrame* frame = &frames[i];
+      if (frame != latest && frame->refcount == 0 && !frame->writing) {
+        ret = frame;
+        break;
+      }
+    }
+    if (ret != NULL) {
+      ret->writing = true;
+      break;
+    }
+    // every frame is held by consumers
+    pthread_cond_wait(&cond, &mutex);
+  }
+  pthread_mutex_unlock(&mutex);
+  return ret;
+}
+
+int socc_liveview::fill(LiveViewFrame* frame) {
+  uint32_t params[1] = {LIVEVIEW_HANDLE};
+  Container response;
+  uint32_t size = 0;
+
+  frame->jpeg = NULL;
+  frame->jpeg_size = 0;
+  frame->dataset_size = 0;
+  frame->focal_frame_info = NULL;
+  frame->focal_frame_info_size = 0;
+
+  uint64_t begin = socc_monotonic_us();
+  if (ptp_mutex != NULL) {
+    pthread_mutex_lock(ptp_mutex);
+  }
+  int ret = ptp->receive_into(PTP_OC_GETOBJECT, params, 1, response,
+                              frame->dataset, frame->capacity, size);
+  if (ptp_mutex != NULL) {
+    pthread_mutex_unlock(ptp_mutex);
+  }
+  uint64_t end = socc_monotonic_us();
+
+  if (ret == SOCC_ERROR_USB_OVERFLOW) {
+    if (size <= frame->capacity) {
+      return SOCC_PTP_ERROR_TRANSACTION;
+    }
+    // with room for the images growing a little more, each of which would
+    // be received twice
+    uint32_t capacity = (size + size / 4 + CAPACITY_ALIGN - 1) /
+                        CAPACITY_ALIGN * CAPACITY_ALIGN;
+    uint8_t* dataset = (uint8_t*)realloc(frame->dataset, capacity);
+    if (dataset == NULL) {
+      return ret;
+    }
+    frame->dataset = dataset;
+    frame->capacity = capacity;
+    return ret;
+  }
+  if (ret != SOCC_OK) {
+    return ret;
+  }
+  if (response.code != PTP_RC_OK || size < LIVEVIEW_HEADER_SIZE) {
+    // Access_Denied until the LiveView image becomes ready
+    return SOCC_OK;
+  }
+
+  LiveViewImage image(frame->dataset);
+  uint64_t offset = image.get() - frame->dataset;
+  if (offset + image.size() > size) {
+    return SOCC_PTP_ERROR_TRANSACTION;
+  }
+  frame->jpeg = image.get();
+  frame->jpeg_size = image.size();
+  uint8_t* ffi = image.focalFrameInfo();
+  if (ffi != NULL &&
+      (uint64_t)(ffi - frame->dataset) + image.focalFrameInfoSize() <= size) {
+    frame->focal_frame_info = ffi;
+    frame->focal_frame_info_size = image.focalFrameInfoSize();
+  }
+  frame->dataset_size = size;
+  frame->timestamp_us = end;
+  frame->transfer_us = (uint32_t)(end - begin);
+  frame->entropy_offset = entropy_offset(frame->jpeg, frame->jpeg_size);
+  return SOCC_OK;
+}
+
+void socc_liveview::publish(LiveViewFrame* frame) {
+  frame->sequence = ++sequence;
+  frame->writing = false;
+  frame->consumed = false;
+  frame->refcount = 1;  // the reference of the engine
+
+  if (latest != NULL) {
+    if (!latest->consumed) {
+      stats.dropped++;
+    }
+    unref(latest);
+  }
+  latest = frame;
+
+  stats.frames++;
+  stats.transfer_us_last = frame->transfer_us;
+  transfer_us_total += frame->transfer_us;
+  stats.transfer_us_avg = (uint32_t)(transfer_us_total / stats.frames);
+  if (frame->transfer_us > stats.transfer_us_max) {
+    stats.transfer_us_max = frame->transfer_us;
+  }
+  if (last_publish_us != 0 && frame->timestamp_us > last_publish_us) {
+    double fps = 1000000.0 / (frame->timestamp_us - last_publish_us);
+    stats.fps = stats.fps == 0 ? fps : stats.fps * 0.875 + fps * 0.125;
+  }
+  last_publish_us = frame->timestamp_us;
+
+  pthread_cond_broadcast(&cond);
+}
+
+void socc_liveview::unref(LiveViewFrame* frame) {
+  if (--frame->refcount == 0) {
+    pthread_cond_broadcast(&cond);
+  }
+}
@@ -2,19 +2,92 @@
 #include <ports_ptp_impl.h>
 #include <ports_usb.h>
 #include <ports_usb_impl.h>
+#include <sched.h>
 #include <socc_ptp.h>
+#include <socc_trace.h>
 #include <socc_types.h>
 #include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
 
 using namespace com::sony::imaging::remote;
 
+// not to spin while the interrupt endpoint keeps failing
+#define EVENT_ERROR_BACKOFF_US 10000
+
+// wakes a thread waiting for the turn of its synchronous transaction
+typedef struct sync_waiter {
+  pthread_mutex_t mutex;
+  pthread_cond_t cond;
+  sync_waiter() {
+    pthread_mutex_init(&mutex, NULL);
+    pthread_cond_init(&cond, NULL);
+  }
+  ~sync_waiter() {
+    pthread_cond_destroy(&cond);
+    pthread_mutex_destroy(&mutex);
+  }
+} sync_waiter;
+
+static thread_local sync_waiter waiter;
+
+struct socc_ptp::async_request {
+  std::atomic<async_request*> next;
+  // a synchronous request is only a ticket, the transaction is performed by
+  // its own thread when granted
+  bool sync;
+  std::atomic<bool> granted;
+  sync_waiter* waiter;
+
+  bool receive;
+  uint16_t code;
+  uint32_t params[5];
+  uint8_t nparam;
+  void* data;
+  uint32_t size;
+  socc_async_callback_func_t callback;
+  void* vp;
+};
+
 socc_ptp::socc_ptp(int32_t busn, int32_t devn) : busn(busn), devn(devn) {
   usb = new com::sony::imaging::ports::ports_usb_impl(busn, devn);
   ptp = new com::sony::imaging::ports::ports_ptp_impl(busn, devn, 1, 0, usb);
+  init();
+}
+socc_ptp::socc_ptp(com::sony::imaging::ports::ports_usb* usb)
+    : busn(0), devn(0), usb(usb) {
+  ptp = new com::sony::imaging::ports::ports_ptp_impl(busn, devn, 1, 0, usb);
+  init();
 }
+
+void socc_ptp::init() {
+  queue_stub = new async_request();
+  queue_stub->next = NULL;
+  queue_head = queue_stub;
+  queue_tail = queue_stub;
+  dispatching = false;
+  owner = NULL;
+  prepared_issued = false;
+  prepared_nested = false;
+  pthread_mutex_init(&transfer_mutex, NULL);
+  pthread_cond_init(&transfer_cond, NULL);
+  transfer_running = false;
+  transfer_stopping = false;
+  transfer_next = NULL;
+  event_running = false;
+  event_stopping = false;
+  event_callback = NULL;
+  event_vp = NULL;
+}
+
 socc_ptp::~socc_ptp() {
+  stop_event_thread();
+  stop_transfer_thread();
+  pthread_cond_destroy(&transfer_cond);
+  pthread_mutex_destroy(&transfer_mutex);
+  delete queue_stub;
   if (ptp != NULL) {
     delete ptp;
   }
@@ -27,27 +100,417 @@ int socc_ptp::connect() { return usb->open(); }
 
 int socc_ptp::disconnect() { return usb->close(); }
 
+int socc_ptp::reconnect() { return usb->reopen(); }
+
+int socc_ptp::serial_number(char* buffer, size_t size) {
+  socc_device_handle_info_t info;
+  int ret = usb->snatch_device_handle(info);
+  if (ret != SOCC_OK) {
+    return ret;
+  }
+  if (info.option == NULL || size == 0 ||
+      strcmp(info.option_description, "usb_device_info_t") != 0) {
+    return SOCC_ERROR_NOT_SUPPORT;
+  }
+  const com::sony::imaging::ports::usb_device_info_t* device =
+      (const com::sony::imaging::ports::usb_device_info_t*)info.option;
+  size_t length =
+      strnlen((const char*)device->ascii_SerialNumber,
+              sizeof(device->ascii_SerialNumber));
+  if (length >= size) {
+    return SOCC_ERROR_INVALID_PARAMETER;
+  }
+  memcpy(buffer, device->ascii_SerialNumber, length);
+  buffer[length] = '\0';
+  return SOCC_OK;
+}
+
 void socc_ptp::set_hotplug_callback(socc_hotplug_callback_func_t callback_func,
                                     void* vp) {
   usb->set_hotplug_callback(callback_func, vp);
 }
 
+void socc_ptp::push(async_request* request) {
+  request->next.store(NULL, std::memory_order_relaxed);
+  async_request* prev = queue_head.exchange(request);
+  prev->next.store(request, std::memory_order_release);
+}
+
+socc_ptp::async_request* socc_ptp::pop() {
+  async_request* tail = queue_tail;
+  async_request* next = tail->next.load(std::memory_order_acquire);
+  if (tail == queue_stub) {
+    if (next == NULL) {
+      if (queue_head.load() == queue_stub) {
+        return NULL;
+      }
+      // a request is being pushed
+      while ((next = tail->next.load(std::memory_order_acquire)) == NULL) {
+        sched_yield();
+      }
+    }
+    queue_tail = next;
+    tail = next;
+    next = tail->next.load(std::memory_order_acquire);
+  }
+  if (next == NULL) {
+    // the stub keeps the queue linked when the last request is taken
+    if (queue_head.load() == tail) {
+      push(queue_stub);
+    }
+    while ((next = tail->next.load(std::memory_order_acquire)) == NULL) {
+      sched_yield();
+    }
+  }
+  queue_tail = next;
+  return tail;
+}
+
+bool socc_ptp::acquire() {
+  bool expected = false;
+  return dispatching.compare_exchange_strong(expected, true);
+}
+
+void socc_ptp::grant(async_request* request) {
+  if (request->sync) {
+    // the request is on the stack of its thread, untouched once granted
+    sync_waiter* w = request->waiter;
+    pthread_mutex_lock(&w->mutex);
+    request->granted = true;
+    pthread_cond_signal(&w->cond);
+    pthread_mutex_unlock(&w->mutex);
+  } else {
+    pthread_mutex_lock(&transfer_mutex);
+    transfer_next = request;
+    pthread_cond_signal(&transfer_cond);
+    pthread_mutex_unlock(&transfer_mutex);
+  }
+}
+
+void socc_ptp::pass_on() {
+  async_request* request;
+  while ((request = pop()) == NULL) {
+    dispatching = false;
+    // a request pushed before the release has failed to acquire it
+    if (queue_head.load() == queue_stub || !acquire()) {
+      return;
+    }
+  }
+  grant(request);
+}
+
+bool socc_ptp::begin_transaction() {
+  if (owner.load() == &waiter) {
+    return true;
+  }
+  async_request request;
+  request.sync = true;
+  request.granted = false;
+  request.waiter = &waiter;
+  push(&request);
+  if (acquire()) {
+    pass_on();
+  }
+  pthread_mutex_lock(&waiter.mutex);
+  while (!request.granted) {
+    pthread_cond_wait(&waiter.cond, &waiter.mutex);
+  }
+  pthread_mutex_unlock(&waiter.mutex);
+  owner = &waiter;
+  return false;
+}
+
+void socc_ptp::end_transaction(bool nested) {
+  if (nested) {
+    return;
+  }
+  owner = NULL;
+  pass_on();
+}
+
 int socc_ptp::send(uint16_t code, uint32_t* params, uint8_t nparam,
                    Container& response, void* data, uint32_t size) {
-  return ptp->send(code, params, nparam, response, data, size);
+  bool nested = begin_transaction();
+  uint64_t begin = socc_trace_now();
+  int ret = ptp->send(code, params, nparam, response, data, size);
+  socc_trace_span("send", "ptp", begin, "code", code);
+  end_transaction(nested);
+  return ret;
 }
 
 int socc_ptp::receive(uint16_t code, uint32_t* params, uint8_t nparam,
                       Container& response, void** data, uint32_t& size) {
-  return ptp->receive(code, params, nparam, response, data, size);
+  bool nested = begin_transaction();
+  uint64_t begin = socc_trace_now();
+  int ret = ptp->receive(code, params, nparam, response, data, size);
+  socc_trace_span("receive", "ptp", begin, "code", code);
+  end_transaction(nested);
+  return ret;
+}
+
+int socc_ptp::receive_into(uint16_t code, uint32_t* params, uint8_t nparam,
+                           Container& response, void* data, uint32_t capacity,
+                           uint32_t& size) {
+  bool nested = begin_transaction();
+  uint64_t begin = socc_trace_now();
+  int ret = ptp->receive_into(code, params, nparam, response, data, capacity,
+                              size);
+  socc_trace_span("receive", "ptp", begin, "code", code);
+  end_transaction(nested);
+  return ret;
+}
+
+int socc_ptp::prepare_send(uint16_t code, uint32_t* params, uint8_t nparam,
+                           void* data, uint32_t size,
+                           PreparedTransaction& prepared) {
+  return ptp->prepare_send(code, params, nparam, data, size, prepared);
+}
+
+int socc_ptp::issue_prepared(PreparedTransaction& prepared) {
+  bool nested = begin_transaction();
+  int ret = ptp->issue_prepared(prepared);
+  if (ret != SOCC_OK) {
+    end_transaction(nested);
+  } else {
+    prepared_issued = true;
+    prepared_nested = nested;
+  }
+  return ret;
+}
+
+int socc_ptp::complete_prepared(Container& response) {
+  // not to release the transactions held by another thread
+  if (owner.load() != &waiter || !prepared_issued) {
+    return SOCC_ERROR_INVALID_PARAMETER;
+  }
+  prepared_issued = false;
+  int ret = ptp->complete_prepared(response);
+  end_transaction(prepared_nested);
+  return ret;
+}
+
+int socc_ptp::send_async(uint16_t code, uint32_t* params, uint8_t nparam,
+                         void* data, uint32_t size,
+                         socc_async_callback_func_t callback, void* vp) {
+  return queue(false, code, params, nparam, data, size, callback, vp);
+}
+
+int socc_ptp::receive_async(uint16_t code, uint32_t* params, uint8_t nparam,
+                            socc_async_callback_func_t callback, void* vp) {
+  return queue(true, code, params, nparam, NULL, 0, callback, vp);
+}
+
+std::future<AsyncResult> socc_ptp::send_async(uint16_t code, uint32_t* params,
+                                              uint8_t nparam, void* data,
+                                              uint32_t size) {
+  std::promise<AsyncResult>* promise = new std::promise<AsyncResult>();
+  std::future<AsyncResult> future = promise->get_future();
+  if (queue(false, code, params, nparam, data, size, fulfill, promise) !=
+      SOCC_OK) {
+    AsyncResult result;
+    memset(&result, 0, sizeof(result));
+    result.ret = SOCC_ERROR_THREAD_CREATE;
+    fulfill(result, promise);
+  }
+  return future;
+}
+
+std::future<AsyncResult> socc_ptp::receive_async(uint16_t code,
+                                                 uint32_t* params,
+                                                 uint8_t nparam) {
+  std::promise<AsyncResult>* promise = new std::promise<AsyncResult>();
+  std::future<AsyncResult> future = promise->get_future();
+  if (queue(true, code, params, nparam, NULL, 0, fulfill, promise) !=
+      SOCC_OK) {
+    AsyncResult result;
+    memset(&result, 0, sizeof(result));
+    result.ret = SOCC_ERROR_THREAD_CREATE;
+    fulfill(result, promise);
+  }
+  return future;
+}
+
+void socc_ptp::fulfill(const AsyncResult& result, void* vp) {
+  std::promise<AsyncResult>* promise = (std::promise<AsyncResult>*)vp;
+  promise->set_value(result);
+  delete promise;
+}
+
+int socc_ptp::queue(bool receive, uint16_t code, uint32_t* params,
+                    uint8_t nparam, void* data, uint32_t size,
+                    socc_async_callback_func_t callback, void* vp) {
+  if (nparam > 5 || (nparam > 0 && params == NULL) || callback == NULL) {
+    return SOCC_ERROR_INVALID_PARAMETER;
+  }
+  async_request* request = new async_request();
+  request->sync = false;
+  request->receive = receive;
+  request->code = code;
+  memset(request->params, 0, sizeof(request->params));
+  if (nparam > 0) {
+    memcpy(request->params, params, sizeof(uint32_t) * nparam);
+  }
+  request->nparam = nparam;
+  request->data = data;
+  request->size = size;
+  request->callback = callback;
+  request->vp = vp;
+
+  pthread_mutex_lock(&transfer_mutex);
+  if (!transfer_running) {
+    transfer_stopping = false;
+    if (pthread_create(&transfer_thread_id, NULL, transfer_thread, this) !=
+        0) {
+      pthread_mutex_unlock(&transfer_mutex);
+      delete request;
+      return SOCC_ERROR_THREAD_CREATE;
+    }
+    transfer_running = true;
+  }
+  pthread_mutex_unlock(&transfer_mutex);
+
+  push(request);
+  if (acquire()) {
+    pass_on();
+  }
+  return SOCC_OK;
+}
+
+void* socc_ptp::transfer_thread(void* vp) {
+  ((socc_ptp*)vp)->run_transfers();
+  return NULL;
+}
+
+void socc_ptp::run_transfers() {
+  while (1) {
+    pthread_mutex_lock(&transfer_mutex);
+    while (transfer_next == NULL && !transfer_stopping) {
+      pthread_cond_wait(&transfer_cond, &transfer_mutex);
+    }
+    async_request* request = transfer_next;
+    transfer_next = NULL;
+    pthread_mutex_unlock(&transfer_mutex);
+    if (request == NULL) {
+      break;
+    }
+
+    // granted the dispatching, the asynchronous requests in a row are
+    // performed here and the callbacks may call synchronous ones
+    owner = &waiter;
+    while (request != NULL && !request->sync) {
+      AsyncResult result;
+      memset(&result, 0, sizeof(result));
+      if (transfer_stopping) {
+        result.ret = SOCC_ERROR_CANCELED;
+      } else if (request->receive) {
+        result.ret = receive(request->code, request->params, request->nparam,
+                             result.response, &result.data, result.size);
+      } else {
+        result.ret = send(request->code, request->params, request->nparam,
+                          result.response, request->data, request->size);
+      }
+      request->callback(result, request->vp);
+      delete request;
+      request = pop();
+    }
+    owner = NULL;
+    if (request != NULL) {
+      grant(request);
+    } else {
+      pass_on();
+    }
+  }
+}
+
+void socc_ptp::stop_transfer_thread() {
+  pthread_mutex_lock(&transfer_mutex);
+  if (!transfer_running) {
+    pthread_mutex_unlock(&transfer_mutex);
+    return;
+  }
+  transfer_stopping = true;
+  pthread_cond_signal(&transfer_cond);
+  pthread_mutex_unlock(&transfer_mutex);
+
+  pthread_join(transfer_thread_id, NULL);
+  transfer_running = false;
+
+  // the requests granted after the thread has left, and those still queued,
+  // are canceled here. This object has no other user once it is deleted.
+  async_request* request = transfer_next;
+  transfer_next = NULL;
+  if (request == NULL) {
+    request = pop();
+  }
+  while (request != NULL) {
+    if (!request->sync) {
+      AsyncResult result;
+      memset(&result, 0, sizeof(result));
+      result.ret = SOCC_ERROR_CANCELED;
+      request->callback(result, request->vp);
+      delete request;
+    }
+    request = pop();
+  }
+  dispatching = false;
 }
 
 int socc_ptp::wait_event(Container& container) {
   return ptp->wait_event(container);
 }
 
+int socc_ptp::set_event_callback(socc_async_callback_func_t callback,
+                                 void* vp) {
+  stop_event_thread();
+  if (callback == NULL) {
+    return SOCC_OK;
+  }
+  event_callback = callback;
+  event_vp = vp;
+  event_stopping = false;
+  if (pthread_create(&event_thread_id, NULL, event_thread, this) != 0) {
+    return SOCC_ERROR_THREAD_CREATE;
+  }
+  event_running = true;
+  return SOCC_OK;
+}
+
+void* socc_ptp::event_thread(void* vp) {
+  ((socc_ptp*)vp)->run_events();
+  return NULL;
+}
+
+void socc_ptp::run_events() {
+  while (!event_stopping) {
+    AsyncResult result;
+    memset(&result, 0, sizeof(result));
+    result.ret = ptp->wait_event(result.response);
+    if (event_stopping) {
+      break;
+    }
+    if (result.ret == SOCC_ERROR_USB_TIMEOUT) {
+      continue;
+    }
+    event_callback(result, event_vp);
+    if (result.ret != SOCC_OK) {
+      usleep(EVENT_ERROR_BACKOFF_US);
+    }
+  }
+}
+
+void socc_ptp::stop_event_thread() {
+  if (!event_running) {
+    return;
+  }
+  event_stopping = true;
+  pthread_join(event_thread_id, NULL);
+  event_running = false;
+}
+
 void socc_ptp::dispose_data(void** data) { ptp->dispose_data(data); }
 
 int socc_ptp::clear_halt(int what) { return usb->clear_halt(what); }
 
 int socc_ptp::reset() { return usb->reset(); }
+
+socc_stats* socc_ptp::stats() { return ptp->stats(); }
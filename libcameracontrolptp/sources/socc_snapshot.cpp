@@ -0,0 +1,321 @@
+#include <parser.h>
+#include <socc_snapshot.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/time.h>
+
+#include <algorithm>
+
+using namespace com::sony::imaging::remote;
+
+// the bytes of the values compared at once by diff()
+#define SNAPSHOT_BLOCK_SIZE 64
+
+#define DATATYPE_STR 0xFFFF
+#define DATATYPE_ARRAY 0x4000
+
+namespace {
+
+// a property in the dataset, before the columns are sorted
+struct entry {
+  uint16_t code;
+  uint16_t type;
+  uint32_t offset;  // of the current value in the dataset
+  uint32_t size;
+};
+
+bool entry_less(const entry& a, const entry& b) { return a.code < b.code; }
+
+// an integer of DataType, signed ones for the odd DataType like the parser
+int64_t read_signed(const uint8_t* p, uint32_t unit) {
+  uint64_t value = 0;
+  memcpy(&value, p, unit);
+  if (unit < 8 && 0 != (value >> (unit * 8 - 1))) {
+    value |= ~0ULL << (unit * 8);
+  }
+  return (int64_t)value;
+}
+
+void append_value(std::string& str, uint16_t type, const uint8_t* p,
+                  uint32_t unit) {
+  char buf[32];
+  if (0 != (type & 1)) {
+    snprintf(buf, sizeof(buf), "%lld", (long long)read_signed(p, unit));
+  } else {
+    uint64_t value = 0;
+    memcpy(&value, p, unit);
+    snprintf(buf, sizeof(buf), "%llu", (unsigned long long)value);
+  }
+  str += buf;
+}
+
+}  // namespace
+
+socc_snapshot::socc_snapshot() : offsets_(1, 0), time_us_(0) {}
+
+socc_snapshot::~socc_snapshot() {}
+
+int socc_snapshot::parse(const void* data, uint32_t size) {
+  const uint8_t* _data = (const uint8_t*)data;
+  struct timeval now;
+  gettimeofday(&now, NULL);
+  time_us_ = (uint64_t)now.tv_sec * 1000000 + now.tv_usec;
+  codes_.clear();
+  types_.clear();
+  offsets_.assign(1, 0);
+  values_.clear();
+
+  uint32_t pos = sizeof(uint64_t);
+  if (NULL == data || size < pos) {
+    return SOCC_ERROR_INVALID_PARAMETER;
+  }
+  uint64_t num = *(uint64_t*)_data;
+
+  // the smallest dataset is a string of 9 bytes, for a broken num
+  std::vector<entry> entries;
+  entries.reserve(std::min<uint64_t>(num, size / 9));
+  int ret = SOCC_OK;
+  for (uint64_t i = 0; i < num; i++) {
+    uint32_t current, current_size;
+    uint32_t dataset_size = SDIDevicePropInfoDataset::measure(
+        _data + pos, size - pos, &current, &current_size);
+    if (0 == dataset_size) {
+      ret = SOCC_ERROR_INVALID_PARAMETER;
+      break;
+    }
+    entry e;
+    e.code = *(uint16_t*)(_data + pos);
+    e.type = *(uint16_t*)(_data + pos + 2);
+    e.offset = pos + current;
+    e.size = current_size;
+    entries.push_back(e);
+    pos += dataset_size;
+  }
+
+  // the later one of a duplicated code, like SDIDevicePropInfoDatasetArray
+  std::stable_sort(entries.begin(), entries.end(), entry_less);
+  size_t total = 0;
+  for (size_t i = 0; i < entries.size(); i++) {
+    total += entries[i].size;
+  }
+  codes_.reserve(entries.size());
+  types_.reserve(entries.size());
+  offsets_.reserve(entries.size() + 1);
+  values_.reserve(total);
+  for (size_t i = 0; i < entries.size(); i++) {
+    const entry& e = entries[i];
+    if (i + 1 < entries.size() && entries[i + 1].code == e.code) {
+      continue;
+    }
+    codes_.push_back(e.code);
+    types_.push_back(e.type);
+    values_.insert(values_.end(), _data + e.offset,
+                   _data + e.offset + e.size);
+    offsets_.push_back(values_.size());
+  }
+  return ret;
+}
+
+uint32_t socc_snapshot::num() const { return codes_.size(); }
+
+uint16_t socc_snapshot::code(uint32_t i) const { return codes_[i]; }
+
+uint16_t socc_snapshot::type(uint32_t i) const { return types_[i]; }
+
+uint64_t socc_snapshot::time_us() const { return time_us_; }
+
+int32_t socc_snapshot::find(uint16_t code) const {
+  std::vector<uint16_t>::const_iterator it =
+      std::lower_bound(codes_.begin(), codes_.end(), code);
+  if (it == codes_.end() || *it != code) {
+    return -1;
+  }
+  return it - codes_.begin();
+}
+
+void socc_snapshot::value_to_string(uint32_t i, std::string& str) const {
+  const uint8_t* p = &values_[offsets_[i]];
+  uint16_t type = types_[i];
+  if (DATATYPE_STR == type) {
+    // the lower bytes of UCS-2, until the terminating null
+    for (uint8_t k = 0; k < p[0] && 0 != p[1 + k * 2]; k++) {
+      str += (char)p[1 + k * 2];
+    }
+    return;
+  }
+  uint32_t unit = SDIDevicePropInfoDataset::valueSize(type);
+  if (DATATYPE_ARRAY == (type & 0xF000)) {
+    uint32_t n = *(const uint32_t*)p;
+    for (uint32_t k = 0; k < n; k++) {
+      if (k > 0) {
+        str += " ";
+      }
+      append_value(str, type, p + 4 + k * unit, unit);
+    }
+    return;
+  }
+  append_value(str, type, p, unit);
+}
+
+void socc_snapshot::value_to_json(uint32_t i, std::string& str) const {
+  const uint8_t* p = &values_[offsets_[i]];
+  uint16_t type = types_[i];
+  if (DATATYPE_STR == type) {
+    char buf[8];
+    str += "\"";
+    for (uint8_t k = 0; k < p[0] && 0 != p[1 + k * 2]; k++) {
+      uint8_t c = p[1 + k * 2];
+      if ('"' == c || '\\' == c) {
+        str += '\\';
+        str += (char)c;
+      } else if (c < 0x20 || c >= 0x7F) {
+        snprintf(buf, sizeof(buf), "\\u%04x", c);
+        str += buf;
+      } else {
+        str += (char)c;
+      }
+    }
+    str += "\"";
+    return;
+  }
+  uint32_t unit = SDIDevicePropInfoDataset::valueSize(type);
+  if (DATATYPE_ARRAY == (type & 0xF000)) {
+    uint32_t n = *(const uint32_t*)p;
+    str += "[";
+    for (uint32_t k = 0; k < n; k++) {
+      if (k > 0) {
+        str += ", ";
+      }
+      append_value(str, type, p + 4 + k * unit, unit);
+    }
+    str += "]";
+    return;
+  }
+  append_value(str, type, p, unit);
+}
+
+// the same properties with the values of the same sizes, as two snapshots of
+// a camera mostly are: the values are compared in blocks
+void socc_snapshot::diff_aligned(const socc_snapshot& before,
+                                 const socc_snapshot& after,
+                                 std::vector<SnapshotChange>& changes) {
+  const uint8_t* a = before.values_.data();
+  const uint8_t* b = after.values_.data();
+  const std::vector<uint32_t>& offsets = before.offsets_;
+  size_t size = before.values_.size();
+  uint32_t num = before.num();
+  uint32_t i = 0;
+  for (size_t pos = 0; pos < size; pos += SNAPSHOT_BLOCK_SIZE) {
+    size_t len = std::min<size_t>(SNAPSHOT_BLOCK_SIZE, size - pos);
+    if (0 == memcmp(a + pos, b + pos, len)) {
+      continue;
+    }
+    // the properties in the block, except the ones compared in the previous
+    uint32_t first = std::upper_bound(offsets.begin(), offsets.end(), pos) -
+                     offsets.begin() - 1;
+    for (i = std::max(i, first); i < num && offsets[i] < pos + len; i++) {
+      if (0 != memcmp(a + offsets[i], b + offsets[i],
+                      offsets[i + 1] - offsets[i])) {
+        SnapshotChange change = {before.codes_[i], (int32_t)i, (int32_t)i};
+        changes.push_back(change);
+      }
+    }
+  }
+}
+
+// the properties joined by the codes
+void socc_snapshot::diff_merged(const socc_snapshot& before,
+                                const socc_snapshot& after,
+                                std::vector<SnapshotChange>& changes) {
+  uint32_t i = 0, j = 0;
+  while (i < before.num() || j < after.num()) {
+    if (j == after.num() ||
+        (i < before.num() && before.codes_[i] < after.codes_[j])) {
+      SnapshotChange change = {before.codes_[i], (int32_t)i, -1};
+      changes.push_back(change);
+      i++;
+      continue;
+    }
+    if (i == before.num() || after.codes_[j] < before.codes_[i]) {
+      SnapshotChange change = {after.codes_[j], -1, (int32_t)j};
+      changes.push_back(change);
+      j++;
+      continue;
+    }
+    uint32_t size = before.offsets_[i + 1] - before.offsets_[i];
+    if (before.types_[i] != after.types_[j] ||
+        size != after.offsets_[j + 1] - after.offsets_[j] ||
+        0 != memcmp(&before.values_[before.offsets_[i]],
+                    &after.values_[after.offsets_[j]], size)) {
+      SnapshotChange change = {before.codes_[i], (int32_t)i, (int32_t)j};
+      changes.push_back(change);
+    }
+    i++;
+    j++;
+  }
+}
+
+void socc_snapshot::diff(const socc_snapshot& before,
+                         const socc_snapshot& after,
+                         std::vector<SnapshotChange>& changes) {
+  changes.clear();
+  if (before.codes_ == after.codes_ && before.types_ == after.types_ &&
+      before.offsets_ == after.offsets_) {
+    diff_aligned(before, after, changes);
+  } else {
+    diff_merged(before, after, changes);
+  }
+}
+
+void socc_snapshot::changes_to_string(
+    const socc_snapshot& before, const socc_snapshot& after,
+    const std::vector<SnapshotChange>& changes, std::string& str) {
+  char buf[16];
+  for (size_t i = 0; i < changes.size(); i++) {
+    const SnapshotChange& c = changes[i];
+    snprintf(buf, sizeof(buf), "0x%04X: ", c.code);
+    str += buf;
+    if (-1 == c.before) {
+      str += "-";
+    } else {
+      before.value_to_string(c.before, str);
+    }
+    str += " -> ";
+    if (-1 == c.after) {
+      str += "-";
+    } else {
+      after.value_to_string(c.after, str);
+    }
+    str += "\n";
+  }
+}
+
+void socc_snapshot::changes_to_json(const socc_snapshot& before,
+                                    const socc_snapshot& after,
+                                    const std::vector<SnapshotChange>& changes,
+                                    std::string& str) {
+  char buf[64];
+  str += "[";
+  for (size_t i = 0; i < changes.size(); i++) {
+    const SnapshotChange& c = changes[i];
+    uint16_t type =
+        -1 == c.after ? before.type(c.before) : after.type(c.after);
+    snprintf(buf, sizeof(buf), "%s{\"code\":\"0x%04X\",\"type\":\"0x%04X\"",
+             i > 0 ? "," : "", c.code, type);
+    str += buf;
+    str += ",\"before\":";
+    if (-1 == c.before) {
+      str += "null";
+    } else {
+      before.value_to_json(c.before, str);
+    }
+    str += ",\"after\":";
+    if (-1 == c.after) {
+      str += "null";
+    } else {
+      after.value_to_json(c.after, str);
+    }
+    str += "}";
+  }
+  str += "]";
+}
@@ -0,0 +1,304 @@
+#include <socc_stats.h>
+#include <socc_time.h>
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+
+using namespace com::sony::imaging::remote;
+
+#define PTP_RC_OK 0x2001
+
+#define PHASE_REQUEST 0
+#define PHASE_FIRST_DATA 1
+#define PHASE_LAST_DATA 2
+#define PHASE_RESPONSE 3
+
+// the only writer is the thread in the transaction
+template <typename T>
+static inline void add(std::atomic<T>& counter, T value) {
+  counter.store(counter.load(std::memory_order_relaxed) + value,
+                std::memory_order_relaxed);
+}
+
+template <typename T>
+static inline T load(const std::atomic<T>& counter) {
+  return counter.load(std::memory_order_relaxed);
+}
+
+socc_stats::socc_stats()
+    : on(true),
+      current(NULL),
+      timing(false),
+      start_ns(0),
+      bytes_in(0),
+      bytes_out(0) {
+  // the last one is for the operation codes which have not found a room
+  operations = new counters_t[SOCC_STATS_OPERATIONS + 1]();
+  memset(phases, 0, sizeof(phases));
+}
+
+socc_stats::~socc_stats() { delete[] operations; }
+
+void socc_stats::set_enabled(bool enabled) { on.store(enabled); }
+
+bool socc_stats::enabled() { return on.load(); }
+
+void socc_stats::reset() {
+  for (int i = 0; i <= SOCC_STATS_OPERATIONS; i++) {
+    counters_t* c = &operations[i];
+    c->count.store(0);
+    c->errors.store(0);
+    c->stalls.store(0);
+    c->timeouts.store(0);
+    c->responses_ng.store(0);
+    c->bytes_in.store(0);
+    c->bytes_out.store(0);
+    c->total_us.store(0);
+    c->max_us.store(0);
+    c->phases_count.store(0);
+    for (int j = 0; j < 4; j++) {
+      c->phases_sum[j].store(0);
+      c->last[j].store(0);
+    }
+    for (int j = 0; j < SOCC_STATS_BUCKETS; j++) {
+      c->histogram[j].store(0);
+    }
+  }
+}
+
+void socc_stats::begin(uint16_t code) {
+  if (!on.load(std::memory_order_relaxed)) {
+    current = NULL;
+    return;
+  }
+  current = find(code);
+  timing = load(current->count) % SOCC_STATS_PHASE_SAMPLING == 0;
+  memset(phases, 0, sizeof(phases));
+  bytes_in = 0;
+  bytes_out = 0;
+  start_ns = socc_monotonic_ns();
+}
+
+void socc_stats::request_sent() {
+  if (timing) {
+    phases[PHASE_REQUEST] = socc_monotonic_ns() - start_ns;
+  }
+}
+
+void socc_stats::data(uint32_t bytes, bool out) {
+  if (current == NULL) {
+    return;
+  }
+  if (timing) {
+    uint64_t now = socc_monotonic_ns() - start_ns;
+    if (phases[PHASE_FIRST_DATA] == 0) {
+      phases[PHASE_FIRST_DATA] = now;
+    }
+    phases[PHASE_LAST_DATA] = now;
+  }
+  if (out) {
+    bytes_out += bytes;
+  } else {
+    bytes_in += bytes;
+  }
+}
+
+void socc_stats::end(int rc, uint16_t response_code) {
+  counters_t* c = current;
+  if (c == NULL) {
+    return;
+  }
+  bool phases_timed = timing;
+  current = NULL;
+  timing = false;
+
+  uint64_t elapsed_us = (socc_monotonic_ns() - start_ns) / 1000;
+
+  add<uint64_t>(c->count, 1);
+  if (rc != SOCC_OK && rc != SOCC_ERROR_USB_OVERFLOW) {
+    add<uint64_t>(c->errors, 1);
+    if (rc == SOCC_ERROR_USB_ENDPOINT_HALTED) {
+      add<uint64_t>(c->stalls, 1);
+    } else if (rc == SOCC_ERROR_USB_TIMEOUT) {
+      add<uint64_t>(c->timeouts, 1);
+    }
+  } else if (response_code != PTP_RC_OK) {
+    add<uint64_t>(c->responses_ng, 1);
+  }
+  add<uint64_t>(c->bytes_in, bytes_in);
+  add<uint64_t>(c->bytes_out, bytes_out);
+  add<uint64_t>(c->total_us, elapsed_us);
+  if (elapsed_us > load(c->max_us)) {
+    c->max_us.store(elapsed_us, std::memory_order_relaxed);
+  }
+  if (phases_timed) {
+    if (rc == SOCC_OK) {
+      phases[PHASE_RESPONSE] = elapsed_us * 1000;
+    }
+    add<uint64_t>(c->phases_count, 1);
+    for (int i = 0; i < 4; i++) {
+      add<uint64_t>(c->phases_sum[i], phases[i] / 1000);
+      c->last[i].store(phases[i] / 1000, std::memory_order_relaxed);
+    }
+  }
+  add<uint32_t>(c->histogram[bucket(elapsed_us)], 1);
+}
+
+int socc_stats::get(OperationStats* stats, int size) {
+  int n = 0;
+  for (int i = 0; i <= SOCC_STATS_OPERATIONS && n < size; i++) {
+    counters_t* c = &operations[i];
+    if ((i < SOCC_STATS_OPERATIONS && load(c->code) == 0) ||
+        load(c->count) == 0) {
+      continue;
+    }
+    OperationStats* s = &stats[n++];
+    s->code = load(c->code);
+    s->count = load(c->count);
+    s->errors = load(c->errors);
+    s->stalls = load(c->stalls);
+    s->timeouts = load(c->timeouts);
+    s->responses_ng = load(c->responses_ng);
+    s->bytes_in = load(c->bytes_in);
+    s->bytes_out = load(c->bytes_out);
+    s->total_us = load(c->total_us);
+    s->max_us = load(c->max_us);
+    s->phases_count = load(c->phases_count);
+    s->phases_sum.request_us = load(c->phases_sum[PHASE_REQUEST]);
+    s->phases_sum.first_data_us = load(c->phases_sum[PHASE_FIRST_DATA]);
+    s->phases_sum.last_data_us = load(c->phases_sum[PHASE_LAST_DATA]);
+    s->phases_sum.response_us = load(c->phases_sum[PHASE_RESPONSE]);
+    s->last.request_us = load(c->last[PHASE_REQUEST]);
+    s->last.first_data_us = load(c->last[PHASE_FIRST_DATA]);
+    s->last.last_data_us = load(c->last[PHASE_LAST_DATA]);
+    s->last.response_us = load(c->last[PHASE_RESPONSE]);
+    for (int j = 0; j < SOCC_STATS_BUCKETS; j++) {
+      s->histogram[j] = load(c->histogram[j]);
+    }
+  }
+  return n;
+}
+
+uint64_t socc_stats::percentile(const OperationStats& stats,
+                                double percentile) {
+  uint64_t total = 0;
+  for (int i = 0; i < SOCC_STATS_BUCKETS; i++) {
+    total += stats.histogram[i];
+  }
+  if (total == 0) {
+    return 0;
+  }
+
+  uint64_t rank = (uint64_t)(total * percentile / 100.0 + 0.5);
+  if (rank < 1) {
+    rank = 1;
+  }
+  uint64_t seen = 0;
+  for (int i = 0; i < SOCC_STATS_BUCKETS; i++) {
+    seen += stats.histogram[i];
+    if (seen >= rank) {
+      uint64_t upper = bucket_upper_us(i);
+      return upper < stats.max_us ? upper : stats.max_us;
+    }
+  }
+  return stats.max_us;
+}
+
+void socc_stats::to_json(std::string& json) {
+  OperationStats* stats = new OperationStats[SOCC_STATS_OPERATIONS + 1];
+  int n = get(stats, SOCC_STATS_OPERATIONS + 1);
+  uint64_t count = 0, errors = 0, stalls = 0, timeouts = 0;
+  uint64_t bytes_in = 0, bytes_out = 0;
+  char buf[1024];
+
+  json = "{\"enabled\":";
+  json += enabled() ? "true" : "false";
+  json += ",\"operations\":[";
+  for (int i = 0; i < n; i++) {
+    const OperationStats& s = stats[i];
+    double in_bps = s.total_us > 0 ? s.bytes_in * 1000000.0 / s.total_us : 0;
+    double out_bps = s.total_us > 0 ? s.bytes_out * 1000000.0 / s.total_us : 0;
+    uint64_t timed = s.phases_count > 0 ? s.phases_count : 1;
+    snprintf(buf, sizeof(buf),
+             "%s{\"code\":\"0x%04X\",\"count\":%llu,\"errors\":%llu,"
+             "\"stalls\":%llu,\"timeouts\":%llu,\"responses_ng\":%llu,"
+             "\"bytes_in\":%llu,\"bytes_out\":%llu,"
+             "\"in_bytes_per_sec\":%.0f,\"out_bytes_per_sec\":%.0f,"
+             "\"avg_us\":%llu,\"p50_us\":%llu,\"p90_us\":%llu,"
+             "\"p99_us\":%llu,\"max_us\":%llu,"
+             "\"phases_avg_us\":{\"request\":%llu,\"first_data\":%llu,"
+             "\"last_data\":%llu,\"response\":%llu},"
+             "\"last_us\":{\"request\":%llu,\"first_data\":%llu,"
+             "\"last_data\":%llu,\"response\":%llu}}",
+             i > 0 ? "," : "", s.code, (unsigned long long)s.count,
+             (unsigned long long)s.errors, (unsigned long long)s.stalls,
+             (unsigned long long)s.timeouts,
+             (unsigned long long)s.responses_ng,
+             (unsigned long long)s.bytes_in, (unsigned long long)s.bytes_out,
+             in_bps, out_bps, (unsigned long long)(s.total_us / s.count),
+             (unsigned long long)percentile(s, 50),
+             (unsigned long long)percentile(s, 90),
+             (unsigned long long)percentile(s, 99),
+             (unsigned long long)s.max_us,
+             (unsigned long long)(s.phases_sum.request_us / timed),
+             (unsigned long long)(s.phases_sum.first_data_us / timed),
+             (unsigned long long)(s.phases_sum.last_data_us / timed),
+             (unsigned long long)(s.phases_sum.response_us / timed),
+             (unsigned long long)s.last.request_us,
+             (unsigned long long)s.last.first_data_us,
+             (unsigned long long)s.last.last_data_us,
+             (unsigned long long)s.last.response_us);
+    json += buf;
+    count += s.count;
+    errors += s.errors;
+    stalls += s.stalls;
+    timeouts += s.timeouts;
+    bytes_in += s.bytes_in;
+    bytes_out += s.bytes_out;
+  }
+  snprintf(buf, sizeof(buf),
+           "],\"total\":{\"count\":%llu,\"errors\":%llu,\"stalls\":%llu,"
+           "\"timeouts\":%llu,\"bytes_in\":%llu,\"bytes_out\":%llu}}",
+           (unsigned long long)count, (unsigned long long)errors,
+           (unsigned long long)stalls, (unsigned long long)timeouts,
+           (unsigned long long)bytes_in, (unsigned long long)bytes_out);
+  json += buf;
+  delete[] stats;
+}
+
+uint64_t socc_stats::bucket_upper_us(int bucket) {
+  if (bucket < 16) {
+    return bucket;
+  }
+  int msb = (bucket - 16) / 8 + 4;
+  int sub = (bucket - 16) % 8;
+  return ((uint64_t)(8 + sub + 1) << (msb - 3)) - 1;
+}
+
+socc_stats::counters_t* socc_stats::find(uint16_t code) {
+  int slot = (code ^ (code >> 6)) % SOCC_STATS_OPERATIONS;
+  for (int i = 0; i < SOCC_STATS_OPERATIONS && code != 0; i++) {
+    counters_t* c = &operations[slot];
+    uint32_t found = load(c->code);
+    if (found == code) {
+      return c;
+    }
+    if (found == 0) {
+      c->code.store(code, std::memory_order_release);
+      return c;
+    }
+    slot = (slot + 1) % SOCC_STATS_OPERATIONS;
+  }
+  return &operations[SOCC_STATS_OPERATIONS];
+}
+
+int socc_stats::bucket(uint64_t us) {
+  if (us < 16) {
+    return us;
+  }
+  int msb = 63 - __builtin_clzll(us);
+  if (msb > 31) {
+    return SOCC_STATS_BUCKETS - 1;
+  }
+  return 16 + (msb - 4) * 8 + ((us >> (msb - 3)) & 7);
+}
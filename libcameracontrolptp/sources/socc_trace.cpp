@@ -0,0 +1,250 @@
+#include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <socc_time.h>
+#include <socc_trace.h>
+#include <socc_types.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include <atomic>
+#include <string>
+
+using namespace com::sony::imaging::remote;
+
+#define TRACE_EVENTS_PER_THREAD 16384
+
+typedef struct trace_event_t {
+  const char* name;
+  const char* category;
+  const char* arg_name;
+  uint32_t arg;
+  uint64_t begin_ns;
+  uint64_t end_ns;
+} trace_event_t;
+
+// a ring with a single writer, the owner thread, and a single reader, the
+// flush under flush_mutex
+typedef struct trace_buffer_t {
+  trace_event_t events[TRACE_EVENTS_PER_THREAD];
+  std::atomic<uint64_t> written;
+  std::atomic<uint64_t> flushed;
+  std::atomic<uint64_t> dropped;
+  uint32_t tid;
+  trace_buffer_t* next;
+} trace_buffer_t;
+
+static std::atomic<bool> tracing(false);
+static std::atomic<trace_buffer_t*> buffers(NULL);
+static std::atomic<uint32_t> next_tid(1);
+static thread_local trace_buffer_t* local_buffer = NULL;
+static pthread_key_t buffer_key;
+static pthread_once_t buffer_key_once = PTHREAD_ONCE_INIT;
+
+static pthread_mutex_t flush_mutex = PTHREAD_MUTEX_INITIALIZER;
+static int trace_fd = -1;
+static char process_name[64];
+static bool process_named = false;
+static bool hooks_registered = false;
+
+// the spans of a thread are written and its buffer is freed when it exits
+static void release_buffer(void* vp) {
+  trace_buffer_t* buffer = (trace_buffer_t*)vp;
+  socc_trace_flush();
+
+  // the other threads only push to the head, and the flush reads the list
+  // under the same lock
+  pthread_mutex_lock(&flush_mutex);
+  trace_buffer_t* head = buffer;
+  if (!buffers.compare_exchange_strong(head, buffer->next)) {
+    trace_buffer_t* b = head;
+    while (b->next != buffer) {
+      b = b->next;
+    }
+    b->next = buffer->next;
+  }
+  pthread_mutex_unlock(&flush_mutex);
+  local_buffer = NULL;
+  delete buffer;
+}
+
+static void create_buffer_key() {
+  pthread_key_create(&buffer_key, release_buffer);
+}
+
+static trace_buffer_t* get_local_buffer() {
+  if (local_buffer == NULL) {
+    trace_buffer_t* buffer = new trace_buffer_t();
+    buffer->tid = next_tid.fetch_add(1);
+    buffer->next = buffers.load();
+    while (!buffers.compare_exchange_weak(buffer->next, buffer)) {
+    }
+    local_buffer = buffer;
+    pthread_once(&buffer_key_once, create_buffer_key);
+    pthread_setspecific(buffer_key, buffer);
+  }
+  return local_buffer;
+}
+
+static void flush_at_exit() { socc_trace_flush(); }
+
+// the child of fork() must not write the spans of its parent again
+static void forget_parent_spans() {
+  for (trace_buffer_t* b = buffers.load(); b != NULL; b = b->next) {
+    b->flushed.store(b->written.load());
+  }
+  process_named = false;
+  pthread_mutex_init(&flush_mutex, NULL);
+}
+
+int com::sony::imaging::remote::socc_trace_start(const char* path,
+                                                 const char* name) {
+  pthread_mutex_lock(&flush_mutex);
+  snprintf(process_name, sizeof(process_name), "%s", name);
+  process_named = false;
+  if (trace_fd >= 0) {
+    // inherited from the parent, which has started the trace
+    pthread_mutex_unlock(&flush_mutex);
+    return SOCC_OK;
+  }
+
+  trace_fd = open(path, O_WRONLY | O_CREAT | O_EXCL | O_APPEND, 0666);
+  if (trace_fd >= 0) {
+    if (write(trace_fd, "[\n", 2) != 2) {
+      close(trace_fd);
+      trace_fd = -1;
+    }
+  } else if (errno == EEXIST) {
+    // another process has begun the array
+    trace_fd = open(path, O_WRONLY | O_APPEND);
+  }
+  if (trace_fd < 0) {
+    pthread_mutex_unlock(&flush_mutex);
+    return SOCC_ERROR_FILE_IO;
+  }
+
+  if (!hooks_registered) {
+    atexit(flush_at_exit);
+    pthread_atfork(NULL, NULL, forget_parent_spans);
+    hooks_registered = true;
+  }
+  tracing.store(true);
+  pthread_mutex_unlock(&flush_mutex);
+  return SOCC_OK;
+}
+
+int com::sony::imaging::remote::socc_trace_start_from_env(const char* name) {
+  const char* path = getenv(SOCC_TRACE_ENV);
+  if (path == NULL || path[0] == '\0') {
+    return SOCC_OK;
+  }
+  return socc_trace_start(path, name);
+}
+
+void com::sony::imaging::remote::socc_trace_stop() {
+  socc_trace_flush();
+  pthread_mutex_lock(&flush_mutex);
+  tracing.store(false);
+  if (trace_fd >= 0) {
+    close(trace_fd);
+    trace_fd = -1;
+  }
+  pthread_mutex_unlock(&flush_mutex);
+}
+
+int com::sony::imaging::remote::socc_trace_flush() {
+  std::string out;
+  char line[512];
+  int pid = getpid();
+
+  pthread_mutex_lock(&flush_mutex);
+  if (trace_fd < 0) {
+    pthread_mutex_unlock(&flush_mutex);
+    return SOCC_OK;
+  }
+
+  if (!process_named) {
+    snprintf(line, sizeof(line),
+             "{\"name\":\"process_name\",\"ph\":\"M\",\"pid\":%d,"
+             "\"args\":{\"name\":\"%s\"}},\n",
+             pid, process_name);
+    out += line;
+    process_named = true;
+  }
+
+  for (trace_buffer_t* b = buffers.load(); b != NULL; b = b->next) {
+    uint64_t first = b->flushed.load(std::memory_order_relaxed);
+    uint64_t last = b->written.load(std::memory_order_acquire);
+    for (uint64_t i = first; i < last; i++) {
+      const trace_event_t* e = &b->events[i % TRACE_EVENTS_PER_THREAD];
+      int len = snprintf(line, sizeof(line),
+                         "{\"name\":\"%s\",\"cat\":\"%s\",\"ph\":\"X\","
+                         "\"pid\":%d,\"tid\":%u,\"ts\":%.3f,\"dur\":%.3f",
+                         e->name, e->category, pid, b->tid,
+                         e->begin_ns / 1000.0,
+                         (e->end_ns - e->begin_ns) / 1000.0);
+      if (e->arg_name != NULL) {
+        len += snprintf(line + len, sizeof(line) - len,
+                        ",\"args\":{\"%s\":%u}", e->arg_name, e->arg);
+      }
+      snprintf(line + len, sizeof(line) - len, "},\n");
+      out += line;
+    }
+    b->flushed.store(last, std::memory_order_release);
+
+    uint64_t dropped = b->dropped.exchange(0);
+    if (dropped > 0) {
+      snprintf(line, sizeof(line),
+               "{\"name\":\"dropped\",\"ph\":\"i\",\"s\":\"t\",\"pid\":%d,"
+               "\"tid\":%u,\"ts\":%.3f,\"args\":{\"spans\":%llu}},\n",
+               pid, b->tid, socc_monotonic_ns() / 1000.0,
+               (unsigned long long)dropped);
+      out += line;
+    }
+  }
+
+  // a single append, not to be interleaved with the other processes
+  int ret = SOCC_OK;
+  if (!out.empty() &&
+      write(trace_fd, out.data(), out.size()) != (ssize_t)out.size()) {
+    ret = SOCC_ERROR_FILE_IO;
+  }
+  pthread_mutex_unlock(&flush_mutex);
+  return ret;
+}
+
+uint64_t com::sony::imaging::remote::socc_trace_now() {
+  if (!tracing.load(std::memory_order_relaxed)) {
+    return 0;
+  }
+  return socc_monotonic_ns();
+}
+
+void com::sony::imaging::remote::socc_trace_span(const char* name,
+                                                 const char* category,
+                                                 uint64_t begin,
+                                                 const char* arg_name,
+                                                 uint32_t arg) {
+  if (begin == 0) {
+    return;
+  }
+  uint64_t end = socc_monotonic_ns();
+  trace_buffer_t* b = get_local_buffer();
+  uint64_t w = b->written.load(std::memory_order_relaxed);
+  if (w - b->flushed.load(std::memory_order_acquire) >=
+      TRACE_EVENTS_PER_THREAD) {
+    b->dropped.fetch_add(1, std::memory_order_relaxed);
+    return;
+  }
+  trace_event_t* e = &b->events[w % TRACE_EVENTS_PER_THREAD];
+  e->name = name;
+  e->category = category;
+  e->arg_name = arg_name;
+  e->arg = arg;
+  e->begin_ns = begin;
+  e->end_ns = end;
+  b->written.store(w + 1, std::memory_order_release);
+}